@@ -4,17 +4,24 @@
 // reference: https://github.com/PacktPublishing/Mastering-Graphics-Programming-with-Vulkan
 
 struct PointLight{
-    vec4 position;  // ignore w
+    vec4 position;  // w is the range
     vec4 color; // w is intensity
 };
 
-uint MaterialFeatures_ColorTexture     = 1 << 0;
-uint MaterialFeatures_NormalTexture    = 1 << 1;
-uint MaterialFeatures_RoughnessTexture = 1 << 2;
-uint MaterialFeatures_OcclusionTexture = 1 << 3;
-uint MaterialFeatures_EmissiveTexture =  1 << 4;
-uint MaterialFeatures_TangentVertexAttribute = 1 << 5;
-uint MaterialFeatures_TexcoordVertexAttribute = 1 << 6;
+// must match kMaxLightsPerCluster
+const uint MAX_LIGHTS_PER_CLUSTER = 128;
+
+const uint MaterialFeatures_ColorTexture     = 1 << 0;
+const uint MaterialFeatures_NormalTexture    = 1 << 1;
+const uint MaterialFeatures_RoughnessTexture = 1 << 2;
+const uint MaterialFeatures_OcclusionTexture = 1 << 3;
+const uint MaterialFeatures_EmissiveTexture =  1 << 4;
+const uint MaterialFeatures_TangentVertexAttribute = 1 << 5;
+const uint MaterialFeatures_TexcoordVertexAttribute = 1 << 6;
+
+// the material's MaterialFeatures bits, one pipeline permutation per value so
+// the feature branches below are resolved when the pipeline is compiled
+layout (constant_id = 0) const uint MATERIAL_FLAGS = 0;
 
 //layout(std140, binding = 0) uniform GlobalUbo {
 //    mat4 m; // model mat
@@ -29,10 +36,37 @@ layout (std140, set = 0, binding = 0) uniform GlobalUbo {
     mat4 inverse_view_matrix;
     vec4 ambient_light_color;
     vec4 direct_light;
-    PointLight point_lights[10];    // can apply Specialization Constants
-    int num_lights;
+    uvec4 cluster_grid;     // x, y, z: cluster counts, w: ignore
+    vec4 cluster_depth;     // x: near, y: far, z: slice scale, w: slice bias
+    vec4 viewport_extent;   // x, y: width, height, z, w: reciprocal
+    mat4 shadow_matrices[4];        // light view projection per cascade
+    vec4 shadow_cascade_splits;     // far view depth of each cascade
+    vec4 shadow_texel_sizes;        // world size of one shadow texel per cascade
+    uint num_lights;
+    uint ibl_prefiltered_mips;      // 0: no environment, flat ambient
 } globalUbo;
 
+// written by cluster_light_cull.comp
+layout (std430, set = 0, binding = 2) readonly buffer PointLights {
+    PointLight lights[];
+} pointLights;
+
+layout (std430, set = 0, binding = 3) readonly buffer ClusterLightCounts {
+    uint counts[];
+} clusterLightCounts;
+
+layout (std430, set = 0, binding = 4) readonly buffer ClusterLightIndices {
+    uint indices[];
+} clusterLightIndices;
+
+// cascaded shadow map of direct_light, one layer per cascade
+layout (set = 0, binding = 5) uniform sampler2DArrayShadow shadowMap;
+
+// image based lighting, see IblSystem
+layout (set = 0, binding = 6) uniform samplerCube irradianceMap;
+layout (set = 0, binding = 7) uniform samplerCube prefilteredMap;
+layout (set = 0, binding = 8) uniform sampler2D brdfLut;
+
 layout(set = 1, binding = 0) uniform sampler2D globalTextures[];
 
 layout (std140, set = 2, binding = 0) uniform MaterialUbo {
@@ -124,8 +158,98 @@ float heaviside( float v ) {
     else return 0.0;
 }
 
+// https://www.khronos.org/registry/glTF/specs/2.0/glTF-2.0.html#specular-brdf
+vec3 evaluate_brdf( vec3 N, vec3 V, vec3 L, vec3 base_colour, float alpha, float metalness ) {
+    vec3 H = normalize( L + V );
+
+    float NdotH = dot(N, H);
+    float alpha_squared = alpha * alpha;
+    float d_denom = ( NdotH * NdotH ) * ( alpha_squared - 1.0 ) + 1.0;
+    float distribution = ( alpha_squared * heaviside( NdotH ) ) / ( PI * d_denom * d_denom );
+
+    float NdotL = clamp( dot(N, L), 0, 1 );
+    float NdotV = dot(N, V);
+    float HdotL = dot(H, L);
+    float HdotV = dot(H, V);
+
+    float visibility = ( heaviside( HdotL ) / ( abs( NdotL ) + sqrt( alpha_squared + ( 1.0 - alpha_squared ) * ( NdotL * NdotL ) ) ) ) * ( heaviside( HdotV ) / ( abs( NdotV ) + sqrt( alpha_squared + ( 1.0 - alpha_squared ) * ( NdotV * NdotV ) ) ) );
+    float specular_brdf = visibility * distribution;
+    vec3 diffuse_brdf = (1 / PI) * base_colour;
+
+    // NOTE(marco): f0 in the formula notation refers to the base colour here
+    vec3 conductor_fresnel = specular_brdf * ( base_colour + ( 1.0 - base_colour ) * pow( 1.0 - abs( HdotV ), 5 ) );
+
+    // NOTE(marco): f0 in the formula notation refers to the value derived from ior = 1.5
+    float f0 = 0.04; // pow( ( 1 - ior ) / ( 1 + ior ), 2 )
+    float fr = f0 + ( 1 - f0 ) * pow(1 - abs( HdotV ), 5 );
+    vec3 fresnel_mix = mix( diffuse_brdf, vec3( specular_brdf ), fr );
+
+    return mix( fresnel_mix, conductor_fresnel, metalness );
+}
+
+// diffuse and specular environment light (split sum), the flat ambient term
+// when no environment was baked
+vec3 ambient_lighting( vec3 N, vec3 V, vec3 base_colour, float roughness, float metalness ) {
+    if ( globalUbo.ibl_prefiltered_mips == 0 ) {
+        return base_colour * 0.1;
+    }
+
+    float NdotV = clamp( dot( N, V ), 1e-4, 1.0 );
+    vec3 R = reflect( -V, N );
+    vec3 f0 = mix( vec3( 0.04 ), base_colour, metalness );
+
+    vec2 scale_bias = texture( brdfLut, vec2( NdotV, roughness ) ).rg;
+    float lod = roughness * float( globalUbo.ibl_prefiltered_mips - 1 );
+    vec3 specular = textureLod( prefilteredMap, R, lod ).rgb * ( f0 * scale_bias.x + scale_bias.y );
+    vec3 diffuse = texture( irradianceMap, N ).rgb * base_colour * ( 1.0 - metalness );
+
+    return diffuse + specular;
+}
+
+// 3x3 PCF in the first cascade whose split covers the fragment, lit beyond the last one
+float sample_shadow( vec3 position_world, vec3 N ) {
+    float view_depth = ( globalUbo.view_matrix * vec4( position_world, 1.0 ) ).z;
+    int cascade = -1;
+    for ( int i = 0; i < 4; ++i ) {
+        if ( view_depth < globalUbo.shadow_cascade_splits[i] ) {
+            cascade = i;
+            break;
+        }
+    }
+    if ( cascade < 0 ) return 1.0;
+
+    // push the lookup along the normal by about a texel against acne
+    vec3 offset_position = position_world + N * globalUbo.shadow_texel_sizes[cascade] * 1.5;
+    vec4 shadow_coord = globalUbo.shadow_matrices[cascade] * vec4( offset_position, 1.0 );
+    shadow_coord.xyz /= shadow_coord.w;
+    vec2 uv = shadow_coord.xy * 0.5 + 0.5;
+
+    vec2 texel = 1.0 / vec2( textureSize( shadowMap, 0 ).xy );
+    float lit = 0.0;
+    for ( int y = -1; y <= 1; ++y ) {
+        for ( int x = -1; x <= 1; ++x ) {
+            lit += texture( shadowMap, vec4( uv + vec2( x, y ) * texel, cascade, shadow_coord.z ) );
+        }
+    }
+    return lit / 9.0;
+}
+
+// froxel of this fragment: screen tile in xy, logarithmic view depth slice in z
+uint get_cluster_index( vec3 position_world ) {
+    uvec3 grid = globalUbo.cluster_grid.xyz;
+
+    float view_depth = ( globalUbo.view_matrix * vec4( position_world, 1.0 ) ).z;
+    float slice = log( max( view_depth, globalUbo.cluster_depth.x ) ) * globalUbo.cluster_depth.z + globalUbo.cluster_depth.w;
+    uint z = min( uint( max( slice, 0.0 ) ), grid.z - 1 );
+
+    uvec2 xy = uvec2( gl_FragCoord.xy * globalUbo.viewport_extent.zw * vec2( grid.xy ) );
+    xy = min( xy, grid.xy - 1 );
+
+    return xy.x + grid.x * ( xy.y + grid.y * z );
+}
+
 void main() {
-    uint flags = materialUbo.rough_meta_flag_handles.z;
+    uint flags = MATERIAL_FLAGS;
 
     mat3 TBN = mat3( 1.0 );
 
@@ -164,7 +288,8 @@ void main() {
 
     vec3 camera_pos_world = globalUbo.inverse_view_matrix[3].xyz;
     vec3 V = normalize( camera_pos_world - vPositionWorld.xyz );
-    vec3 L = normalize( globalUbo.direct_light.xyz - vPositionWorld.xyz );
+    // direct_light points towards the light
+    vec3 L = normalize( globalUbo.direct_light.xyz );
     // NOTE(marco): normal textures are encoded to [0, 1] but need to be mapped to [-1, 1] value
     vec3 N = normalize( vNormalWorld );
     if ( ( flags & MaterialFeatures_NormalTexture ) != 0 ) {
@@ -174,7 +299,6 @@ void main() {
         N = N * materialUbo.nor_occ_rough_meta_factor.x;
         N = normalize( TBN * N );
     }
-    vec3 H = normalize( L + V );
 
     float roughness = materialUbo.nor_occ_rough_meta_factor.z;
     float metalness = materialUbo.nor_occ_rough_meta_factor.w;
@@ -210,39 +334,51 @@ void main() {
         emissive += decode_srgb( e.rgb ) * materialUbo.emissive_factor;
     }
 
-    // https://www.khronos.org/registry/glTF/specs/2.0/glTF-2.0.html#specular-brdf
-    float NdotH = dot(N, H);
-    float alpha_squared = alpha * alpha;
-    float d_denom = ( NdotH * NdotH ) * ( alpha_squared - 1.0 ) + 1.0;
-    float distribution = ( alpha_squared * heaviside( NdotH ) ) / ( PI * d_denom * d_denom );
-
     float NdotL = clamp( dot(N, L), 0, 1 );
 
+    vec3 ambient_colour = ambient_lighting( N, V, base_colour.rgb, roughness, metalness );
+
     if ( NdotL > 1e-5 ) {
-        float NdotV = dot(N, V);
-        float HdotL = dot(H, L);
-        float HdotV = dot(H, V);
+        vec3 material_colour = evaluate_brdf( N, V, L, base_colour.rgb, alpha, metalness );
+        float shadow = sample_shadow( vPositionWorld.xyz, N );
+        // the flat ambient only stands in for the unlit side, the environment lights everything
+        if ( globalUbo.ibl_prefiltered_mips == 0 ) {
+            material_colour = mix( ambient_colour, material_colour, shadow );
+        } else {
+            material_colour = ambient_colour + material_colour * shadow;
+        }
 
-        float visibility = ( heaviside( HdotL ) / ( abs( NdotL ) + sqrt( alpha_squared + ( 1.0 - alpha_squared ) * ( NdotL * NdotL ) ) ) ) * ( heaviside( HdotV ) / ( abs( NdotV ) + sqrt( alpha_squared + ( 1.0 - alpha_squared ) * ( NdotV * NdotV ) ) ) );
-        float specular_brdf = visibility * distribution;
-        vec3 diffuse_brdf = (1 / PI) * base_colour.rgb;
+        material_colour = emissive + mix( material_colour, material_colour * ao, materialUbo.nor_occ_rough_meta_factor.y);
 
-        // NOTE(marco): f0 in the formula notation refers to the base colour here
-        vec3 conductor_fresnel = specular_brdf * ( base_colour.rgb + ( 1.0 - base_colour.rgb ) * pow( 1.0 - abs( HdotV ), 5 ) );
+         frag_color = vec4( ( material_colour ), base_colour.a );
+    } else {
+        frag_color = vec4( mix( ambient_colour, ambient_colour * ao, materialUbo.nor_occ_rough_meta_factor.y ), base_colour.a );
+    }
 
-        // NOTE(marco): f0 in the formula notation refers to the value derived from ior = 1.5
-        float f0 = 0.04; // pow( ( 1 - ior ) / ( 1 + ior ), 2 )
-        float fr = f0 + ( 1 - f0 ) * pow(1 - abs( HdotV ), 5 );
-        vec3 fresnel_mix = mix( diffuse_brdf, vec3( specular_brdf ), fr );
+    // only the point lights binned into this fragment's cluster
+    uint cluster_index = get_cluster_index( vPositionWorld.xyz );
+    uint light_count = min( clusterLightCounts.counts[cluster_index], MAX_LIGHTS_PER_CLUSTER );
+    uint light_offset = cluster_index * MAX_LIGHTS_PER_CLUSTER;
 
-        // ambient environment color
+    vec3 point_light_colour = vec3( 0 );
+    for ( uint i = 0; i < light_count; ++i ) {
+        PointLight light = pointLights.lights[clusterLightIndices.indices[light_offset + i]];
 
-        vec3 material_colour = mix( fresnel_mix, conductor_fresnel, metalness );
+        vec3 to_light = light.position.xyz - vPositionWorld.xyz;
+        float distance_squared = dot( to_light, to_light );
+        float range_squared = light.position.w * light.position.w;
+        if ( distance_squared >= range_squared ) continue;
 
-        material_colour = emissive + mix( material_colour, material_colour * ao, materialUbo.nor_occ_rough_meta_factor.y);
+        vec3 light_dir = to_light * inversesqrt( max( distance_squared, 1e-8 ) );
+        float light_NdotL = clamp( dot(N, light_dir), 0, 1 );
+        if ( light_NdotL <= 1e-5 ) continue;
 
-         frag_color = vec4( ( material_colour ), base_colour.a );
-    } else {
-        frag_color = vec4( base_colour.rgb * 0.1, base_colour.a );
+        // inverse square, windowed to reach zero at the light range
+        float window = clamp( 1.0 - pow( distance_squared / range_squared, 2.0 ), 0.0, 1.0 );
+        float attenuation = window * window / max( distance_squared, 1e-4 );
+
+        point_light_colour += evaluate_brdf( N, V, light_dir, base_colour.rgb, alpha, metalness ) *
+                              light.color.rgb * light.color.w * light_NdotL * attenuation;
     }
-}
\ No newline at end of file
+    frag_color.rgb += mix( point_light_colour, point_light_colour * ao, materialUbo.nor_occ_rough_meta_factor.y );
+}
@@ -0,0 +1,162 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : enable
+
+// geometry pass of DeferredPbrRenderSystem, same vertex shader and material
+// data as bindless_pbr_shader, writes the surface instead of shading it
+
+const uint MaterialFeatures_ColorTexture     = 1 << 0;
+const uint MaterialFeatures_NormalTexture    = 1 << 1;
+const uint MaterialFeatures_RoughnessTexture = 1 << 2;
+const uint MaterialFeatures_OcclusionTexture = 1 << 3;
+const uint MaterialFeatures_EmissiveTexture =  1 << 4;
+const uint MaterialFeatures_TangentVertexAttribute = 1 << 5;
+const uint MaterialFeatures_TexcoordVertexAttribute = 1 << 6;
+
+// the material's MaterialFeatures bits, one pipeline permutation per value so
+// the feature branches below are resolved when the pipeline is compiled
+layout (constant_id = 0) const uint MATERIAL_FLAGS = 0;
+
+layout(set = 1, binding = 0) uniform sampler2D globalTextures[];
+
+layout (std140, set = 2, binding = 0) uniform MaterialUbo {
+    mat4 model_matrix;
+    mat4 model_inv_matrix;
+
+    // x: color, y: normal, z: emissive, w: ignore
+    uvec4 color_normal_emi_occ_texture_handles;
+
+    // x: roughness, y: metallicm, z,w: ignore
+    uvec4 rough_meta_flag_handles;
+
+    // x: normal_scale
+    // y: occlusion_factor
+    // z: roughness_factor
+    // w: metallic_factor
+    vec4 nor_occ_rough_meta_factor;
+
+    vec3 emissive_factor;
+    vec4 base_color_factor;
+} materialUbo;
+
+layout (location = 0) in vec4 vPositionWorld;
+layout (location = 1) in vec3 vNormalWorld;
+layout (location = 2) in vec4 vTangentWorld;
+layout (location = 3) in vec2 vTexcoord0;
+
+layout (location = 0) out vec4 gbuffer_albedo;      // rgb: base colour (sRGB target), a: ao
+layout (location = 1) out vec2 gbuffer_normal;      // octahedral world normal
+layout (location = 2) out vec4 gbuffer_material;    // x: roughness, y: metalness, z: occlusion strength
+layout (location = 3) out vec3 gbuffer_emissive;
+
+vec3 decode_srgb( vec3 c ) {
+    vec3 result;
+    if ( c.r <= 0.04045) {
+        result.r = c.r / 12.92;
+    } else {
+        result.r = pow( ( c.r + 0.055 ) / 1.055, 2.4 );
+    }
+
+    if ( c.g <= 0.04045) {
+        result.g = c.g / 12.92;
+    } else {
+        result.g = pow( ( c.g + 0.055 ) / 1.055, 2.4 );
+    }
+
+    if ( c.b <= 0.04045) {
+        result.b = c.b / 12.92;
+    } else {
+        result.b = pow( ( c.b + 0.055 ) / 1.055, 2.4 );
+    }
+
+    return clamp( result, 0.0, 1.0 );
+}
+
+vec2 sign_not_zero( vec2 v ) {
+    return vec2( v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0 );
+}
+
+vec2 octahedral_encode( vec3 n ) {
+    n /= ( abs( n.x ) + abs( n.y ) + abs( n.z ) );
+    return n.z >= 0.0 ? n.xy : ( 1.0 - abs( n.yx ) ) * sign_not_zero( n.xy );
+}
+
+void main() {
+    uint flags = MATERIAL_FLAGS;
+
+    mat3 TBN = mat3( 1.0 );
+
+    if ( ( flags & MaterialFeatures_TangentVertexAttribute ) != 0 ) {
+        vec3 tangent = normalize( vTangentWorld.xyz );
+        vec3 bitangent = cross( normalize( vNormalWorld ), tangent ) * vTangentWorld.w;
+
+        TBN = mat3(
+            tangent,
+            bitangent,
+            normalize( vNormalWorld )
+        );
+    }
+    else {
+        // NOTE(marco): taken from https://community.khronos.org/t/computing-the-tangent-space-in-the-fragment-shader/52861
+        vec3 Q1 = dFdx( vPositionWorld.xyz );
+        vec3 Q2 = dFdy( vPositionWorld.xyz );
+        vec2 st1 = dFdx( vTexcoord0 );
+        vec2 st2 = dFdy( vTexcoord0 );
+
+        vec3 T = normalize(  Q1 * st2.t - Q2 * st1.t );
+        vec3 B = normalize( -Q1 * st2.s + Q2 * st1.s );
+
+        // the transpose of texture-to-eye space matrix
+        TBN = mat3(
+            T,
+            B,
+            normalize( vNormalWorld )
+        );
+    }
+
+    // NOTE(marco): normal textures are encoded to [0, 1] but need to be mapped to [-1, 1] value
+    vec3 N = normalize( vNormalWorld );
+    if ( ( flags & MaterialFeatures_NormalTexture ) != 0 ) {
+         N = normalize( texture(globalTextures[materialUbo.color_normal_emi_occ_texture_handles.y], vTexcoord0).rgb * 2.0 - 1.0 );
+
+        // apply normal scale, default is 1.0f
+        N = N * materialUbo.nor_occ_rough_meta_factor.x;
+        N = normalize( TBN * N );
+    }
+
+    float roughness = materialUbo.nor_occ_rough_meta_factor.z;
+    float metalness = materialUbo.nor_occ_rough_meta_factor.w;
+
+    if ( ( flags & MaterialFeatures_RoughnessTexture ) != 0 ) {
+        // Red channel for occlusion value
+        // Green channel contains roughness values
+        // Blue channel contains metalness
+         vec4 rm = texture(globalTextures[nonuniformEXT(materialUbo.rough_meta_flag_handles.x)], vTexcoord0);
+
+        roughness *= rm.g;
+        metalness *= rm.b;
+    }
+
+    float ao = 1.0f;
+    if ( ( flags & MaterialFeatures_OcclusionTexture ) != 0 ) {
+         ao = texture(globalTextures[nonuniformEXT(materialUbo.color_normal_emi_occ_texture_handles.w)], vTexcoord0).r;
+    }
+
+    vec4 base_colour = materialUbo.base_color_factor;
+    if ( ( flags & MaterialFeatures_ColorTexture ) != 0 ) {
+         vec4 albedo = texture( globalTextures[nonuniformEXT(materialUbo.color_normal_emi_occ_texture_handles.x)], vTexcoord0 );
+        base_colour.rgb *= decode_srgb( albedo.rgb );
+        base_colour.a *= albedo.a;
+    }
+
+    vec3 emissive = vec3( 0 );
+    if ( ( flags & MaterialFeatures_EmissiveTexture ) != 0 ) {
+         vec4 e = texture(globalTextures[nonuniformEXT(materialUbo.color_normal_emi_occ_texture_handles.z)], vTexcoord0);
+
+        emissive += decode_srgb( e.rgb ) * materialUbo.emissive_factor;
+    }
+
+    gbuffer_albedo = vec4( base_colour.rgb, ao );
+    gbuffer_normal = octahedral_encode( N );
+    gbuffer_material = vec4( roughness, metalness, materialUbo.nor_occ_rough_meta_factor.y, 0.0 );
+    gbuffer_emissive = emissive;
+}
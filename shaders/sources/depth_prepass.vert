@@ -0,0 +1,37 @@
+#version 450
+
+// depth-only pass before bindless_pbr_shader, position stream only
+
+layout (std140, set = 0, binding = 0) uniform GlobalUbo {
+    mat4 projection_matrix;
+    mat4 view_matrix;
+    mat4 inverse_view_matrix;
+    vec4 ambient_light_color;
+    vec4 direct_light;
+    uvec4 cluster_grid;     // x, y, z: cluster counts, w: ignore
+    vec4 cluster_depth;     // x: near, y: far, z: slice scale, w: slice bias
+    vec4 viewport_extent;   // x, y: width, height, z, w: reciprocal
+    mat4 shadow_matrices[4];        // light view projection per cascade
+    vec4 shadow_cascade_splits;     // far view depth of each cascade
+    vec4 shadow_texel_sizes;        // world size of one shadow texel per cascade
+    uint num_lights;
+    uint ibl_prefiltered_mips;      // 0: no environment, flat ambient
+} globalUbo;
+
+layout (std140, set = 2, binding = 0) uniform MaterialUbo {
+    mat4 model_matrix;
+} materialUbo;
+
+// packed vertices fill w with the tangent sign, unused here
+layout(location=0) in vec4 position;
+
+// per instance, see M1kInstanceData
+layout(location=4) in mat4 instanceModel;
+
+// must match bindless_pbr_shader.vert bit for bit
+invariant gl_Position;
+
+void main() {
+    vec4 positionWorld = instanceModel * ( materialUbo.model_matrix * vec4(position.xyz, 1) );
+    gl_Position = globalUbo.projection_matrix * globalUbo.view_matrix * positionWorld;
+}
@@ -2,11 +2,6 @@
 
 // reference: https://github.com/PacktPublishing/Mastering-Graphics-Programming-with-Vulkan
 
-struct PointLight{
-    vec4 position;  // ignore w
-    vec4 color; // w is intensity
-};
-
 uint MaterialFeatures_ColorTexture     = 1 << 0;
 uint MaterialFeatures_NormalTexture    = 1 << 1;
 uint MaterialFeatures_RoughnessTexture = 1 << 2;
@@ -28,8 +23,14 @@ layout (std140, set = 0, binding = 0) uniform GlobalUbo {
     mat4 inverse_view_matrix;
     vec4 ambient_light_color;
     vec4 direct_light;
-    PointLight point_lights[10];    // can apply Specialization Constants
-    int num_lights;
+    uvec4 cluster_grid;     // x, y, z: cluster counts, w: ignore
+    vec4 cluster_depth;     // x: near, y: far, z: slice scale, w: slice bias
+    vec4 viewport_extent;   // x, y: width, height, z, w: reciprocal
+    mat4 shadow_matrices[4];        // light view projection per cascade
+    vec4 shadow_cascade_splits;     // far view depth of each cascade
+    vec4 shadow_texel_sizes;        // world size of one shadow texel per cascade
+    uint num_lights;
+    uint ibl_prefiltered_mips;      // 0: no environment, flat ambient
 } globalUbo;
 
 layout(std140, set = 1, binding = 0) uniform MaterialUbo {
@@ -151,7 +152,7 @@ void main() {
 
     vec3 camera_pos_world = globalUbo.inverse_view_matrix[3].xyz;
     vec3 V = normalize( camera_pos_world - vPositionWorld.xyz );
-    vec3 L = normalize( globalUbo.direct_light.xyz - vPositionWorld.xyz );
+    vec3 L = normalize( globalUbo.direct_light.xyz );
     // NOTE(marco): normal textures are encoded to [0, 1] but need to be mapped to [-1, 1] value
     vec3 N = normalize( vNormalWorld );
     if ( ( materialUbo.flags & MaterialFeatures_NormalTexture ) != 0 ) {
@@ -2,11 +2,6 @@
 
 // reference: https://github.com/PacktPublishing/Mastering-Graphics-Programming-with-Vulkan
 
-struct PointLight{
-    vec4 position;  // ignore w
-    vec4 color; // w is intensity
-};
-
 uint MaterialFeatures_ColorTexture     = 1 << 0;
 uint MaterialFeatures_NormalTexture    = 1 << 1;
 uint MaterialFeatures_RoughnessTexture = 1 << 2;
@@ -14,6 +9,7 @@ uint MaterialFeatures_OcclusionTexture = 1 << 3;
 uint MaterialFeatures_EmissiveTexture =  1 << 4;
 uint MaterialFeatures_TangentVertexAttribute = 1 << 5;
 uint MaterialFeatures_TexcoordVertexAttribute = 1 << 6;
+uint MaterialFeatures_PackedVertex = 1 << 7;
 
 layout (std140, set = 0, binding = 0) uniform GlobalUbo {
     mat4 projection_matrix;
@@ -21,8 +17,14 @@ layout (std140, set = 0, binding = 0) uniform GlobalUbo {
     mat4 inverse_view_matrix;
     vec4 ambient_light_color;
     vec4 direct_light;
-    PointLight point_lights[10];    // can apply Specialization Constants
-    int num_lights;
+    uvec4 cluster_grid;     // x, y, z: cluster counts, w: ignore
+    vec4 cluster_depth;     // x: near, y: far, z: slice scale, w: slice bias
+    vec4 viewport_extent;   // x, y: width, height, z, w: reciprocal
+    mat4 shadow_matrices[4];        // light view projection per cascade
+    vec4 shadow_cascade_splits;     // far view depth of each cascade
+    vec4 shadow_texel_sizes;        // world size of one shadow texel per cascade
+    uint num_lights;
+    uint ibl_prefiltered_mips;      // 0: no environment, flat ambient
 } globalUbo;
 
 // for each object or vertex
@@ -39,8 +41,10 @@ layout(std140, set = 1, binding = 0) uniform MaterialUbo {
     uint  flags;
 }materialUbo;
 
-layout(location=0) in vec3 position;
-layout(location=1) in vec3 normal;
+// packed vertices: position unorm in the mesh bounds with the tangent sign
+// in w, normal and tangent octahedral snorm, see M1kPackedVertex
+layout(location=0) in vec4 position;
+layout(location=1) in vec4 normal;
 layout(location=2) in vec4 tangent;
 layout(location=3) in vec2 texCoord0;
 
@@ -49,16 +53,30 @@ layout (location = 1) out vec3 vNormalWorld;
 layout (location = 2) out vec4 vTangentWorld;
 layout (location = 3) out vec2 vTexcoord0;
 
+vec3 octahedral_decode( vec2 e ) {
+    vec3 n = vec3( e, 1.0 - abs( e.x ) - abs( e.y ) );
+    float t = max( -n.z, 0.0 );
+    n.xy += vec2( n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t );
+    return normalize( n );
+}
+
 void main() {
-    vPositionWorld = materialUbo.model_matrix * vec4(position, 1);
+    vPositionWorld = materialUbo.model_matrix * vec4(position.xyz, 1);
     gl_Position = globalUbo.projection_matrix * globalUbo.view_matrix * vPositionWorld;
 
+    vec3 vertex_normal = normal.xyz;
+    vec4 vertex_tangent = tangent;
+    if ( ( materialUbo.flags & MaterialFeatures_PackedVertex ) != 0 ) {
+        vertex_normal = octahedral_decode( normal.xy );
+        vertex_tangent = vec4( octahedral_decode( tangent.xy ), position.w * 2.0 - 1.0 );
+    }
+
     if ( ( materialUbo.flags & MaterialFeatures_TexcoordVertexAttribute ) != 0 ) {
         vTexcoord0 = texCoord0;
     }
-    vNormalWorld = mat3( materialUbo.inverse_model_matrix ) * normal;
+    vNormalWorld = mat3( materialUbo.inverse_model_matrix ) * vertex_normal;
 
     if ( ( materialUbo.flags & MaterialFeatures_TangentVertexAttribute ) != 0 ) {
-        vTangentWorld = tangent;
+        vTangentWorld = vertex_tangent;
     }
 }
\ No newline at end of file
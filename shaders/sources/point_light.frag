@@ -4,19 +4,20 @@ layout(location = 0) in vec2 fragOffset;
 
 layout(location = 0) out vec4 outColor;
 
-struct PointLight{
-    vec4 position;  // ignore w
-    vec4 color; // w is intensity
-};
-
 layout (std140, set = 0, binding = 0) uniform GlobalUbo {
     mat4 projection_matrix;
     mat4 view_matrix;
     mat4 inverse_view_matrix;
     vec4 ambient_light_color;
     vec4 direct_light;
-    PointLight point_lights[10];    // can apply Specialization Constants
-    int num_lights;
+    uvec4 cluster_grid;     // x, y, z: cluster counts, w: ignore
+    vec4 cluster_depth;     // x: near, y: far, z: slice scale, w: slice bias
+    vec4 viewport_extent;   // x, y: width, height, z, w: reciprocal
+    mat4 shadow_matrices[4];        // light view projection per cascade
+    vec4 shadow_cascade_splits;     // far view depth of each cascade
+    vec4 shadow_texel_sizes;        // world size of one shadow texel per cascade
+    uint num_lights;
+    uint ibl_prefiltered_mips;      // 0: no environment, flat ambient
 } ubo;
 
 layout(push_constant) uniform Push {
@@ -0,0 +1,21 @@
+#version 450
+
+// shadow cascade depth, position stream only, the cascade matrix is pushed
+
+layout (std140, set = 2, binding = 0) uniform MaterialUbo {
+    mat4 model_matrix;
+} materialUbo;
+
+layout(push_constant) uniform Push {
+    mat4 light_view_projection;
+} push;
+
+// packed vertices fill w with the tangent sign, unused here
+layout(location=0) in vec4 position;
+
+// per instance, see M1kInstanceData
+layout(location=4) in mat4 instanceModel;
+
+void main() {
+    gl_Position = push.light_view_projection * ( instanceModel * ( materialUbo.model_matrix * vec4(position.xyz, 1) ) );
+}
@@ -39,7 +39,8 @@ M1kBuffer::M1kBuffer(
     uint32_t instance_count,
     VkBufferUsageFlags usage_flags,
     VkMemoryPropertyFlags memory_property_flags,
-    VkDeviceSize min_offset_alignment)
+    VkDeviceSize min_offset_alignment,
+    bool share_with_compute)
         : m1k_device_{device},
           instance_size_{instance_size},
           instance_count_{instance_count},
@@ -48,7 +49,8 @@ M1kBuffer::M1kBuffer(
 
     alignment_size_ = getAlignment(instance_size, min_offset_alignment);
     buffer_size_ = alignment_size_ * instance_count;
-    device.createBuffer(buffer_size_, usage_flags, memory_property_flags, buffer_, memory_);
+    device.createBuffer(buffer_size_, usage_flags, memory_property_flags, buffer_, memory_,
+                        share_with_compute);
 }
 
 M1kBuffer::~M1kBuffer() {
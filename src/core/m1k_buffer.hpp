@@ -16,7 +16,8 @@ public:
         uint32_t instance_count,
         VkBufferUsageFlags usage_flags,
         VkMemoryPropertyFlags memory_property_flags,
-        VkDeviceSize min_offset_alignment = 1);
+        VkDeviceSize min_offset_alignment = 1,
+        bool share_with_compute = false);
     ~M1kBuffer();
 
     M1kBuffer(const M1kBuffer&) = delete;
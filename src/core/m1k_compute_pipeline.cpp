@@ -0,0 +1,84 @@
+//
+// Created by fangl on 2024/3/26.
+//
+
+#include "m1k_compute_pipeline.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <cassert>
+#include <chrono>
+#include <stdexcept>
+
+namespace m1k {
+
+M1kComputePipeline::M1kComputePipeline(M1kDevice& device,
+                                       VkPipelineLayout pipeline_layout,
+                                       const std::string& comp_filepath)
+    : m1k_device_(device) {
+    createComputePipeline(pipeline_layout, comp_filepath);
+}
+
+M1kComputePipeline::~M1kComputePipeline() {
+    vkDestroyShaderModule(m1k_device_.device(), comp_shader_module_, nullptr);
+    vkDestroyPipeline(m1k_device_.device(), compute_pipeline_, nullptr);
+}
+
+void M1kComputePipeline::bind(VkCommandBuffer command_buffer) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline_);
+}
+
+void M1kComputePipeline::createComputePipeline(VkPipelineLayout pipeline_layout,
+                                               const std::string& comp_filepath) {
+    assert(pipeline_layout != VK_NULL_HANDLE &&
+           "Cannot create compute pipeline :: No pipelineLayout provided");
+
+    char* comp_code = nullptr;
+    size_t comp_code_size = 0;
+    if (!readFileBinary(comp_filepath, &comp_code, &comp_code_size)) {
+        throw std::runtime_error("failed to open file : " + comp_filepath);
+    }
+
+    VkShaderModuleCreateInfo module_info{};
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.codeSize = comp_code_size;
+    module_info.pCode = reinterpret_cast<const uint32_t*>(comp_code);
+
+    VkResult result = vkCreateShaderModule(m1k_device_.device(), &module_info,
+                                           nullptr, &comp_shader_module_);
+    delete[] comp_code;
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute shader module");
+    }
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.module = comp_shader_module_;
+    shader_stage.pName = "main";
+
+    VkComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage = shader_stage;
+    pipeline_info.layout = pipeline_layout;
+    pipeline_info.basePipelineIndex = -1;
+    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+    VkPipelineCreationFeedback creation_feedback{};
+    VkPipelineCreationFeedbackCreateInfo feedback_info{};
+    feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    feedback_info.pPipelineCreationFeedback = &creation_feedback;
+    pipeline_info.pNext = &feedback_info;
+
+    auto &pipeline_cache = m1k_device_.pipelineCache();
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (vkCreateComputePipelines(m1k_device_.device(), pipeline_cache.cache(), 1,
+                                 &pipeline_info, nullptr, &compute_pipeline_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline");
+    }
+    pipeline_cache.record(creation_feedback,
+                          std::chrono::duration<double, std::milli>(
+                              std::chrono::high_resolution_clock::now() - start_time).count());
+}
+
+}
@@ -0,0 +1,41 @@
+//
+// Created by fangl on 2024/3/26.
+//
+
+#pragma once
+
+#include "m1k_device.hpp"
+
+// std
+#include <string>
+#include <vector>
+
+namespace m1k {
+
+class M1kComputePipeline {
+   public:
+    M1kComputePipeline(M1kDevice& device,
+                       VkPipelineLayout pipeline_layout,
+                       const std::string& comp_filepath);
+    ~M1kComputePipeline();
+
+    M1kComputePipeline(const M1kComputePipeline&) = delete;
+    M1kComputePipeline& operator=(const M1kComputePipeline&) = delete;
+
+    void bind(VkCommandBuffer command_buffer);
+
+    // group_count = ceil(item_count / local_size)
+    static uint32_t groupCount(uint32_t item_count, uint32_t local_size) {
+        return (item_count + local_size - 1) / local_size;
+    }
+
+   private:
+    void createComputePipeline(VkPipelineLayout pipeline_layout,
+                               const std::string& comp_filepath);
+
+    M1kDevice& m1k_device_;
+    VkPipeline compute_pipeline_ = VK_NULL_HANDLE;
+    VkShaderModule comp_shader_module_ = VK_NULL_HANDLE;
+};
+
+}
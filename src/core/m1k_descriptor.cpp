@@ -32,6 +32,19 @@ M1kDescriptorSetLayout::Builder &M1kDescriptorSetLayout::Builder::addBinding(
     return *this;
 }
 
+M1kDescriptorSetLayout::Builder &M1kDescriptorSetLayout::Builder::addBindings(
+    const M1kShaderReflection &reflection,
+    uint32_t set,
+    uint32_t runtime_array_count)
+{
+    for (const auto &binding : reflection.getSetBindings(set)) {
+        uint32_t count = binding.descriptorCount != 0 ? binding.descriptorCount : runtime_array_count;
+        assert(count != 0 && "Runtime sized array needs a descriptor count");
+        addBinding(binding.binding, binding.descriptorType, binding.stageFlags, count);
+    }
+    return *this;
+}
+
 std::unique_ptr<M1kDescriptorSetLayout> M1kDescriptorSetLayout::Builder::build() const {
     return std::make_unique<M1kDescriptorSetLayout>(m1k_device_, bindings_);
 }
@@ -57,18 +70,7 @@ M1kDescriptorSetLayout::M1kDescriptorSetLayout(
         set_layout_bindings.push_back(kv.second);
     }
 
-    VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info{};
-    descriptor_set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptor_set_layout_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
-    descriptor_set_layout_info.pBindings = set_layout_bindings.data();
-
-    if (vkCreateDescriptorSetLayout(
-        m1k_device.device(),
-        &descriptor_set_layout_info,
-        nullptr,
-        &descriptor_set_layout_) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
-    }
+    descriptor_set_layout_ = m1k_device.layoutCache().getSetLayout(set_layout_bindings);
 }
 
 M1kDescriptorSetLayout::M1kDescriptorSetLayout(
@@ -89,41 +91,18 @@ M1kDescriptorSetLayout::M1kDescriptorSetLayout(
         set_layout_bindings.push_back(kv.second);
     }
 
-    VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info{};
-    descriptor_set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptor_set_layout_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
-    descriptor_set_layout_info.pBindings = set_layout_bindings.data();
-    descriptor_set_layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
-
     VkDescriptorBindingFlags bindless_flags =
         VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
         VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
         VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
-    \
-    uint32_t binding_size = static_cast<uint32_t>(set_layout_bindings.size());
-    std::vector<VkDescriptorBindingFlags> binding_flags {binding_size};
-    for(auto& binding_flag : binding_flags) {
-        binding_flag = bindless_flags;
-    }
 
-    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extended_info{
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
-        nullptr };
-    extended_info.bindingCount = binding_size;
-    extended_info.pBindingFlags = binding_flags.data();
-    descriptor_set_layout_info.pNext = &extended_info;
-
-    if (vkCreateDescriptorSetLayout(
-            m1k_device.device(),
-            &descriptor_set_layout_info,
-            nullptr,
-            &descriptor_set_layout_) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
-    }
-}
+    uint32_t binding_size = static_cast<uint32_t>(set_layout_bindings.size());
+    std::vector<VkDescriptorBindingFlags> binding_flags(binding_size, bindless_flags);
 
-M1kDescriptorSetLayout::~M1kDescriptorSetLayout() {
-    vkDestroyDescriptorSetLayout(m1k_device_.device(), descriptor_set_layout_, nullptr);
+    descriptor_set_layout_ = m1k_device.layoutCache().getSetLayout(
+        set_layout_bindings,
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+        binding_flags);
 }
 
 
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "m1k_device.hpp"
+#include "m1k_shader_reflection.hpp"
 
 // std
 #include <memory>
@@ -25,6 +26,12 @@ public:
             VkDescriptorType descriptor_type,
             VkShaderStageFlags stage_flags,
             uint32_t count = 1);
+        // every binding the shaders of reflection declare in set, runtime
+        // sized arrays get runtime_array_count descriptors
+        Builder &addBindings(
+            const M1kShaderReflection &reflection,
+            uint32_t set,
+            uint32_t runtime_array_count = 0);
 
         std::unique_ptr<M1kDescriptorSetLayout> build() const;
         std::unique_ptr<M1kDescriptorSetLayout> build_for_bindless() const;
@@ -42,9 +49,6 @@ public:
         std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings,
         bool isBindless);
 
-
-    ~M1kDescriptorSetLayout();
-
     M1kDescriptorSetLayout(const M1kDescriptorSetLayout &) = delete;
     M1kDescriptorSetLayout &operator=(const M1kDescriptorSetLayout &) = delete;
 
@@ -52,6 +56,7 @@ public:
 
 private:
     M1kDevice &m1k_device_;
+    // owned by the device layout cache, shared with identical layouts
     VkDescriptorSetLayout descriptor_set_layout_;
     std::unordered_map<uint32_t, VkDescriptorSetLayoutBinding> bindings;
 
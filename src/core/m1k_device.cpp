@@ -3,6 +3,7 @@
 //
 
 #include "m1k_device.hpp"
+#include "m1k_config.hpp"
 
 // std headers
 #include <cstring>
@@ -68,11 +69,31 @@ M1kDevice::M1kDevice(M1kWindow &window) : window_{window} {
     createLogicalDevice();
     // help with command buffer_ allocation or something else
     createCommandPool();
+    createUploadSyncObjects();
+    createPipelineCache();
+    layout_cache_ = std::make_unique<M1kLayoutCache>(device_);
 
     std::cout << "max push constant size: " << properties.limits.maxPushConstantsSize << "\n";
 }
 
 M1kDevice::~M1kDevice() {
+    // waits for the GPU and runs the remaining deferred deletions, flushed
+    // while the timeline still exists since a deleter may queue more (a
+    // model releasing its textures)
+    flushUploads();
+    graphics_timeline_->flush();
+    graphics_timeline_.reset();
+    pipeline_cache_->printStats();
+    pipeline_cache_->save();
+    pipeline_cache_.reset();
+    layout_cache_.reset();
+    vkDestroySemaphore(device_, transfer_semaphore_, nullptr);
+    if (has_dedicated_transfer_queue_) {
+        vkDestroyCommandPool(device_, transfer_command_pool_, nullptr);
+    }
+    if (has_async_compute_queue_) {
+        vkDestroyCommandPool(device_, compute_command_pool_, nullptr);
+    }
     vkDestroyCommandPool(device_, command_pool_, nullptr);
     vkDestroyDevice(device_, nullptr);
 
@@ -161,6 +182,14 @@ void M1kDevice::createLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+    has_dedicated_transfer_queue_ = indices.transferFamilyHasValue;
+    if (has_dedicated_transfer_queue_) {
+        uniqueQueueFamilies.insert(indices.transferFamily);
+    }
+    has_async_compute_queue_ = indices.computeFamilyHasValue;
+    if (has_async_compute_queue_) {
+        uniqueQueueFamilies.insert(indices.computeFamily);
+    }
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -184,6 +213,8 @@ void M1kDevice::createLogicalDevice() {
     vkGetPhysicalDeviceFeatures2(
         physical_device_,
         &physical_device_features_2 );
+    // every supported core feature is enabled with the query result
+    is_multi_draw_indirect_supported_ = physical_device_features_2.features.multiDrawIndirect;
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -194,8 +225,27 @@ void M1kDevice::createLogicalDevice() {
     // because we already use feature2 for more detailed control!
     // set it to nullptr
     createInfo.pEnabledFeatures = nullptr;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(device_extensions_.size());
-    createInfo.ppEnabledExtensionNames = device_extensions_.data();
+    // the KHR alias as well when advertised, ImGui loads the KHR entry points
+    std::vector<const char *> enabled_extensions = device_extensions_;
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &extension_count, nullptr);
+    std::vector<VkExtensionProperties> available_extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &extension_count,
+                                         available_extensions.data());
+    for (const auto &extension : available_extensions) {
+        if (is_dynamic_rendering_supported_ &&
+            strcmp(extension.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0) {
+            enabled_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        }
+        // enabling it implies the drawIndirectCount feature, which can't be
+        // requested here next to the per extension feature structs
+        if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+            enabled_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            is_draw_indirect_count_supported_ = true;
+        }
+    }
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabled_extensions.size());
+    createInfo.ppEnabledExtensionNames = enabled_extensions.data();
 
     // might not really be necessary anymore because device_ specific validation layers
     // have been deprecated
@@ -208,8 +258,16 @@ void M1kDevice::createLogicalDevice() {
 
     // for bindless function
     createInfo.pNext = &physical_device_features_2;
+    physical_device_features_2.pNext = &timeline_features_;
+    timeline_features_.pNext = nullptr;
+    indexing_features_.pNext = nullptr;
+    dynamic_rendering_features_.pNext = nullptr;
     if(is_bindless_supported_) {
-        physical_device_features_2.pNext = &indexing_features_;
+        timeline_features_.pNext = &indexing_features_;
+    }
+    if(is_dynamic_rendering_supported_) {
+        dynamic_rendering_features_.pNext = timeline_features_.pNext;
+        timeline_features_.pNext = &dynamic_rendering_features_;
     }
 
     if (vkCreateDevice(physical_device_, &createInfo, nullptr, &device_) != VK_SUCCESS) {
@@ -218,6 +276,23 @@ void M1kDevice::createLogicalDevice() {
 
     vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphics_queue_);
     vkGetDeviceQueue(device_, indices.presentFamily, 0, &present_queue_);
+
+    if (has_dedicated_transfer_queue_) {
+        vkGetDeviceQueue(device_, indices.transferFamily, 0, &transfer_queue_);
+        std::cout << "M1K::INFO~~~~~~~~Using dedicated transfer queue family "
+                  << indices.transferFamily << std::endl;
+    } else {
+        transfer_queue_ = graphics_queue_;
+    }
+
+    if (has_async_compute_queue_) {
+        vkGetDeviceQueue(device_, indices.computeFamily, 0, &compute_queue_);
+        std::cout << "M1K::INFO~~~~~~~~Using async compute queue family "
+                  << indices.computeFamily << std::endl;
+    } else {
+        // graphics families are required to support compute as well
+        compute_queue_ = graphics_queue_;
+    }
 }
 
 void M1kDevice::createCommandPool() {
@@ -232,6 +307,46 @@ void M1kDevice::createCommandPool() {
     if (vkCreateCommandPool(device_, &poolInfo, nullptr, &command_pool_) != VK_SUCCESS) {
         throw std::runtime_error("failed to create command pool_!");
     }
+
+    if (has_dedicated_transfer_queue_) {
+        poolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &transfer_command_pool_) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create transfer command pool_!");
+        }
+    } else {
+        transfer_command_pool_ = command_pool_;
+    }
+
+    if (has_async_compute_queue_) {
+        poolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily;
+        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &compute_command_pool_) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute command pool_!");
+        }
+    } else {
+        compute_command_pool_ = command_pool_;
+    }
+}
+
+void M1kDevice::createUploadSyncObjects() {
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &transfer_semaphore_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload synchronization objects!");
+    }
+
+    graphics_timeline_ = std::make_unique<M1kTimeline>(device_);
+}
+
+void M1kDevice::createPipelineCache() {
+    pipeline_cache_ = std::make_unique<M1kPipelineCache>(device_, properties,
+                                                         kDefaultPipelineCachePath);
 }
 
 void M1kDevice::createSurface() { window_.createWindowSurface(instance_, &surface_); }
@@ -255,15 +370,26 @@ bool M1kDevice::isDeviceSuitable(VkPhysicalDevice device) {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
         &indexing_features_
     };
+    // and timeline semaphores for frame pacing
+    indexing_features_.pNext = &timeline_features_;
+    timeline_features_.pNext = &dynamic_rendering_features_;
+    dynamic_rendering_features_.pNext = nullptr;
     vkGetPhysicalDeviceFeatures2(device, &device_features_2);
     is_bindless_supported_ = indexing_features_.descriptorBindingPartiallyBound &&
                              indexing_features_.runtimeDescriptorArray;
 
+    // dynamic rendering is core in 1.3, optional: render passes are the fallback
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(device, &device_properties);
+    is_dynamic_rendering_supported_ = device_properties.apiVersion >= VK_API_VERSION_1_3 &&
+                                      dynamic_rendering_features_.dynamicRendering;
+
     return indices.isComplete() &&
            extensionsSupported &&
            swapChainAdequate &&
            supportedFeatures.samplerAnisotropy &&
-           is_bindless_supported_;
+           is_bindless_supported_ &&
+           timeline_features_.timelineSemaphore;
 }
 
 VkSampleCountFlagBits M1kDevice::getMaxUsableSampleCount() {
@@ -403,20 +529,49 @@ QueueFamilyIndices M1kDevice::findQueueFamilies(VkPhysicalDevice device) {
     std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
+    // lower is better: transfer only, then transfer + compute
+    int transferScore = 2;
+    // prefer a compute family that isn't also picked for transfers
+    int computeScore = 2;
+
     int i = 0;
     for (const auto &queueFamily : queueFamilies) {
-        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if (queueFamily.queueCount == 0) {
+            i++;
+            continue;
+        }
+
+        if (!indices.graphicsFamilyHasValue && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             indices.graphicsFamily = i;
             indices.graphicsFamilyHasValue = true;
         }
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
-        if (queueFamily.queueCount > 0 && presentSupport) {
+        if (!indices.presentFamilyHasValue && presentSupport) {
             indices.presentFamily = i;
             indices.presentFamilyHasValue = true;
         }
-        if (indices.isComplete()) {
-            break;
+
+        // graphics and compute families implicitly support transfer
+        bool canTransfer = queueFamily.queueFlags &
+                           (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+        if (canTransfer && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            int score = (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) ? 1 : 0;
+            if (score < transferScore) {
+                indices.transferFamily = i;
+                indices.transferFamilyHasValue = true;
+                transferScore = score;
+            }
+        }
+
+        if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+            !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            int score = (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) ? 1 : 0;
+            if (score < computeScore) {
+                indices.computeFamily = i;
+                indices.computeFamilyHasValue = true;
+                computeScore = score;
+            }
         }
 
         i++;
@@ -485,7 +640,8 @@ void M1kDevice::createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer &buffer,
-    VkDeviceMemory &bufferMemory) {
+    VkDeviceMemory &bufferMemory,
+    bool share_with_compute) {
 
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -493,6 +649,19 @@ void M1kDevice::createBuffer(
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // written on the async compute queue and read by graphics every frame,
+    // concurrent sharing saves an ownership transfer per frame. The transfer
+    // family joins in so the buffer can be uploaded to as well
+    QueueFamilyIndices indices = findPhysicalQueueFamilies();
+    uint32_t sharedFamilies[] = {indices.graphicsFamily, indices.computeFamily,
+                                 indices.transferFamily};
+    if (share_with_compute && has_async_compute_queue_) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount =
+            has_dedicated_transfer_queue_ && indices.transferFamily != indices.computeFamily ? 3 : 2;
+        bufferInfo.pQueueFamilyIndices = sharedFamilies;
+    }
+
     if (vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to create vertex buffer_!");
     }
@@ -531,6 +700,8 @@ VkCommandBuffer M1kDevice::beginSingleTimeCommands() {
 }
 
 void M1kDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+    // queued after the pending uploads, it may read them
+    flushUploads();
     vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo{};
@@ -538,14 +709,137 @@ void M1kDevice::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
+    // wait for this submission only, not for the frames in flight
+    uint64_t signalValue = graphics_timeline_->nextSignalValue();
+    VkSemaphore timelineSemaphore = graphics_timeline_->semaphore();
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timelineSemaphore;
+
     vkQueueSubmit(graphics_queue_, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphics_queue_);
+    graphics_timeline_->wait(signalValue);
 
     vkFreeCommandBuffers(device_, command_pool_, 1, &commandBuffer);
 }
 
-void M1kDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+VkCommandBuffer M1kDevice::uploadTransferCommands() {
+    if (!has_dedicated_transfer_queue_) {
+        // transfer_queue_ is the graphics queue
+        return uploadGraphicsCommands();
+    }
+    if (upload_transfer_command_buffer_ != VK_NULL_HANDLE) {
+        return upload_transfer_command_buffer_;
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = transfer_command_pool_;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    upload_transfer_command_buffer_ = commandBuffer;
+    return commandBuffer;
+}
+
+VkCommandBuffer M1kDevice::uploadGraphicsCommands() {
+    if (upload_graphics_command_buffer_ == VK_NULL_HANDLE) {
+        upload_graphics_command_buffer_ = beginSingleTimeCommands();
+    }
+    return upload_graphics_command_buffer_;
+}
+
+uint64_t M1kDevice::flushUploads() {
+    VkCommandBuffer transfer_command_buffer = upload_transfer_command_buffer_;
+    VkCommandBuffer graphics_command_buffer = upload_graphics_command_buffer_;
+    if (transfer_command_buffer == VK_NULL_HANDLE && graphics_command_buffer == VK_NULL_HANDLE) {
+        return last_upload_value_;
+    }
+    upload_transfer_command_buffer_ = VK_NULL_HANDLE;
+    upload_graphics_command_buffer_ = VK_NULL_HANDLE;
+
+    uint64_t transfer_value = 0;
+    if (transfer_command_buffer != VK_NULL_HANDLE) {
+        vkEndCommandBuffer(transfer_command_buffer);
+        transfer_value = ++transfer_semaphore_value_;
+
+        VkTimelineSemaphoreSubmitInfo transferTimelineInfo{};
+        transferTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        transferTimelineInfo.signalSemaphoreValueCount = 1;
+        transferTimelineInfo.pSignalSemaphoreValues = &transfer_value;
+
+        VkSubmitInfo transferSubmit{};
+        transferSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        transferSubmit.pNext = &transferTimelineInfo;
+        transferSubmit.commandBufferCount = 1;
+        transferSubmit.pCommandBuffers = &transfer_command_buffer;
+        transferSubmit.signalSemaphoreCount = 1;
+        transferSubmit.pSignalSemaphores = &transfer_semaphore_;
+        vkQueueSubmit(transfer_queue_, 1, &transferSubmit, VK_NULL_HANDLE);
+    }
+
+    // the graphics half signals the graphics timeline, also when it only
+    // waits for the transfer part
+    uint64_t signalValue = graphics_timeline_->nextSignalValue();
+    VkSemaphore timelineSemaphore = graphics_timeline_->semaphore();
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo graphicsSubmit{};
+    graphicsSubmit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    graphicsSubmit.pNext = &timelineInfo;
+    graphicsSubmit.signalSemaphoreCount = 1;
+    graphicsSubmit.pSignalSemaphores = &timelineSemaphore;
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    if (transfer_command_buffer != VK_NULL_HANDLE) {
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &transfer_value;
+        graphicsSubmit.waitSemaphoreCount = 1;
+        graphicsSubmit.pWaitSemaphores = &transfer_semaphore_;
+        graphicsSubmit.pWaitDstStageMask = &waitStage;
+    }
+    if (graphics_command_buffer != VK_NULL_HANDLE) {
+        vkEndCommandBuffer(graphics_command_buffer);
+        graphicsSubmit.commandBufferCount = 1;
+        graphicsSubmit.pCommandBuffers = &graphics_command_buffer;
+    }
+    vkQueueSubmit(graphics_queue_, 1, &graphicsSubmit, VK_NULL_HANDLE);
+    last_upload_value_ = signalValue;
+
+    // the next frame submission finishes after the batch
+    graphics_timeline_->deferDestroy(
+        [this, transfer_command_buffer, graphics_command_buffer]() {
+            if (transfer_command_buffer != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device_, transfer_command_pool_, 1, &transfer_command_buffer);
+            }
+            if (graphics_command_buffer != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device_, command_pool_, 1, &graphics_command_buffer);
+            }
+        });
+    return signalValue;
+}
+
+void M1kDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size,
+                           VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+                           bool share_with_compute) {
+    VkCommandBuffer commandBuffer = uploadTransferCommands();
 
     VkBufferCopy copyRegion{};
     copyRegion.srcOffset = 0;  // Optional
@@ -553,12 +847,71 @@ void M1kDevice::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize
     copyRegion.size = size;
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-    endSingleTimeCommands(commandBuffer);
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = dstBuffer;
+    barrier.offset = 0;
+    barrier.size = size;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dst_access;
+
+    if (!has_dedicated_transfer_queue_) {
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
+    // queue family ownership transfer, release half on the transfer queue.
+    // Concurrent buffers have no owner, the semaphore orders the two halves
+    QueueFamilyIndices indices = findPhysicalQueueFamilies();
+    if (!share_with_compute || !has_async_compute_queue_) {
+        barrier.srcQueueFamilyIndex = indices.transferFamily;
+        barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+    }
+    barrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    // ...and the acquire half on graphics, for whoever reads it first
+    VkCommandBuffer acquireCommandBuffer = uploadGraphicsCommands();
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dst_access;
+
+    vkCmdPipelineBarrier(acquireCommandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage,
+                         0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
 void M1kDevice::copyBufferToImage(
-    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layer_count) {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layer_count,
+    uint32_t mip_levels) {
+    VkCommandBuffer commandBuffer = uploadTransferCommands();
+
+    // the layout transition happens on the queue doing the copy, so the
+    // image only has to change owner once
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layer_count;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
 
     VkBufferImageCopy region{};
     region.bufferOffset = 0;
@@ -580,7 +933,32 @@ void M1kDevice::copyBufferToImage(
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1,
         &region);
-    endSingleTimeCommands(commandBuffer);
+
+    if (!has_dedicated_transfer_queue_) {
+        return;
+    }
+
+    // hand the image over to graphics for mip generation and sampling,
+    // the layout stays TRANSFER_DST_OPTIMAL
+    QueueFamilyIndices indices = findPhysicalQueueFamilies();
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = indices.transferFamily;
+    barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkCommandBuffer acquireCommandBuffer = uploadGraphicsCommands();
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(acquireCommandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void M1kDevice::createImageWithInfo(
@@ -664,18 +1042,20 @@ void M1kDevice::transitionImageLayout(VkImage image, VkFormat format,
 }
 
 VkImageView M1kDevice::createImageView(VkImage image, VkFormat format,
-                                       uint32_t mip_levels, VkImageAspectFlags aspect_mask)
+                                       uint32_t mip_levels, VkImageAspectFlags aspect_mask,
+                                       VkImageViewType view_type,
+                                       uint32_t base_layer, uint32_t layer_count)
 {
     VkImageViewCreateInfo view_info = {};
     view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     view_info.image = image;
-    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.viewType = view_type;
     view_info.format = format;
     view_info.subresourceRange.aspectMask = aspect_mask;
     view_info.subresourceRange.baseMipLevel = 0;
     view_info.subresourceRange.levelCount = mip_levels;
-    view_info.subresourceRange.baseArrayLayer = 0;
-    view_info.subresourceRange.layerCount = 1;
+    view_info.subresourceRange.baseArrayLayer = base_layer;
+    view_info.subresourceRange.layerCount = layer_count;
 
     VkImageView image_view;
     if (vkCreateImageView(device_, &view_info, nullptr, &image_view) != VK_SUCCESS) {
@@ -6,8 +6,12 @@
 
 
 #include "../ui/m1k_window.hpp"
+#include "m1k_layout_cache.hpp"
+#include "m1k_pipeline_cache.hpp"
+#include "m1k_timeline.hpp"
 
 // std lib headers
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -23,8 +27,14 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
     uint32_t graphicsFamily;
     uint32_t presentFamily;
+    // only set for a family without graphics, otherwise uploads use graphics
+    uint32_t transferFamily;
+    // same rule for async compute
+    uint32_t computeFamily;
     bool graphicsFamilyHasValue = false;
     bool presentFamilyHasValue = false;
+    bool transferFamilyHasValue = false;
+    bool computeFamilyHasValue = false;
     bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
 };
 
@@ -54,7 +64,23 @@ class M1kDevice {
     VkSurfaceKHR surface() { return surface_; }
     VkQueue graphicsQueue() { return graphics_queue_; }
     VkQueue presentQueue() { return present_queue_; }
+    VkQueue transferQueue() { return transfer_queue_; }
+    bool hasDedicatedTransferQueue() const { return has_dedicated_transfer_queue_; }
+    VkQueue computeQueue() { return compute_queue_; }
+    VkCommandPool getComputeCommandPool() { return compute_command_pool_; }
+    bool hasAsyncComputeQueue() const { return has_async_compute_queue_; }
+    // every graphics queue submission signals this
+    M1kTimeline &graphicsTimeline() { return *graphics_timeline_; }
+    // every pipeline is created through it, saved when the device goes away
+    M1kPipelineCache &pipelineCache() { return *pipeline_cache_; }
+    // shared descriptor set and pipeline layouts, alive as long as the device
+    M1kLayoutCache &layoutCache() { return *layout_cache_; }
     VkSampleCountFlagBits maxMSAASampleCount() { return msaa_samples_; }
+    bool isDynamicRenderingSupported() const { return is_dynamic_rendering_supported_; }
+    // vkCmdDrawIndexedIndirectCount, through VK_KHR_draw_indirect_count
+    bool isDrawIndirectCountSupported() const { return is_draw_indirect_count_supported_; }
+    // drawCount > 1 in vkCmdDrawIndexedIndirect
+    bool isMultiDrawIndirectSupported() const { return is_multi_draw_indirect_supported_; }
 
     SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physical_device_); }
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
@@ -65,16 +91,38 @@ class M1kDevice {
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
+    // uploads are batched and never waited on by the CPU. The copies go into
+    // the batch's transfer buffer (the graphics one if there is no dedicated
+    // transfer queue), the ownership acquires and the graphics work that
+    // follows them (mip generation) into its graphics buffer.
+    // flushUploads() submits the batch and returns the graphics timeline value
+    // it signals. Later graphics submissions are ordered after it by the
+    // acquire barriers, so the renderer only has to flush before its frame
+    // and compute submissions. Staging memory goes through deferDestroy
+    VkCommandBuffer uploadTransferCommands();
+    VkCommandBuffer uploadGraphicsCommands();
+    uint64_t flushUploads();
+    // value of the last submitted batch, 0 before the first one
+    uint64_t lastUploadValue() const { return last_upload_value_; }
+
     // Buffer Helper Functions
     void createBuffer(
         VkDeviceSize size,
         VkBufferUsageFlags usage,
         VkMemoryPropertyFlags properties,
         VkBuffer &buffer,
-        VkDeviceMemory &bufferMemory);
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+        VkDeviceMemory &bufferMemory,
+        bool share_with_compute = false);
+    // dst_stage / dst_access: the first use after the copy, the data is made
+    // visible there on the graphics queue. share_with_compute as the buffer
+    // was created with
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size,
+                    VkPipelineStageFlags dst_stage, VkAccessFlags dst_access,
+                    bool share_with_compute = false);
+    // leaves every mip level in TRANSFER_DST_OPTIMAL, owned by the graphics queue
     void copyBufferToImage(
-        VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
+        VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount,
+        uint32_t mip_levels = 1);
     void createImageWithInfo(
         const VkImageCreateInfo &imageInfo,
         VkMemoryPropertyFlags properties,
@@ -85,7 +133,9 @@ class M1kDevice {
                                uint32_t mip_levels=1);
     VkImageView createImageView(VkImage image, VkFormat format,
                                 uint32_t mip_levels = 1,
-                                VkImageAspectFlags aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT);
+                                VkImageAspectFlags aspect_mask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                VkImageViewType view_type = VK_IMAGE_VIEW_TYPE_2D,
+                                uint32_t base_layer = 0, uint32_t layer_count = 1);
 
     VkPhysicalDeviceProperties properties;
 
@@ -96,6 +146,8 @@ class M1kDevice {
     void pickPhysicalDevice();
     void createLogicalDevice();
     void createCommandPool();
+    void createUploadSyncObjects();
+    void createPipelineCache();
 
     // helper functions
     bool isDeviceSuitable(VkPhysicalDevice device);
@@ -113,11 +165,27 @@ class M1kDevice {
     VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
     M1kWindow &window_;
     VkCommandPool command_pool_;
+    VkCommandPool transfer_command_pool_;
+    VkCommandPool compute_command_pool_;
 
     VkDevice device_;
     VkSurfaceKHR surface_;
     VkQueue graphics_queue_;
     VkQueue present_queue_;
+    VkQueue transfer_queue_;
+    bool has_dedicated_transfer_queue_ = false;
+    VkQueue compute_queue_;
+    bool has_async_compute_queue_ = false;
+
+    // upload batch: transfer -> timeline wait -> graphics acquire
+    VkCommandBuffer upload_transfer_command_buffer_ = VK_NULL_HANDLE;
+    VkCommandBuffer upload_graphics_command_buffer_ = VK_NULL_HANDLE;
+    VkSemaphore transfer_semaphore_;    // timeline, signaled by the transfer queue
+    uint64_t transfer_semaphore_value_ = 0;
+    uint64_t last_upload_value_ = 0;
+    std::unique_ptr<M1kTimeline> graphics_timeline_;
+    std::unique_ptr<M1kPipelineCache> pipeline_cache_;
+    std::unique_ptr<M1kLayoutCache> layout_cache_;
 
     const std::vector<const char *> validation_layers_ = {"VK_LAYER_KHRONOS_validation"};
 
@@ -135,6 +203,17 @@ class M1kDevice {
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features_
         { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
          nullptr };
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features_
+        { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+         nullptr };
+
+    bool is_draw_indirect_count_supported_ = false;
+    bool is_multi_draw_indirect_supported_ = false;
+
+    bool is_dynamic_rendering_supported_ = false;
+    VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features_
+        { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+         nullptr };
 };
 
 }
\ No newline at end of file
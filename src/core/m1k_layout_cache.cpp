@@ -0,0 +1,108 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_layout_cache.hpp"
+
+// std
+#include <stdexcept>
+
+namespace m1k {
+
+M1kLayoutCache::~M1kLayoutCache() {
+    for (auto& entry : pipeline_layouts_) {
+        vkDestroyPipelineLayout(device_, entry.second, nullptr);
+    }
+    for (auto& entry : set_layouts_) {
+        vkDestroyDescriptorSetLayout(device_, entry.second, nullptr);
+    }
+}
+
+VkDescriptorSetLayout M1kLayoutCache::getSetLayout(
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    VkDescriptorSetLayoutCreateFlags flags,
+    const std::vector<VkDescriptorBindingFlags>& binding_flags) {
+    std::vector<uint64_t> key{flags, bindings.size(), binding_flags.size()};
+    for (const auto& binding : bindings) {
+        key.push_back(binding.binding);
+        key.push_back(binding.descriptorType);
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+        key.push_back(reinterpret_cast<uint64_t>(binding.pImmutableSamplers));
+    }
+    key.insert(key.end(), binding_flags.begin(), binding_flags.end());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = set_layouts_.find(key);
+    if (found != set_layouts_.end()) {
+        ++reuse_count_;
+        return found->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.flags = flags;
+    layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    layout_info.pBindings = bindings.data();
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+    if (!binding_flags.empty()) {
+        flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+        flags_info.pBindingFlags = binding_flags.data();
+        layout_info.pNext = &flags_info;
+    }
+
+    VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+    if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, &set_layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    set_layouts_.emplace(std::move(key), set_layout);
+    return set_layout;
+}
+
+VkPipelineLayout M1kLayoutCache::getPipelineLayout(
+    const std::vector<VkDescriptorSetLayout>& set_layouts,
+    const std::vector<VkPushConstantRange>& push_constant_ranges) {
+    std::vector<uint64_t> key{set_layouts.size(), push_constant_ranges.size()};
+    for (VkDescriptorSetLayout set_layout : set_layouts) {
+        key.push_back(reinterpret_cast<uint64_t>(set_layout));
+    }
+    for (const auto& range : push_constant_ranges) {
+        key.push_back(range.stageFlags);
+        key.push_back(range.offset);
+        key.push_back(range.size);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = pipeline_layouts_.find(key);
+    if (found != pipeline_layouts_.end()) {
+        ++reuse_count_;
+        return found->second;
+    }
+
+    VkPipelineLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layout_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+    layout_info.pSetLayouts = set_layouts.data();
+    layout_info.pushConstantRangeCount = static_cast<uint32_t>(push_constant_ranges.size());
+    layout_info.pPushConstantRanges = push_constant_ranges.data();
+
+    VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+    if (vkCreatePipelineLayout(device_, &layout_info, nullptr, &pipeline_layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+    pipeline_layouts_.emplace(std::move(key), pipeline_layout);
+    return pipeline_layout;
+}
+
+M1kLayoutCache::Stats M1kLayoutCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats{};
+    stats.set_layout_count = static_cast<uint32_t>(set_layouts_.size());
+    stats.pipeline_layout_count = static_cast<uint32_t>(pipeline_layouts_.size());
+    stats.reuse_count = reuse_count_;
+    return stats;
+}
+
+}
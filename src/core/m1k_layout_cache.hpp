@@ -0,0 +1,67 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+// libs
+#include <vulkan/vulkan.h>
+
+// std
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Device wide owner of the descriptor set layouts and pipeline layouts.
+ *
+ * Asking twice for the same bindings, or the same set layouts and push
+ * constant ranges, returns the same handle, so render systems declaring
+ * identical layouts share one object (the forward and deferred G-buffer
+ * pipelines, the shadow pass and the meshlet culling sharing the global
+ * set). Matching handles also keep the bound sets compatible between the
+ * pipelines.
+ *
+ * Handles live until the device is destroyed, never destroy them.
+ * Thread safe.
+ */
+class M1kLayoutCache {
+   public:
+    struct Stats {
+        uint32_t set_layout_count = 0;
+        uint32_t pipeline_layout_count = 0;
+        uint32_t reuse_count = 0;      // requests answered with an existing layout
+    };
+
+    explicit M1kLayoutCache(VkDevice device) : device_(device) {}
+    ~M1kLayoutCache();
+
+    M1kLayoutCache(const M1kLayoutCache&) = delete;
+    M1kLayoutCache& operator=(const M1kLayoutCache&) = delete;
+
+    // binding_flags: empty, or one per binding in the order given
+    VkDescriptorSetLayout getSetLayout(
+        const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+        VkDescriptorSetLayoutCreateFlags flags = 0,
+        const std::vector<VkDescriptorBindingFlags>& binding_flags = {});
+
+    VkPipelineLayout getPipelineLayout(
+        const std::vector<VkDescriptorSetLayout>& set_layouts,
+        const std::vector<VkPushConstantRange>& push_constant_ranges = {});
+
+    Stats getStats() const;
+
+   private:
+    VkDevice device_;
+
+    // keyed by every field the create info reads, compared whole
+    std::map<std::vector<uint64_t>, VkDescriptorSetLayout> set_layouts_{};
+    std::map<std::vector<uint64_t>, VkPipelineLayout> pipeline_layouts_{};
+    uint32_t reuse_count_ = 0;
+    mutable std::mutex mutex_{};
+};
+
+}
@@ -4,28 +4,86 @@
 
 #include "m1k_pipeline.hpp"
 #include "m1k_model.hpp"
+#include "m1k_shader_reflection.hpp"
 
 // std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
-#include <iostream>
 #include <cassert>
 
 namespace m1k {
 
+namespace {
+
+// what a vertex shader input sees of a format: normalized, scaled and float
+// formats all read as float
+enum class VertexNumeric { Float, Sint, Uint };
+
+struct VertexFormatInfo {
+    VertexNumeric numeric;
+    uint32_t component_count;
+};
+
+// the 8, 16 and 32 bit vertex formats, false for anything else
+bool vertexFormatInfo(VkFormat format, VertexFormatInfo& info) {
+    switch (format) {
+        case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8_SNORM: case VK_FORMAT_R8_USCALED:
+        case VK_FORMAT_R8_SSCALED: case VK_FORMAT_R16_UNORM: case VK_FORMAT_R16_SNORM:
+        case VK_FORMAT_R16_USCALED: case VK_FORMAT_R16_SSCALED: case VK_FORMAT_R16_SFLOAT:
+        case VK_FORMAT_R32_SFLOAT:
+            info = {VertexNumeric::Float, 1}; return true;
+        case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8_SNORM: case VK_FORMAT_R8G8_USCALED:
+        case VK_FORMAT_R8G8_SSCALED: case VK_FORMAT_R16G16_UNORM: case VK_FORMAT_R16G16_SNORM:
+        case VK_FORMAT_R16G16_USCALED: case VK_FORMAT_R16G16_SSCALED:
+        case VK_FORMAT_R16G16_SFLOAT: case VK_FORMAT_R32G32_SFLOAT:
+            info = {VertexNumeric::Float, 2}; return true;
+        case VK_FORMAT_R8G8B8_UNORM: case VK_FORMAT_R8G8B8_SNORM:
+        case VK_FORMAT_R16G16B16_UNORM: case VK_FORMAT_R16G16B16_SNORM:
+        case VK_FORMAT_R16G16B16_SFLOAT: case VK_FORMAT_R32G32B32_SFLOAT:
+            info = {VertexNumeric::Float, 3}; return true;
+        case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SNORM:
+        case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        case VK_FORMAT_A2B10G10R10_SNORM_PACK32: case VK_FORMAT_R16G16B16A16_UNORM:
+        case VK_FORMAT_R16G16B16A16_SNORM: case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            info = {VertexNumeric::Float, 4}; return true;
+
+        case VK_FORMAT_R8_SINT: case VK_FORMAT_R16_SINT: case VK_FORMAT_R32_SINT:
+            info = {VertexNumeric::Sint, 1}; return true;
+        case VK_FORMAT_R8G8_SINT: case VK_FORMAT_R16G16_SINT: case VK_FORMAT_R32G32_SINT:
+            info = {VertexNumeric::Sint, 2}; return true;
+        case VK_FORMAT_R8G8B8_SINT: case VK_FORMAT_R16G16B16_SINT: case VK_FORMAT_R32G32B32_SINT:
+            info = {VertexNumeric::Sint, 3}; return true;
+        case VK_FORMAT_R8G8B8A8_SINT: case VK_FORMAT_R16G16B16A16_SINT:
+        case VK_FORMAT_R32G32B32A32_SINT:
+            info = {VertexNumeric::Sint, 4}; return true;
+
+        case VK_FORMAT_R8_UINT: case VK_FORMAT_R16_UINT: case VK_FORMAT_R32_UINT:
+            info = {VertexNumeric::Uint, 1}; return true;
+        case VK_FORMAT_R8G8_UINT: case VK_FORMAT_R16G16_UINT: case VK_FORMAT_R32G32_UINT:
+            info = {VertexNumeric::Uint, 2}; return true;
+        case VK_FORMAT_R8G8B8_UINT: case VK_FORMAT_R16G16B16_UINT: case VK_FORMAT_R32G32B32_UINT:
+            info = {VertexNumeric::Uint, 3}; return true;
+        case VK_FORMAT_R8G8B8A8_UINT: case VK_FORMAT_R16G16B16A16_UINT:
+        case VK_FORMAT_R32G32B32A32_UINT:
+            info = {VertexNumeric::Uint, 4}; return true;
+
+        default:
+            return false;
+    }
+}
+
+}
+
 M1kPipeline::M1kPipeline(M1kDevice& device,
             PipelineConfigInfo& config_info,
             const std::string& vert_filepath,
             const std::string& frag_filepath) : m1k_device_(device)
 {
-    // first check whether we have the pipeline cache
-    createDirectoryIfNotExists(kDefaultPipelineCacheDirectory);
-    processPipelineCache(kDefaultPipelineCachePath);
-
     createGraphicPipeline(config_info, vert_filepath, frag_filepath);
-
-    // 创建完，如果之前没有的话，就要保存，同时也要删除pipeline_cache
-    savePipelineCache(kDefaultPipelineCachePath);
 }
 
 M1kPipeline::~M1kPipeline() {
@@ -51,6 +109,53 @@ std::vector<char> M1kPipeline::readFile(const std::string& filepath) {
     return buffer;
 }
 
+void M1kPipeline::matchVertexInput(PipelineConfigInfo& config_info,
+                                   const std::vector<char>& vert_code,
+                                   const std::string& vert_filepath) {
+    // the file buffer has no alignment guarantee for words
+    std::vector<uint32_t> code(vert_code.size() / sizeof(uint32_t));
+    std::memcpy(code.data(), vert_code.data(), code.size() * sizeof(uint32_t));
+    M1kShaderReflection reflection{code.data(), code.size()};
+    const auto& inputs = reflection.getVertexInputs();
+
+    auto& attributes = config_info.attribute_descriptions;
+    for (const auto& input : inputs) {
+        auto attribute = std::find_if(attributes.begin(), attributes.end(),
+            [&](const VkVertexInputAttributeDescription& attribute) {
+                return attribute.location == input.location;
+            });
+        if (attribute == attributes.end()) {
+            throw std::runtime_error("M1k::ERR--------" + vert_filepath + " reads vertex location " +
+                                     std::to_string(input.location) + ", the pipeline has no attribute for it");
+        }
+
+        // fewer components are fine, the rest read as (0, 0, 0, 1): packed
+        // normals are two snorms for a vec4. A different numeric type or
+        // components the shader never reads mean the layouts disagree
+        VertexFormatInfo provided{};
+        VertexFormatInfo expected{};
+        if (!vertexFormatInfo(attribute->format, provided) ||
+            !vertexFormatInfo(input.format, expected)) {
+            continue;
+        }
+        if (provided.numeric != expected.numeric ||
+            provided.component_count > expected.component_count) {
+            throw std::runtime_error("M1k::ERR--------" + vert_filepath + " vertex location " +
+                                     std::to_string(input.location) + " reads format " +
+                                     std::to_string(input.format) + ", the pipeline provides format " +
+                                     std::to_string(attribute->format));
+        }
+    }
+
+    attributes.erase(std::remove_if(attributes.begin(), attributes.end(),
+        [&](const VkVertexInputAttributeDescription& attribute) {
+            return std::none_of(inputs.begin(), inputs.end(),
+                [&](const M1kShaderReflection::VertexInput& input) {
+                    return input.location == attribute.location;
+                });
+        }), attributes.end());
+}
+
 void M1kPipeline::bind(VkCommandBuffer command_buffer) {
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_);
 
@@ -64,17 +169,20 @@ void M1kPipeline::createGraphicPipeline(PipelineConfigInfo& config_info,
         config_info.pipeline_layout != VK_NULL_HANDLE &&
         "Cannot create graphics pipeline :: No pipelineLayout provided in configInfo");
     assert(
-        config_info.render_pass != VK_NULL_HANDLE &&
-        "Cannot create graphics pipeline :: No render pass provided in configInfo");
+        (config_info.render_pass != VK_NULL_HANDLE ||
+         !config_info.color_attachment_formats.empty() ||
+         config_info.depth_attachment_format != VK_FORMAT_UNDEFINED) &&
+        "Cannot create graphics pipeline :: No render pass or attachment formats provided in configInfo");
 
     auto vert_code = readFile(vert_filepath);
-    auto frag_code = readFile(frag_filepath);
-
-    std::cout << "Vertex Shader Code Size : " << vert_code.size() << "\n";
-    std::cout << "Fragment Shader Code Size : " << frag_code.size() << "\n";
-
     createShaderModule(vert_code, &vert_shader_module_);
-    createShaderModule(frag_code, &frag_shader_module_);
+    matchVertexInput(config_info, vert_code, vert_filepath);
+
+    bool has_fragment_stage = !frag_filepath.empty();
+    if (has_fragment_stage) {
+        auto frag_code = readFile(frag_filepath);
+        createShaderModule(frag_code, &frag_shader_module_);
+    }
 
     VkPipelineShaderStageCreateInfo shader_stages[2];
 
@@ -94,6 +202,17 @@ void M1kPipeline::createGraphicPipeline(PipelineConfigInfo& config_info,
     shader_stages[1].pNext = nullptr;
     shader_stages[1].pSpecializationInfo = nullptr;
 
+    VkSpecializationInfo specialization_info{};
+    if (!config_info.specialization_entries.empty()) {
+        specialization_info.mapEntryCount =
+            static_cast<uint32_t>(config_info.specialization_entries.size());
+        specialization_info.pMapEntries = config_info.specialization_entries.data();
+        specialization_info.dataSize = config_info.specialization_data.size();
+        specialization_info.pData = config_info.specialization_data.data();
+        shader_stages[0].pSpecializationInfo = &specialization_info;
+        shader_stages[1].pSpecializationInfo = &specialization_info;
+    }
+
     auto& binding_descriptions = config_info.binding_descriptions;
     auto& attribute_descriptions = config_info.attribute_descriptions;
 
@@ -107,7 +226,7 @@ void M1kPipeline::createGraphicPipeline(PipelineConfigInfo& config_info,
     // last
     VkGraphicsPipelineCreateInfo pipeline_info{};
     pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
+    pipeline_info.stageCount = has_fragment_stage ? 2 : 1;
     pipeline_info.pStages = shader_stages;
     pipeline_info.pVertexInputState = &vertex_input_info;
     pipeline_info.pInputAssemblyState = &config_info.input_assembly_info;
@@ -115,11 +234,20 @@ void M1kPipeline::createGraphicPipeline(PipelineConfigInfo& config_info,
     pipeline_info.pRasterizationState = &config_info.rasterization_info;
 
     // set MSAA
-    config_info.multisample_info.rasterizationSamples = m1k_device_.maxMSAASampleCount();
-    config_info.multisample_info.sampleShadingEnable = VK_TRUE;
+    VkSampleCountFlagBits samples = config_info.rasterization_samples != 0
+                                        ? config_info.rasterization_samples
+                                        : m1k_device_.maxMSAASampleCount();
+    config_info.multisample_info.rasterizationSamples = samples;
+    config_info.multisample_info.sampleShadingEnable =
+        samples != VK_SAMPLE_COUNT_1_BIT ? VK_TRUE : VK_FALSE;
     config_info.multisample_info.minSampleShading = 0.4f;
     pipeline_info.pMultisampleState = &config_info.multisample_info;
 
+    if (!config_info.color_blend_attachments.empty()) {
+        config_info.color_blend_info.attachmentCount =
+            static_cast<uint32_t>(config_info.color_blend_attachments.size());
+        config_info.color_blend_info.pAttachments = config_info.color_blend_attachments.data();
+    }
     pipeline_info.pColorBlendState = &config_info.color_blend_info;
     pipeline_info.pDepthStencilState = &config_info.depth_stencil_info;
     pipeline_info.pDynamicState = &config_info.dynamic_state_info;
@@ -128,68 +256,43 @@ void M1kPipeline::createGraphicPipeline(PipelineConfigInfo& config_info,
     pipeline_info.renderPass = config_info.render_pass;
     pipeline_info.subpass = config_info.subpass;
 
+    // dynamic rendering: no render pass, formats come through pNext
+    VkPipelineRenderingCreateInfo rendering_info{};
+    if (config_info.render_pass == VK_NULL_HANDLE) {
+        rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        rendering_info.colorAttachmentCount =
+            static_cast<uint32_t>(config_info.color_attachment_formats.size());
+        rendering_info.pColorAttachmentFormats = config_info.color_attachment_formats.data();
+        rendering_info.depthAttachmentFormat = config_info.depth_attachment_format;
+        rendering_info.stencilAttachmentFormat = config_info.stencil_attachment_format;
+        pipeline_info.pNext = &rendering_info;
+        pipeline_info.subpass = 0;
+    }
+
     pipeline_info.basePipelineIndex = -1;
     pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
 
+    // whether the device cache already had it, and how long it took
+    VkPipelineCreationFeedback creation_feedback{};
+    VkPipelineCreationFeedbackCreateInfo feedback_info{};
+    feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+    feedback_info.pPipelineCreationFeedback = &creation_feedback;
+    feedback_info.pNext = pipeline_info.pNext;
+    pipeline_info.pNext = &feedback_info;
+
+    auto& pipeline_cache = m1k_device_.pipelineCache();
+    auto start_time = std::chrono::high_resolution_clock::now();
     if(vkCreateGraphicsPipelines(m1k_device_.device(),
-            pipeline_cache_,
+            pipeline_cache.cache(),
             1,
             &pipeline_info,
             nullptr,
             &graphics_pipeline_) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline");
     }
-}
-
-void M1kPipeline::processPipelineCache(const std::string& cache_path) {
-    VkPipelineCacheCreateInfo pipeline_cache_create_info {
-        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
-    };
-    char* cache_data = nullptr;
-    size_t cache_size = 0;
-    if(readFileBinary(cache_path, &cache_data, &cache_size)) {
-        std::cout << "M1k::INFO~~~~~~~~Reading cache from: " <<
-            cache_path << "\n\t Size: " << cache_size << std::endl;
-    } else {
-        std::cout << "M1k::INFO~~~~~~~~Create cache to:" << cache_path << std::endl;
-    }
-
-    pipeline_cache_create_info.initialDataSize = cache_size;
-    pipeline_cache_create_info.pInitialData = cache_data;
-
-    if(vkCreatePipelineCache(m1k_device_.device(),
-                              &pipeline_cache_create_info,
-                              nullptr,
-                              &pipeline_cache_) != VK_SUCCESS)
-    {
-        throw std::runtime_error("M1K::ERR--------Create pipeline cache failed!");
-    }
-
-    delete[] cache_data;
-}
-
-void M1kPipeline::savePipelineCache(const std::string& cache_path) {
-    // store cache into file
-    size_t cache_data_size = 0;
-    vkGetPipelineCacheData(m1k_device_.device(),
-                           pipeline_cache_,
-                           &cache_data_size, nullptr);
-
-    void* tobe_write_cache_data = allocateAligned(cache_data_size, 64);
-
-    if(vkGetPipelineCacheData( m1k_device_.device(),
-                               pipeline_cache_,
-                               &cache_data_size,
-                               tobe_write_cache_data ) == VK_SUCCESS)
-    {
-        writeFileBinary( cache_path, tobe_write_cache_data, cache_data_size );
-    } else {
-        std::cerr << "M1k::ERR--------Failed to get pipeline cache data." << std::endl;
-    }
-
-    deallocateAligned(tobe_write_cache_data);
-
-    vkDestroyPipelineCache(m1k_device_.device(), pipeline_cache_, nullptr);
+    pipeline_cache.record(creation_feedback,
+                          std::chrono::duration<double, std::milli>(
+                              std::chrono::high_resolution_clock::now() - start_time).count());
 }
 
 void M1kPipeline::createShaderModule(const std::vector<char>& code, VkShaderModule* shader_module) {
@@ -8,6 +8,7 @@
 #include "m1k_config.hpp"
 
 // std
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -29,6 +30,9 @@ struct PipelineConfigInfo {
     VkPipelineRasterizationStateCreateInfo rasterization_info;
     VkPipelineMultisampleStateCreateInfo multisample_info;
     VkPipelineColorBlendAttachmentState color_blend_attachment;
+    // one state per color attachment for multiple render targets, replaces
+    // color_blend_attachment when not empty
+    std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachments{};
     VkPipelineColorBlendStateCreateInfo color_blend_info;
     VkPipelineDepthStencilStateCreateInfo depth_stencil_info;
 
@@ -39,12 +43,46 @@ struct PipelineConfigInfo {
     VkRenderPass render_pass = nullptr;
 
     uint32_t subpass = 0;
+
+    // attachment formats for dynamic rendering, used when render_pass is null
+    std::vector<VkFormat> color_attachment_formats{};
+    VkFormat depth_attachment_format = VK_FORMAT_UNDEFINED;
+    VkFormat stencil_attachment_format = VK_FORMAT_UNDEFINED;
+    // 0: the device MSAA count the swap chain renders with
+    VkSampleCountFlagBits rasterization_samples{};
+
+    // specialization constants of every stage, e.g. the material flags of
+    // M1kPipelinePermutations
+    std::vector<VkSpecializationMapEntry> specialization_entries{};
+    std::vector<uint8_t> specialization_data{};
+};
+
+// what a pipeline renders into: a render pass, or the attachment formats of
+// the vkCmdBeginRendering it is used in
+struct RenderTargetInfo {
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    std::vector<VkFormat> color_formats{};
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+    VkFormat stencil_format = VK_FORMAT_UNDEFINED;
+    // 0: the device MSAA count, e.g. single sampled offscreen targets use 1
+    VkSampleCountFlagBits samples{};
+
+    void applyTo(PipelineConfigInfo& config_info) const {
+        config_info.render_pass = render_pass;
+        config_info.subpass = subpass;
+        config_info.color_attachment_formats = color_formats;
+        config_info.depth_attachment_format = depth_format;
+        config_info.stencil_attachment_format = stencil_format;
+        config_info.rasterization_samples = samples;
+    }
 };
 
 
 class M1kPipeline {
    public:
     M1kPipeline() = default;
+    // empty frag_filepath -> vertex stage only, e.g. depth-only passes
     M1kPipeline(M1kDevice& device,
                 PipelineConfigInfo& config_info,
                 const std::string& vert_filepath,
@@ -62,22 +100,23 @@ class M1kPipeline {
 
    private:
     static std::vector<char> readFile(const std::string& filepath);
+    // keeps the vertex attributes the shader reads, throws if it reads one
+    // the config doesn't provide or one with an incompatible format
+    static void matchVertexInput(PipelineConfigInfo& config_info,
+                                 const std::vector<char>& vert_code,
+                                 const std::string& vert_filepath);
 
     void createGraphicPipeline(PipelineConfigInfo& config_info,
                                const std::string& vert_filepath,
                                const std::string& frag_filepath);
 
-    void processPipelineCache(const std::string& cache_path);
-    void savePipelineCache(const std::string& cache_path);
-
     void createShaderModule(const std::vector<char>& code, VkShaderModule* shader_module);
 
     M1kDevice &m1k_device_;
     VkPipeline graphics_pipeline_;
-    VkPipelineCache pipeline_cache_ = VK_NULL_HANDLE;
 
-    VkShaderModule vert_shader_module_;
-    VkShaderModule frag_shader_module_;
+    VkShaderModule vert_shader_module_ = VK_NULL_HANDLE;
+    VkShaderModule frag_shader_module_ = VK_NULL_HANDLE;
 };
 
 }
@@ -0,0 +1,116 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_pipeline_build_queue.hpp"
+#include "m1k_pipeline_permutations.hpp"
+
+// std
+#include <chrono>
+#include <iterator>
+#include <iostream>
+
+namespace m1k {
+
+void M1kPipelineBuildQueue::addGraphics(std::unique_ptr<M1kPipeline>& target,
+                                        Configure configure,
+                                        const std::string& vert_filepath,
+                                        const std::string& frag_filepath) {
+    graphics_.push_back({&target, std::move(configure), vert_filepath, frag_filepath});
+}
+
+void M1kPipelineBuildQueue::addCompute(std::unique_ptr<M1kComputePipeline>& target,
+                                       VkPipelineLayout pipeline_layout,
+                                       const std::string& comp_filepath) {
+    computes_.push_back({&target, pipeline_layout, comp_filepath});
+}
+
+void M1kPipelineBuildQueue::addPermutations(M1kPipelinePermutations& permutations) {
+    permutations_.push_back(&permutations);
+}
+
+void M1kPipelineBuildQueue::build(M1kThreadPool& thread_pool) {
+    uint32_t graphics_count = static_cast<uint32_t>(graphics_.size() - built_graphics_count_);
+    uint32_t compute_count = static_cast<uint32_t>(computes_.size() - built_compute_count_);
+    uint32_t job_count = graphics_count + compute_count;
+    if (job_count == 0) return;
+
+    // the descriptions count as built even if one fails, the pool rethrows
+    // the first failure once every job is done
+    size_t graphics_begin = built_graphics_count_;
+    size_t compute_begin = built_compute_count_;
+    built_graphics_count_ = graphics_.size();
+    built_compute_count_ = computes_.size();
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    thread_pool.parallelFor(job_count, [&](uint32_t job_index, uint32_t) {
+        if (job_index < graphics_count) {
+            const auto& description = graphics_[graphics_begin + job_index];
+            PipelineConfigInfo config_info{};
+            description.configure(config_info);
+            *description.target = std::make_unique<M1kPipeline>(
+                m1k_device_, config_info, description.vert_filepath, description.frag_filepath);
+        } else {
+            const auto& description = computes_[compute_begin + job_index - graphics_count];
+            *description.target = std::make_unique<M1kComputePipeline>(
+                m1k_device_, description.pipeline_layout, description.comp_filepath);
+        }
+    });
+    auto elapsed = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start_time).count();
+
+    std::cout << "M1K::INFO~~~~~~~~Built " << job_count << " pipelines on "
+              << thread_pool.threadCount() << " threads in " << elapsed << " ms" << std::endl;
+}
+
+std::vector<M1kPipelineRebuild> M1kPipelineBuildQueue::prepareRebuild(
+    const std::string& shader_filepath) {
+    std::vector<M1kPipelineRebuild> rebuilds;
+    M1kDevice* device = &m1k_device_;
+
+    for (size_t i = 0; i < built_graphics_count_; ++i) {
+        const auto& description = graphics_[i];
+        if (description.vert_filepath != shader_filepath &&
+            description.frag_filepath != shader_filepath) {
+            continue;
+        }
+
+        auto replacement = std::make_shared<std::unique_ptr<M1kPipeline>>();
+        M1kPipelineRebuild rebuild{};
+        rebuild.build = [device, description, replacement]() {
+            PipelineConfigInfo config_info{};
+            description.configure(config_info);
+            *replacement = std::make_unique<M1kPipeline>(
+                *device, config_info, description.vert_filepath, description.frag_filepath);
+        };
+        rebuild.commit = [device, target = description.target, replacement]() {
+            if (*replacement) replacePipeline(*device, *target, std::move(*replacement));
+        };
+        rebuilds.push_back(std::move(rebuild));
+    }
+
+    for (size_t i = 0; i < built_compute_count_; ++i) {
+        const auto& description = computes_[i];
+        if (description.comp_filepath != shader_filepath) continue;
+
+        auto replacement = std::make_shared<std::unique_ptr<M1kComputePipeline>>();
+        M1kPipelineRebuild rebuild{};
+        rebuild.build = [device, description, replacement]() {
+            *replacement = std::make_unique<M1kComputePipeline>(
+                *device, description.pipeline_layout, description.comp_filepath);
+        };
+        rebuild.commit = [device, target = description.target, replacement]() {
+            if (*replacement) replacePipeline(*device, *target, std::move(*replacement));
+        };
+        rebuilds.push_back(std::move(rebuild));
+    }
+
+    for (M1kPipelinePermutations* permutations : permutations_) {
+        auto variants = permutations->prepareRebuild(shader_filepath);
+        rebuilds.insert(rebuilds.end(), std::make_move_iterator(variants.begin()),
+                        std::make_move_iterator(variants.end()));
+    }
+    return rebuilds;
+}
+
+}
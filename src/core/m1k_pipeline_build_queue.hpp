@@ -0,0 +1,110 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_compute_pipeline.hpp"
+#include "m1k_device.hpp"
+#include "m1k_pipeline.hpp"
+#include "m1k_thread_pool.hpp"
+
+// std
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace m1k {
+
+class M1kPipelinePermutations;
+
+// a pipeline recreated off the main thread, e.g. after a shader changed:
+// build runs on a worker, commit on the main thread between frames swaps the
+// new pipeline in. commit does nothing if build didn't finish. An empty build
+// has nothing to compile, only commit runs.
+struct M1kPipelineRebuild {
+    std::function<void()> build;
+    std::function<void()> commit;
+};
+
+// target takes replacement, the old pipeline is released once no frame in
+// flight can still use it. Main thread only.
+template <typename T>
+void replacePipeline(M1kDevice& device, std::unique_ptr<T>& target, std::unique_ptr<T> replacement) {
+    std::shared_ptr<T> retired{target.release()};
+    device.graphicsTimeline().deferDestroy([retired]() mutable { retired.reset(); });
+    target = std::move(replacement);
+}
+
+/*
+ * Pipelines registered by the render systems while they are constructed,
+ * compiled together once every system is up.
+ *
+ * A graphics description is the shader paths plus a function filling a
+ * PipelineConfigInfo. The config is built on the worker compiling it, so
+ * pointers into it (blend attachments, dynamic states) stay valid without
+ * copying. build() reads the SPIR-V, creates the shader modules and calls
+ * vkCreate*Pipelines on the thread pool against the device pipeline cache,
+ * the only state the jobs share.
+ *
+ * The descriptions are kept after building, so the pipelines using a shader
+ * can be rebuilt when it changes, see M1kShaderHotReload.
+ *
+ * Targets stay null until build() returns, systems must not draw before.
+ */
+class M1kPipelineBuildQueue {
+   public:
+    // runs on a worker, everything it reads has to be safe to read there
+    using Configure = std::function<void(PipelineConfigInfo&)>;
+
+    explicit M1kPipelineBuildQueue(M1kDevice& device) : m1k_device_(device) {}
+
+    M1kPipelineBuildQueue(const M1kPipelineBuildQueue&) = delete;
+    M1kPipelineBuildQueue& operator=(const M1kPipelineBuildQueue&) = delete;
+
+    // empty frag_filepath -> vertex stage only, as for M1kPipeline
+    void addGraphics(std::unique_ptr<M1kPipeline>& target,
+                     Configure configure,
+                     const std::string& vert_filepath,
+                     const std::string& frag_filepath);
+    void addCompute(std::unique_ptr<M1kComputePipeline>& target,
+                    VkPipelineLayout pipeline_layout,
+                    const std::string& comp_filepath);
+    // variants are created on demand, the queue only rebuilds them
+    void addPermutations(M1kPipelinePermutations& permutations);
+
+    // compiles everything queued so far and blocks until it is done, the
+    // first failure is rethrown once all jobs finished
+    void build(M1kThreadPool& thread_pool);
+
+    // the built pipelines and permutation variants reading shader_filepath,
+    // main thread only
+    std::vector<M1kPipelineRebuild> prepareRebuild(const std::string& shader_filepath);
+
+    size_t size() const { return graphics_.size() + computes_.size(); }
+
+   private:
+    struct GraphicsDescription {
+        std::unique_ptr<M1kPipeline>* target;
+        Configure configure;
+        std::string vert_filepath;
+        std::string frag_filepath;
+    };
+
+    struct ComputeDescription {
+        std::unique_ptr<M1kComputePipeline>* target;
+        VkPipelineLayout pipeline_layout;
+        std::string comp_filepath;
+    };
+
+    M1kDevice& m1k_device_;
+    std::vector<GraphicsDescription> graphics_{};
+    std::vector<ComputeDescription> computes_{};
+    std::vector<M1kPipelinePermutations*> permutations_{};
+    // the ones before are built
+    size_t built_graphics_count_ = 0;
+    size_t built_compute_count_ = 0;
+};
+
+}
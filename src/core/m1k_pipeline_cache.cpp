@@ -0,0 +1,136 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_pipeline_cache.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace m1k {
+
+M1kPipelineCache::M1kPipelineCache(VkDevice device,
+                                   const VkPhysicalDeviceProperties &properties,
+                                   const std::string &cache_path)
+    : device_(device), properties_(properties), cache_path_(cache_path) {
+    char *cache_data = nullptr;
+    size_t cache_size = 0;
+    bool has_file = readFileBinary(cache_path_, &cache_data, &cache_size);
+    std::unique_ptr<char[]> file{cache_data};
+
+    if (!has_file) {
+        std::cout << "M1k::INFO~~~~~~~~No pipeline cache yet, creating: "
+                  << cache_path_ << std::endl;
+    } else if (!isCompatible(cache_data, cache_size)) {
+        std::cout << "M1k::WARN========Pipeline cache " << cache_path_
+                  << " was written by another device or driver, starting empty."
+                  << std::endl;
+        cache_size = 0;
+    } else {
+        std::cout << "M1k::INFO~~~~~~~~Reading pipeline cache from: " << cache_path_
+                  << "\n\t Size: " << cache_size << std::endl;
+    }
+
+    VkPipelineCacheCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize = cache_size;
+    create_info.pInitialData = cache_size > 0 ? cache_data : nullptr;
+
+    if (vkCreatePipelineCache(device_, &create_info, nullptr, &cache_) != VK_SUCCESS) {
+        throw std::runtime_error("M1K::ERR--------Create pipeline cache failed!");
+    }
+}
+
+M1kPipelineCache::~M1kPipelineCache() {
+    vkDestroyPipelineCache(device_, cache_, nullptr);
+}
+
+bool M1kPipelineCache::isCompatible(const char *data, size_t size) const {
+    VkPipelineCacheHeaderVersionOne header{};
+    if (size < sizeof(header)) return false;
+    std::memcpy(&header, data, sizeof(header));
+
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties_.vendorID &&
+           header.deviceID == properties_.deviceID &&
+           std::memcmp(header.pipelineCacheUUID, properties_.pipelineCacheUUID,
+                       VK_UUID_SIZE) == 0;
+}
+
+void M1kPipelineCache::record(const VkPipelineCreationFeedback &feedback,
+                              double host_milliseconds) {
+    bool is_valid = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) != 0;
+    bool is_hit = is_valid &&
+        (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) != 0;
+    double milliseconds = is_valid ? static_cast<double>(feedback.duration) / 1.0e6
+                                   : host_milliseconds;
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (is_hit) {
+        ++stats_.hit_count;
+        stats_.hit_milliseconds += milliseconds;
+    } else {
+        ++stats_.miss_count;
+        stats_.miss_milliseconds += milliseconds;
+    }
+}
+
+M1kPipelineCache::Stats M1kPipelineCache::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void M1kPipelineCache::printStats() const {
+    Stats stats = getStats();
+    std::cout << "M1k::INFO~~~~~~~~Pipeline cache: " << stats.hit_count << " hits ("
+              << stats.hit_milliseconds << " ms), " << stats.miss_count << " misses ("
+              << stats.miss_milliseconds << " ms)" << std::endl;
+}
+
+void M1kPipelineCache::save() {
+    size_t cache_size = 0;
+    if (vkGetPipelineCacheData(device_, cache_, &cache_size, nullptr) != VK_SUCCESS ||
+        cache_size == 0) {
+        std::cerr << "M1k::ERR--------Failed to get pipeline cache data." << std::endl;
+        return;
+    }
+
+    std::unique_ptr<char[]> cache_data{new char[cache_size]};
+    if (vkGetPipelineCacheData(device_, cache_, &cache_size, cache_data.get()) != VK_SUCCESS) {
+        std::cerr << "M1k::ERR--------Failed to get pipeline cache data." << std::endl;
+        return;
+    }
+
+    std::filesystem::path path(cache_path_);
+    if (path.has_parent_path()) {
+        createDirectoryIfNotExists(path.parent_path().string());
+    }
+
+    // rename replaces the old file in one step, readers see old or new
+    std::string temporary_path = cache_path_ + ".tmp";
+    std::error_code error;
+    if (!writeFileBinary(temporary_path, cache_data.get(), cache_size)) {
+        std::cerr << "M1k::ERR--------Failed to write pipeline cache " << temporary_path
+                  << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return;
+    }
+
+    std::filesystem::rename(temporary_path, cache_path_, error);
+    if (error) {
+        std::cerr << "M1k::ERR--------Failed to write pipeline cache " << cache_path_
+                  << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return;
+    }
+    std::cout << "M1k::INFO~~~~~~~~Pipeline cache saved to: " << cache_path_
+              << "\n\t Size: " << cache_size << std::endl;
+}
+
+}
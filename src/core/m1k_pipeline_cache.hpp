@@ -0,0 +1,72 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+// std
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace m1k {
+
+/*
+ * The one VkPipelineCache of the device, every graphics and compute pipeline
+ * is created through it.
+ *
+ * Loaded once at startup. The file is only used when its header matches the
+ * running driver (vendor, device and pipelineCacheUUID), a cache written by
+ * another GPU or driver version starts empty instead of being handed to the
+ * driver. save() writes a temporary file and renames it over the old one, so
+ * a crash while writing never leaves a truncated cache behind.
+ *
+ * Hits and misses are counted through pipeline creation feedback, with the
+ * time spent on each, to compare cold and warm startups.
+ *
+ * vkCreate*Pipelines synchronizes its use of the cache internally, record()
+ * locks, so pipelines may be built from any thread.
+ */
+class M1kPipelineCache {
+   public:
+    struct Stats {
+        uint32_t hit_count = 0;
+        uint32_t miss_count = 0;
+        double hit_milliseconds = 0.0;
+        double miss_milliseconds = 0.0;
+    };
+
+    M1kPipelineCache(VkDevice device,
+                     const VkPhysicalDeviceProperties &properties,
+                     const std::string &cache_path);
+    ~M1kPipelineCache();
+
+    M1kPipelineCache(const M1kPipelineCache&) = delete;
+    M1kPipelineCache& operator=(const M1kPipelineCache&) = delete;
+
+    VkPipelineCache cache() const { return cache_; }
+
+    // feedback of one pipeline created through the cache, host_milliseconds
+    // is used when the driver left the feedback invalid
+    void record(const VkPipelineCreationFeedback &feedback, double host_milliseconds);
+    Stats getStats() const;
+    void printStats() const;
+
+    // atomically replaces the cache file with the current contents
+    void save();
+
+   private:
+    bool isCompatible(const char *data, size_t size) const;
+
+    VkDevice device_;
+    VkPhysicalDeviceProperties properties_;
+    std::string cache_path_;
+    VkPipelineCache cache_ = VK_NULL_HANDLE;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_{};
+};
+
+}
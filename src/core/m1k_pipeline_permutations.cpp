@@ -0,0 +1,179 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_pipeline_permutations.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace m1k {
+
+namespace {
+
+// constant_id of MATERIAL_FLAGS in the mesh shaders
+constexpr uint32_t kMaterialFlagsConstantId = 0;
+
+template <typename T>
+uint64_t hashValue(const T &value, uint64_t hash) {
+    return fnv1a(&value, sizeof(value), hash);
+}
+
+// only for Vulkan structs made of 32 bit members, nothing to pad
+template <typename T>
+uint64_t hashArray(const std::vector<T> &values, uint64_t hash) {
+    hash = hashValue(values.size(), hash);
+    return values.empty() ? hash : fnv1a(values.data(), sizeof(T) * values.size(), hash);
+}
+
+uint64_t hashString(const std::string &value, uint64_t hash) {
+    hash = hashValue(value.size(), hash);
+    return fnv1a(value.data(), value.size(), hash);
+}
+
+}
+
+M1kPipelinePermutations::M1kPipelinePermutations(M1kDevice &device,
+                                                 M1kPipelineBuildQueue::Configure configure,
+                                                 const std::string &vert_filepath,
+                                                 const std::string &frag_filepath)
+    : m1k_device_(device), configure_(std::move(configure)),
+      vert_filepath_(vert_filepath), frag_filepath_(frag_filepath) {
+    PipelineConfigInfo config_info{};
+    configure_(config_info);
+    config_hash_ = hashConfigInfo(config_info);
+    config_hash_ = hashString(vert_filepath_, config_hash_);
+    config_hash_ = hashString(frag_filepath_, config_hash_);
+}
+
+M1kPipeline &M1kPipelinePermutations::get(uint32_t flags) {
+    uint64_t key = hashValue(flags, config_hash_);
+    auto &variant = pipelines_[key];
+    if (variant.pipeline == nullptr) {
+        variant.flags = flags;
+        variant.pipeline = createVariant(flags);
+        if (is_rebuild_pending_) stale_keys_.push_back(key);
+        std::cout << "M1K::INFO~~~~~~~~Created pipeline permutation, material flags 0x"
+                  << std::hex << flags << std::dec << std::endl;
+    }
+    return *variant.pipeline;
+}
+
+std::unique_ptr<M1kPipeline> M1kPipelinePermutations::createVariant(uint32_t flags) const {
+    PipelineConfigInfo config_info{};
+    configure_(config_info);
+    config_info.specialization_entries.push_back(
+        {kMaterialFlagsConstantId, 0, sizeof(uint32_t)});
+    config_info.specialization_data.resize(sizeof(uint32_t));
+    std::memcpy(config_info.specialization_data.data(), &flags, sizeof(uint32_t));
+
+    return std::make_unique<M1kPipeline>(m1k_device_, config_info,
+                                         vert_filepath_, frag_filepath_);
+}
+
+std::vector<M1kPipelineRebuild> M1kPipelinePermutations::prepareRebuild(
+    const std::string &shader_filepath) {
+    std::vector<M1kPipelineRebuild> rebuilds;
+    if (shader_filepath != vert_filepath_ && shader_filepath != frag_filepath_) {
+        return rebuilds;
+    }
+
+    // the map only grows on the main thread, its nodes stay where they are
+    for (auto &entry : pipelines_) {
+        Variant *variant = &entry.second;
+        uint32_t flags = variant->flags;
+        auto replacement = std::make_shared<std::unique_ptr<M1kPipeline>>();
+
+        M1kPipelineRebuild rebuild{};
+        rebuild.build = [this, flags, replacement]() {
+            *replacement = createVariant(flags);
+        };
+        rebuild.commit = [this, variant, replacement]() {
+            if (*replacement) replacePipeline(m1k_device_, variant->pipeline, std::move(*replacement));
+        };
+        rebuilds.push_back(std::move(rebuild));
+    }
+
+    is_rebuild_pending_ = true;
+    M1kPipelineRebuild drop_stale{};
+    drop_stale.commit = [this]() { dropStaleVariants(); };
+    rebuilds.push_back(std::move(drop_stale));
+    return rebuilds;
+}
+
+void M1kPipelinePermutations::dropStaleVariants() {
+    is_rebuild_pending_ = false;
+    for (uint64_t key : stale_keys_) {
+        auto found = pipelines_.find(key);
+        if (found == pipelines_.end()) continue;
+
+        // a frame in flight may still draw with it
+        replacePipeline(m1k_device_, found->second.pipeline, std::unique_ptr<M1kPipeline>{});
+        pipelines_.erase(found);
+    }
+    if (!stale_keys_.empty()) {
+        std::cout << "M1K::INFO~~~~~~~~Dropped " << stale_keys_.size()
+                  << " pipeline permutations created during the reload" << std::endl;
+    }
+    stale_keys_.clear();
+}
+
+uint64_t M1kPipelinePermutations::hashConfigInfo(const PipelineConfigInfo &config_info) {
+    uint64_t hash = kFnvOffsetBasis;
+    hash = hashArray(config_info.binding_descriptions, hash);
+    hash = hashArray(config_info.attribute_descriptions, hash);
+
+    hash = hashValue(config_info.input_assembly_info.topology, hash);
+    hash = hashValue(config_info.input_assembly_info.primitiveRestartEnable, hash);
+
+    const auto &raster = config_info.rasterization_info;
+    hash = hashValue(raster.depthClampEnable, hash);
+    hash = hashValue(raster.rasterizerDiscardEnable, hash);
+    hash = hashValue(raster.polygonMode, hash);
+    hash = hashValue(raster.cullMode, hash);
+    hash = hashValue(raster.frontFace, hash);
+    hash = hashValue(raster.depthBiasEnable, hash);
+    hash = hashValue(raster.depthBiasConstantFactor, hash);
+    hash = hashValue(raster.depthBiasClamp, hash);
+    hash = hashValue(raster.depthBiasSlopeFactor, hash);
+    hash = hashValue(raster.lineWidth, hash);
+
+    // the sample count itself comes from rasterization_samples
+    hash = hashValue(config_info.multisample_info.alphaToCoverageEnable, hash);
+    hash = hashValue(config_info.multisample_info.alphaToOneEnable, hash);
+
+    const auto &blend = config_info.color_blend_info;
+    hash = hashValue(blend.logicOpEnable, hash);
+    hash = hashValue(blend.logicOp, hash);
+    hash = hashValue(blend.attachmentCount, hash);
+    hash = hashValue(blend.blendConstants, hash);
+    hash = hashValue(config_info.color_blend_attachment, hash);
+    hash = hashArray(config_info.color_blend_attachments, hash);
+
+    const auto &depth = config_info.depth_stencil_info;
+    hash = hashValue(depth.depthTestEnable, hash);
+    hash = hashValue(depth.depthWriteEnable, hash);
+    hash = hashValue(depth.depthCompareOp, hash);
+    hash = hashValue(depth.depthBoundsTestEnable, hash);
+    hash = hashValue(depth.stencilTestEnable, hash);
+    hash = hashValue(depth.front, hash);
+    hash = hashValue(depth.back, hash);
+    hash = hashValue(depth.minDepthBounds, hash);
+    hash = hashValue(depth.maxDepthBounds, hash);
+
+    hash = hashArray(config_info.dynamics_state_enables, hash);
+
+    hash = hashValue(config_info.pipeline_layout, hash);
+    hash = hashValue(config_info.render_pass, hash);
+    hash = hashValue(config_info.subpass, hash);
+    hash = hashArray(config_info.color_attachment_formats, hash);
+    hash = hashValue(config_info.depth_attachment_format, hash);
+    hash = hashValue(config_info.stencil_attachment_format, hash);
+    hash = hashValue(config_info.rasterization_samples, hash);
+    return hash;
+}
+
+}
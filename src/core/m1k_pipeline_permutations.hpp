@@ -0,0 +1,77 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_device.hpp"
+#include "m1k_pipeline.hpp"
+#include "m1k_pipeline_build_queue.hpp"
+
+// std
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Variants of one pipeline that differ in the material flags, compiled into
+ * the shaders as specialization constant 0 (MATERIAL_FLAGS), so each
+ * material runs a shader with its feature branches folded away.
+ *
+ * A variant is created the first time its flags are asked for and kept
+ * under a hash of the PipelineConfigInfo, the shader paths and the flags.
+ * Creation goes through the device pipeline cache, after the first run a
+ * new variant costs a cache lookup rather than a compile.
+ *
+ * Main thread only: resolve the pipelines of a frame before recording.
+ */
+class M1kPipelinePermutations {
+   public:
+    M1kPipelinePermutations(M1kDevice &device,
+                            M1kPipelineBuildQueue::Configure configure,
+                            const std::string &vert_filepath,
+                            const std::string &frag_filepath);
+
+    M1kPipelinePermutations(const M1kPipelinePermutations&) = delete;
+    M1kPipelinePermutations &operator=(const M1kPipelinePermutations&) = delete;
+
+    M1kPipeline &get(uint32_t flags);
+
+    size_t size() const { return pipelines_.size(); }
+
+    // every variant created so far if shader_filepath is one of the two
+    // shaders, none otherwise. Variants get() creates before the rebuild
+    // commits may have read the old binary, the last commit drops them and
+    // the next get() creates them again
+    std::vector<M1kPipelineRebuild> prepareRebuild(const std::string &shader_filepath);
+
+    // everything vkCreateGraphicsPipelines reads from config_info, not the
+    // pointers into it
+    static uint64_t hashConfigInfo(const PipelineConfigInfo &config_info);
+
+   private:
+    struct Variant {
+        uint32_t flags = 0;
+        std::unique_ptr<M1kPipeline> pipeline;
+    };
+
+    std::unique_ptr<M1kPipeline> createVariant(uint32_t flags) const;
+    void dropStaleVariants();
+
+    M1kDevice &m1k_device_;
+    M1kPipelineBuildQueue::Configure configure_;
+    std::string vert_filepath_;
+    std::string frag_filepath_;
+    uint64_t config_hash_ = 0;
+
+    std::unordered_map<uint64_t, Variant> pipelines_{};
+    // keys of the variants created while a rebuild was pending
+    bool is_rebuild_pending_ = false;
+    std::vector<uint64_t> stale_keys_{};
+};
+
+}
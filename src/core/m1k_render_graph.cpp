@@ -0,0 +1,748 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_render_graph.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+namespace m1k {
+
+namespace {
+
+bool isDepthFormat(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool hasStencilComponent(VkFormat format) {
+    return format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+           format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+bool isAttachmentUsage(M1kResourceUsage usage) {
+    return usage == M1kResourceUsage::ColorAttachment ||
+           usage == M1kResourceUsage::DepthAttachment ||
+           usage == M1kResourceUsage::DepthAttachmentRead;
+}
+
+}
+
+// ---------------------------------- builder ----------------------------------
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::writeColor(
+    Handle image, VkAttachmentLoadOp load_op, VkClearValue clear_value) {
+    Access access{image, M1kResourceUsage::ColorAttachment, true};
+    access.load_op = load_op;
+    access.clear_value = clear_value;
+    graph_.passes_[pass_index_].accesses.push_back(access);
+    return *this;
+}
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::writeDepth(
+    Handle image, VkAttachmentLoadOp load_op, VkClearValue clear_value) {
+    Access access{image, M1kResourceUsage::DepthAttachment, true};
+    access.load_op = load_op;
+    access.clear_value = clear_value;
+    graph_.passes_[pass_index_].accesses.push_back(access);
+    return *this;
+}
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::readDepth(Handle image) {
+    Access access{image, M1kResourceUsage::DepthAttachmentRead, false};
+    access.load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+    graph_.passes_[pass_index_].accesses.push_back(access);
+    return *this;
+}
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::read(Handle resource,
+                                                               M1kResourceUsage usage) {
+    assert(!isAttachmentUsage(usage) && "Use readDepth() for attachments");
+    graph_.passes_[pass_index_].accesses.push_back({resource, usage, false});
+    return *this;
+}
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::write(Handle resource,
+                                                                M1kResourceUsage usage) {
+    assert(!isAttachmentUsage(usage) && "Use writeColor() / writeDepth() for attachments");
+    graph_.passes_[pass_index_].accesses.push_back({resource, usage, true});
+    return *this;
+}
+
+M1kRenderGraph::PassBuilder& M1kRenderGraph::PassBuilder::setSideEffect() {
+    graph_.passes_[pass_index_].has_side_effect = true;
+    return *this;
+}
+
+// ---------------------------------- graph ----------------------------------
+
+M1kRenderGraph::M1kRenderGraph(M1kDevice& device) : m1k_device_{device} {}
+
+M1kRenderGraph::~M1kRenderGraph() {
+    releasePhysicalImages();
+}
+
+void M1kRenderGraph::reset() {
+    resources_.clear();
+    passes_.clear();
+    execution_order_.clear();
+    culled_pass_count_ = 0;
+    is_compiled_ = false;
+}
+
+M1kRenderGraph::Handle M1kRenderGraph::createImage(const std::string& name,
+                                                   const M1kRenderGraphImageDesc& desc) {
+    Resource resource{};
+    resource.name = name;
+    resource.desc = desc;
+    resource.aspect = isDepthFormat(desc.format) ? VK_IMAGE_ASPECT_DEPTH_BIT
+                                                 : VK_IMAGE_ASPECT_COLOR_BIT;
+    resources_.push_back(std::move(resource));
+    return static_cast<Handle>(resources_.size() - 1);
+}
+
+M1kRenderGraph::Handle M1kRenderGraph::importImage(const std::string& name, VkImage image,
+                                                   VkImageView view, VkFormat format,
+                                                   VkExtent2D extent,
+                                                   VkImageLayout initial_layout,
+                                                   VkImageLayout final_layout) {
+    Resource resource{};
+    resource.name = name;
+    resource.is_imported = true;
+    resource.desc.extent = extent;
+    resource.desc.format = format;
+    resource.aspect = isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT
+                                            : VK_IMAGE_ASPECT_COLOR_BIT;
+    resource.image = image;
+    resource.view = view;
+    resource.initial_layout = initial_layout;
+    resource.final_layout = final_layout;
+    resources_.push_back(std::move(resource));
+    return static_cast<Handle>(resources_.size() - 1);
+}
+
+M1kRenderGraph::Handle M1kRenderGraph::importBuffer(const std::string& name, VkBuffer buffer,
+                                                    VkDeviceSize size) {
+    Resource resource{};
+    resource.name = name;
+    resource.is_image = false;
+    resource.is_imported = true;
+    resource.buffer = buffer;
+    resource.buffer_size = size;
+    resources_.push_back(std::move(resource));
+    return static_cast<Handle>(resources_.size() - 1);
+}
+
+void M1kRenderGraph::markOutput(Handle resource, VkImageLayout final_layout) {
+    assert(resource < resources_.size() && "Invalid render graph resource");
+    resources_[resource].is_output = true;
+    if (final_layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+        resources_[resource].final_layout = final_layout;
+    }
+}
+
+void M1kRenderGraph::addPass(const std::string& name, const SetupFunction& setup,
+                             ExecuteFunction execute) {
+    assert(!is_compiled_ && "Cannot add passes to a compiled render graph");
+
+    Pass pass{};
+    pass.name = name;
+    pass.execute = std::move(execute);
+    passes_.push_back(std::move(pass));
+
+    PassBuilder builder{*this, static_cast<uint32_t>(passes_.size() - 1)};
+    setup(builder);
+}
+
+M1kRenderGraph::UsageInfo M1kRenderGraph::usageInfo(M1kResourceUsage usage) {
+    switch (usage) {
+        case M1kResourceUsage::ColorAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+        case M1kResourceUsage::DepthAttachment:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+        case M1kResourceUsage::DepthAttachmentRead:
+            return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+        case M1kResourceUsage::SampledRead:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    VK_IMAGE_USAGE_SAMPLED_BIT};
+        case M1kResourceUsage::StorageRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL,
+                    VK_IMAGE_USAGE_STORAGE_BIT};
+        case M1kResourceUsage::StorageWrite:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL,
+                    VK_IMAGE_USAGE_STORAGE_BIT};
+        case M1kResourceUsage::TransferRead:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+        case M1kResourceUsage::TransferWrite:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+        case M1kResourceUsage::IndirectRead:
+            return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                    VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED,
+                    0};
+    }
+    throw std::runtime_error("unknown render graph resource usage");
+}
+
+void M1kRenderGraph::compile() {
+    assert(!is_compiled_ && "Render graph already compiled");
+
+    for (const auto& pass : passes_) {
+        for (const auto& access : pass.accesses) {
+            if (access.resource >= resources_.size()) {
+                throw std::runtime_error("render graph pass '" + pass.name +
+                                         "' uses an unknown resource");
+            }
+            if (isAttachmentUsage(access.usage) && !m1k_device_.isDynamicRenderingSupported()) {
+                throw std::runtime_error("render graph attachments need dynamic rendering");
+            }
+        }
+    }
+
+    cullPasses();
+    computeLifetimes();
+
+    // the physical images only change with the declarations
+    std::vector<uint32_t> signature = physicalSignature();
+    if (signature != physical_signature_) {
+        releasePhysicalImages();
+        physical_signature_ = std::move(signature);
+        buildPhysicalImages();
+    }
+
+    uint32_t physical_index = 0;
+    for (auto& resource : resources_) {
+        if (resource.is_imported || resource.first_use == ~0u) continue;
+        resource.physical_index = physical_index;
+        resource.image = physical_images_[physical_index].image;
+        resource.view = physical_images_[physical_index].view;
+        ++physical_index;
+    }
+
+    is_compiled_ = true;
+}
+
+void M1kRenderGraph::cullPasses() {
+    // a pass stays if something reads what it writes; imported resources and
+    // outputs count as read by whoever comes after the graph
+    for (auto& resource : resources_) {
+        resource.reader_count = (resource.is_imported || resource.is_output) ? 1 : 0;
+    }
+    for (auto& pass : passes_) {
+        pass.ref_count = pass.has_side_effect ? 1 : 0;
+        pass.is_culled = false;
+        for (const auto& access : pass.accesses) {
+            if (access.is_write) {
+                ++pass.ref_count;
+            } else {
+                ++resources_[access.resource].reader_count;
+            }
+        }
+    }
+
+    std::vector<Handle> unread_resources;
+    for (Handle i = 0; i < resources_.size(); ++i) {
+        if (resources_[i].reader_count == 0) unread_resources.push_back(i);
+    }
+
+    auto cull = [&](Pass& pass) {
+        pass.is_culled = true;
+        for (const auto& access : pass.accesses) {
+            if (!access.is_write && --resources_[access.resource].reader_count == 0) {
+                unread_resources.push_back(access.resource);
+            }
+        }
+    };
+
+    for (auto& pass : passes_) {
+        if (pass.ref_count == 0) cull(pass);
+    }
+
+    while (!unread_resources.empty()) {
+        Handle resource = unread_resources.back();
+        unread_resources.pop_back();
+
+        for (auto& pass : passes_) {
+            if (pass.is_culled) continue;
+            for (const auto& access : pass.accesses) {
+                if (access.is_write && access.resource == resource && --pass.ref_count == 0) {
+                    cull(pass);
+                    break;
+                }
+            }
+        }
+    }
+
+    execution_order_.clear();
+    culled_pass_count_ = 0;
+    for (uint32_t i = 0; i < passes_.size(); ++i) {
+        if (passes_[i].is_culled) {
+            ++culled_pass_count_;
+        } else {
+            execution_order_.push_back(i);
+        }
+    }
+}
+
+void M1kRenderGraph::computeLifetimes() {
+    uint32_t order_end = static_cast<uint32_t>(execution_order_.size());
+
+    for (uint32_t order = 0; order < order_end; ++order) {
+        for (const auto& access : passes_[execution_order_[order]].accesses) {
+            auto& resource = resources_[access.resource];
+            resource.first_use = std::min(resource.first_use, order);
+            resource.last_use = std::max(resource.last_use, order);
+            if (resource.is_image) {
+                resource.usage |= usageInfo(access.usage).image_usage;
+            }
+        }
+    }
+
+    for (auto& resource : resources_) {
+        if (resource.is_output && resource.first_use != ~0u) {
+            resource.last_use = order_end;
+        }
+    }
+
+    // nobody reads a transient attachment after its last pass, don't write it back
+    for (uint32_t order = 0; order < order_end; ++order) {
+        for (auto& access : passes_[execution_order_[order]].accesses) {
+            const auto& resource = resources_[access.resource];
+            if (isAttachmentUsage(access.usage) && !resource.is_imported &&
+                resource.last_use == order) {
+                access.store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> M1kRenderGraph::physicalSignature() const {
+    std::vector<uint32_t> signature;
+    for (const auto& resource : resources_) {
+        if (resource.is_imported || resource.first_use == ~0u) continue;
+        signature.insert(signature.end(), {
+            resource.desc.extent.width, resource.desc.extent.height,
+            static_cast<uint32_t>(resource.desc.format),
+            static_cast<uint32_t>(resource.desc.samples),
+            resource.usage | resource.desc.extra_usage,
+            resource.first_use, resource.last_use});
+    }
+    return signature;
+}
+
+void M1kRenderGraph::buildPhysicalImages() {
+    VkDevice device = m1k_device_.device();
+    VkDeviceSize unaliased_size = 0;
+
+    for (const auto& resource : resources_) {
+        if (resource.is_imported || resource.first_use == ~0u) continue;
+
+        VkImageCreateInfo image_info{};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.extent = {resource.desc.extent.width, resource.desc.extent.height, 1};
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.format = resource.desc.format;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_info.usage = resource.usage | resource.desc.extra_usage;
+        image_info.samples = resource.desc.samples;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        PhysicalImage physical{};
+        if (vkCreateImage(device, &image_info, nullptr, &physical.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render graph image " + resource.name);
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, physical.image, &requirements);
+        physical.size = requirements.size;
+        unaliased_size += requirements.size;
+
+        // every image is bound at offset 0, so any block with a compatible
+        // memory type whose last user is done can take it; prefer the best fit
+        uint32_t best_block = ~0u;
+        for (uint32_t i = 0; i < memory_blocks_.size(); ++i) {
+            const auto& block = memory_blocks_[i];
+            if (block.free_after >= resource.first_use ||
+                (block.memory_type_bits & requirements.memoryTypeBits) == 0) {
+                continue;
+            }
+            if (best_block == ~0u) {
+                best_block = i;
+                continue;
+            }
+            const auto& best = memory_blocks_[best_block];
+            bool fits = block.size >= requirements.size;
+            bool best_fits = best.size >= requirements.size;
+            if ((fits && (!best_fits || block.size < best.size)) ||
+                (!fits && !best_fits && block.size > best.size)) {
+                best_block = i;
+            }
+        }
+        if (best_block == ~0u) {
+            memory_blocks_.push_back({});
+            best_block = static_cast<uint32_t>(memory_blocks_.size() - 1);
+        }
+
+        auto& block = memory_blocks_[best_block];
+        block.size = std::max(block.size, requirements.size);
+        block.memory_type_bits &= requirements.memoryTypeBits;
+        block.free_after = resource.last_use;
+        physical.block_index = best_block;
+
+        physical_images_.push_back(physical);
+    }
+
+    VkDeviceSize aliased_size = 0;
+    for (auto& block : memory_blocks_) {
+        VkMemoryAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = block.size;
+        alloc_info.memoryTypeIndex =
+            m1k_device_.findMemoryType(block.memory_type_bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(device, &alloc_info, nullptr, &block.memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate render graph memory!");
+        }
+        aliased_size += block.size;
+    }
+
+    uint32_t physical_index = 0;
+    for (const auto& resource : resources_) {
+        if (resource.is_imported || resource.first_use == ~0u) continue;
+
+        auto& physical = physical_images_[physical_index++];
+        vkBindImageMemory(device, physical.image, memory_blocks_[physical.block_index].memory, 0);
+        physical.view = m1k_device_.createImageView(physical.image, resource.desc.format, 1,
+                                                    resource.aspect);
+    }
+
+    if (!physical_images_.empty()) {
+        std::cout << "M1K::INFO~~~~~~~~Render graph: " << physical_images_.size()
+                  << " transient images in " << memory_blocks_.size() << " allocations, "
+                  << unaliased_size / (1024 * 1024) << " MB -> "
+                  << aliased_size / (1024 * 1024) << " MB" << std::endl;
+    }
+}
+
+void M1kRenderGraph::releasePhysicalImages() {
+    if (physical_images_.empty() && memory_blocks_.empty()) return;
+
+    // frames in flight may still render with them
+    m1k_device_.graphicsTimeline().deferDestroy(
+        [device = m1k_device_.device(), images = std::move(physical_images_),
+         blocks = std::move(memory_blocks_)]() {
+            for (const auto& physical : images) {
+                vkDestroyImageView(device, physical.view, nullptr);
+                vkDestroyImage(device, physical.image, nullptr);
+            }
+            for (const auto& block : blocks) {
+                vkFreeMemory(device, block.memory, nullptr);
+            }
+        });
+
+    physical_images_.clear();
+    memory_blocks_.clear();
+    physical_signature_.clear();
+}
+
+void M1kRenderGraph::recordBarrier(Resource& resource, const Access& access, bool is_first_use,
+                                   std::vector<VkImageMemoryBarrier>& image_barriers,
+                                   std::vector<VkBufferMemoryBarrier>& buffer_barriers,
+                                   VkPipelineStageFlags& src_stages,
+                                   VkPipelineStageFlags& dst_stages) {
+    UsageInfo info = usageInfo(access.usage);
+    ResourceState& state = resource.state;
+    MemoryBlock* block = nullptr;
+
+    if (!resource.is_imported) {
+        block = &memory_blocks_[physical_images_[resource.physical_index].block_index];
+        // the memory was last used by another image (or the previous frame),
+        // the contents are garbage either way
+        if (is_first_use) {
+            state = {};
+            state.write_stages = block->last_stages;
+            state.write_access = block->last_access;
+        }
+    }
+
+    bool changes_layout = resource.is_image && state.layout != info.layout;
+    VkPipelineStageFlags src_stage_mask = 0;
+    VkAccessFlags src_access_mask = 0;
+
+    if (access.is_write || changes_layout) {
+        src_stage_mask = state.write_stages | state.read_stages;
+        src_access_mask = state.write_access;
+    } else if (state.write_stages != 0 && (info.stages & ~state.visible_stages) != 0) {
+        // same layout read, only the last write has to be made visible
+        src_stage_mask = state.write_stages;
+        src_access_mask = state.write_access;
+    } else {
+        state.read_stages |= info.stages;
+        if (block != nullptr) block->last_stages |= info.stages;
+        return;
+    }
+
+    if (resource.is_image) {
+        VkImageLayout old_layout = state.layout;
+        // cleared or fully overwritten, no need to keep the contents
+        if (access.load_op != VK_ATTACHMENT_LOAD_OP_LOAD && isAttachmentUsage(access.usage)) {
+            old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        VkImageAspectFlags aspect = resource.aspect;
+        if (hasStencilComponent(resource.desc.format)) {
+            aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = old_layout;
+        barrier.newLayout = info.layout;
+        barrier.srcAccessMask = src_access_mask;
+        barrier.dstAccessMask = info.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = resource.image;
+        barrier.subresourceRange = {aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                                    VK_REMAINING_ARRAY_LAYERS};
+        image_barriers.push_back(barrier);
+    } else {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = src_access_mask;
+        barrier.dstAccessMask = info.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = resource.buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        buffer_barriers.push_back(barrier);
+    }
+
+    src_stages |= src_stage_mask != 0 ? src_stage_mask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    dst_stages |= info.stages;
+
+    if (access.is_write || changes_layout) {
+        // a layout transition acts like a write before info.stages
+        state.layout = resource.is_image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        state.write_stages = info.stages;
+        state.write_access = access.is_write ? info.access : 0;
+        state.read_stages = access.is_write ? 0 : info.stages;
+        state.visible_stages = access.is_write ? 0 : info.stages;
+    } else {
+        state.read_stages |= info.stages;
+        state.visible_stages |= info.stages;
+    }
+
+    if (block != nullptr) {
+        block->last_stages = state.write_stages | state.read_stages;
+        block->last_access = state.write_access;
+    }
+}
+
+void M1kRenderGraph::beginRendering(VkCommandBuffer command_buffer, const Pass& pass) {
+    std::vector<VkRenderingAttachmentInfo> color_attachments;
+    VkRenderingAttachmentInfo depth_attachment{};
+    bool has_depth = false;
+    VkExtent2D extent{0, 0};
+
+    for (const auto& access : pass.accesses) {
+        if (!isAttachmentUsage(access.usage)) continue;
+
+        const auto& resource = resources_[access.resource];
+        extent = resource.desc.extent;
+
+        VkRenderingAttachmentInfo attachment{};
+        attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        attachment.imageView = resource.view;
+        attachment.imageLayout = usageInfo(access.usage).layout;
+        attachment.loadOp = access.load_op;
+        attachment.storeOp = access.store_op;
+        attachment.clearValue = access.clear_value;
+
+        if (access.usage == M1kResourceUsage::ColorAttachment) {
+            color_attachments.push_back(attachment);
+        } else {
+            depth_attachment = attachment;
+            has_depth = true;
+        }
+    }
+
+    VkRenderingInfo rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    rendering_info.renderArea = {{0, 0}, extent};
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = static_cast<uint32_t>(color_attachments.size());
+    rendering_info.pColorAttachments = color_attachments.data();
+    rendering_info.pDepthAttachment = has_depth ? &depth_attachment : nullptr;
+
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+
+    // pipelines use dynamic viewport / scissor
+    VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent.width),
+                        static_cast<float>(extent.height), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, extent};
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+}
+
+void M1kRenderGraph::execute(VkCommandBuffer command_buffer) {
+    assert(is_compiled_ && "Render graph must be compiled before execute");
+
+    for (auto& resource : resources_) {
+        if (!resource.is_imported) continue;
+        // no idea who used it before the graph
+        resource.state = {};
+        resource.state.layout = resource.initial_layout;
+        resource.state.write_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        resource.state.write_access = VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+
+    for (uint32_t order = 0; order < execution_order_.size(); ++order) {
+        const Pass& pass = passes_[execution_order_[order]];
+
+        image_barriers.clear();
+        buffer_barriers.clear();
+        VkPipelineStageFlags src_stages = 0;
+        VkPipelineStageFlags dst_stages = 0;
+        bool has_attachments = false;
+
+        for (const auto& access : pass.accesses) {
+            auto& resource = resources_[access.resource];
+            recordBarrier(resource, access, resource.first_use == order,
+                          image_barriers, buffer_barriers, src_stages, dst_stages);
+            has_attachments |= isAttachmentUsage(access.usage);
+        }
+
+        if (!image_barriers.empty() || !buffer_barriers.empty()) {
+            vkCmdPipelineBarrier(command_buffer, src_stages, dst_stages, 0, 0, nullptr,
+                                 static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data(),
+                                 static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+        }
+
+        if (has_attachments) {
+            beginRendering(command_buffer, pass);
+        }
+        pass.execute(command_buffer, *this);
+        if (has_attachments) {
+            vkCmdEndRendering(command_buffer);
+        }
+    }
+
+    // hand imported resources and outputs over to whoever comes next
+    image_barriers.clear();
+    buffer_barriers.clear();
+    VkPipelineStageFlags src_stages = 0;
+    for (auto& resource : resources_) {
+        if ((!resource.is_imported && !resource.is_output) || resource.first_use == ~0u) continue;
+
+        const ResourceState& state = resource.state;
+        bool changes_layout = resource.is_image &&
+                              resource.final_layout != VK_IMAGE_LAYOUT_UNDEFINED &&
+                              resource.final_layout != state.layout;
+        if (state.write_access == 0 && !changes_layout) continue;
+
+        src_stages |= state.write_stages | state.read_stages;
+        if (resource.is_image) {
+            VkImageAspectFlags aspect = resource.aspect;
+            if (hasStencilComponent(resource.desc.format)) {
+                aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+            }
+
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout = state.layout;
+            barrier.newLayout = changes_layout ? resource.final_layout : state.layout;
+            barrier.srcAccessMask = state.write_access;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = resource.image;
+            barrier.subresourceRange = {aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                                        VK_REMAINING_ARRAY_LAYERS};
+            image_barriers.push_back(barrier);
+        } else {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = state.write_access;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = resource.buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+            buffer_barriers.push_back(barrier);
+        }
+
+        if (!resource.is_imported) {
+            auto& block = memory_blocks_[physical_images_[resource.physical_index].block_index];
+            block.last_stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            block.last_access = VK_ACCESS_MEMORY_WRITE_BIT;
+        }
+    }
+
+    if (!image_barriers.empty() || !buffer_barriers.empty()) {
+        vkCmdPipelineBarrier(command_buffer, src_stages, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data(),
+                             static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+    }
+}
+
+VkImage M1kRenderGraph::getImage(Handle image) const {
+    assert(image < resources_.size() && resources_[image].is_image && "Invalid render graph image");
+    return resources_[image].image;
+}
+
+VkImageView M1kRenderGraph::getImageView(Handle image) const {
+    assert(image < resources_.size() && resources_[image].is_image && "Invalid render graph image");
+    return resources_[image].view;
+}
+
+VkBuffer M1kRenderGraph::getBuffer(Handle buffer) const {
+    assert(buffer < resources_.size() && !resources_[buffer].is_image && "Invalid render graph buffer");
+    return resources_[buffer].buffer;
+}
+
+}
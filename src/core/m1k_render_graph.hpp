@@ -0,0 +1,224 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_device.hpp"
+
+// std
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace m1k {
+
+// how a pass touches a resource, decides stages, access masks and layouts
+enum class M1kResourceUsage {
+    ColorAttachment,      // write
+    DepthAttachment,      // depth test + write
+    DepthAttachmentRead,  // depth test only
+    SampledRead,          // fragment / compute shader sampling
+    StorageRead,          // compute storage image / buffer
+    StorageWrite,
+    TransferRead,
+    TransferWrite,
+    IndirectRead,         // draw / dispatch indirect arguments
+};
+
+struct M1kRenderGraphImageDesc {
+    VkExtent2D extent{};
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    // added to the usage flags derived from the passes
+    VkImageUsageFlags extra_usage = 0;
+};
+
+/*
+ * Frame render graph on top of the renderer.
+ *
+ * Rebuilt every frame: reset(), declare resources and passes, compile(),
+ * execute(). Passes run in declaration order on the graphics queue; passes
+ * whose writes nobody reads are culled. Barriers and layout transitions are
+ * derived from the declared usages and batched into one vkCmdPipelineBarrier
+ * per pass.
+ *
+ * Transient images only live between their first and last use, images with
+ * disjoint lifetimes share VkDeviceMemory. The physical images are kept
+ * across frames while the declarations don't change.
+ *
+ * Passes with attachments are rendered with dynamic rendering, the graph
+ * begins and ends it around the execute callback.
+ */
+class M1kRenderGraph {
+   public:
+    using Handle = uint32_t;
+    static constexpr Handle kInvalidHandle = ~0u;
+
+    class PassBuilder {
+       public:
+        // attachments, load_op CLEAR uses clear_value
+        PassBuilder& writeColor(Handle image,
+                                VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                                VkClearValue clear_value = {});
+        PassBuilder& writeDepth(Handle image,
+                                VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                                VkClearValue clear_value = {});
+        PassBuilder& readDepth(Handle image);
+
+        PassBuilder& read(Handle resource, M1kResourceUsage usage);
+        PassBuilder& write(Handle resource, M1kResourceUsage usage);
+
+        // never culled, e.g. writes to host visible buffers
+        PassBuilder& setSideEffect();
+
+       private:
+        friend class M1kRenderGraph;
+        PassBuilder(M1kRenderGraph& graph, uint32_t pass_index)
+            : graph_{graph}, pass_index_{pass_index} {}
+
+        M1kRenderGraph& graph_;
+        uint32_t pass_index_;
+    };
+
+    using SetupFunction = std::function<void(PassBuilder&)>;
+    using ExecuteFunction = std::function<void(VkCommandBuffer, const M1kRenderGraph&)>;
+
+    explicit M1kRenderGraph(M1kDevice& device);
+    ~M1kRenderGraph();
+
+    M1kRenderGraph(const M1kRenderGraph&) = delete;
+    M1kRenderGraph& operator=(const M1kRenderGraph&) = delete;
+
+    // drops the declarations of the last frame, keeps the physical images
+    void reset();
+
+    Handle createImage(const std::string& name, const M1kRenderGraphImageDesc& desc);
+    // external images start in initial_layout and are left in final_layout
+    // (UNDEFINED: whatever the last pass needed)
+    Handle importImage(const std::string& name, VkImage image, VkImageView view,
+                       VkFormat format, VkExtent2D extent,
+                       VkImageLayout initial_layout, VkImageLayout final_layout);
+    Handle importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize size);
+    // keeps the passes producing it, transient images then live to the end
+    // of the graph and can be read after execute() in final_layout
+    void markOutput(Handle resource, VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+    void addPass(const std::string& name, const SetupFunction& setup,
+                 ExecuteFunction execute);
+
+    void compile();
+    void execute(VkCommandBuffer command_buffer);
+
+    VkImage getImage(Handle image) const;
+    VkImageView getImageView(Handle image) const;
+    VkBuffer getBuffer(Handle buffer) const;
+
+    uint32_t culledPassCount() const { return culled_pass_count_; }
+
+   private:
+    struct ResourceState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags write_stages = 0;
+        VkAccessFlags write_access = 0;
+        // since the last write
+        VkPipelineStageFlags read_stages = 0;
+        VkPipelineStageFlags visible_stages = 0;
+    };
+
+    struct Resource {
+        std::string name;
+        bool is_image = true;
+        bool is_imported = false;
+        bool is_output = false;
+
+        M1kRenderGraphImageDesc desc{};
+        VkImageUsageFlags usage = 0;
+        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize buffer_size = 0;
+
+        VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        // compile results, indices into the execution order
+        uint32_t first_use = ~0u;
+        uint32_t last_use = 0;
+        uint32_t reader_count = 0;
+        uint32_t physical_index = ~0u;  // transient images only
+
+        ResourceState state{};
+    };
+
+    struct Access {
+        Handle resource;
+        M1kResourceUsage usage;
+        bool is_write;
+        VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        VkAttachmentStoreOp store_op = VK_ATTACHMENT_STORE_OP_STORE;
+        VkClearValue clear_value{};
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Access> accesses{};
+        ExecuteFunction execute;
+        bool has_side_effect = false;
+        bool is_culled = false;
+        uint32_t ref_count = 0;
+    };
+
+    // one memory allocation shared by transient images with disjoint lifetimes
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memory_type_bits = ~0u;
+        uint32_t free_after = 0;
+        // last access of whichever image used it, kept across frames
+        VkPipelineStageFlags last_stages = 0;
+        VkAccessFlags last_access = 0;
+    };
+
+    struct PhysicalImage {
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        uint32_t block_index = 0;
+        VkDeviceSize size = 0;
+    };
+
+    struct UsageInfo {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        VkImageUsageFlags image_usage;
+    };
+    static UsageInfo usageInfo(M1kResourceUsage usage);
+
+    void cullPasses();
+    void computeLifetimes();
+    void buildPhysicalImages();
+    void releasePhysicalImages();
+    std::vector<uint32_t> physicalSignature() const;
+
+    void recordBarrier(Resource& resource, const Access& access, bool is_first_use,
+                       std::vector<VkImageMemoryBarrier>& image_barriers,
+                       std::vector<VkBufferMemoryBarrier>& buffer_barriers,
+                       VkPipelineStageFlags& src_stages, VkPipelineStageFlags& dst_stages);
+    void beginRendering(VkCommandBuffer command_buffer, const Pass& pass);
+
+    M1kDevice& m1k_device_;
+
+    std::vector<Resource> resources_{};
+    std::vector<Pass> passes_{};
+    std::vector<uint32_t> execution_order_{};
+    uint32_t culled_pass_count_ = 0;
+    bool is_compiled_ = false;
+
+    std::vector<PhysicalImage> physical_images_{};
+    std::vector<MemoryBlock> memory_blocks_{};
+    std::vector<uint32_t> physical_signature_{};
+};
+
+}
@@ -5,20 +5,61 @@
 #include "m1k_renderer.hpp"
 
 // std
+#include <algorithm>
 #include <stdexcept>
 #include <array>
+#include <iostream>
 
 
 namespace m1k {
 
-M1kRenderer::M1kRenderer(M1kWindow &window, M1kDevice &device)
-    : m1k_window_(window), m1k_device_(device) {
+namespace {
+
+bool hasStencilComponent(VkFormat format) {
+    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+}
+
+VkImageMemoryBarrier imageBarrier(VkImage image, VkImageAspectFlags aspect_mask,
+                                  VkImageLayout old_layout, VkImageLayout new_layout,
+                                  VkAccessFlags src_access, VkAccessFlags dst_access) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {aspect_mask, 0, 1, 0, 1};
+    return barrier;
+}
+
+}
+
+M1kRenderer::M1kRenderer(M1kWindow &window, M1kDevice &device, M1kThreadPool &thread_pool,
+                         uint32_t frames_in_flight, bool use_dynamic_rendering)
+    : m1k_window_(window), m1k_device_(device), thread_pool_(thread_pool),
+      frames_in_flight_(std::clamp(frames_in_flight, 1u, kMaxFramesInFlight)),
+      use_dynamic_rendering_(use_dynamic_rendering && device.isDynamicRenderingSupported()),
+      render_graph_(device) {
+
+    if (use_dynamic_rendering && !use_dynamic_rendering_) {
+        std::cout << "M1K::WARN========Dynamic rendering not supported, "
+                     "falling back to render passes" << std::endl;
+    }
+
+    frame_timeline_values_.resize(frames_in_flight_, 0);
 
     recreateSwapChain();
     createCommandBuffers();
+    createThreadCommandPools();
+    createComputeResources();
 }
 
 M1kRenderer::~M1kRenderer() {
+    destroyComputeResources();
+    destroyThreadCommandPools();
     freeCommandBuffers();
 }
 
@@ -30,23 +71,44 @@ void M1kRenderer::recreateSwapChain() {
         glfwWaitEvents();
     }
 
-    vkDeviceWaitIdle(m1k_device_.device());
-
+    // no vkDeviceWaitIdle here: frames in flight keep rendering with the old
+    // swap chain, it is retired through the deletion queue instead
     if(m1k_swap_chain_ == nullptr) {
-        m1k_swap_chain_ = std::make_unique<M1kSwapChain>(m1k_device_, extent);
+        m1k_swap_chain_ = std::make_unique<M1kSwapChain>(m1k_device_, extent, frames_in_flight_,
+                                                         use_dynamic_rendering_);
     } else {
         std::shared_ptr<M1kSwapChain> old_swap_chain = std::move(m1k_swap_chain_);
-        m1k_swap_chain_ = std::make_unique<M1kSwapChain>(m1k_device_, extent, old_swap_chain);
-
-        if(!old_swap_chain->compareSwapFormat(*m1k_swap_chain_.get())) {
+        m1k_swap_chain_ = std::make_unique<M1kSwapChain>(m1k_device_, extent, frames_in_flight_,
+                                                         use_dynamic_rendering_, old_swap_chain);
+
+        // same formats -> same render pass object (or none with dynamic
+        // rendering), so pipelines, ImGui and secondary buffer inheritance
+        // built on getSwapChainRenderTarget() stay valid
+        if(!old_swap_chain->compareSwapFormat(*m1k_swap_chain_) ||
+           old_swap_chain->getRenderPass() != m1k_swap_chain_->getRenderPass()) {
             throw std::runtime_error("Swap chain image(or depth) format has changed!");
         }
+
+        // released after the first frame on the new swap chain completed,
+        // its presents were queued before that frame
+        m1k_device_.graphicsTimeline().deferDestroy([old_swap_chain]() {});
     }
     // ...
 }
 
+RenderTargetInfo M1kRenderer::getSwapChainRenderTarget() const {
+    RenderTargetInfo render_target{};
+    if (use_dynamic_rendering_) {
+        render_target.color_formats = {m1k_swap_chain_->getSwapChainImageFormat()};
+        render_target.depth_format = m1k_swap_chain_->getSwapChainDepthFormat();
+    } else {
+        render_target.render_pass = m1k_swap_chain_->getRenderPass();
+    }
+    return render_target;
+}
+
 void M1kRenderer::createCommandBuffers() {
-    command_buffers_.resize(M1kSwapChain::MAX_FRAMES_IN_FLIGHT);
+    command_buffers_.resize(frames_in_flight_);
 
     VkCommandBufferAllocateInfo alloc_info{};
     alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -70,10 +132,95 @@ void M1kRenderer::freeCommandBuffers() {
     command_buffers_.clear();
 }
 
+void M1kRenderer::createThreadCommandPools() {
+    QueueFamilyIndices queue_family_indices = m1k_device_.findPhysicalQueueFamilies();
+
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = queue_family_indices.graphicsFamily;
+    // no RESET_COMMAND_BUFFER_BIT: the pools are only reset as a whole
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    // workers + main thread
+    uint32_t pool_count = thread_pool_.threadCount() + 1;
+
+    thread_command_pools_.resize(frames_in_flight_);
+    for (auto& frame_pools : thread_command_pools_) {
+        frame_pools.resize(pool_count);
+        for (auto& thread_pool : frame_pools) {
+            if (vkCreateCommandPool(m1k_device_.device(), &pool_info, nullptr,
+                                    &thread_pool.command_pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create thread command pool");
+            }
+        }
+    }
+}
+
+void M1kRenderer::destroyThreadCommandPools() {
+    for (auto& frame_pools : thread_command_pools_) {
+        for (auto& thread_pool : frame_pools) {
+            // frees the secondary buffers as well
+            vkDestroyCommandPool(m1k_device_.device(), thread_pool.command_pool, nullptr);
+        }
+    }
+    thread_command_pools_.clear();
+}
+
+void M1kRenderer::resetThreadCommandPools(int frame_index) {
+    for (auto& thread_pool : thread_command_pools_[frame_index]) {
+        if (thread_pool.used_count == 0) continue;
+
+        vkResetCommandPool(m1k_device_.device(), thread_pool.command_pool, 0);
+        thread_pool.used_count = 0;
+    }
+}
+
+void M1kRenderer::createComputeResources() {
+    compute_command_buffers_.resize(frames_in_flight_);
+
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = m1k_device_.getComputeCommandPool();
+    alloc_info.commandBufferCount = static_cast<uint32_t>(compute_command_buffers_.size());
+
+    if (vkAllocateCommandBuffers(m1k_device_.device(), &alloc_info,
+                                 compute_command_buffers_.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate compute command buffers!");
+    }
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    compute_finished_semaphores_.resize(frames_in_flight_);
+    for (auto& semaphore : compute_finished_semaphores_) {
+        if (vkCreateSemaphore(m1k_device_.device(), &semaphore_info, nullptr, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute semaphore!");
+        }
+    }
+}
+
+void M1kRenderer::destroyComputeResources() {
+    for (auto semaphore : compute_finished_semaphores_) {
+        vkDestroySemaphore(m1k_device_.device(), semaphore, nullptr);
+    }
+    compute_finished_semaphores_.clear();
+
+    vkFreeCommandBuffers(m1k_device_.device(), m1k_device_.getComputeCommandPool(),
+                         static_cast<uint32_t>(compute_command_buffers_.size()),
+                         compute_command_buffers_.data());
+    compute_command_buffers_.clear();
+}
+
 VkCommandBuffer M1kRenderer::beginFrame() {
     assert(!is_frame_started_ && "Cannot call beginFrame while already in progress");
 
-    auto result = m1k_swap_chain_->acquireNextImage(&current_image_index_);
+    // the only CPU wait of the frame: this slot's previous submission
+    M1kTimeline &timeline = m1k_device_.graphicsTimeline();
+    timeline.wait(frame_timeline_values_[current_frame_index_]);
+    timeline.collectGarbage();
+
+    auto result = m1k_swap_chain_->acquireNextImage(current_frame_index_, &current_image_index_);
 
     if(result == VK_ERROR_OUT_OF_DATE_KHR) {
         recreateSwapChain();
@@ -85,6 +232,11 @@ VkCommandBuffer M1kRenderer::beginFrame() {
     }
 
     is_frame_started_ = true;
+    render_graph_.reset();
+
+    // this slot's timeline value has been waited on, so every secondary
+    // buffer recorded the last time round is done
+    resetThreadCommandPools(current_frame_index_);
 
     auto command_buffer = getCurrentCommandBuffer();
     VkCommandBufferBeginInfo begin_info{};
@@ -99,8 +251,21 @@ VkCommandBuffer M1kRenderer::beginFrame() {
 
 void M1kRenderer::endFrame() {
     assert(is_frame_started_ && "Cannot call endFrame while frame is not in progress");
+    assert(active_pass_ == ActivePass::None && "Cannot call endFrame inside a render pass");
     auto command_buffer = getCurrentCommandBuffer();
 
+    // the render pass did this through the resolve attachment's final layout
+    if (use_dynamic_rendering_) {
+        VkImageMemoryBarrier present_barrier = imageBarrier(
+            m1k_swap_chain_->getImage(current_image_index_), VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0);
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &present_barrier);
+    }
+
     if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record command buffer_");
     }
@@ -108,7 +273,23 @@ void M1kRenderer::endFrame() {
 
 void M1kRenderer::submitQueue() {
     auto command_buffer = getCurrentCommandBuffer();
-    auto result = m1k_swap_chain_->submitCommandBuffers(&command_buffer, &current_image_index_);
+
+    // uploads recorded up to now go first, the frame may draw them
+    m1k_device_.flushUploads();
+
+    VkSemaphore compute_semaphore = VK_NULL_HANDLE;
+    if (is_compute_submitted_) {
+        compute_semaphore = compute_finished_semaphores_[current_frame_index_];
+        is_compute_submitted_ = false;
+    }
+    M1kTimeline &timeline = m1k_device_.graphicsTimeline();
+    uint64_t signal_value = timeline.nextSignalValue();
+    timeline.assignPendingDeletions(signal_value);
+    frame_timeline_values_[current_frame_index_] = signal_value;
+
+    auto result = m1k_swap_chain_->submitCommandBuffers(&command_buffer, current_frame_index_,
+                                                        &current_image_index_, signal_value,
+                                                        compute_semaphore, compute_wait_stage_);
 
     if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m1k_window_.wasWindowResized()) {
         m1k_window_.resetWindowResizedFlag();
@@ -118,31 +299,191 @@ void M1kRenderer::submitQueue() {
     }
 
     is_frame_started_ = false;
-    current_frame_index_ = (current_frame_index_ + 1) % M1kSwapChain::MAX_FRAMES_IN_FLIGHT;
+    current_frame_index_ = (current_frame_index_ + 1) % frames_in_flight_;
+}
+
+void M1kRenderer::executeRenderGraph(VkCommandBuffer command_buffer) {
+    assert(is_frame_started_ && "Cannot execute the render graph if frame is not in progress");
+    assert(command_buffer == getCurrentCommandBuffer() &&
+           "Cannot execute the render graph on command buffer_ from a different frame");
+    assert(active_pass_ == ActivePass::None && "Render graph passes run outside of the swap chain pass");
+
+    render_graph_.compile();
+    render_graph_.execute(command_buffer);
 }
 
-void M1kRenderer::beginSwapChainRenderPass(VkCommandBuffer command_buffer) {
+void M1kRenderer::beginSwapChainRenderPass(VkCommandBuffer command_buffer,
+                                           VkSubpassContents contents) {
     assert(is_frame_started_ && "Cannot call beginSwapChainRenderPass if frame is not in progress");
     assert(
         command_buffer == getCurrentCommandBuffer() &&
         "Cannot begin render pass on command buffer_ from a different frame");
+    assert(active_pass_ == ActivePass::None && "Cannot begin a render pass inside another one");
 
-    VkRenderPassBeginInfo render_pass_info{};
-    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_info.renderPass = m1k_swap_chain_->getRenderPass();
-    render_pass_info.framebuffer = m1k_swap_chain_->getFrameBuffer(current_image_index_);
-
-    render_pass_info.renderArea.offset = {0, 0};
-    render_pass_info.renderArea.extent = m1k_swap_chain_->getSwapChainExtent();  // not windows extent
+    VkExtent2D extent = m1k_swap_chain_->getSwapChainExtent();  // not windows extent
 
     std::array<VkClearValue, 2> clear_values{};
     clear_values[0].color = {0.01f, 0.01f, 0.01f, 1.0f};   // attachment
     clear_values[1].depthStencil = {1.0f, 0};
-    render_pass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
-    render_pass_info.pClearValues = clear_values.data();
 
-    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    if (use_dynamic_rendering_) {
+        // everything is cleared or resolved, so the old contents are discarded;
+        // the waits on the attachment stages order us after the previous frame
+        VkImageAspectFlags depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if (hasStencilComponent(m1k_swap_chain_->getSwapChainDepthFormat())) {
+            depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+        std::array<VkImageMemoryBarrier, 3> barriers = {
+            imageBarrier(m1k_swap_chain_->getImage(current_image_index_), VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                         0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT),
+            imageBarrier(m1k_swap_chain_->getColorImage(), VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT),
+            imageBarrier(m1k_swap_chain_->getDepthImage(), depth_aspect,
+                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT)};
+        VkPipelineStageFlags attachment_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        vkCmdPipelineBarrier(command_buffer, attachment_stages, attachment_stages, 0,
+                             0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        VkImageView swap_chain_view = m1k_swap_chain_->getImageView(current_image_index_);
+
+        // MSAA color, resolved into the swap chain image
+        VkRenderingAttachmentInfo color_attachment{};
+        color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        color_attachment.clearValue = clear_values[0];
+        if (m1k_device_.maxMSAASampleCount() != VK_SAMPLE_COUNT_1_BIT) {
+            color_attachment.imageView = m1k_swap_chain_->getColorImageView();
+            color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            color_attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+            color_attachment.resolveImageView = swap_chain_view;
+            color_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        } else {
+            color_attachment.imageView = swap_chain_view;
+            color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        }
+
+        VkRenderingAttachmentInfo depth_attachment{};
+        depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        depth_attachment.imageView = m1k_swap_chain_->getDepthImageView();
+        depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depth_attachment.clearValue = clear_values[1];
+
+        VkRenderingInfo rendering_info{};
+        rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+            rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+        }
+        rendering_info.renderArea = {{0, 0}, extent};
+        rendering_info.layerCount = 1;
+        rendering_info.colorAttachmentCount = 1;
+        rendering_info.pColorAttachments = &color_attachment;
+        rendering_info.pDepthAttachment = &depth_attachment;
+
+        vkCmdBeginRendering(command_buffer, &rendering_info);
+    } else {
+        VkRenderPassBeginInfo render_pass_info{};
+        render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        render_pass_info.renderPass = m1k_swap_chain_->getRenderPass();
+        render_pass_info.framebuffer = m1k_swap_chain_->getFrameBuffer(current_image_index_);
+
+        render_pass_info.renderArea.offset = {0, 0};
+        render_pass_info.renderArea.extent = extent;
+
+        render_pass_info.clearValueCount = static_cast<uint32_t>(clear_values.size());
+        render_pass_info.pClearValues = clear_values.data();
+
+        vkCmdBeginRenderPass(command_buffer, &render_pass_info, contents);
+    }
+    active_pass_ = ActivePass::Scene;
+
+    // dynamic state can't be set on the primary buffer for secondary contents
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        return;
+    }
+
+    setViewportAndScissor(command_buffer);
+}
+
+void M1kRenderer::endSwapChainRenderPass(VkCommandBuffer command_buffer) {
+    assert(is_frame_started_ && "Cannot call endSwapChainRenderPass if frame is not in progress");
+    assert(
+        command_buffer == getCurrentCommandBuffer() &&
+        "Cannot end render pass on command buffer_ from a different frame");
+    assert(active_pass_ == ActivePass::Scene && "Swap chain render pass is not active");
+
+    if (use_dynamic_rendering_) {
+        vkCmdEndRendering(command_buffer);
+    } else {
+        vkCmdEndRenderPass(command_buffer);
+    }
+    active_pass_ = ActivePass::None;
+}
+
+void M1kRenderer::beginOverlayPass(VkCommandBuffer command_buffer, VkSubpassContents contents) {
+    assert(use_dynamic_rendering_ && "Overlay pass needs dynamic rendering, draw inside the swap chain render pass instead");
+    assert(command_buffer == getCurrentCommandBuffer() &&
+           "Cannot begin overlay pass on command buffer_ from a different frame");
+    assert(active_pass_ == ActivePass::None && "Cannot begin a render pass inside another one");
+
+    // draw over the resolved scene
+    VkImageMemoryBarrier barrier = imageBarrier(
+        m1k_swap_chain_->getImage(current_image_index_), VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkRenderingAttachmentInfo color_attachment{};
+    color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    color_attachment.imageView = m1k_swap_chain_->getImageView(current_image_index_);
+    color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+    VkRenderingInfo rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    }
+    rendering_info.renderArea = {{0, 0}, m1k_swap_chain_->getSwapChainExtent()};
+    rendering_info.layerCount = 1;
+    rendering_info.colorAttachmentCount = 1;
+    rendering_info.pColorAttachments = &color_attachment;
+
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+    active_pass_ = ActivePass::Overlay;
+
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS) {
+        return;
+    }
+
+    setViewportAndScissor(command_buffer);
+}
 
+void M1kRenderer::endOverlayPass(VkCommandBuffer command_buffer) {
+    assert(command_buffer == getCurrentCommandBuffer() &&
+           "Cannot end overlay pass on command buffer_ from a different frame");
+    assert(active_pass_ == ActivePass::Overlay && "Overlay pass is not active");
+
+    vkCmdEndRendering(command_buffer);
+    active_pass_ = ActivePass::None;
+}
+
+void M1kRenderer::setViewportAndScissor(VkCommandBuffer command_buffer) {
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -153,18 +494,161 @@ void M1kRenderer::beginSwapChainRenderPass(VkCommandBuffer command_buffer) {
     VkRect2D scissor{{0, 0}, m1k_swap_chain_->getSwapChainExtent()};
     vkCmdSetViewport(command_buffer, 0, 1, &viewport);
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+}
+
+VkCommandBuffer M1kRenderer::beginSecondaryCommandBuffer(uint32_t thread_index) {
+    assert(is_frame_started_ && "Cannot begin secondary command buffer if frame is not in progress");
+    assert(thread_index < thread_command_pools_[current_frame_index_].size() && "Invalid thread index");
+
+    auto& thread_pool = thread_command_pools_[current_frame_index_][thread_index];
+
+    // buffers survive vkResetCommandPool, so reuse before allocating
+    if (thread_pool.used_count == thread_pool.secondary_buffers.size()) {
+        VkCommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        alloc_info.commandPool = thread_pool.command_pool;
+        alloc_info.commandBufferCount = 1;
+
+        VkCommandBuffer new_buffer;
+        if (vkAllocateCommandBuffers(m1k_device_.device(), &alloc_info, &new_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate secondary command buffer");
+        }
+        thread_pool.secondary_buffers.push_back(new_buffer);
+    }
+    VkCommandBuffer command_buffer = thread_pool.secondary_buffers[thread_pool.used_count++];
+
+    assert(active_pass_ != ActivePass::None && "Secondary command buffers continue the active pass");
+
+    VkCommandBufferInheritanceInfo inheritance_info{};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+    // dynamic rendering has no render pass to inherit, only the formats
+    VkFormat color_format = m1k_swap_chain_->getSwapChainImageFormat();
+    VkCommandBufferInheritanceRenderingInfo rendering_inheritance{};
+    if (use_dynamic_rendering_) {
+        bool is_scene = active_pass_ == ActivePass::Scene;
+        rendering_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        rendering_inheritance.colorAttachmentCount = 1;
+        rendering_inheritance.pColorAttachmentFormats = &color_format;
+        rendering_inheritance.depthAttachmentFormat =
+            is_scene ? m1k_swap_chain_->getSwapChainDepthFormat() : VK_FORMAT_UNDEFINED;
+        rendering_inheritance.rasterizationSamples =
+            is_scene ? m1k_device_.maxMSAASampleCount() : VK_SAMPLE_COUNT_1_BIT;
+        inheritance_info.pNext = &rendering_inheritance;
+    } else {
+        inheritance_info.renderPass = m1k_swap_chain_->getRenderPass();
+        inheritance_info.subpass = 0;
+        inheritance_info.framebuffer = m1k_swap_chain_->getFrameBuffer(current_image_index_);
+    }
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording secondary command buffer");
+    }
 
+    // dynamic state is not inherited from the primary buffer
+    setViewportAndScissor(command_buffer);
+
+    return command_buffer;
 }
 
-void M1kRenderer::endSwapChainRenderPass(VkCommandBuffer command_buffer) {
-    assert(is_frame_started_ && "Cannot call endSwapChainRenderPass if frame is not in progress");
-    assert(
-        command_buffer == getCurrentCommandBuffer() &&
-        "Cannot end render pass on command buffer_ from a different frame");
+void M1kRenderer::endSecondaryCommandBuffer(VkCommandBuffer command_buffer) {
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record secondary command buffer");
+    }
+}
+
+void M1kRenderer::executeSecondaryCommandBuffers(
+    VkCommandBuffer primary_command_buffer,
+    const std::vector<VkCommandBuffer>& secondary_command_buffers) {
+    assert(primary_command_buffer == getCurrentCommandBuffer() &&
+           "Cannot execute secondary buffers on a primary buffer from a different frame");
+
+    if (secondary_command_buffers.empty()) return;
+
+    vkCmdExecuteCommands(primary_command_buffer,
+                         static_cast<uint32_t>(secondary_command_buffers.size()),
+                         secondary_command_buffers.data());
+}
+
+void M1kRenderer::recordSecondaryParallel(
+    VkCommandBuffer primary_command_buffer, uint32_t job_count,
+    const std::function<void(VkCommandBuffer, uint32_t)>& record) {
+    if (job_count == 0) return;
 
-    vkCmdEndRenderPass(command_buffer);
+    std::vector<VkCommandBuffer> secondary_command_buffers(job_count, VK_NULL_HANDLE);
+    thread_pool_.parallelFor(job_count, [&](uint32_t job_index, uint32_t thread_index) {
+        VkCommandBuffer command_buffer = beginSecondaryCommandBuffer(thread_index);
+        record(command_buffer, job_index);
+        endSecondaryCommandBuffer(command_buffer);
+        secondary_command_buffers[job_index] = command_buffer;
+    });
+
+    executeSecondaryCommandBuffers(primary_command_buffer, secondary_command_buffers);
 }
 
+VkCommandBuffer M1kRenderer::beginComputeCommands() {
+    assert(is_frame_started_ && "Cannot begin compute commands if frame is not in progress");
+    assert(!is_compute_submitted_ && "Compute commands already submitted this frame");
+
+    // the graphics submission of this frame slot waited on the last use,
+    // and its timeline value was waited on in beginFrame
+    VkCommandBuffer command_buffer = compute_command_buffers_[current_frame_index_];
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording compute command buffer!");
+    }
+    return command_buffer;
 }
 
+void M1kRenderer::endComputeCommands(VkCommandBuffer command_buffer,
+                                     VkPipelineStageFlags wait_stage) {
+    assert(command_buffer == compute_command_buffers_[current_frame_index_] &&
+           "Cannot end compute commands of a different frame");
 
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record compute command buffer!");
+    }
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &compute_finished_semaphores_[current_frame_index_];
+
+    // another queue, so the acquire barriers don't order it after the
+    // uploads it may read (meshlets), wait for the batch on the GPU instead
+    uint64_t upload_value = m1k_device_.flushUploads();
+    VkSemaphore timeline_semaphore = m1k_device_.graphicsTimeline().semaphore();
+    VkPipelineStageFlags upload_wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkTimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    if (!m1k_device_.graphicsTimeline().isCompleted(upload_value)) {
+        timeline_info.waitSemaphoreValueCount = 1;
+        timeline_info.pWaitSemaphoreValues = &upload_value;
+        submit_info.pNext = &timeline_info;
+        submit_info.waitSemaphoreCount = 1;
+        submit_info.pWaitSemaphores = &timeline_semaphore;
+        submit_info.pWaitDstStageMask = &upload_wait_stage;
+    }
+
+    if (vkQueueSubmit(m1k_device_.computeQueue(), 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit compute command buffer!");
+    }
+
+    is_compute_submitted_ = true;
+    compute_wait_stage_ = wait_stage;
+}
+
+}
@@ -8,25 +8,40 @@
 #include "../ui/m1k_window.hpp"
 #include "m1k_device.hpp"
 #include "m1k_swap_chain.hpp"
+#include "m1k_pipeline.hpp"
+#include "m1k_render_graph.hpp"
+#include "../utils/m1k_thread_pool.hpp"
+#include "m1k_config.hpp"
 
 // std
 #include <memory>
 #include <cassert>
+#include <functional>
 #include <vector>
 
 namespace m1k {
 
 class M1kRenderer {
    public:
-    M1kRenderer(M1kWindow &window,M1kDevice &device);
+    // use_dynamic_rendering is ignored on devices without dynamic rendering
+    M1kRenderer(M1kWindow &window, M1kDevice &device, M1kThreadPool &thread_pool,
+                uint32_t frames_in_flight = kDefaultFramesInFlight,
+                bool use_dynamic_rendering = kUseDynamicRendering);
     ~M1kRenderer();
 
     // copy version delete
     M1kRenderer(const M1kRenderer&) = delete;
     M1kRenderer &operator=(const M1kRenderer&) = delete;
 
+    // VK_NULL_HANDLE with dynamic rendering
     VkRenderPass getSwapChainRenderPass() const { return m1k_swap_chain_->getRenderPass(); }
+    VkFormat getSwapChainImageFormat() const { return m1k_swap_chain_->getSwapChainImageFormat(); }
+    VkFormat getSwapChainDepthFormat() const { return m1k_swap_chain_->getSwapChainDepthFormat(); }
+    bool usesDynamicRendering() const { return use_dynamic_rendering_; }
+    // what pipelines drawing in the swap chain pass are built against
+    RenderTargetInfo getSwapChainRenderTarget() const;
     float getAspectRatio() const { return m1k_swap_chain_->extentAspectRatio(); }
+    VkExtent2D getSwapChainExtent() const { return m1k_swap_chain_->getSwapChainExtent(); }
     bool isFrameInProgress() const { return is_frame_started_; }
 
     VkCommandBuffer getCurrentCommandBuffer() const {
@@ -39,26 +54,96 @@ class M1kRenderer {
         return current_frame_index_;
     }
 
+    // size of every per-frame resource array
+    uint32_t getFramesInFlight() const { return frames_in_flight_; }
+
+    // the main thread records with the pools after the workers' ones
+    uint32_t getMainThreadIndex() const { return thread_pool_.threadCount(); }
+
     VkCommandBuffer beginFrame();
     void endFrame();
     void submitQueue();
 
-    void beginSwapChainRenderPass(VkCommandBuffer command_buffer);
+    // offscreen passes of the current frame, reset in beginFrame. Declare
+    // them, then executeRenderGraph() outside of the swap chain pass.
+    M1kRenderGraph &getRenderGraph() { return render_graph_; }
+    void executeRenderGraph(VkCommandBuffer command_buffer);
+
+    void beginSwapChainRenderPass(VkCommandBuffer command_buffer,
+                                  VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void endSwapChainRenderPass(VkCommandBuffer command_buffer);
 
+    // dynamic rendering only: single sampled pass loading the resolved swap
+    // chain image, for drawing on top of the scene (UI) without depth
+    void beginOverlayPass(VkCommandBuffer command_buffer,
+                          VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+    void endOverlayPass(VkCommandBuffer command_buffer);
+
+    // secondary command buffers inside the current swap chain (or overlay)
+    // pass, thread_index selects the per-thread pool of the current frame
+    VkCommandBuffer beginSecondaryCommandBuffer(uint32_t thread_index);
+    void endSecondaryCommandBuffer(VkCommandBuffer command_buffer);
+    void executeSecondaryCommandBuffers(VkCommandBuffer primary_command_buffer,
+                                        const std::vector<VkCommandBuffer>& secondary_command_buffers);
+
+    // records job_count secondary buffers on the worker threads, then
+    // executes them in job order from the primary buffer
+    void recordSecondaryParallel(
+        VkCommandBuffer primary_command_buffer, uint32_t job_count,
+        const std::function<void(VkCommandBuffer, uint32_t)>& record);
+
+    // compute work of the current frame, submitted to the async compute queue
+    // at endComputeCommands() so it overlaps the previous frame's graphics.
+    // this frame's graphics submission waits on it at wait_stage. Buffers
+    // written here and read by graphics need share_with_compute and one copy
+    // per frame in flight.
+    VkCommandBuffer beginComputeCommands();
+    void endComputeCommands(VkCommandBuffer command_buffer,
+                            VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+
    private:
+    struct ThreadCommandPool {
+        VkCommandPool command_pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> secondary_buffers{};
+        uint32_t used_count = 0;
+    };
+
     void createCommandBuffers();
     void freeCommandBuffers();
+    void createThreadCommandPools();
+    void destroyThreadCommandPools();
+    void resetThreadCommandPools(int frame_index);
+    void createComputeResources();
+    void destroyComputeResources();
     void recreateSwapChain();
+    void setViewportAndScissor(VkCommandBuffer command_buffer);
+
+    enum class ActivePass { None, Scene, Overlay };
 
     M1kWindow& m1k_window_;
     M1kDevice& m1k_device_;
+    M1kThreadPool& thread_pool_;
+    uint32_t frames_in_flight_;
+    bool use_dynamic_rendering_;
     std::unique_ptr<M1kSwapChain> m1k_swap_chain_;
+    M1kRenderGraph render_graph_;
     std::vector<VkCommandBuffer> command_buffers_;
+    // graphics timeline value signaled by the last submission of each frame slot
+    std::vector<uint64_t> frame_timeline_values_;
+
+    // [frame in flight][thread], reset wholesale every frame
+    std::vector<std::vector<ThreadCommandPool>> thread_command_pools_;
+
+    std::vector<VkCommandBuffer> compute_command_buffers_;
+    std::vector<VkSemaphore> compute_finished_semaphores_;
+    bool is_compute_submitted_{false};
+    VkPipelineStageFlags compute_wait_stage_{0};
 
     uint32_t current_image_index_;
     int current_frame_index_{0};
     bool is_frame_started_{false};
+    // secondary buffers inherit the attachments of the pass they run in
+    ActivePass active_pass_{ActivePass::None};
 };
 
 }
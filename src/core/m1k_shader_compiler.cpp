@@ -0,0 +1,141 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_shader_compiler.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#ifndef M1K_GLSLC_EXECUTABLE
+#define M1K_GLSLC_EXECUTABLE "glslc"
+#endif
+
+namespace m1k {
+
+namespace {
+
+// passed to every compile and part of the cache key, the Shaders target
+// builds with none
+constexpr const char* kGlslcFlags = "";
+
+// runs command with stdout and stderr in log_path, output gets what it printed
+bool runCommand(std::string command, const std::filesystem::path& log_path,
+                std::string& output) {
+    command += " > \"" + log_path.string() + "\" 2>&1";
+#ifdef _WIN32
+    // cmd drops the outer quotes of a command line starting with one
+    command = "\"" + command + "\"";
+#endif
+    bool is_success = std::system(command.c_str()) == 0;
+
+    char* log_data = nullptr;
+    size_t log_size = 0;
+    if (readFileBinary(log_path.string(), &log_data, &log_size)) {
+        std::unique_ptr<char[]> log{log_data};
+        output.assign(log.get(), log_size);
+    }
+    std::error_code error;
+    std::filesystem::remove(log_path, error);
+    return is_success;
+}
+
+// writes to a temporary next to target first, so target is replaced whole
+bool copyFileAtomic(const std::filesystem::path& source, const std::filesystem::path& target) {
+    std::filesystem::path temporary_path = target;
+    temporary_path += ".tmp";
+
+    std::error_code error;
+    std::filesystem::copy_file(source, temporary_path,
+                               std::filesystem::copy_options::overwrite_existing, error);
+    if (!error) std::filesystem::rename(temporary_path, target, error);
+    if (error) {
+        std::cerr << "M1k::ERR--------Failed to write " << target.string() << ": "
+                  << error.message() << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+}
+
+M1kShaderCompiler::M1kShaderCompiler(const std::string& cache_directory)
+    : cache_directory_(cache_directory) {
+    createDirectoryIfNotExists(cache_directory_);
+
+    // another compiler or other flags make other binaries from the same source
+    std::string version;
+    std::string command = std::string("\"") + M1K_GLSLC_EXECUTABLE + "\" --version";
+    if (!runCommand(command, std::filesystem::path(cache_directory_) / "glslc_version.log",
+                    version)) {
+        std::cout << "M1K::WARN========Failed to query the glslc version, the shader cache "
+                     "only tells compilers apart by path." << std::endl;
+        version.clear();
+    }
+    std::string executable = M1K_GLSLC_EXECUTABLE;
+    std::string flags = kGlslcFlags;
+    compiler_hash_ = fnv1a(executable.data(), executable.size());
+    compiler_hash_ = fnv1a(version.data(), version.size(), compiler_hash_);
+    compiler_hash_ = fnv1a(flags.data(), flags.size(), compiler_hash_);
+}
+
+bool M1kShaderCompiler::compile(const std::string& source_path,
+                                const std::string& binary_path) const {
+    char* source_data = nullptr;
+    size_t source_size = 0;
+    if (!readFileBinary(source_path, &source_data, &source_size)) {
+        std::cerr << "M1k::ERR--------Failed to read shader source " << source_path << std::endl;
+        return false;
+    }
+    std::unique_ptr<char[]> source{source_data};
+
+    // glslc picks the stage from the extension, it is part of the name
+    std::filesystem::path source_file(source_path);
+    std::ostringstream cache_name;
+    cache_name << std::hex << std::setw(16) << std::setfill('0')
+               << fnv1a(source.get(), source_size, compiler_hash_) << "_"
+               << source_file.filename().string() << ".spv";
+    std::filesystem::path cache_path = std::filesystem::path(cache_directory_) / cache_name.str();
+
+    if (std::filesystem::exists(cache_path)) {
+        std::cout << "M1k::INFO~~~~~~~~Shader " << source_file.filename().string()
+                  << " found in the shader cache" << std::endl;
+        return copyFileAtomic(cache_path, binary_path);
+    }
+
+    std::filesystem::path temporary_path = cache_path;
+    temporary_path += ".tmp";
+    std::string command = std::string("\"") + M1K_GLSLC_EXECUTABLE + "\" " + kGlslcFlags +
+                          " \"" + source_path + "\" -o \"" + temporary_path.string() + "\"";
+    std::filesystem::path log_path = cache_path;
+    log_path += ".log";
+
+    std::error_code error;
+    std::string output;
+    if (!runCommand(command, log_path, output)) {
+        std::cerr << "M1k::ERR--------Failed to compile shader " << source_path << ":\n"
+                  << output << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    std::filesystem::rename(temporary_path, cache_path, error);
+    if (error) {
+        std::cerr << "M1k::ERR--------Failed to write " << cache_path.string() << ": "
+                  << error.message() << std::endl;
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+
+    std::cout << "M1k::INFO~~~~~~~~Compiled shader " << source_file.filename().string()
+              << std::endl;
+    return copyFileAtomic(cache_path, binary_path);
+}
+
+}
@@ -0,0 +1,39 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+namespace m1k {
+
+/*
+ * Compiles one GLSL source to SPIR-V at runtime with glslc, the compiler the
+ * Shaders target uses at build time.
+ *
+ * Results are kept under kShaderCacheDirectory named by a hash of the source,
+ * the glslc path and version and the compile flags, compiling a source seen
+ * before (e.g. an edit undone) is a file copy, a new compiler misses. The
+ * binary the pipelines read is replaced in one rename, a pipeline built at
+ * the same time never reads a half written file.
+ *
+ * No state besides the cache directory, safe to call from any thread for
+ * different sources.
+ */
+class M1kShaderCompiler {
+   public:
+    explicit M1kShaderCompiler(const std::string& cache_directory);
+
+    // false if the source can't be read or doesn't compile, the binary is
+    // left as it was then. The error carries glslc's output.
+    bool compile(const std::string& source_path, const std::string& binary_path) const;
+
+   private:
+    std::string cache_directory_;
+    uint64_t compiler_hash_ = 0;    // seeds the source hash of the cache names
+};
+
+}
@@ -0,0 +1,139 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_shader_hot_reload.hpp"
+#include "m1k_config.hpp"
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+namespace m1k {
+
+namespace {
+
+bool isShaderSource(const std::filesystem::path& path) {
+    auto extension = path.extension();
+    return extension == ".vert" || extension == ".frag" || extension == ".comp";
+}
+
+}
+
+M1kShaderHotReload::M1kShaderHotReload(M1kPipelineBuildQueue& build_queue,
+                                       const std::string& source_directory,
+                                       const std::string& binary_directory)
+    : build_queue_(build_queue), compiler_(kShaderCacheDirectory),
+      source_directory_(source_directory), binary_directory_(binary_directory) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(source_directory_, error)) {
+        std::cout << "M1K::WARN========Shader sources not found at " << source_directory_
+                  << ", shader hot reload disabled." << std::endl;
+        is_watching_ = false;
+        return;
+    }
+    // the first scan only records the write times
+    scanSources();
+    changed_sources_.clear();
+    std::cout << "M1K::INFO~~~~~~~~Watching " << write_times_.size() << " shaders in "
+              << source_directory_ << std::endl;
+}
+
+M1kShaderHotReload::~M1kShaderHotReload() {
+    if (job_.valid()) job_.wait();
+}
+
+void M1kShaderHotReload::update(float frame_time) {
+    if (!is_watching_) return;
+
+    if (job_.valid() &&
+        job_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        finishJob();
+    }
+
+    time_since_scan_ += frame_time;
+    if (time_since_scan_ < kShaderWatchInterval) return;
+    time_since_scan_ = 0.0f;
+
+    scanSources();
+    if (!job_.valid() && !changed_sources_.empty()) {
+        startJob();
+    }
+}
+
+void M1kShaderHotReload::scanSources() {
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(source_directory_, error)) {
+        if (!entry.is_regular_file(error) || !isShaderSource(entry.path())) continue;
+
+        auto write_time = entry.last_write_time(error);
+        if (error) continue;
+
+        std::string source_path = entry.path().string();
+        auto found = write_times_.find(source_path);
+        if (found == write_times_.end()) {
+            // new file, no pipeline can use it yet
+            write_times_.emplace(source_path, write_time);
+        } else if (found->second != write_time) {
+            found->second = write_time;
+            changed_sources_.insert(source_path);
+        }
+    }
+}
+
+void M1kShaderHotReload::startJob() {
+    uint32_t rebuild_count = 0;
+    for (const auto& source_path : changed_sources_) {
+        ShaderJob shader{};
+        shader.source_path = source_path;
+        shader.binary_path = binary_directory_ + "/" +
+            std::filesystem::path(source_path).filename().string() + ".spv";
+        shader.rebuilds = build_queue_.prepareRebuild(shader.binary_path);
+        rebuild_count += static_cast<uint32_t>(
+            std::count_if(shader.rebuilds.begin(), shader.rebuilds.end(),
+                          [](const M1kPipelineRebuild& rebuild) { return bool(rebuild.build); }));
+        job_shaders_.push_back(std::move(shader));
+    }
+    changed_sources_.clear();
+
+    std::cout << "M1K::INFO~~~~~~~~Reloading " << job_shaders_.size() << " shaders, "
+              << rebuild_count << " pipelines" << std::endl;
+
+    job_ = std::async(std::launch::async, [this]() {
+        uint32_t built_count = 0;
+        for (auto& shader : job_shaders_) {
+            if (!compiler_.compile(shader.source_path, shader.binary_path)) continue;
+
+            for (auto& rebuild : shader.rebuilds) {
+                if (!rebuild.build) continue;
+                try {
+                    rebuild.build();
+                    ++built_count;
+                } catch (const std::exception& e) {
+                    std::cerr << "M1k::ERR--------Failed to rebuild a pipeline of "
+                              << shader.binary_path << ": " << e.what() << std::endl;
+                }
+            }
+        }
+        return built_count;
+    });
+}
+
+void M1kShaderHotReload::finishJob() {
+    uint32_t built_count = job_.get();
+    // rebuilds that failed have nothing to swap in and keep the old pipeline
+    for (auto& shader : job_shaders_) {
+        for (auto& rebuild : shader.rebuilds) {
+            rebuild.commit();
+        }
+    }
+    job_shaders_.clear();
+
+    reloaded_count_ += built_count;
+    std::cout << "M1K::INFO~~~~~~~~Swapped in " << built_count << " reloaded pipelines"
+              << std::endl;
+}
+
+}
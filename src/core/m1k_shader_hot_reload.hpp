@@ -0,0 +1,83 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_pipeline_build_queue.hpp"
+#include "m1k_shader_compiler.hpp"
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Watches the shader sources while the engine runs and swaps in the
+ * pipelines of a changed shader without stopping the frame loop.
+ *
+ * update() polls the write times every kShaderWatchInterval. The pipelines
+ * reading a changed shader are looked up in the build queue, then one
+ * background job compiles the sources (M1kShaderCompiler) and creates the
+ * new pipelines while frames keep rendering with the old ones. The finished
+ * pipelines are swapped in by a later update() between two frames, the old
+ * ones retire through the graphics timeline.
+ *
+ * A shader that doesn't compile keeps its old binary and pipelines, the
+ * errors are in the log. Edits made while a job runs go into the next one.
+ *
+ * The job runs on its own thread, not the thread pool, so a long compile
+ * doesn't take a worker from the frame's command recording.
+ */
+class M1kShaderHotReload {
+   public:
+    M1kShaderHotReload(M1kPipelineBuildQueue& build_queue,
+                       const std::string& source_directory,
+                       const std::string& binary_directory);
+    // waits for a running job, its pipelines are dropped
+    ~M1kShaderHotReload();
+
+    M1kShaderHotReload(const M1kShaderHotReload&) = delete;
+    M1kShaderHotReload& operator=(const M1kShaderHotReload&) = delete;
+
+    // main thread, before the frame is recorded
+    void update(float frame_time);
+
+    bool isWatching() const { return is_watching_; }
+    bool isReloading() const { return job_.valid(); }
+    uint32_t getReloadedCount() const { return reloaded_count_; }
+
+   private:
+    struct ShaderJob {
+        std::string source_path;
+        std::string binary_path;
+        std::vector<M1kPipelineRebuild> rebuilds;
+    };
+
+    void scanSources();
+    void startJob();
+    void finishJob();
+
+    M1kPipelineBuildQueue& build_queue_;
+    M1kShaderCompiler compiler_;
+    std::string source_directory_;
+    std::string binary_directory_;
+    bool is_watching_ = true;
+
+    float time_since_scan_ = 0.0f;
+    std::unordered_map<std::string, std::filesystem::file_time_type> write_times_{};
+    std::set<std::string> changed_sources_{};
+
+    // owned by the job thread until job_ is ready
+    std::vector<ShaderJob> job_shaders_{};
+    std::future<uint32_t> job_{};
+    uint32_t reloaded_count_ = 0;
+};
+
+}
@@ -0,0 +1,471 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_shader_reflection.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace m1k {
+
+namespace {
+
+// the parts of the SPIR-V specification reflection needs
+constexpr uint32_t kSpirvMagic = 0x07230203;
+constexpr size_t kSpirvHeaderWords = 5;
+
+constexpr uint32_t kOpEntryPoint = 15;
+constexpr uint32_t kOpTypeVoid = 19;
+constexpr uint32_t kOpTypeBool = 20;
+constexpr uint32_t kOpTypeInt = 21;
+constexpr uint32_t kOpTypeFloat = 22;
+constexpr uint32_t kOpTypeVector = 23;
+constexpr uint32_t kOpTypeMatrix = 24;
+constexpr uint32_t kOpTypeImage = 25;
+constexpr uint32_t kOpTypeSampler = 26;
+constexpr uint32_t kOpTypeSampledImage = 27;
+constexpr uint32_t kOpTypeArray = 28;
+constexpr uint32_t kOpTypeRuntimeArray = 29;
+constexpr uint32_t kOpTypeStruct = 30;
+constexpr uint32_t kOpTypePointer = 32;
+constexpr uint32_t kOpTypeForwardPointer = 39;
+constexpr uint32_t kOpConstant = 43;
+constexpr uint32_t kOpSpecConstant = 50;
+constexpr uint32_t kOpVariable = 59;
+constexpr uint32_t kOpDecorate = 71;
+constexpr uint32_t kOpMemberDecorate = 72;
+constexpr uint32_t kOpTypeAccelerationStructure = 5341;
+
+constexpr uint32_t kDecorationBlock = 2;
+constexpr uint32_t kDecorationBufferBlock = 3;
+constexpr uint32_t kDecorationArrayStride = 6;
+constexpr uint32_t kDecorationMatrixStride = 7;
+constexpr uint32_t kDecorationBuiltIn = 11;
+constexpr uint32_t kDecorationLocation = 30;
+constexpr uint32_t kDecorationBinding = 33;
+constexpr uint32_t kDecorationDescriptorSet = 34;
+constexpr uint32_t kDecorationOffset = 35;
+
+constexpr uint32_t kStorageUniformConstant = 0;
+constexpr uint32_t kStorageInput = 1;
+constexpr uint32_t kStorageUniform = 2;
+constexpr uint32_t kStoragePushConstant = 9;
+constexpr uint32_t kStorageStorageBuffer = 12;
+
+constexpr uint32_t kDimBuffer = 5;
+constexpr uint32_t kDimSubpassData = 6;
+
+constexpr uint32_t kNone = ~0u;
+
+uint32_t opcode(const uint32_t *instruction) { return instruction[0] & 0xffffu; }
+uint32_t wordCount(const uint32_t *instruction) { return instruction[0] >> 16; }
+
+VkShaderStageFlags stageOf(uint32_t execution_model) {
+    switch (execution_model) {
+        case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+        case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+        case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+        case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+        case 5364: return VK_SHADER_STAGE_TASK_BIT_EXT;
+        case 5365: return VK_SHADER_STAGE_MESH_BIT_EXT;
+        default: return 0;
+    }
+}
+
+struct Decorations {
+    uint32_t set = 0;
+    uint32_t binding = kNone;
+    uint32_t location = kNone;
+    uint32_t array_stride = 0;
+    bool is_builtin = false;
+    bool is_block = false;
+    bool is_buffer_block = false;
+};
+
+struct MemberDecorations {
+    uint32_t offset = 0;
+    uint32_t matrix_stride = 0;
+};
+
+// ids of one module indexed by what defines and decorates them, the
+// instructions point into the code being reflected
+class SpirvModule {
+   public:
+    SpirvModule(const uint32_t *code, size_t word_count) {
+        if (word_count < kSpirvHeaderWords || code[0] != kSpirvMagic) {
+            throw std::runtime_error("M1k::ERR--------Not a SPIR-V module!");
+        }
+
+        size_t offset = kSpirvHeaderWords;
+        while (offset < word_count) {
+            const uint32_t *instruction = code + offset;
+            uint32_t count = wordCount(instruction);
+            if (count == 0 || offset + count > word_count) {
+                throw std::runtime_error("M1k::ERR--------Truncated SPIR-V module!");
+            }
+
+            uint32_t op = opcode(instruction);
+            if (op == kOpEntryPoint) {
+                if (execution_model_ == kNone) execution_model_ = instruction[1];
+            } else if (op == kOpDecorate) {
+                decorate(decorations_[instruction[1]], instruction[2],
+                         count > 3 ? instruction[3] : 0);
+            } else if (op == kOpMemberDecorate) {
+                auto &members = member_decorations_[instruction[1]];
+                if (members.size() <= instruction[2]) members.resize(instruction[2] + 1);
+                decorateMember(members[instruction[2]], instruction[3],
+                               count > 4 ? instruction[4] : 0);
+            } else if (op == kOpConstant || op == kOpSpecConstant) {
+                definitions_[instruction[2]] = instruction;
+            } else if (op == kOpVariable) {
+                definitions_[instruction[2]] = instruction;
+                variables_.push_back(instruction);
+            } else if ((op >= kOpTypeVoid && op < kOpTypeForwardPointer) ||
+                       op == kOpTypeAccelerationStructure) {
+                definitions_[instruction[1]] = instruction;
+            }
+            offset += count;
+        }
+    }
+
+    VkShaderStageFlags stage() const { return stageOf(execution_model_); }
+    const std::vector<const uint32_t *> &variables() const { return variables_; }
+
+    const uint32_t *find(uint32_t id) const {
+        auto found = definitions_.find(id);
+        return found != definitions_.end() ? found->second : nullptr;
+    }
+
+    const Decorations &decorationsOf(uint32_t id) const {
+        static const Decorations kUndecorated{};
+        auto found = decorations_.find(id);
+        return found != decorations_.end() ? found->second : kUndecorated;
+    }
+
+    // specialization constants count with their default
+    uint32_t constantValue(uint32_t id) const {
+        const uint32_t *constant = find(id);
+        if (constant == nullptr || wordCount(constant) < 4) return 1;
+        return constant[3];
+    }
+
+    // the element type under any arrays, their lengths multiplied into count,
+    // 0 for a runtime sized one
+    uint32_t unwrapArrays(uint32_t type_id, uint32_t &count) const {
+        count = 1;
+        const uint32_t *type = find(type_id);
+        while (type != nullptr) {
+            if (opcode(type) == kOpTypeArray) {
+                count *= constantValue(type[3]);
+            } else if (opcode(type) == kOpTypeRuntimeArray) {
+                count = 0;
+            } else {
+                break;
+            }
+            type_id = type[2];
+            type = find(type_id);
+        }
+        return type_id;
+    }
+
+    VkDescriptorType descriptorType(uint32_t type_id, uint32_t storage_class) const {
+        const uint32_t *type = find(type_id);
+        if (type == nullptr) return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+
+        if (storage_class == kStorageStorageBuffer) return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        if (storage_class == kStorageUniform) {
+            // std430 buffers of older SPIR-V are Uniform BufferBlocks
+            return decorationsOf(type_id).is_buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                                                          : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        }
+
+        switch (opcode(type)) {
+            case kOpTypeSampledImage:
+                return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            case kOpTypeSampler:
+                return VK_DESCRIPTOR_TYPE_SAMPLER;
+            case kOpTypeAccelerationStructure:
+                return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+            case kOpTypeImage: {
+                uint32_t dim = type[3];
+                bool is_storage = type[7] == 2;
+                if (dim == kDimSubpassData) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                if (dim == kDimBuffer) {
+                    return is_storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                      : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                }
+                return is_storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                  : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+            }
+            default:
+                return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+        }
+    }
+
+    // bytes a block member of the type spans, by its explicit layout
+    uint32_t typeSize(uint32_t type_id) const {
+        const uint32_t *type = find(type_id);
+        if (type == nullptr) return 0;
+
+        switch (opcode(type)) {
+            case kOpTypeBool:
+                return 4;
+            case kOpTypeInt:
+            case kOpTypeFloat:
+                return type[2] / 8;
+            case kOpTypeVector:
+            case kOpTypeMatrix:
+                // a matrix without a MatrixStride, columns packed
+                return typeSize(type[2]) * type[3];
+            case kOpTypeArray: {
+                uint32_t stride = decorationsOf(type_id).array_stride;
+                return (stride != 0 ? stride : typeSize(type[2])) * constantValue(type[3]);
+            }
+            case kOpTypeStruct: {
+                auto found = member_decorations_.find(type_id);
+                uint32_t size = 0;
+                for (uint32_t i = 2; i < wordCount(type); ++i) {
+                    uint32_t member_index = i - 2;
+                    MemberDecorations member{};
+                    if (found != member_decorations_.end() &&
+                        member_index < found->second.size()) {
+                        member = found->second[member_index];
+                    }
+
+                    uint32_t member_size = typeSize(type[i]);
+                    const uint32_t *member_type = find(type[i]);
+                    if (member_type != nullptr && opcode(member_type) == kOpTypeMatrix &&
+                        member.matrix_stride != 0) {
+                        member_size = member.matrix_stride * member_type[3];
+                    }
+                    size = std::max(size, member.offset + member_size);
+                }
+                return size;
+            }
+            default:
+                return 0;
+        }
+    }
+
+    // one entry per location the input takes
+    void addVertexInputs(uint32_t type_id, uint32_t location,
+                         std::vector<M1kShaderReflection::VertexInput> &inputs) const {
+        const uint32_t *type = find(type_id);
+        if (type == nullptr) return;
+
+        switch (opcode(type)) {
+            case kOpTypeInt:
+            case kOpTypeFloat:
+                inputs.push_back({location, vertexFormat(type, 1)});
+                break;
+            case kOpTypeVector: {
+                const uint32_t *component = find(type[2]);
+                if (component != nullptr) {
+                    inputs.push_back({location, vertexFormat(component, type[3])});
+                }
+                break;
+            }
+            case kOpTypeMatrix:
+                for (uint32_t column = 0; column < type[3]; ++column) {
+                    addVertexInputs(type[2], location + column, inputs);
+                }
+                break;
+            case kOpTypeArray: {
+                size_t first = inputs.size();
+                addVertexInputs(type[2], location, inputs);
+                uint32_t element_locations = static_cast<uint32_t>(inputs.size() - first);
+                for (uint32_t element = 1; element < constantValue(type[3]); ++element) {
+                    addVertexInputs(type[2], location + element * element_locations, inputs);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+   private:
+    static void decorate(Decorations &decorations, uint32_t decoration, uint32_t value) {
+        switch (decoration) {
+            case kDecorationDescriptorSet: decorations.set = value; break;
+            case kDecorationBinding: decorations.binding = value; break;
+            case kDecorationLocation: decorations.location = value; break;
+            case kDecorationArrayStride: decorations.array_stride = value; break;
+            case kDecorationBuiltIn: decorations.is_builtin = true; break;
+            case kDecorationBlock: decorations.is_block = true; break;
+            case kDecorationBufferBlock: decorations.is_buffer_block = true; break;
+            default: break;
+        }
+    }
+
+    static void decorateMember(MemberDecorations &member, uint32_t decoration, uint32_t value) {
+        if (decoration == kDecorationOffset) member.offset = value;
+        if (decoration == kDecorationMatrixStride) member.matrix_stride = value;
+    }
+
+    // 32 bit components only, the engine has no other vertex inputs
+    static VkFormat vertexFormat(const uint32_t *scalar, uint32_t component_count) {
+        static constexpr VkFormat kFloatFormats[] = {
+            VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+            VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+        static constexpr VkFormat kSintFormats[] = {
+            VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT,
+            VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+        static constexpr VkFormat kUintFormats[] = {
+            VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT,
+            VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+
+        if (scalar[2] != 32 || component_count == 0 || component_count > 4) {
+            return VK_FORMAT_UNDEFINED;
+        }
+        if (opcode(scalar) == kOpTypeFloat) return kFloatFormats[component_count - 1];
+        bool is_signed = scalar[3] != 0;
+        return is_signed ? kSintFormats[component_count - 1] : kUintFormats[component_count - 1];
+    }
+
+    uint32_t execution_model_ = kNone;
+    std::unordered_map<uint32_t, const uint32_t *> definitions_{};
+    std::unordered_map<uint32_t, Decorations> decorations_{};
+    std::unordered_map<uint32_t, std::vector<MemberDecorations>> member_decorations_{};
+    std::vector<const uint32_t *> variables_{};
+};
+
+}
+
+M1kShaderReflection::M1kShaderReflection(const uint32_t *code, size_t word_count) {
+    SpirvModule module{code, word_count};
+    stages_ = module.stage();
+
+    for (const uint32_t *variable : module.variables()) {
+        const uint32_t *pointer = module.find(variable[1]);
+        if (pointer == nullptr || opcode(pointer) != kOpTypePointer) continue;
+
+        uint32_t type_id = pointer[3];
+        uint32_t storage_class = variable[3];
+        const Decorations &decorations = module.decorationsOf(variable[2]);
+
+        if (storage_class == kStorageUniformConstant || storage_class == kStorageUniform ||
+            storage_class == kStorageStorageBuffer) {
+            if (decorations.binding == kNone) continue;
+
+            uint32_t count = 1;
+            uint32_t element_id = module.unwrapArrays(type_id, count);
+            VkDescriptorType descriptor_type = module.descriptorType(element_id, storage_class);
+            if (descriptor_type == VK_DESCRIPTOR_TYPE_MAX_ENUM) continue;
+
+            VkDescriptorSetLayoutBinding binding{};
+            binding.binding = decorations.binding;
+            binding.descriptorType = descriptor_type;
+            binding.descriptorCount = count;
+            binding.stageFlags = stages_;
+            bindings_[{decorations.set, decorations.binding}] = binding;
+        } else if (storage_class == kStoragePushConstant) {
+            push_constant_size_ = std::max(push_constant_size_, module.typeSize(type_id));
+            push_constant_stages_ |= stages_;
+        } else if (storage_class == kStorageInput && stages_ == VK_SHADER_STAGE_VERTEX_BIT) {
+            // gl_VertexIndex and friends have no location
+            if (decorations.location == kNone || decorations.is_builtin) continue;
+            module.addVertexInputs(type_id, decorations.location, vertex_inputs_);
+        }
+    }
+
+    std::sort(vertex_inputs_.begin(), vertex_inputs_.end(),
+              [](const VertexInput &a, const VertexInput &b) { return a.location < b.location; });
+}
+
+M1kShaderReflection M1kShaderReflection::fromFile(const std::string &filepath) {
+    char *data = nullptr;
+    size_t size = 0;
+    if (!readFileBinary(filepath, &data, &size)) {
+        throw std::runtime_error("M1k::ERR--------Failed to read shader " + filepath);
+    }
+    std::unique_ptr<char[]> file{data};
+    if (size % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("M1k::ERR--------Not a SPIR-V module: " + filepath);
+    }
+
+    // the file buffer has no alignment guarantee for words
+    std::vector<uint32_t> code(size / sizeof(uint32_t));
+    std::memcpy(code.data(), data, size);
+    return M1kShaderReflection{code.data(), code.size()};
+}
+
+M1kShaderReflection M1kShaderReflection::fromFiles(const std::vector<std::string> &filepaths) {
+    M1kShaderReflection reflection{};
+    for (const auto &filepath : filepaths) {
+        reflection.merge(fromFile(filepath));
+    }
+    return reflection;
+}
+
+void M1kShaderReflection::merge(const M1kShaderReflection &other) {
+    stages_ |= other.stages_;
+
+    for (const auto &entry : other.bindings_) {
+        auto found = bindings_.find(entry.first);
+        if (found == bindings_.end()) {
+            bindings_.emplace(entry.first, entry.second);
+            continue;
+        }
+
+        auto &binding = found->second;
+        if (binding.descriptorType != entry.second.descriptorType) {
+            throw std::runtime_error(
+                "M1k::ERR--------Shaders disagree on the descriptor type of set " +
+                std::to_string(entry.first.first) + " binding " +
+                std::to_string(entry.first.second));
+        }
+        binding.stageFlags |= entry.second.stageFlags;
+        // a runtime sized array stays one
+        binding.descriptorCount =
+            (binding.descriptorCount == 0 || entry.second.descriptorCount == 0)
+                ? 0 : std::max(binding.descriptorCount, entry.second.descriptorCount);
+    }
+
+    push_constant_size_ = std::max(push_constant_size_, other.push_constant_size_);
+    push_constant_stages_ |= other.push_constant_stages_;
+
+    for (const auto &input : other.vertex_inputs_) {
+        bool is_known = std::any_of(vertex_inputs_.begin(), vertex_inputs_.end(),
+                                    [&](const VertexInput &known) {
+                                        return known.location == input.location;
+                                    });
+        if (!is_known) vertex_inputs_.push_back(input);
+    }
+    std::sort(vertex_inputs_.begin(), vertex_inputs_.end(),
+              [](const VertexInput &a, const VertexInput &b) { return a.location < b.location; });
+}
+
+std::vector<VkDescriptorSetLayoutBinding> M1kShaderReflection::getSetBindings(uint32_t set) const {
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    // the map is ordered by set, then binding
+    for (const auto &entry : bindings_) {
+        if (entry.first.first == set) bindings.push_back(entry.second);
+    }
+    return bindings;
+}
+
+uint32_t M1kShaderReflection::getSetCount() const {
+    return bindings_.empty() ? 0 : bindings_.rbegin()->first.first + 1;
+}
+
+std::vector<VkPushConstantRange> M1kShaderReflection::getPushConstantRanges() const {
+    if (push_constant_size_ == 0) return {};
+
+    VkPushConstantRange range{};
+    range.stageFlags = push_constant_stages_;
+    range.offset = 0;
+    // sizes are multiples of 4
+    range.size = (push_constant_size_ + 3u) & ~3u;
+    return {range};
+}
+
+}
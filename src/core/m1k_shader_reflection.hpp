@@ -0,0 +1,73 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+// libs
+#include <vulkan/vulkan.h>
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * What a SPIR-V module expects from its pipeline: the descriptor bindings of
+ * every set, the push constant block and, for vertex shaders, the input
+ * locations. Read straight from the binary, so the C++ side can't drift from
+ * the GLSL.
+ *
+ * Reflections of several shaders merge, a binding declared by two stages
+ * ends up visible to both. Merge the shaders of every pipeline sharing a set
+ * layout to get that layout, a set layout has to match exactly between the
+ * pipelines it is bound with.
+ *
+ * Only the parts of SPIR-V the engine's shaders use are understood: no
+ * specialization constant array sizes besides their default, no 64 bit
+ * vertex inputs.
+ */
+class M1kShaderReflection {
+   public:
+    struct VertexInput {
+        uint32_t location;
+        VkFormat format;
+    };
+
+    M1kShaderReflection() = default;
+    M1kShaderReflection(const uint32_t* code, size_t word_count);
+
+    static M1kShaderReflection fromFile(const std::string& filepath);
+    static M1kShaderReflection fromFiles(const std::vector<std::string>& filepaths);
+
+    // throws if both declare a binding with different descriptor types
+    void merge(const M1kShaderReflection& other);
+
+    VkShaderStageFlags getStages() const { return stages_; }
+
+    // sorted by binding, a descriptorCount of 0 is a runtime sized array
+    std::vector<VkDescriptorSetLayoutBinding> getSetBindings(uint32_t set) const;
+    // highest set used + 1
+    uint32_t getSetCount() const;
+
+    // one range from 0 over every stage declaring a block, empty without any
+    std::vector<VkPushConstantRange> getPushConstantRanges() const;
+
+    // vertex stage only, a matrix takes one location per column
+    const std::vector<VertexInput>& getVertexInputs() const { return vertex_inputs_; }
+
+   private:
+    VkShaderStageFlags stages_ = 0;
+    // by (set, binding)
+    std::map<std::pair<uint32_t, uint32_t>, VkDescriptorSetLayoutBinding> bindings_{};
+    uint32_t push_constant_size_ = 0;
+    VkShaderStageFlags push_constant_stages_ = 0;
+    std::vector<VertexInput> vertex_inputs_{};
+};
+
+}
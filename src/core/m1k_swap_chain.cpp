@@ -15,13 +15,17 @@
 
 namespace m1k {
 
-M1kSwapChain:: M1kSwapChain( M1kDevice &deviceRef, VkExtent2D extent)
-    : device_{deviceRef}, window_extent_{extent} {
+M1kSwapChain:: M1kSwapChain( M1kDevice &deviceRef, VkExtent2D extent, uint32_t framesInFlight,
+                             bool useDynamicRendering)
+    : device_{deviceRef}, window_extent_{extent}, frames_in_flight_{framesInFlight},
+      use_dynamic_rendering_{useDynamicRendering} {
     init();
 }
 
-M1kSwapChain:: M1kSwapChain( M1kDevice &deviceRef, VkExtent2D extent, std::shared_ptr<M1kSwapChain> previous)
-    : device_{deviceRef}, window_extent_{extent}, old_swap_chain_(previous) {
+M1kSwapChain:: M1kSwapChain( M1kDevice &deviceRef, VkExtent2D extent, uint32_t framesInFlight,
+                             bool useDynamicRendering, std::shared_ptr<M1kSwapChain> previous)
+    : device_{deviceRef}, window_extent_{extent}, frames_in_flight_{framesInFlight},
+      use_dynamic_rendering_{useDynamicRendering}, old_swap_chain_(previous) {
     init();
 
     // clean up
@@ -31,13 +35,72 @@ M1kSwapChain:: M1kSwapChain( M1kDevice &deviceRef, VkExtent2D extent, std::share
 void M1kSwapChain::init() {
     createSwapChain();
     createImageViews();
-    createRenderPass();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
+    reuseOrCreateRenderTargets();
+    if (!use_dynamic_rendering_) {
+        createFramebuffers();
+    }
     createSyncObjects();
 }
 
+M1kSwapChain::AttachmentOwner::~AttachmentOwner() {
+    vkDestroyImageView(device, color_image_view, nullptr);
+    vkDestroyImage(device, color_image, nullptr);
+    vkFreeMemory(device, color_image_memory, nullptr);
+
+    vkDestroyImageView(device, depth_image_view, nullptr);
+    vkDestroyImage(device, depth_image, nullptr);
+    vkFreeMemory(device, depth_image_memory, nullptr);
+}
+
+VkExtent2D M1kSwapChain::attachmentExtentBucket(VkExtent2D extent) {
+    auto round_up = [](uint32_t value) {
+        return (value + kAttachmentExtentGranularity - 1) /
+               kAttachmentExtentGranularity * kAttachmentExtentGranularity;
+    };
+    return {round_up(extent.width), round_up(extent.height)};
+}
+
+void M1kSwapChain::reuseOrCreateRenderTargets() {
+    swap_chain_depth_format_ = findDepthFormat();
+    attachment_extent_ = attachmentExtentBucket(swap_chain_extent_);
+
+    bool same_formats = old_swap_chain_ != nullptr && compareSwapFormat(*old_swap_chain_);
+
+    // a compatible render pass keeps every pipeline built against it valid,
+    // dynamic rendering pipelines only depend on the formats
+    if (use_dynamic_rendering_) {
+        render_pass_ = VK_NULL_HANDLE;
+    } else if (same_formats) {
+        render_pass_owner_ = old_swap_chain_->render_pass_owner_;
+        render_pass_ = render_pass_owner_->render_pass;
+    } else {
+        createRenderPass();
+        render_pass_owner_.reset(new RenderPassOwner{device_.device(), render_pass_});
+    }
+
+    const AttachmentOwner *old_attachments =
+        same_formats ? old_swap_chain_->attachment_owner_.get() : nullptr;
+    if (old_attachments != nullptr &&
+        old_attachments->extent.width == attachment_extent_.width &&
+        old_attachments->extent.height == attachment_extent_.height) {
+        attachment_owner_ = old_swap_chain_->attachment_owner_;
+    } else {
+        createColorResources();
+        createDepthResources();
+        attachment_owner_.reset(new AttachmentOwner{
+            device_.device(), attachment_extent_,
+            color_image_, color_image_memory_, color_image_view_,
+            depth_image_, depth_image_memory_, depth_image_view_});
+    }
+
+    color_image_ = attachment_owner_->color_image;
+    color_image_memory_ = attachment_owner_->color_image_memory;
+    color_image_view_ = attachment_owner_->color_image_view;
+    depth_image_ = attachment_owner_->depth_image;
+    depth_image_memory_ = attachment_owner_->depth_image_memory;
+    depth_image_view_ = attachment_owner_->depth_image_view;
+}
+
  M1kSwapChain::~ M1kSwapChain() {
     for (auto imageView : swap_chain_image_views_) {
         vkDestroyImageView(device_.device(), imageView, nullptr);
@@ -49,41 +112,27 @@ void M1kSwapChain::init() {
         swap_chain_ = nullptr;
     }
 
-    vkDestroyImageView(device_.device(), color_image_view_, nullptr);
-    vkDestroyImage(device_.device(), color_image_, nullptr);
-    vkFreeMemory(device_.device(), color_image_memory_, nullptr);
-
-    vkDestroyImageView(device_.device(), depth_image_view_, nullptr);
-    vkDestroyImage(device_.device(), depth_image_, nullptr);
-    vkFreeMemory(device_.device(), depth_image_memory_, nullptr);
-
     for (auto framebuffer : swap_chain_framebuffers_) {
         vkDestroyFramebuffer(device_.device(), framebuffer, nullptr);
     }
 
-    vkDestroyRenderPass(device_.device(), render_pass_, nullptr);
+    // render pass and attachments go with the last owner
+    attachment_owner_.reset();
+    render_pass_owner_.reset();
 
     // cleanup synchronization objects
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < frames_in_flight_; i++) {
         vkDestroySemaphore(device_.device(), render_finished_semaphores_[i], nullptr);
         vkDestroySemaphore(device_.device(), image_available_semaphores_[i], nullptr);
-        vkDestroyFence(device_.device(), in_flight_fences_[i], nullptr);
     }
 }
 
-VkResult  M1kSwapChain::acquireNextImage(uint32_t *imageIndex) {
-    vkWaitForFences(
-        device_.device(),
-        1,
-        &in_flight_fences_[current_frame_],
-        VK_TRUE,
-        std::numeric_limits<uint64_t>::max());
-
+VkResult  M1kSwapChain::acquireNextImage(uint32_t frameIndex, uint32_t *imageIndex) {
     VkResult result = vkAcquireNextImageKHR(
         device_.device(),
         swap_chain_,
         std::numeric_limits<uint64_t>::max(),
-        image_available_semaphores_[current_frame_],  // must be a not signaled semaphore
+        image_available_semaphores_[frameIndex],  // must be a not signaled semaphore
         VK_NULL_HANDLE,
         imageIndex);
 
@@ -91,30 +140,39 @@ VkResult  M1kSwapChain::acquireNextImage(uint32_t *imageIndex) {
 }
 
 VkResult  M1kSwapChain::submitCommandBuffers(
-    const VkCommandBuffer *buffers, uint32_t *imageIndex) {
-    if (images_in_flight_[*imageIndex] != VK_NULL_HANDLE) {
-        vkWaitForFences(device_.device(), 1, &images_in_flight_[*imageIndex], VK_TRUE, UINT64_MAX);
-    }
-    images_in_flight_[*imageIndex] = in_flight_fences_[current_frame_];
+    const VkCommandBuffer *buffers, uint32_t frameIndex, uint32_t *imageIndex,
+    uint64_t signalValue, VkSemaphore wait_semaphore, VkPipelineStageFlags wait_stage) {
+    M1kTimeline &timeline = device_.graphicsTimeline();
+
+    // an image can be acquired again while an older frame slot still renders to it
+    timeline.wait(image_timeline_values_[*imageIndex]);
+    image_timeline_values_[*imageIndex] = signalValue;
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = {image_available_semaphores_[current_frame_]};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    VkSemaphore waitSemaphores[] = {image_available_semaphores_[frameIndex], wait_semaphore};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, wait_stage};
+    submitInfo.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE ? 2 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = buffers;
 
-    VkSemaphore signalSemaphores[] = {render_finished_semaphores_[current_frame_]};
-    submitInfo.signalSemaphoreCount = 1;
+    // binary one for present, the timeline for everyone else
+    VkSemaphore signalSemaphores[] = {render_finished_semaphores_[frameIndex], timeline.semaphore()};
+    uint64_t signalValues[] = {0, signalValue};
+    submitInfo.signalSemaphoreCount = 2;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    vkResetFences(device_.device(), 1, &in_flight_fences_[current_frame_]);
-    if (vkQueueSubmit(device_.graphicsQueue(), 1, &submitInfo, in_flight_fences_[current_frame_]) !=
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 2;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+    submitInfo.pNext = &timelineInfo;
+
+    if (vkQueueSubmit(device_.graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) !=
         VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer_!");
     }
@@ -133,8 +191,6 @@ VkResult  M1kSwapChain::submitCommandBuffers(
 
     auto result = vkQueuePresentKHR(device_.presentQueue(), &presentInfo);
 
-    current_frame_ = (current_frame_ + 1) % MAX_FRAMES_IN_FLIGHT;
-
     return result;
 }
 
@@ -317,13 +373,14 @@ void  M1kSwapChain::createFramebuffers() {
 void M1kSwapChain::createColorResources() {
     VkFormat color_format = getSwapChainImageFormat();
 
-    VkExtent2D swap_chain_extent = getSwapChainExtent();
+    // may be larger than the swap chain, framebuffers only use the top left
+    VkExtent2D attachment_extent = attachment_extent_;
 
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = swap_chain_extent.width;
-    imageInfo.extent.height = swap_chain_extent.height;
+    imageInfo.extent.width = attachment_extent.width;
+    imageInfo.extent.height = attachment_extent.height;
     imageInfo.extent.depth = 1;
     imageInfo.mipLevels = 1;
     imageInfo.arrayLayers = 1;
@@ -347,13 +404,13 @@ void M1kSwapChain::createColorResources() {
 void  M1kSwapChain::createDepthResources() {
     VkFormat depth_format = findDepthFormat();
     swap_chain_depth_format_ = depth_format;
-    VkExtent2D swapChainExtent = getSwapChainExtent();
+    VkExtent2D attachment_extent = attachment_extent_;
 
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = swapChainExtent.width;
-    imageInfo.extent.height = swapChainExtent.height;
+    imageInfo.extent.width = attachment_extent.width;
+    imageInfo.extent.height = attachment_extent.height;
     imageInfo.extent.depth = 1;
     imageInfo.mipLevels = 1;
     imageInfo.arrayLayers = 1;
@@ -375,24 +432,18 @@ void  M1kSwapChain::createDepthResources() {
 }
 
 void  M1kSwapChain::createSyncObjects() {
-    image_available_semaphores_.resize(MAX_FRAMES_IN_FLIGHT);
-    render_finished_semaphores_.resize(MAX_FRAMES_IN_FLIGHT);
-    in_flight_fences_.resize(MAX_FRAMES_IN_FLIGHT);
-    images_in_flight_.resize(imageCount(), VK_NULL_HANDLE);
+    image_available_semaphores_.resize(frames_in_flight_);
+    render_finished_semaphores_.resize(frames_in_flight_);
+    image_timeline_values_.resize(imageCount(), 0);
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo fenceInfo = {};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < frames_in_flight_; i++) {
         if (vkCreateSemaphore(device_.device(), &semaphoreInfo, nullptr, &image_available_semaphores_[i]) !=
                 VK_SUCCESS ||
             vkCreateSemaphore(device_.device(), &semaphoreInfo, nullptr, &render_finished_semaphores_[i]) !=
-                VK_SUCCESS ||
-            vkCreateFence(device_.device(), &fenceInfo, nullptr, &in_flight_fences_[i]) != VK_SUCCESS) {
+                VK_SUCCESS) {
             throw std::runtime_error("failed to create synchronization objects for a frame!");
         }
     }
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "m1k_device.hpp"
+#include "m1k_config.hpp"
 
 // vulkan headers
 #include <vulkan/vulkan.h>
@@ -18,10 +19,12 @@ namespace m1k {
 
 class M1kSwapChain {
    public:
-    static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
-
-     M1kSwapChain( M1kDevice &deviceRef, VkExtent2D windowExtent);
-     M1kSwapChain( M1kDevice &deviceRef, VkExtent2D windowExtent, std::shared_ptr<M1kSwapChain> previous);
+     // useDynamicRendering: no render pass and framebuffers, the renderer
+     // begins rendering on the image views directly
+     M1kSwapChain( M1kDevice &deviceRef, VkExtent2D windowExtent, uint32_t framesInFlight,
+                   bool useDynamicRendering);
+     M1kSwapChain( M1kDevice &deviceRef, VkExtent2D windowExtent, uint32_t framesInFlight,
+                   bool useDynamicRendering, std::shared_ptr<M1kSwapChain> previous);
      ~M1kSwapChain();
 
     M1kSwapChain(const  M1kSwapChain &) = delete;
@@ -30,6 +33,14 @@ class M1kSwapChain {
     VkFramebuffer getFrameBuffer(int index) { return swap_chain_framebuffers_[index]; }
     VkRenderPass getRenderPass() { return render_pass_; }
     VkImageView getImageView(int index) { return swap_chain_image_views_[index]; }
+    VkImage getImage(int index) { return swap_chain_images_[index]; }
+    // MSAA color and depth attachments, shared by all images
+    VkImage getColorImage() { return color_image_; }
+    VkImageView getColorImageView() { return color_image_view_; }
+    VkImage getDepthImage() { return depth_image_; }
+    VkImageView getDepthImageView() { return depth_image_view_; }
+    VkFormat getSwapChainDepthFormat() { return swap_chain_depth_format_; }
+    bool usesDynamicRendering() const { return use_dynamic_rendering_; }
     size_t imageCount() { return swap_chain_images_.size(); }
     VkFormat getSwapChainImageFormat() { return swap_chain_image_format_; }
     VkExtent2D getSwapChainExtent() { return swap_chain_extent_; }
@@ -41,8 +52,15 @@ class M1kSwapChain {
     }
     VkFormat findDepthFormat();
 
-    VkResult acquireNextImage(uint32_t *imageIndex);
-    VkResult submitCommandBuffers(const VkCommandBuffer *buffers, uint32_t *imageIndex);
+    // frame pacing lives in the renderer, it waits on the graphics timeline
+    // before reusing a frame slot, so no fences here
+    VkResult acquireNextImage(uint32_t frameIndex, uint32_t *imageIndex);
+    // signals signalValue on the graphics timeline, wait_semaphore is an
+    // optional extra dependency, e.g. this frame's async compute
+    VkResult submitCommandBuffers(const VkCommandBuffer *buffers, uint32_t frameIndex,
+                                  uint32_t *imageIndex, uint64_t signalValue,
+                                  VkSemaphore wait_semaphore = VK_NULL_HANDLE,
+                                  VkPipelineStageFlags wait_stage = 0);
 
     bool compareSwapFormat(const M1kSwapChain &swap_chain) const {
         return swap_chain.swap_chain_depth_format_ == swap_chain_depth_format_ &&
@@ -58,6 +76,8 @@ class M1kSwapChain {
     void createRenderPass();
     void createFramebuffers();
     void createSyncObjects();
+    // takes over the render pass and attachments of old_swap_chain_ if possible
+    void reuseOrCreateRenderTargets();
 
     // Helper functions
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(
@@ -70,9 +90,33 @@ class M1kSwapChain {
     VkFormat swap_chain_depth_format_;
     VkExtent2D swap_chain_extent_;
 
+    // The render pass and the MSAA color / depth images can be shared with
+    // the next swap chain, the last owner destroys them. Attachments are
+    // allocated at a bucketed extent, so resizing within a bucket keeps them.
+    struct RenderPassOwner {
+        VkDevice device;
+        VkRenderPass render_pass;
+        ~RenderPassOwner() { vkDestroyRenderPass(device, render_pass, nullptr); }
+    };
+    struct AttachmentOwner {
+        VkDevice device;
+        VkExtent2D extent;
+        VkImage color_image;
+        VkDeviceMemory color_image_memory;
+        VkImageView color_image_view;
+        VkImage depth_image;
+        VkDeviceMemory depth_image_memory;
+        VkImageView depth_image_view;
+        ~AttachmentOwner();
+    };
+
+    static VkExtent2D attachmentExtentBucket(VkExtent2D extent);
+
     std::vector<VkFramebuffer> swap_chain_framebuffers_;
     VkRenderPass render_pass_;
+    std::shared_ptr<RenderPassOwner> render_pass_owner_;
 
+    VkExtent2D attachment_extent_;
     VkImage color_image_;
     VkDeviceMemory color_image_memory_;
     VkImageView color_image_view_;
@@ -80,21 +124,23 @@ class M1kSwapChain {
     VkImage depth_image_;
     VkDeviceMemory depth_image_memory_;
     VkImageView depth_image_view_;
+    std::shared_ptr<AttachmentOwner> attachment_owner_;
 
     std::vector<VkImage> swap_chain_images_;
     std::vector<VkImageView> swap_chain_image_views_;
 
     M1kDevice &device_;
     VkExtent2D window_extent_;
+    uint32_t frames_in_flight_;
+    bool use_dynamic_rendering_;
 
     VkSwapchainKHR swap_chain_;
     std::shared_ptr<M1kSwapChain> old_swap_chain_;
 
     std::vector<VkSemaphore> image_available_semaphores_;
     std::vector<VkSemaphore> render_finished_semaphores_;
-    std::vector<VkFence> in_flight_fences_;
-    std::vector<VkFence> images_in_flight_;
-    size_t current_frame_ = 0;
+    // timeline value of the last submission rendering to each image
+    std::vector<uint64_t> image_timeline_values_;
 };
 
 }  // namespace m1k
@@ -0,0 +1,97 @@
+//
+// Created by fangl on 2024/3/27.
+//
+
+#include "m1k_timeline.hpp"
+
+// std
+#include <limits>
+#include <stdexcept>
+
+namespace m1k {
+
+M1kTimeline::M1kTimeline(VkDevice device) : device_(device) {
+    VkSemaphoreTypeCreateInfo type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+
+    if (vkCreateSemaphore(device_, &semaphore_info, nullptr, &semaphore_) != VK_SUCCESS) {
+        throw std::runtime_error("M1K::ERR--------Create timeline semaphore failed!");
+    }
+}
+
+M1kTimeline::~M1kTimeline() {
+    flush();
+    vkDestroySemaphore(device_, semaphore_, nullptr);
+}
+
+uint64_t M1kTimeline::completedValue() {
+    uint64_t value = 0;
+    if (vkGetSemaphoreCounterValue(device_, semaphore_, &value) == VK_SUCCESS) {
+        completed_value_ = value;
+    }
+    return completed_value_;
+}
+
+bool M1kTimeline::isCompleted(uint64_t value) {
+    // skip the query when the cached value already answers it
+    return value <= completed_value_ || value <= completedValue();
+}
+
+void M1kTimeline::wait(uint64_t value) {
+    if (isCompleted(value)) return;
+
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphore_;
+    wait_info.pValues = &value;
+
+    if (vkWaitSemaphores(device_, &wait_info, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+        throw std::runtime_error("M1K::ERR--------Wait for timeline semaphore failed!");
+    }
+    completed_value_ = value;
+}
+
+void M1kTimeline::deferDestroy(std::function<void()> deleter) {
+    // uploads may signal values before the frame does, so the value is only
+    // known once the frame is submitted
+    deletion_queue_.push_back({kUnassignedValue, std::move(deleter)});
+}
+
+void M1kTimeline::assignPendingDeletions(uint64_t frame_value) {
+    // unassigned entries are always at the back
+    for (auto it = deletion_queue_.rbegin();
+         it != deletion_queue_.rend() && it->value == kUnassignedValue; ++it) {
+        it->value = frame_value;
+    }
+}
+
+void M1kTimeline::collectGarbage() {
+    if (deletion_queue_.empty()) return;
+
+    // values only grow, so the queue is sorted (unassigned ones last)
+    uint64_t completed = completedValue();
+    while (!deletion_queue_.empty() && deletion_queue_.front().value <= completed) {
+        auto deleter = std::move(deletion_queue_.front().deleter);
+        deletion_queue_.pop_front();
+        deleter();
+    }
+}
+
+void M1kTimeline::flush() {
+    waitIdle();
+
+    while (!deletion_queue_.empty()) {
+        auto deleter = std::move(deletion_queue_.front().deleter);
+        deletion_queue_.pop_front();
+        deleter();
+    }
+}
+
+}
@@ -0,0 +1,70 @@
+//
+// Created by fangl on 2024/3/27.
+//
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+// std
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace m1k {
+
+/*
+ * Timeline semaphore of the graphics queue.
+ *
+ * Every graphics submission (frames and uploads) signals the next value, so
+ * "has submission X finished" is a single integer compare. Also owns the
+ * deletion queue: resources handed to deferDestroy() are released once the
+ * GPU passed every submission that could still reference them.
+ *
+ * Only one thread submits to the graphics queue, so nothing is locked.
+ */
+class M1kTimeline {
+   public:
+    explicit M1kTimeline(VkDevice device);
+    ~M1kTimeline();
+
+    M1kTimeline(const M1kTimeline&) = delete;
+    M1kTimeline& operator=(const M1kTimeline&) = delete;
+
+    VkSemaphore semaphore() const { return semaphore_; }
+
+    // reserves the value the next graphics submission has to signal
+    uint64_t nextSignalValue() { return ++last_submitted_value_; }
+    uint64_t lastSubmittedValue() const { return last_submitted_value_; }
+
+    uint64_t completedValue();
+    bool isCompleted(uint64_t value);
+    void wait(uint64_t value);
+    void waitIdle() { wait(last_submitted_value_); }
+
+    // runs deleter once the next frame submission completed, so it is safe
+    // to call while the current frame is still recording
+    void deferDestroy(std::function<void()> deleter);
+    // called by the renderer with the value its frame submission signals
+    void assignPendingDeletions(uint64_t frame_value);
+    void collectGarbage();
+    // waits for the GPU and releases everything still queued
+    void flush();
+
+   private:
+    static constexpr uint64_t kUnassignedValue = UINT64_MAX;
+
+    struct PendingDeletion {
+        uint64_t value;
+        std::function<void()> deleter;
+    };
+
+    VkDevice device_;
+    VkSemaphore semaphore_ = VK_NULL_HANDLE;
+    uint64_t last_submitted_value_ = 0;
+    uint64_t completed_value_ = 0;
+
+    std::deque<PendingDeletion> deletion_queue_{};
+};
+
+}
@@ -29,7 +29,10 @@ M1kApplication::M1kApplication() {
     global_pool_ =
         M1kDescriptorPool::Builder(m1k_device_)
             .setMaxSets(kMaxGlobalPoolSetSize)
-            .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 50 * M1kSwapChain::MAX_FRAMES_IN_FLIGHT)
+            .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 50 * m1k_renderer_.getFramesInFlight())
+            // lights and clusters per frame, meshlets per mesh
+            .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         3 * m1k_renderer_.getFramesInFlight() + kMaxGlobalPoolSetSize)
             .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,kMaxMaterialsNumber)
             .build();
 
@@ -50,62 +53,101 @@ M1kApplication::~M1kApplication() {
 
 void M1kApplication::run() {
     std::vector<std::shared_ptr<M1kBuffer>> global_ubo_buffers(
-        M1kSwapChain::MAX_FRAMES_IN_FLIGHT);
+        m1k_renderer_.getFramesInFlight());
     for (int i = 0; i < global_ubo_buffers.size(); ++i) {
+        // the culling passes on the async compute queue read it too
         global_ubo_buffers[i] = std::make_unique<M1kBuffer>(
             m1k_device_, sizeof(GlobalUbo), 1,
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 1, true);
         global_ubo_buffers[i]->map();
     }
 
+    // the shared sets as the shaders declare them. A set layout is merged
+    // over every shader it is bound for, so all their pipelines agree on it.
+    // set 0: global ubo, point lights, light clusters, shadow cascades, IBL
+    auto global_set_shaders = M1kShaderReflection::fromFiles({
+        "./shaders/binaries/bindless_pbr_shader.vert.spv",
+        "./shaders/binaries/bindless_pbr_shader.frag.spv",
+        "./shaders/binaries/depth_prepass.vert.spv",
+        "./shaders/binaries/point_light.vert.spv",
+        "./shaders/binaries/point_light.frag.spv",
+        "./shaders/binaries/deferred_lighting.frag.spv",
+        "./shaders/binaries/cluster_light_cull.comp.spv",
+        "./shaders/binaries/meshlet_cull.comp.spv"});
+    // set 1: the bindless textures
+    auto bindless_set_shaders = M1kShaderReflection::fromFiles({
+        "./shaders/binaries/bindless_pbr_shader.vert.spv",
+        "./shaders/binaries/bindless_pbr_shader.frag.spv",
+        "./shaders/binaries/deferred_gbuffer.frag.spv"});
+    // set 2: material ubo, meshlets of dense meshes
+    auto pbr_set_shaders = M1kShaderReflection::fromFiles({
+        "./shaders/binaries/bindless_pbr_shader.vert.spv",
+        "./shaders/binaries/bindless_pbr_shader.frag.spv",
+        "./shaders/binaries/depth_prepass.vert.spv",
+        "./shaders/binaries/shadow_depth.vert.spv",
+        "./shaders/binaries/deferred_gbuffer.frag.spv",
+        "./shaders/binaries/meshlet_cull.comp.spv"});
+
     global_set_layout_ =
         M1kDescriptorSetLayout::Builder(m1k_device_)
-            .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                        VK_SHADER_STAGE_ALL_GRAPHICS)
-            .addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                        VK_SHADER_STAGE_FRAGMENT_BIT)
+            .addBindings(global_set_shaders, 0)
             .build();
     pbr_set_layout_ =
         M1kDescriptorSetLayout::Builder(m1k_device_)
-            .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                        VK_SHADER_STAGE_ALL_GRAPHICS)
-//            .addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-//                        VK_SHADER_STAGE_FRAGMENT_BIT)   // diffuseTex
-//            .addBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-//                        VK_SHADER_STAGE_FRAGMENT_BIT)   // roughnessTex
-//            .addBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-//                        VK_SHADER_STAGE_FRAGMENT_BIT)   // occlusionTex
-//            .addBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-//                        VK_SHADER_STAGE_FRAGMENT_BIT)   // emissiveTex
-//            .addBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-//                        VK_SHADER_STAGE_FRAGMENT_BIT)   // normalTex
+            .addBindings(pbr_set_shaders, 2)
             .build();
     bindless_set_layout_ =
         M1kDescriptorSetLayout::Builder(m1k_device_)
-            .addBinding(kBindlessTextureBinding,
-                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                        VK_SHADER_STAGE_FRAGMENT_BIT,
-                        kMaxBindlessResources)
+            .addBindings(bindless_set_shaders, 1, kMaxBindlessResources)
             .build_for_bindless();
 
+    asset_manager_ = std::make_unique<M1kAssetManager>(
+        m1k_device_, *pbr_set_layout_, *global_pool_, thread_pool_);
 
-    // for all UBOs of each frame and textures
-    // JUST FOR TEST
-    M1kTexture test_texture{m1k_device_,
-                            "../assets/textures/checkboard_texture.png"};
-    auto& test_texture_image_info =
-        test_texture.getDescriptorImageInfo();  // VkDescriptorImageinfo
+    // systems register their pipelines here, all are compiled together on
+    // the thread pool once the last system is created
+    M1kPipelineBuildQueue pipeline_build_queue{m1k_device_};
+
+    // point light storage and cluster buffers live in the global set
+    light_cluster_system_ = std::make_unique<LightClusterSystem>(
+        m1k_device_, m1k_renderer_.getFramesInFlight(),
+        global_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
+    // the shadow map array is sampled through the global set as well
+    shadow_system_ = std::make_unique<CascadedShadowSystem>(
+        m1k_device_, m1k_renderer_.getFramesInFlight(),
+        global_set_layout_->getDescriptorSetLayout(),
+        pbr_set_layout_->getDescriptorSetLayout(),
+        bindless_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
+    auto shadow_map_image_info = shadow_system_->getShadowMapImageInfo();
+    // baked or loaded from the cache here, before the first frame
+    ibl_system_ = std::make_unique<IblSystem>(m1k_device_, kEnvironmentMapPath);
+    auto irradiance_image_info = ibl_system_->getIrradianceImageInfo();
+    auto prefiltered_image_info = ibl_system_->getPrefilteredImageInfo();
+    auto brdf_lut_image_info = ibl_system_->getBrdfLutImageInfo();
+    cluster_cull_system_ = std::make_unique<ClusterCullSystem>(
+        m1k_device_, m1k_renderer_.getFramesInFlight(),
+        global_set_layout_->getDescriptorSetLayout(),
+        pbr_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
 
     // for TEST render system ONLY
     // for all UBOs of each frame and textures
     std::vector<VkDescriptorSet> global_descriptor_sets(
-        M1kSwapChain::MAX_FRAMES_IN_FLIGHT);
-    for (int i = 0; i < M1kSwapChain::MAX_FRAMES_IN_FLIGHT; ++i) {
+        m1k_renderer_.getFramesInFlight());
+    for (int i = 0; i < global_descriptor_sets.size(); ++i) {
         auto global_buffer_info = global_ubo_buffers[i]->descriptorInfo();
+        auto light_buffer_info = light_cluster_system_->getLightBufferInfo(i);
+        auto cluster_count_buffer_info = light_cluster_system_->getClusterCountBufferInfo(i);
+        auto cluster_index_buffer_info = light_cluster_system_->getClusterIndexBufferInfo(i);
         M1kDescriptorWriter(*global_set_layout_, *global_pool_)
             .writeBuffer(0, &global_buffer_info)
-            .writeImage(1, &test_texture_image_info)
+            .writeBuffer(2, &light_buffer_info)
+            .writeBuffer(3, &cluster_count_buffer_info)
+            .writeBuffer(4, &cluster_index_buffer_info)
+            .writeImage(5, &shadow_map_image_info)
+            .writeImage(6, &irradiance_image_info)
+            .writeImage(7, &prefiltered_image_info)
+            .writeImage(8, &brdf_lut_image_info)
             .build(global_descriptor_sets[i]);
     }
 
@@ -119,19 +161,39 @@ void M1kApplication::run() {
 
     // systems init
     point_light_system_ = std::make_unique<PointLightSystem>(
-        m1k_device_, m1k_renderer_.getSwapChainRenderPass(),
-        global_set_layout_->getDescriptorSetLayout());
+        m1k_device_, m1k_renderer_.getSwapChainRenderTarget(),
+        global_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
 
 //    pbr_render_system_ = std::make_unique<PbrRenderSystem>(
-//        m1k_device_, m1k_renderer_.getSwapChainRenderPass(),
+//        m1k_device_, m1k_renderer_.getSwapChainRenderTarget(),
 //        global_set_layout_->getDescriptorSetLayout(),
 //        pbr_set_layout_->getDescriptorSetLayout());
 
     bindless_pbr_render_system_ = std::make_unique<BindlessPbrRenderSystem>(
-        m1k_device_, m1k_renderer_.getSwapChainRenderPass(),
+        m1k_device_, m1k_renderer_.getSwapChainRenderTarget(),
+        m1k_renderer_.getFramesInFlight(),
         global_set_layout_->getDescriptorSetLayout(),
         pbr_set_layout_->getDescriptorSetLayout(),
-        bindless_set_layout_->getDescriptorSetLayout());
+        bindless_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
+
+    // the G-buffer pass lives on the render graph, which needs dynamic rendering
+    if (m1k_device_.isDynamicRenderingSupported()) {
+        deferred_pbr_render_system_ = std::make_unique<DeferredPbrRenderSystem>(
+            m1k_device_, m1k_renderer_.getSwapChainRenderTarget(),
+            m1k_renderer_.getFramesInFlight(),
+            global_set_layout_->getDescriptorSetLayout(),
+            pbr_set_layout_->getDescriptorSetLayout(),
+            bindless_set_layout_->getDescriptorSetLayout(), pipeline_build_queue);
+    } else {
+        is_deferred_shading_ = false;
+    }
+
+    pipeline_build_queue.build(thread_pool_);
+
+    // edited shaders are recompiled and their pipelines rebuilt in the
+    // background, the queue knows which pipelines read which shader
+    M1kShaderHotReload shader_hot_reload{pipeline_build_queue, kShaderSourceDirectory,
+                                         kShaderBinaryDirectory};
 
     M1kCamera camera{};
     camera.setViewTarget(glm::vec3(-1.0f, -2.0f, -2.5f), glm::vec3(0.0f,0.0f,0.0f));
@@ -157,7 +219,12 @@ void M1kApplication::run() {
 
         float aspect = m1k_renderer_.getAspectRatio();
         // camera.setOrthographicProjection(-aspect,aspect,-1,1,-1,1);
-        camera.setPerspectiveProjection(glm::radians(50.0f), aspect, 0.1f, 200.0f);
+        camera.setPerspectiveProjection(glm::radians(50.0f), aspect, kCameraNear, kCameraFar);
+
+        // pipelines of edited shaders are swapped in before anything is recorded
+        if (is_shader_hot_reload_enabled_) {
+            shader_hot_reload.update(frame_time);
+        }
 
         if(auto command_buffer = m1k_renderer_.beginFrame()) {
             int frame_index = m1k_renderer_.getFrameIndex();
@@ -168,36 +235,99 @@ void M1kApplication::run() {
                 camera,
                 global_descriptor_sets[frame_index],
                 bindless_descriptor_set,
-                game_objects_
+                game_objects_,
+                scene_bvh_,
+                m1k_renderer_,
+                lod_bias_,
+                is_cluster_culling_enabled_ ? cluster_cull_system_.get() : nullptr
             };
 
+            // imgui
+            loopImGUI(frame_info);
+
+            // objects may have been loaded, moved or cleared by the UI, the
+            // shadow cache below has to see this frame's scene
+            scene_bvh_.syncGameObjects(game_objects_);
+
             // update global UBO!
             GlobalUbo ubo{};
             ubo.projection_matrix = camera.getProjection();
             ubo.view_matrix = camera.getView();
             ubo.inverse_view_matrix = camera.getViewInverse();
 
-            point_light_system_->update(frame_info, ubo);
+            point_light_system_->update(frame_info, point_lights_);
+            light_cluster_system_->update(frame_info, point_lights_, ubo);
+            shadow_system_->update(frame_info, ubo);
+            ibl_system_->update(ubo);
 
             global_ubo_buffers[frame_index]->writeToBuffer(&ubo);
             global_ubo_buffers[frame_index]->flush();
 
-            // imgui
-            loopImGUI(frame_info);
+            // light binning and meshlet culling go to the async compute queue
+            // right away and overlap the previous frame's rasterization, this
+            // frame's graphics submission waits for them before drawing
+            VkCommandBuffer compute_command_buffer = m1k_renderer_.beginComputeCommands();
+            light_cluster_system_->cull(frame_info, compute_command_buffer);
+            if (is_cluster_culling_enabled_) {
+                cluster_cull_system_->cull(frame_info, compute_command_buffer);
+            }
+            m1k_renderer_.endComputeCommands(compute_command_buffer);
 
-            // render
-            m1k_renderer_.beginSwapChainRenderPass(command_buffer);
+            // only the cascades picked by update(), often none
+            shadow_system_->render(frame_info);
 
-            bindless_pbr_render_system_->updateBindlessTextures(frame_info);
+            // new textures of loaded models, before anything samples them
+            bindless_pbr_render_system_->updateBindlessTextures(frame_info, *asset_manager_);
 
-            point_light_system_->render(frame_info);
-            // pbr_render_system_->render(frame_info);
-            bindless_pbr_render_system_->render(frame_info);
+            bool is_deferred = is_deferred_shading_ && deferred_pbr_render_system_ != nullptr;
+            if (is_deferred) {
+                deferred_pbr_render_system_->addGeometryPass(frame_info);
+            }
+
+            // offscreen passes declared on the frame's render graph
+            m1k_renderer_.executeRenderGraph(command_buffer);
+
+            // render, everything inside the pass is recorded into secondary buffers
+            m1k_renderer_.beginSwapChainRenderPass(
+                command_buffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-            // render ImGui draw data
-            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command_buffer);
+            // lighting first, it writes the depth the light billboards test against
+            if (is_deferred) {
+                deferred_pbr_render_system_->render(frame_info);
+            }
 
-            m1k_renderer_.endSwapChainRenderPass(command_buffer);
+            uint32_t main_thread_index = m1k_renderer_.getMainThreadIndex();
+
+            VkCommandBuffer light_command_buffer =
+                m1k_renderer_.beginSecondaryCommandBuffer(main_thread_index);
+            frame_info.command_buffer = light_command_buffer;
+            point_light_system_->render(frame_info);
+            m1k_renderer_.endSecondaryCommandBuffer(light_command_buffer);
+            m1k_renderer_.executeSecondaryCommandBuffers(command_buffer, {light_command_buffer});
+
+            // records on the worker threads and executes into the primary buffer
+            frame_info.command_buffer = command_buffer;
+            // pbr_render_system_->render(frame_info);
+            if (!is_deferred) {
+                bindless_pbr_render_system_->render(frame_info);
+            }
+
+            // render ImGui draw data, with dynamic rendering in its own single
+            // sampled pass on the resolved image, ImGui has no depth format
+            if (m1k_renderer_.usesDynamicRendering()) {
+                m1k_renderer_.endSwapChainRenderPass(command_buffer);
+                m1k_renderer_.beginOverlayPass(command_buffer);
+                ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command_buffer);
+                m1k_renderer_.endOverlayPass(command_buffer);
+            } else {
+                VkCommandBuffer ui_command_buffer =
+                    m1k_renderer_.beginSecondaryCommandBuffer(main_thread_index);
+                ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), ui_command_buffer);
+                m1k_renderer_.endSecondaryCommandBuffer(ui_command_buffer);
+                m1k_renderer_.executeSecondaryCommandBuffers(command_buffer, {ui_command_buffer});
+
+                m1k_renderer_.endSwapChainRenderPass(command_buffer);
+            }
             m1k_renderer_.endFrame();
 
             // update bindless textures
@@ -207,6 +337,7 @@ void M1kApplication::run() {
     }
 
     vkDeviceWaitIdle(m1k_device_.device());
+    m1k_device_.graphicsTimeline().collectGarbage();
 }
 
 void M1kApplication::initImGUI() {
@@ -214,7 +345,7 @@ void M1kApplication::initImGUI() {
     // the size of the pool_ is very oversize, but it's copied from imgui demo itself.
     imgui_pool_ =
         M1kDescriptorPool::Builder(m1k_device_)
-            .setMaxSets(M1kSwapChain::MAX_FRAMES_IN_FLIGHT * 2)
+            .setMaxSets(m1k_renderer_.getFramesInFlight() * 2)
             .setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
             .addPoolSize(VK_DESCRIPTOR_TYPE_SAMPLER, 20)
             .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 20)
@@ -247,11 +378,19 @@ void M1kApplication::initImGUI() {
     init_info.Device = m1k_device_.device();
     init_info.Queue = m1k_device_.graphicsQueue();
     init_info.DescriptorPool = imgui_pool_->getPool();
+    init_info.PipelineCache = m1k_device_.pipelineCache().cache();
     init_info.MinImageCount = 3;
     init_info.ImageCount = 3;
 
-    // NOTE!!! if enable the MSAA， this MUST be the SAME as app!
-    init_info.MSAASamples = m1k_device_.maxMSAASampleCount();
+    if (m1k_renderer_.usesDynamicRendering()) {
+        // drawn in the overlay pass, after the MSAA resolve
+        init_info.UseDynamicRendering = true;
+        init_info.ColorAttachmentFormat = m1k_renderer_.getSwapChainImageFormat();
+        init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    } else {
+        // NOTE!!! if enable the MSAA， this MUST be the SAME as app!
+        init_info.MSAASamples = m1k_device_.maxMSAASampleCount();
+    }
 
     ImGui_ImplVulkan_Init(&init_info, m1k_renderer_.getSwapChainRenderPass());
 
@@ -270,6 +409,12 @@ void M1kApplication::loopImGUI(FrameInfo& frame_info) {
     ImGui_ImplVulkan_NewFrame();
     ImGui::NewFrame();
 
+    // mouse picking through the scene BVH
+    if (ImGui::IsMouseClicked(ImGuiMouseButton_Left) &&
+        !ImGui::GetIO().WantCaptureMouse) {
+        pickGameObject(frame_info.camera);
+    }
+
     if (is_displaying_test_scene_) {
         // point light intensity control
         ImGui::Begin("Point Light Control");
@@ -317,15 +462,112 @@ void M1kApplication::loopImGUI(FrameInfo& frame_info) {
     }
 
     if (ImGui::Button("Clear Whole Scene")) {
-        vkDeviceWaitIdle(m1k_device_.device());
+        // models and textures nobody else holds go through the graphics
+        // timeline, frames in flight may still draw them
         game_objects_.clear();
+        has_picked_object_ = false;
         is_displaying_test_scene_ = false;
         std::cout << "M1K::INFO~~~~~~~~Cleared ALL Scene." << std::endl;
     }
 
+    if (deferred_pbr_render_system_ != nullptr) {
+        ImGui::Checkbox("Deferred Shading", &is_deferred_shading_);
+    }
+
+    if (!is_deferred_shading_) {
+        bool is_depth_prepass_enabled = bindless_pbr_render_system_->isDepthPrepassEnabled();
+        if (ImGui::Checkbox("Depth Pre-pass", &is_depth_prepass_enabled)) {
+            bindless_pbr_render_system_->setDepthPrepassEnabled(is_depth_prepass_enabled);
+        }
+    }
+
+    // positive values switch to coarser levels of detail closer to the camera
+    ImGui::SliderFloat("LOD Bias", &lod_bias_, -2.0f, 4.0f);
+    ImGui::Checkbox("Meshlet Culling", &is_cluster_culling_enabled_);
+    if (is_cluster_culling_enabled_) {
+        ImGui::Text("Meshlet culling: %u meshes, %u meshlets tested",
+                    cluster_cull_system_->getCulledMeshCount(),
+                    cluster_cull_system_->getTestedMeshletCount());
+    }
+
+    ImGui::Checkbox("Shader Hot Reload", &is_shader_hot_reload_enabled_);
+
+    ImGui::Text("Point lights: %u (%ux%ux%u clusters)",
+                light_cluster_system_->getLightCount(),
+                kClusterGridX, kClusterGridY, kClusterGridZ);
+    ImGui::Text("Shadow cascades rendered: %u / %u, %u with moving casters",
+                shadow_system_->getRenderedCascadeCount(), kShadowCascadeCount,
+                shadow_system_->getDynamicCascadeCount());
+    ImGui::Text("Environment lighting: %s", ibl_system_->isEnabled() ? "IBL" : "flat ambient");
+    ImGui::Text("Scene BVH: %zu meshes, %zu nodes, %zu visible",
+                scene_bvh_.primitiveCount(), scene_bvh_.nodeCount(),
+                is_deferred_shading_ ? deferred_pbr_render_system_->getVisibleMeshCount()
+                                     : bindless_pbr_render_system_->getVisibleMeshCount());
+    auto asset_stats = asset_manager_->getStats();
+    ImGui::Text("Assets: %u models, %u textures (%u reused, %u by content)",
+                asset_stats.model_count, asset_stats.texture_count,
+                asset_stats.texture_reuses, asset_stats.texture_content_reuses);
+    auto cache_stats = m1k_device_.pipelineCache().getStats();
+    ImGui::Text("Pipeline cache: %u hits (%.1f ms), %u misses (%.1f ms)",
+                cache_stats.hit_count, cache_stats.hit_milliseconds,
+                cache_stats.miss_count, cache_stats.miss_milliseconds);
+    auto layout_stats = m1k_device_.layoutCache().getStats();
+    ImGui::Text("Layouts: %u set, %u pipeline (%u requests shared)",
+                layout_stats.set_layout_count, layout_stats.pipeline_layout_count,
+                layout_stats.reuse_count);
+    ImGui::Text("Instanced draws: %zu",
+                is_deferred_shading_ ? deferred_pbr_render_system_->getDrawCount()
+                                     : bindless_pbr_render_system_->getDrawCount());
+    if (has_picked_object_) {
+        ImGui::Text("Picked: object %u, mesh %u (t = %.3f)",
+                    picked_hit_.primitive.object_id,
+                    picked_hit_.primitive.mesh_index, picked_hit_.t);
+    }
+
     ImGui::Render();  // finish imgui frame
 }
 
+void M1kApplication::pickGameObject(const M1kCamera& camera) {
+    const ImGuiIO& io = ImGui::GetIO();
+    if (io.DisplaySize.x <= 0.0f || io.DisplaySize.y <= 0.0f) return;
+
+    glm::vec2 ndc{2.0f * io.MousePos.x / io.DisplaySize.x - 1.0f,
+                  2.0f * io.MousePos.y / io.DisplaySize.y - 1.0f};
+    glm::mat4 inv_view_projection =
+        glm::inverse(camera.getProjection() * camera.getView());
+
+    glm::vec4 near_point = inv_view_projection * glm::vec4(ndc, 0.0f, 1.0f);
+    glm::vec4 far_point = inv_view_projection * glm::vec4(ndc, 1.0f, 1.0f);
+    near_point /= near_point.w;
+    far_point /= far_point.w;
+
+    M1kRay ray{};
+    ray.origin = glm::vec3(near_point);
+    ray.direction = glm::normalize(glm::vec3(far_point - near_point));
+
+    // narrow phase against the mesh triangles, the ray taken into model
+    // space keeps t comparable as long as its direction isn't re-normalized
+    auto triangle_filter = [&](const M1kBvhPrimitive& primitive, float& t) {
+        auto it = game_objects_.find(primitive.object_id);
+        if (it == game_objects_.end() || it->second.model == nullptr) return false;
+
+        glm::mat4 inv_transform = glm::inverse(it->second.transform.worldMat4());
+        M1kRay model_ray{};
+        model_ray.origin = glm::vec3(inv_transform * glm::vec4(ray.origin, 1.0f));
+        model_ray.direction = glm::vec3(inv_transform * glm::vec4(ray.direction, 0.0f));
+        model_ray.t_max = ray.t_max;
+        return it->second.model->getMesh(primitive.mesh_index).raycast(model_ray, t);
+    };
+
+    M1kBvhHit hit{};
+    has_picked_object_ = scene_bvh_.raycast(ray, hit, triangle_filter);
+    if (has_picked_object_) {
+        picked_hit_ = hit;
+        std::cout << "M1K::INFO~~~~~~~~Picked object: " << hit.primitive.object_id
+                  << ", mesh: " << hit.primitive.mesh_index << std::endl;
+    }
+}
+
 void M1kApplication::loadGameObjects(const std::string& path,
                                      glm::vec3 pos, glm::vec3 scale) {
      if(path.empty()) {
@@ -335,14 +577,11 @@ void M1kApplication::loadGameObjects(const std::string& path,
 
      GameObjectType game_object_type = GameObjectType::PbrObject;
 
+    // a model still used by some object is shared, not loaded again
     auto target_object = M1kGameObject::createGameObject(game_object_type);
-    target_object.model = std::make_shared<M1kModel>(m1k_device_,
-                                                     *pbr_set_layout_,
-                                                     *global_pool_,
-                                                     path);
+    target_object.model = asset_manager_->loadModel(path);
     target_object.transform.translation = pos;
     target_object.transform.scale = scale;
-    target_object.transform.rotation = glm::vec3(0,90,0);
     game_objects_.emplace(target_object.getId(), std::move(target_object));
     std::cout << "M1K::INFO~~~~~~~~Load game object, path: " << path << std::endl;
 }
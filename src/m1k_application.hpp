@@ -7,15 +7,25 @@
 #include "core/m1k_buffer.hpp"
 #include "core/m1k_descriptor.hpp"
 #include "core/m1k_device.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
 #include "core/m1k_renderer.hpp"
+#include "core/m1k_shader_hot_reload.hpp"
+#include "core/m1k_shader_reflection.hpp"
+#include "objects/m1k_asset_manager.hpp"
 #include "objects/m1k_game_object.hpp"
+#include "objects/m1k_scene_bvh.hpp"
 #include "objects/m1k_texture.hpp"
 #include "ui/m1k_camera.hpp"
 #include "utils/m1k_utils.hpp"
 
 // #include "systems/pbr_render_system.hpp"
 #include "systems/point_light_system.hpp"
+#include "systems/light_cluster_system.hpp"
+#include "systems/cascaded_shadow_system.hpp"
+#include "systems/ibl_system.hpp"
+#include "systems/cluster_cull_system.hpp"
 #include "systems/bindless_pbr_render_system.hpp"
+#include "systems/deferred_pbr_render_system.hpp"
 
 #include "ui/keyboard_movement_controller.hpp"
 #include "ui/m1k_window.hpp"
@@ -24,6 +34,7 @@
 
 // std
 #include <memory>
+#include <vector>
 
 namespace m1k {
 
@@ -49,10 +60,12 @@ class M1kApplication {
    private:
     void initImGUI();
     void loopImGUI(FrameInfo& frame_info);
+    void pickGameObject(const M1kCamera& camera);
 
     M1kWindow m1k_window_{kWidth, kHeight, "Hello Vulkan"};
     M1kDevice m1k_device_{m1k_window_};
-    M1kRenderer m1k_renderer_{m1k_window_, m1k_device_};
+    M1kThreadPool thread_pool_{};
+    M1kRenderer m1k_renderer_{m1k_window_, m1k_device_, thread_pool_};
 
     // 这个unique_ptr总觉得要暴雷，最好注意一下内存管理
     std::unique_ptr<M1kDescriptorSetLayout> global_set_layout_{};
@@ -63,14 +76,31 @@ class M1kApplication {
     std::unique_ptr<M1kDescriptorPool> bindless_pool_{};
     std::unique_ptr<M1kDescriptorPool> imgui_pool_{};
 
+    // objects loading the same file share its model and are drawn instanced
+    std::unique_ptr<M1kAssetManager> asset_manager_;
     M1kGameObject::Map game_objects_{};
+    M1kSceneBvh scene_bvh_{};
+    // gathered every frame, reused to avoid reallocating
+    std::vector<PointLight> point_lights_{};
 
     std::unique_ptr<PointLightSystem> point_light_system_;
+    std::unique_ptr<LightClusterSystem> light_cluster_system_;
+    std::unique_ptr<CascadedShadowSystem> shadow_system_;
+    std::unique_ptr<IblSystem> ibl_system_;
+    std::unique_ptr<ClusterCullSystem> cluster_cull_system_;
     // std::unique_ptr<PbrRenderSystem> pbr_render_system_;
     std::unique_ptr<BindlessPbrRenderSystem> bindless_pbr_render_system_;
+    // null without dynamic rendering
+    std::unique_ptr<DeferredPbrRenderSystem> deferred_pbr_render_system_;
 
     // state information
     bool is_displaying_test_scene_ = false;
+    bool has_picked_object_ = false;
+    bool is_deferred_shading_ = kDefaultDeferredShading;
+    float lod_bias_ = 0.0f;
+    bool is_cluster_culling_enabled_ = true;
+    bool is_shader_hot_reload_enabled_ = kDefaultShaderHotReload;
+    M1kBvhHit picked_hit_{};
     const std::string default_model_select_path_ =
         "../assets/models/glTF";
 };
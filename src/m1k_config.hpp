@@ -9,14 +9,122 @@ static constexpr int kWindowWidth = 1366;
 static constexpr int kWindowHeight = 768;
 
 static constexpr float kMaxFrameTime = 0.5f;
+
+static constexpr float kCameraNear = 0.1f;
+static constexpr float kCameraFar = 200.0f;
+
+// frames the CPU may record ahead of the GPU, chosen when the renderer is created
+static constexpr uint32_t kDefaultFramesInFlight = 2;
+static constexpr uint32_t kMaxFramesInFlight = 4;
+
+// MSAA color and depth are allocated in steps of this many pixels, so
+// dragging the window edge doesn't reallocate them every frame
+static constexpr uint32_t kAttachmentExtentGranularity = 256;
+// vkCmdBeginRendering instead of render pass + framebuffers, falls back to
+// render passes on devices without dynamic rendering
+static constexpr bool kUseDynamicRendering = true;
 static constexpr int kMaxMaterialsNumber = 200;
 
 static constexpr int kMaxGlobalPoolSetSize = 1024;
 static constexpr int kMaxBindlessResources = 1024;
 static constexpr int kBindlessTextureBinding = 0;
 
-static const std::string kDefaultPipelineCacheDirectory =
-    "./PipelineCache";
+// below this many draws per job the recording overhead isn't worth a thread
+static constexpr uint32_t kMinDrawsPerRecordJob = 64;
+// lay down depth first so the PBR shading runs once per visible pixel
+static constexpr bool kDefaultDepthPrepass = true;
+// G-buffer + full-screen lighting instead of forward shading, needs dynamic
+// rendering for the render graph attachments
+static constexpr bool kDefaultDeferredShading = false;
+
+// clustered lighting, view space froxels with logarithmic depth slices
+static constexpr uint32_t kMaxPointLights = 4096;
+static constexpr uint32_t kClusterGridX = 16;
+static constexpr uint32_t kClusterGridY = 9;
+static constexpr uint32_t kClusterGridZ = 24;
+// must match MAX_LIGHTS_PER_CLUSTER in the shaders
+static constexpr uint32_t kMaxLightsPerCluster = 128;
+// a point light stops at the distance where intensity / d^2 drops below this
+static constexpr float kPointLightCutoff = 0.005f;
+
+// cascaded shadow maps for direct_light, the shaders assume 4 cascades
+static constexpr uint32_t kShadowCascadeCount = 4;
+static constexpr uint32_t kShadowMapResolution = 2048;
+static constexpr float kShadowDistance = 60.0f;
+// 0: uniform splits, 1: logarithmic splits
+static constexpr float kShadowSplitLambda = 0.75f;
+// casters this far beyond a cascade towards the light still cast into it
+static constexpr float kShadowCasterExtension = 50.0f;
+// cascades are rendered this much larger than their view slice, the cached
+// map stays valid until the slice leaves the margin
+static constexpr float kShadowCacheMargin = 1.25f;
+
+// image based lighting, an equirectangular HDR baked into irradiance and
+// prefiltered specular cubes plus a BRDF LUT; flat ambient if the file is missing.
+// The shipped one is a small procedural sky, replace it for real lighting
+static const std::string kEnvironmentMapPath =
+    "../assets/textures/environment.hdr";
+static const std::string kIblCacheDirectory = "./IblCache";
+static constexpr uint32_t kIrradianceMapSize = 32;
+static constexpr uint32_t kPrefilteredMapSize = 128;
+// roughness 0 to 1 across the mips
+static constexpr uint32_t kPrefilteredMipLevels = 6;
+static constexpr uint32_t kBrdfLutSize = 128;
+static constexpr uint32_t kIblSampleCount = 512;
+
+// 20 byte vertices instead of the 48 byte M1kVertex (see M1kPackedVertex)
+// and 16-bit indices for meshes with at most 65536 vertices
+static constexpr bool kUsePackedVertices = true;
+
+// merge identical vertices and index non-indexed primitives on import
+static constexpr bool kWeldVerticesOnImport = true;
+
+// import time index reordering, see m1k_mesh_optimizer.hpp
+static constexpr bool kOptimizeMeshesOnImport = true;
+// FIFO size the post-transform cache is simulated and optimized with
+static constexpr uint32_t kVertexCacheSize = 16;
+// overdraw clusters may cost this much more ACMR than the whole mesh, 0 keeps
+// the vertex cache order
+static constexpr float kOverdrawThreshold = 1.05f;
+
+// quadric simplified levels of detail sharing each mesh's vertex buffer
+static constexpr bool kGenerateMeshLods = true;
+static constexpr uint32_t kMeshLodCount = 4;          // including full detail
+static constexpr float kMeshLodReduction = 0.5f;      // triangles kept per level
+static constexpr float kMeshLodMaxError = 0.05f;      // of the bounding radius
+// a level is used while its error covers at most this much of the screen
+// height (about a pixel at 1080p), scaled by 2^lod_bias
+static constexpr float kLodScreenError = 1.0f / 1080.0f;
+
+// meshlets of lod 0 for GPU cluster culling, the mesh shader friendly limits
+static constexpr bool kBuildMeshlets = true;
+static constexpr uint32_t kMeshletMaxVertices = 64;
+static constexpr uint32_t kMeshletMaxTriangles = 124;
+// meshes with fewer meshlets are drawn whole, the culling isn't worth a dispatch
+static constexpr uint32_t kMinMeshletsForClusterCulling = 4;
+// per frame capacity of the cluster culling output
+static constexpr uint32_t kMaxClusterCulledMeshes = 1024;
+static constexpr uint32_t kMaxClusterDrawCommands = 65536;
+
+// per frame capacity of the instance transforms of one render system, the
+// shadow cascades share theirs
+static constexpr uint32_t kMaxInstancesPerFrame = 32768;
+
+// bound wherever a material has no texture, loaded once by M1kAssetManager
+static const std::string kDummyTexturePath =
+    "../assets/textures/dummy_texture.png";
+
+// the device wide pipeline cache, see M1kPipelineCache
 static const std::string kDefaultPipelineCachePath =
     "./PipelineCache/pipeline_cache";
 
+
+// recompile changed shader sources while running, see M1kShaderHotReload
+static constexpr bool kDefaultShaderHotReload = true;
+static constexpr float kShaderWatchInterval = 0.5f;   // seconds between scans
+// relative to the build directory the engine runs in, binaries named as the
+// Shaders target names them
+static const std::string kShaderSourceDirectory = "../shaders/sources";
+static const std::string kShaderBinaryDirectory = "./shaders/binaries";
+// SPIR-V by source hash, reverting an edit doesn't compile again
+static const std::string kShaderCacheDirectory = "./ShaderCache";
@@ -9,11 +9,9 @@
 
 namespace m1k {
 
-
-#define MAX_LIGHTS 10
-
+// std430 element of the point light storage buffer
 struct alignas( 16 ) PointLight {
-    glm::vec4 position{};   // ignore w
+    glm::vec4 position{};   // w is the range
     glm::vec4 color{};  // w is intensity
 };
 
@@ -23,9 +21,15 @@ struct alignas( 16 ) GlobalUbo {
     glm::mat4 view_matrix{1.0f};
     glm::mat4 inverse_view_matrix{1.0f};    // last column is the camera position
     glm::vec4 ambient_light_color{1.0f, 1.0f, 1.0f, 0.001f}; // rgb,intensity
-    glm::vec4 direct_light{1.0f, -1.0f, 1.0f, 0.5f};  // x,y,z,intensity
-    struct PointLight point_lights[MAX_LIGHTS];
-    uint32_t num_lights;
+    glm::vec4 direct_light{1.0f, -1.0f, 1.0f, 0.5f};  // direction towards the light, intensity
+    glm::uvec4 cluster_grid{0};  // x,y,z: cluster counts, w: ignore
+    glm::vec4 cluster_depth{0.0f};  // near, far, slice scale, slice bias
+    glm::vec4 viewport_extent{0.0f};  // width, height, 1 / width, 1 / height
+    glm::mat4 shadow_matrices[4]{};  // kShadowCascadeCount, light view projection
+    glm::vec4 shadow_cascade_splits{0.0f};  // far view depth of each cascade
+    glm::vec4 shadow_texel_sizes{0.0f};  // world size of one shadow texel
+    uint32_t num_lights = 0;
+    uint32_t ibl_prefiltered_mips = 0;  // 0: no environment, flat ambient
 };
 
 struct alignas( 16 ) MaterialUbo {
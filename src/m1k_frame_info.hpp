@@ -6,6 +6,8 @@
 
 #include "m1k_data_struct.hpp"
 #include "m1k_game_object.hpp"
+#include "m1k_scene_bvh.hpp"
+#include "core/m1k_renderer.hpp"
 #include "ui/m1k_camera.hpp"
 
 // lib
@@ -14,6 +16,8 @@
 
 namespace m1k {
 
+class ClusterCullSystem;
+
 struct FrameInfo {
     int frame_index;
     float frame_time;
@@ -22,6 +26,12 @@ struct FrameInfo {
     VkDescriptorSet global_descriptor_set;
     VkDescriptorSet bindless_descriptor_set;
     M1kGameObject::Map &game_objects;
+    M1kSceneBvh &scene_bvh;
+    M1kRenderer &renderer;
+    float lod_bias;     // see M1kMesh::selectLod
+    // null with meshlet culling off, otherwise lod 0 meshes with meshlets
+    // draw the commands it culled
+    const ClusterCullSystem *cluster_cull_system;
 };
 
 
@@ -0,0 +1,143 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_asset_manager.hpp"
+#include "m1k_config.hpp"
+#include "m1k_utils.hpp"
+
+// std
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace m1k {
+
+namespace {
+
+// a hash match only nominates a candidate, the bytes decide
+bool hasFileContents(const std::string &path, const char *data, size_t size) {
+    char *file_data = nullptr;
+    size_t file_size = 0;
+    if (!readFileBinary(path, &file_data, &file_size)) {
+        return false;
+    }
+    std::unique_ptr<char[]> file{file_data};
+    return file_size == size && std::memcmp(file.get(), data, size) == 0;
+}
+
+// the entries of released assets, so the maps don't keep every key ever loaded
+template <typename Map>
+void eraseExpired(Map &cache) {
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it->second.expired()) {
+            it = cache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+}
+
+M1kAssetManager::M1kAssetManager(M1kDevice &device,
+                                 M1kDescriptorSetLayout &pbr_set_layout,
+                                 M1kDescriptorPool &pool,
+                                 M1kThreadPool &thread_pool)
+    : m1k_device_(device), pbr_set_layout_(pbr_set_layout), pool_(pool),
+      thread_pool_(thread_pool) {
+    dummy_texture_ = loadTexture(kDummyTexturePath);
+}
+
+std::string M1kAssetManager::canonicalPath(const std::string &path) {
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.generic_string();
+}
+
+template <typename T>
+std::shared_ptr<T> M1kAssetManager::makeAsset(T *asset) {
+    M1kDevice *device = &m1k_device_;
+    return std::shared_ptr<T>(asset, [device](T *released) {
+        device->graphicsTimeline().deferDestroy([released]() { delete released; });
+    });
+}
+
+std::shared_ptr<M1kModel> M1kAssetManager::loadModel(const std::string &path) {
+    std::string key = canonicalPath(path);
+    if (auto model = models_[key].lock()) {
+        ++model_reuses_;
+        std::cout << "M1K::INFO~~~~~~~~Model already loaded, shared: " << key << std::endl;
+        return model;
+    }
+
+    auto model = makeAsset(new M1kModel(m1k_device_, pbr_set_layout_, pool_,
+                                        thread_pool_, *this, key));
+    eraseExpired(models_);
+    models_[key] = model;
+    return model;
+}
+
+std::shared_ptr<M1kTexture> M1kAssetManager::loadTexture(const std::string &path) {
+    std::string key = canonicalPath(path);
+    if (auto texture = textures_[key].lock()) {
+        ++texture_reuses_;
+        return texture;
+    }
+
+    char *file_data = nullptr;
+    size_t file_size = 0;
+    if (!readFileBinary(key, &file_data, &file_size)) {
+        throw std::runtime_error("M1k::ERR++++++++failed to read texture file: " + path);
+    }
+    std::unique_ptr<char[]> file{file_data};
+
+    // same bytes under another path
+    uint64_t content_hash = fnv1a(file.get(), file_size);
+    content_hash = fnv1a(&file_size, sizeof(file_size), content_hash);
+    auto texture = textures_by_content_[content_hash].lock();
+    if (texture && hasFileContents(texture->getTextureFilePath(), file.get(), file_size)) {
+        ++texture_reuses_;
+        ++texture_content_reuses_;
+        textures_[key] = texture;
+        std::cout << "M1K::INFO~~~~~~~~Texture " << key << " has the same contents as "
+                  << texture->getTextureFilePath() << ", shared." << std::endl;
+        return texture;
+    }
+
+    texture = makeAsset(new M1kTexture(m1k_device_, key, file.get(), file_size));
+    eraseExpired(textures_);
+    eraseExpired(textures_by_content_);
+    textures_[key] = texture;
+    textures_by_content_[content_hash] = texture;
+    new_textures_.push_back(texture);
+    return texture;
+}
+
+std::vector<std::shared_ptr<M1kTexture>> M1kAssetManager::takeNewTextures() {
+    std::vector<std::shared_ptr<M1kTexture>> textures;
+    textures.swap(new_textures_);
+    return textures;
+}
+
+M1kAssetManager::Stats M1kAssetManager::getStats() const {
+    Stats stats{};
+    for (const auto &kv : models_) {
+        if (!kv.second.expired()) ++stats.model_count;
+    }
+    // a texture has one entry per path it was loaded under, a content hash
+    // collision leaves one without a content entry
+    std::unordered_set<const M1kTexture *> textures;
+    for (const auto &kv : textures_) {
+        if (auto texture = kv.second.lock()) textures.insert(texture.get());
+    }
+    stats.texture_count = static_cast<uint32_t>(textures.size());
+    stats.model_reuses = model_reuses_;
+    stats.texture_reuses = texture_reuses_;
+    stats.texture_content_reuses = texture_content_reuses_;
+    return stats;
+}
+
+}
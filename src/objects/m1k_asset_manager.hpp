@@ -0,0 +1,89 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_descriptor.hpp"
+#include "m1k_device.hpp"
+#include "m1k_model.hpp"
+#include "m1k_texture.hpp"
+#include "m1k_thread_pool.hpp"
+
+// std
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Engine wide cache of the models and textures loaded from disk.
+ *
+ * Models are looked up by canonical path, textures by canonical path and then
+ * by the FNV-1a hash of the file, so an image two models share, or a copy of
+ * it under another name, is decoded and uploaded once. A hash match is only
+ * shared after the bytes compared equal, a collision loads its own texture.
+ *
+ * Handles are shared_ptrs and the cache only keeps weak references, expired
+ * ones are swept whenever a new asset is added. When the last holder lets go
+ * the asset is queued on the graphics timeline and its GPU memory released
+ * once no frame in flight can read it; its bindless slot is reused by the
+ * next texture. The dummy texture stays loaded for the lifetime of the
+ * manager.
+ *
+ * Main thread only, like the timeline it releases through.
+ */
+class M1kAssetManager {
+   public:
+    struct Stats {
+        uint32_t model_count = 0;       // alive
+        uint32_t texture_count = 0;
+        uint32_t model_reuses = 0;      // loads served from the cache
+        uint32_t texture_reuses = 0;
+        uint32_t texture_content_reuses = 0;  // of those, found by content hash
+    };
+
+    M1kAssetManager(M1kDevice &device,
+                    M1kDescriptorSetLayout &pbr_set_layout,
+                    M1kDescriptorPool &pool,
+                    M1kThreadPool &thread_pool);
+
+    M1kAssetManager(const M1kAssetManager&) = delete;
+    M1kAssetManager &operator=(const M1kAssetManager&) = delete;
+
+    std::shared_ptr<M1kModel> loadModel(const std::string &path);
+    // throws if the file can't be read or decoded
+    std::shared_ptr<M1kTexture> loadTexture(const std::string &path);
+    const std::shared_ptr<M1kTexture> &getDummyTexture() const { return dummy_texture_; }
+
+    // textures created since the last call, their bindless slots need writing
+    std::vector<std::shared_ptr<M1kTexture>> takeNewTextures();
+
+    Stats getStats() const;
+
+   private:
+    static std::string canonicalPath(const std::string &path);
+    // released through the graphics timeline instead of on the spot
+    template <typename T>
+    std::shared_ptr<T> makeAsset(T *asset);
+
+    M1kDevice &m1k_device_;
+    M1kDescriptorSetLayout &pbr_set_layout_;
+    M1kDescriptorPool &pool_;
+    M1kThreadPool &thread_pool_;
+
+    std::unordered_map<std::string, std::weak_ptr<M1kModel>> models_{};
+    std::unordered_map<std::string, std::weak_ptr<M1kTexture>> textures_{};
+    std::unordered_map<uint64_t, std::weak_ptr<M1kTexture>> textures_by_content_{};
+    std::vector<std::shared_ptr<M1kTexture>> new_textures_{};
+    std::shared_ptr<M1kTexture> dummy_texture_;
+
+    uint32_t model_reuses_ = 0;
+    uint32_t texture_reuses_ = 0;
+    uint32_t texture_content_reuses_ = 0;
+};
+
+}
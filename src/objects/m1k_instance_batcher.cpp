@@ -0,0 +1,150 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_instance_batcher.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <iostream>
+
+namespace m1k {
+
+namespace {
+
+// the mesh streams take locations 0 to 3
+constexpr uint32_t kInstanceBinding = 1;
+constexpr uint32_t kInstanceFirstLocation = 4;
+
+}
+
+M1kInstanceBatcher::M1kInstanceBatcher(M1kDevice &device, uint32_t frames_in_flight)
+    : m1k_device_(device) {
+    instance_buffers_.resize(frames_in_flight);
+    for (auto &buffer : instance_buffers_) {
+        // written by the host every frame
+        buffer = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(M1kInstanceData), kMaxInstancesPerFrame,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        buffer->map();
+    }
+}
+
+std::vector<VkVertexInputBindingDescription> M1kInstanceBatcher::getBindingDescriptions() {
+    return {{kInstanceBinding, sizeof(M1kInstanceData), VK_VERTEX_INPUT_RATE_INSTANCE}};
+}
+
+std::vector<VkVertexInputAttributeDescription> M1kInstanceBatcher::getAttributeDescriptions(
+    bool is_positions_only) {
+    std::vector<VkVertexInputAttributeDescription> attribute_descriptions{};
+
+    // a mat4 input takes one location per column
+    uint32_t column_count = is_positions_only ? 4 : 8;
+    for (uint32_t i = 0; i < column_count; ++i) {
+        attribute_descriptions.push_back({kInstanceFirstLocation + i, kInstanceBinding,
+                                          VK_FORMAT_R32G32B32A32_SFLOAT,
+                                          static_cast<uint32_t>(sizeof(glm::vec4) * i)});
+    }
+    return attribute_descriptions;
+}
+
+void M1kInstanceBatcher::addVertexInput(PipelineConfigInfo &config, bool is_positions_only) {
+    auto binding_descriptions = getBindingDescriptions();
+    auto attribute_descriptions = getAttributeDescriptions(is_positions_only);
+    config.binding_descriptions.insert(config.binding_descriptions.end(),
+                                       binding_descriptions.begin(),
+                                       binding_descriptions.end());
+    config.attribute_descriptions.insert(config.attribute_descriptions.end(),
+                                         attribute_descriptions.begin(),
+                                         attribute_descriptions.end());
+}
+
+void M1kInstanceBatcher::begin(int frame_index) {
+    frame_index_ = frame_index;
+    instance_count_ = 0;
+}
+
+void M1kInstanceBatcher::batch(const FrameInfo &frame_info,
+                               const std::vector<M1kBvhPrimitive> &primitives,
+                               std::vector<M1kInstancedDraw> &draws) {
+    entries_.clear();
+    for (const auto &primitive : primitives) {
+        auto it = frame_info.game_objects.find(primitive.object_id);
+        if (it == frame_info.game_objects.end()) continue;
+
+        auto &obj = it->second;
+        if (obj.getType() != GameObjectType::PbrObject || obj.model == nullptr) continue;
+
+        Entry entry{};
+        entry.model = obj.model.get();
+        entry.primitive = primitive;
+        entry.transform = obj.transform.worldMat4();
+        entry.lod = entry.model->selectMeshLod(primitive.mesh_index, frame_info.camera,
+                                               frame_info.lod_bias, entry.transform);
+        entries_.push_back(entry);
+    }
+
+    // object id last keeps the order stable between frames
+    std::sort(entries_.begin(), entries_.end(), [](const Entry &a, const Entry &b) {
+        if (a.model != b.model) return a.model < b.model;
+        if (a.primitive.mesh_index != b.primitive.mesh_index) {
+            return a.primitive.mesh_index < b.primitive.mesh_index;
+        }
+        if (a.lod != b.lod) return a.lod < b.lod;
+        return a.primitive.object_id < b.primitive.object_id;
+    });
+
+    auto *instances = static_cast<M1kInstanceData *>(
+        instance_buffers_[frame_index_]->getMappedMemory());
+
+    size_t first = 0;
+    while (first < entries_.size()) {
+        const Entry &head = entries_[first];
+        size_t last = first + 1;
+        while (last < entries_.size() && entries_[last].model == head.model &&
+               entries_[last].primitive.mesh_index == head.primitive.mesh_index &&
+               entries_[last].lod == head.lod) {
+            ++last;
+        }
+
+        uint32_t run_count = static_cast<uint32_t>(last - first);
+        if (instance_count_ + run_count > kMaxInstancesPerFrame) {
+            if (!has_warned_overflow_) {
+                std::cout << "M1K::WARN========Instance buffer full, "
+                             "the remaining objects are not drawn." << std::endl;
+                has_warned_overflow_ = true;
+            }
+            break;
+        }
+
+        M1kInstancedDraw draw{};
+        draw.primitive = head.primitive;
+        draw.model = head.model;
+        draw.lod = head.lod;
+        draw.first_instance = instance_count_;
+        draw.instance_count = run_count;
+        draws.push_back(draw);
+
+        for (size_t i = first; i < last; ++i) {
+            M1kInstanceData &instance = instances[instance_count_++];
+            instance.model = entries_[i].transform;
+            instance.normal = glm::mat4(
+                glm::transpose(glm::inverse(glm::mat3(entries_[i].transform))));
+        }
+        first = last;
+    }
+}
+
+void M1kInstanceBatcher::bind(VkCommandBuffer command_buffer,
+                              const M1kInstancedDraw &draw) const {
+    VkBuffer buffers[] = {instance_buffers_[frame_index_]->getBuffer()};
+    VkDeviceSize offsets[] = {sizeof(M1kInstanceData) * draw.first_instance};
+    vkCmdBindVertexBuffers(command_buffer, kInstanceBinding, 1, buffers, offsets);
+}
+
+}
@@ -0,0 +1,95 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_buffer.hpp"
+#include "m1k_device.hpp"
+#include "m1k_pipeline.hpp"
+#include "m1k_config.hpp"
+#include "m1k_frame_info.hpp"
+#include "m1k_game_object.hpp"
+#include "m1k_scene_bvh.hpp"
+
+// std
+#include <memory>
+#include <vector>
+
+namespace m1k {
+
+// one entry of the instance stream, locations 4 to 11 of the mesh shaders
+struct M1kInstanceData {
+    glm::mat4 model{1.0f};      // object placement, see TransformComponent::worldMat4
+    glm::mat4 normal{1.0f};     // inverse transpose of model, upper 3x3 used
+};
+
+// one mesh of one model at one level, drawn for instance_count objects
+struct M1kInstancedDraw {
+    M1kBvhPrimitive primitive{};    // of the first instance, keys cluster culled draws
+    M1kModel *model = nullptr;
+    uint32_t lod = 0;
+    uint32_t first_instance = 0;    // into this frame's instance buffer
+    uint32_t instance_count = 0;
+    M1kPipeline *pipeline = nullptr;    // material permutation, set by the render system
+};
+
+/*
+ * Groups the visible primitives of objects sharing a model.
+ *
+ * Primitives are sorted by model, mesh and level of detail, each run becomes
+ * a single M1kInstancedDraw and the world transforms of its objects go to a
+ * host visible per-frame buffer bound as an instance rate vertex stream at
+ * binding 1. A thousand copies of a prop then cost one vkCmdDrawIndexed per
+ * mesh instead of a thousand.
+ *
+ * The binding is placed at the draw's first instance, so draws keep
+ * firstInstance 0 and indirect commands written by the cluster culling pass
+ * work unchanged.
+ */
+class M1kInstanceBatcher {
+   public:
+    M1kInstanceBatcher(M1kDevice &device, uint32_t frames_in_flight);
+
+    M1kInstanceBatcher(const M1kInstanceBatcher&) = delete;
+    M1kInstanceBatcher &operator=(const M1kInstanceBatcher&) = delete;
+
+    // binding 1, appended to the mesh vertex input of a pipeline
+    static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
+    // positions only pipelines skip the normal matrix
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
+        bool is_positions_only);
+    // appends the above to the mesh vertex input already in config
+    static void addVertexInput(PipelineConfigInfo &config, bool is_positions_only);
+
+    // starts over in the buffer of frame_index, the frame that used it last
+    // has finished
+    void begin(int frame_index);
+    // appends the draws of primitives, with the level every pass drawing
+    // them agrees on; the objects the buffer can't take are dropped
+    void batch(const FrameInfo &frame_info,
+               const std::vector<M1kBvhPrimitive> &primitives,
+               std::vector<M1kInstancedDraw> &draws);
+    // the instance stream at draw.first_instance, safe from several workers
+    void bind(VkCommandBuffer command_buffer, const M1kInstancedDraw &draw) const;
+
+    uint32_t getInstanceCount() const { return instance_count_; }
+
+   private:
+    struct Entry {
+        M1kModel *model = nullptr;
+        M1kBvhPrimitive primitive{};
+        uint32_t lod = 0;
+        glm::mat4 transform{1.0f};
+    };
+
+    M1kDevice &m1k_device_;
+    std::vector<std::unique_ptr<M1kBuffer>> instance_buffers_{};
+    int frame_index_ = 0;
+    uint32_t instance_count_ = 0;
+    bool has_warned_overflow_ = false;
+
+    std::vector<Entry> entries_{};
+};
+
+}
@@ -4,62 +4,238 @@
 
 #include "m1k_mesh.hpp"
 
+// libs
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// std
+#include <algorithm>
+#include <cmath>
+
 
 namespace m1k {
 
+namespace {
+
+// octahedral mapping onto [-1, 1]^2, matches octahedral_decode in the shaders
+glm::vec2 octahedralEncode(const glm::vec3& v) {
+    float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (length == 0.0f) return glm::vec2{0.0f};
+
+    glm::vec3 n = v / length;
+    glm::vec2 e{n.x, n.y};
+    if (n.z < 0.0f) {
+        e = (1.0f - glm::abs(glm::vec2{n.y, n.x})) *
+            glm::vec2{n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f};
+    }
+    return e;
+}
+
+void packSnorm2(const glm::vec2& v, int16_t out[2]) {
+    uint32_t packed = glm::packSnorm2x16(v);
+    out[0] = static_cast<int16_t>(packed & 0xffff);
+    out[1] = static_cast<int16_t>(packed >> 16);
+}
+
+}
+
 M1kMesh::M1kMesh(M1kDevice& device,
                  M1kDescriptorSetLayout &set_layout,
                  M1kDescriptorPool &pool,
                  std::vector<M1kVertex>& vertices,
-                 std::vector<uint32_t>& indices, M1kMaterialSet material_set, uint32_t flags)
-    : m1k_device_(device), vertices_(vertices), indices_(indices),
-      material_set_(material_set), flags_(flags)
+                 std::vector<uint32_t>& indices, M1kMaterialSet material_set, uint32_t flags,
+                 std::vector<M1kMeshLod> lods,
+                 std::vector<M1kMeshlet> meshlets)
+    : m1k_device_(device), vertices_(vertices), indices_(indices), lods_(std::move(lods)),
+      meshlets_(std::move(meshlets)), material_set_(material_set), flags_(flags)
 {
-      createVertexBuffers(vertices_);
+      if (lods_.empty()) {
+          lods_.push_back({0, static_cast<uint32_t>(indices_.size()), 0.0f});
+      }
+      computeBounds();
+      if (kUsePackedVertices) {
+          flags_ |= kMaterialFeaturePackedVertex;
+          createPackedVertexBuffers(vertices_);
+      } else {
+          createVertexBuffers(vertices_);
+          createPositionBuffer(vertices_);
+      }
       createIndexBuffers(indices_);
+      if (!meshlets_.empty()) {
+          // read by the culling pass on the async compute queue
+          meshlet_buffer_ = createDeviceLocalBuffer(meshlets_.data(), sizeof(M1kMeshlet),
+                                                    static_cast<uint32_t>(meshlets_.size()),
+                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                                    VK_ACCESS_SHADER_READ_BIT, true);
+      }
       createDescriptorSets(set_layout, pool);
 }
 
 std::vector<VkVertexInputBindingDescription> M1kMesh::getBindingDescriptions() {
+    if (kUsePackedVertices) {
+        return {{0, sizeof(M1kPackedVertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+    }
     return {{0, sizeof(M1kVertex), VK_VERTEX_INPUT_RATE_VERTEX}};
 }
 
 std::vector<VkVertexInputAttributeDescription> M1kMesh::getAttributeDescriptions() {
     std::vector<VkVertexInputAttributeDescription> attribute_descriptions{};
 
+    if (kUsePackedVertices) {
+        attribute_descriptions.push_back({0,0,VK_FORMAT_R16G16B16A16_UNORM,static_cast<uint32_t>(offsetof(M1kPackedVertex, position))});
+        attribute_descriptions.push_back({1,0,VK_FORMAT_R16G16_SNORM,static_cast<uint32_t>(offsetof(M1kPackedVertex, normal))});
+        attribute_descriptions.push_back({2,0,VK_FORMAT_R16G16_SNORM,static_cast<uint32_t>(offsetof(M1kPackedVertex, tangent))});
+        attribute_descriptions.push_back({3,0,VK_FORMAT_R16G16_SFLOAT,static_cast<uint32_t>(offsetof(M1kPackedVertex, uv))});
+        return attribute_descriptions;
+    }
+
     attribute_descriptions.push_back({0,0,VK_FORMAT_R32G32B32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, position))});
-    attribute_descriptions.push_back({1,0,VK_FORMAT_R32G32B32A32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, normal))});
-    attribute_descriptions.push_back({2,0,VK_FORMAT_R32G32B32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, tangent))});
+    attribute_descriptions.push_back({1,0,VK_FORMAT_R32G32B32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, normal))});
+    attribute_descriptions.push_back({2,0,VK_FORMAT_R32G32B32A32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, tangent))});
     attribute_descriptions.push_back({3,0,VK_FORMAT_R32G32_SFLOAT,static_cast<uint32_t>(offsetof(M1kVertex, uv))});
 
     return attribute_descriptions;
 }
 
+std::vector<VkVertexInputBindingDescription> M1kMesh::getPositionBindingDescriptions() {
+    if (kUsePackedVertices) {
+        return {{0, sizeof(M1kPackedVertex::position), VK_VERTEX_INPUT_RATE_VERTEX}};
+    }
+    return {{0, sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX}};
+}
+
+std::vector<VkVertexInputAttributeDescription> M1kMesh::getPositionAttributeDescriptions() {
+    // same format as the full stream, so both positions transform bit for bit equal
+    if (kUsePackedVertices) {
+        return {{0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0}};
+    }
+    return {{0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+}
+
+void M1kMesh::computeBounds() {
+    local_bounds_ = M1kAabb{};
+    for (const auto& vertex : vertices_) {
+        local_bounds_.expand(vertex.position);
+    }
+    bounds_ = local_bounds_.transformed(material_set_.transform);
+}
+
+VkDeviceSize M1kMesh::getGpuMemorySize() const {
+    VkDeviceSize size = vertex_buffer_->getBufferSize() + position_buffer_->getBufferSize();
+    if (has_index_buffer_) {
+        size += index_buffer_->getBufferSize();
+    }
+    if (meshlet_buffer_ != nullptr) {
+        size += meshlet_buffer_->getBufferSize();
+    }
+    return size;
+}
+
+bool M1kMesh::raycast(const M1kRay& ray, float& t) const {
+    // bring the ray into vertex space, t stays comparable since the
+    // direction is transformed without re-normalizing
+    M1kRay local_ray{};
+    local_ray.origin = glm::vec3(material_set_.inv_transform * glm::vec4(ray.origin, 1.0f));
+    local_ray.direction = glm::vec3(material_set_.inv_transform * glm::vec4(ray.direction, 0.0f));
+    local_ray.t_max = ray.t_max;
+
+    bool hit = false;
+    float closest = ray.t_max;
+    auto test_triangle = [&](uint32_t i0, uint32_t i1, uint32_t i2) {
+        float t_hit;
+        if (intersectRayTriangle(local_ray,
+                                 vertices_[i0].position,
+                                 vertices_[i1].position,
+                                 vertices_[i2].position, t_hit) &&
+            t_hit < closest) {
+            closest = t_hit;
+            hit = true;
+        }
+    };
+
+    if (!indices_.empty()) {
+        // full detail only, the coarser levels follow it in indices_
+        for (size_t i = 0; i + 2 < lods_[0].index_count; i += 3) {
+            test_triangle(indices_[i], indices_[i + 1], indices_[i + 2]);
+        }
+    } else {
+        for (uint32_t i = 0; i + 2 < vertices_.size(); i += 3) {
+            test_triangle(i, i + 1, i + 2);
+        }
+    }
+
+    if (hit) {
+        t = closest;
+    }
+    return hit;
+}
+
 void M1kMesh::createVertexBuffers(const std::vector<M1kVertex> &vertices) {
     vertex_count_ = static_cast<uint32_t>(vertices.size());
     assert(vertex_count_ >= 3 && "M1kVertex count must be at least 3");
-    VkDeviceSize buffer_size = sizeof(vertices[0]) * vertex_count_;
-    uint32_t vertex_size = sizeof(vertices[0]);
 
-    M1kBuffer staging_buffer{
-        m1k_device_,
-        vertex_size,
-        vertex_count_,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
+    vertex_buffer_ = createDeviceLocalBuffer(vertices.data(), sizeof(vertices[0]), vertex_count_,
+                                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                             VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
 
-    staging_buffer.map();
-    staging_buffer.writeToBuffer((void *)vertices.data());
+void M1kMesh::createPositionBuffer(const std::vector<M1kVertex> &vertices) {
+    // a depth-only pass fetches 12 bytes per vertex instead of the whole vertex
+    std::vector<glm::vec3> positions(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        positions[i] = vertices[i].position;
+    }
 
-    vertex_buffer_ = std::make_unique<M1kBuffer>(
-        m1k_device_,
-        vertex_size,
-        vertex_count_,
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    position_buffer_ = createDeviceLocalBuffer(positions.data(), sizeof(positions[0]), vertex_count_,
+                                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                               VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                               VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
 
-    m1k_device_.copyBuffer(staging_buffer.getBuffer(), vertex_buffer_->getBuffer(), buffer_size);
+void M1kMesh::createPackedVertexBuffers(const std::vector<M1kVertex> &vertices) {
+    vertex_count_ = static_cast<uint32_t>(vertices.size());
+    assert(vertex_count_ >= 3 && "M1kVertex count must be at least 3");
+
+    // flat axes keep extent 0, every vertex then sits on the minimum
+    glm::vec3 extent = local_bounds_.extent();
+    glm::vec3 inverse_extent{extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                             extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                             extent.z > 0.0f ? 1.0f / extent.z : 0.0f};
+
+    std::vector<M1kPackedVertex> packed_vertices(vertex_count_);
+    std::vector<decltype(M1kPackedVertex::position)> positions(vertex_count_);
+    for (size_t i = 0; i < vertex_count_; ++i) {
+        const auto& vertex = vertices[i];
+        auto& packed = packed_vertices[i];
+
+        glm::vec3 unorm = glm::clamp((vertex.position - local_bounds_.min) * inverse_extent, 0.0f, 1.0f);
+        for (int axis = 0; axis < 3; ++axis) {
+            packed.position[axis] = static_cast<uint16_t>(std::lround(unorm[axis] * 65535.0f));
+        }
+        packed.position[3] = vertex.tangent.w < 0.0f ? 0 : 65535;
+
+        packSnorm2(octahedralEncode(vertex.normal), packed.normal);
+        // the tangent is a direction in the unorm position space, so the
+        // dequantizing model matrix maps it the way it maps the positions
+        packSnorm2(octahedralEncode(glm::vec3(vertex.tangent) * inverse_extent), packed.tangent);
+
+        uint32_t uv = glm::packHalf2x16(vertex.uv);
+        packed.uv[0] = static_cast<uint16_t>(uv & 0xffff);
+        packed.uv[1] = static_cast<uint16_t>(uv >> 16);
+
+        std::copy(std::begin(packed.position), std::end(packed.position), std::begin(positions[i]));
+    }
+
+    vertex_buffer_ = createDeviceLocalBuffer(packed_vertices.data(), sizeof(M1kPackedVertex),
+                                             vertex_count_, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                             VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    position_buffer_ = createDeviceLocalBuffer(positions.data(), sizeof(positions[0]),
+                                               vertex_count_, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                               VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                               VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 }
 
 void M1kMesh::createIndexBuffers(const std::vector<uint32_t> &indices) {
@@ -70,29 +246,61 @@ void M1kMesh::createIndexBuffers(const std::vector<uint32_t> &indices) {
     }
 
     assert(index_count_ >= 3 && "Index count must be at least 3");
-    VkDeviceSize buffer_size = sizeof(indices[0]) * index_count_;
-    uint32_t index_size = sizeof(indices[0]);
 
-    M1kBuffer staging_buffer {
+    // half the index bandwidth whenever the vertices fit
+    if (kUsePackedVertices && vertex_count_ <= 65536) {
+        std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+        index_type_ = VK_INDEX_TYPE_UINT16;
+        index_buffer_ = createDeviceLocalBuffer(short_indices.data(), sizeof(uint16_t), index_count_,
+                                                VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                                VK_ACCESS_INDEX_READ_BIT);
+        return;
+    }
+
+    // staging buffer_ is good for static data
+    index_type_ = VK_INDEX_TYPE_UINT32;
+    index_buffer_ = createDeviceLocalBuffer(indices.data(), sizeof(indices[0]), index_count_,
+                                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                            VK_ACCESS_INDEX_READ_BIT);
+}
+
+std::unique_ptr<M1kBuffer> M1kMesh::createDeviceLocalBuffer(const void *data,
+                                                            uint32_t element_size,
+                                                            uint32_t element_count,
+                                                            VkBufferUsageFlags usage,
+                                                            VkPipelineStageFlags dst_stage,
+                                                            VkAccessFlags dst_access,
+                                                            bool share_with_compute) {
+    VkDeviceSize buffer_size = static_cast<VkDeviceSize>(element_size) * element_count;
+
+    auto staging_buffer = std::make_unique<M1kBuffer>(
         m1k_device_,
-        index_size,
-        index_count_,
+        element_size,
+        element_count,
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    staging_buffer.map();
-    staging_buffer.writeToBuffer((void*)indices.data());
+    staging_buffer->map();
+    staging_buffer->writeToBuffer(const_cast<void *>(data));
 
-    // staging buffer_ is good for static data
-    index_buffer_ = std::make_unique<M1kBuffer>(
+    auto buffer = std::make_unique<M1kBuffer>(
         m1k_device_,
-        index_size,
-        index_count_,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    m1k_device_.copyBuffer(staging_buffer.getBuffer(), index_buffer_->getBuffer(), buffer_size);
+        element_size,
+        element_count,
+        usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        1,
+        share_with_compute);
+
+    m1k_device_.copyBuffer(staging_buffer->getBuffer(), buffer->getBuffer(), buffer_size,
+                           dst_stage, dst_access, share_with_compute);
+
+    // the copy is only queued, the staging buffer lives until the frame after it
+    M1kBuffer *released = staging_buffer.release();
+    m1k_device_.graphicsTimeline().deferDestroy([released]() { delete released; });
+    return buffer;
 }
 
 void M1kMesh::createDescriptorSets(M1kDescriptorSetLayout &set_layout, M1kDescriptorPool &pool) {
@@ -106,6 +314,13 @@ void M1kMesh::createDescriptorSets(M1kDescriptorSetLayout &set_layout, M1kDescri
     MaterialUbo material_ubo;
 
     material_ubo.model = material_set_.transform;
+    if (kUsePackedVertices) {
+        // packed positions are unorm inside the local bounds, the model matrix
+        // maps them back, packed tangents too; normals still use model_inv
+        glm::mat4 dequantize = glm::translate(glm::mat4{1.0f}, local_bounds_.min);
+        dequantize = glm::scale(dequantize, local_bounds_.extent());
+        material_ubo.model = material_set_.transform * dequantize;
+    }
     material_ubo.model_inv = material_set_.inv_transform;
 
     material_ubo.color_normal_emi_occ_texture_handles.x = material_set_.base_color_texture_handle;
@@ -135,6 +350,13 @@ void M1kMesh::createDescriptorSets(M1kDescriptorSetLayout &set_layout, M1kDescri
     auto writer = M1kDescriptorWriter(set_layout, pool)
         .writeBuffer(0, &material_buffer_info);
 
+    // only read by the cluster culling pass
+    VkDescriptorBufferInfo meshlet_buffer_info{};
+    if (meshlet_buffer_ != nullptr) {
+        meshlet_buffer_info = meshlet_buffer_->descriptorInfo();
+        writer.writeBuffer(1, &meshlet_buffer_info);
+    }
+
 //    if(material_set_.base_color_texture != nullptr) {
 //        writer.writeImage(1, &material_set_.base_color_texture->getDescriptorImageInfo());
 //    }
@@ -169,15 +391,76 @@ void M1kMesh::bind(VkCommandBuffer command_buffer, VkPipelineLayout& pipeline_la
     vkCmdBindVertexBuffers(command_buffer, 0, 1, buffers, offsets);
 
     if(has_index_buffer_) {
-        vkCmdBindIndexBuffer(command_buffer, index_buffer_->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+        vkCmdBindIndexBuffer(command_buffer, index_buffer_->getBuffer(), 0, index_type_);
+    }
+}
+
+void M1kMesh::bindPositions(VkCommandBuffer command_buffer, VkPipelineLayout& pipeline_layout) {
+    // the model matrix still comes from the material UBO
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipeline_layout,
+        2, 1,
+        &mesh_descriptor_set_,
+        0, nullptr);
+
+    VkBuffer buffers[] = {position_buffer_->getBuffer()};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, buffers, offsets);
+
+    if(has_index_buffer_) {
+        vkCmdBindIndexBuffer(command_buffer, index_buffer_->getBuffer(), 0, index_type_);
     }
 }
 
-void M1kMesh::draw(VkCommandBuffer command_buffer) {
+uint32_t M1kMesh::selectLod(const M1kCamera& camera, float lod_bias,
+                           const glm::mat4& object_transform) const {
+    if (lods_.size() <= 1) return 0;
+
+    M1kAabb world_bounds = bounds_.transformed(object_transform);
+    glm::vec3 center = world_bounds.center();
+    float radius = 0.5f * glm::length(world_bounds.extent());
+    float distance = glm::length(center - camera.getPosition());
+    if (distance <= radius) return 0;
+
+    // bounding sphere radius as a fraction of the screen height
+    float screen_radius = 0.5f * radius * std::abs(camera.getProjection()[1][1]) / distance;
+    float max_error = kLodScreenError * std::exp2(lod_bias);
+
+    uint32_t lod = 0;
+    while (lod + 1 < lods_.size() && lods_[lod + 1].error * screen_radius <= max_error) {
+        lod++;
+    }
+    return lod;
+}
+
+void M1kMesh::draw(VkCommandBuffer command_buffer, uint32_t lod, uint32_t instance_count) {
     if(has_index_buffer_) {
-        vkCmdDrawIndexed(command_buffer, index_count_, 1, 0, 0, 0);
+        const auto& range = lods_[std::min(lod, static_cast<uint32_t>(lods_.size() - 1))];
+        vkCmdDrawIndexed(command_buffer, range.index_count, instance_count, range.first_index, 0, 0);
+    } else {
+        vkCmdDraw(command_buffer, vertex_count_, instance_count, 0, 0);
+    }
+}
+
+void M1kMesh::drawIndirect(VkCommandBuffer command_buffer,
+                           VkBuffer draw_buffer, VkDeviceSize draw_offset,
+                           VkBuffer draw_count_buffer, VkDeviceSize draw_count_offset,
+                           bool is_multi_draw_supported) {
+    auto meshlet_count = static_cast<uint32_t>(meshlets_.size());
+    constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    if (draw_count_buffer != VK_NULL_HANDLE) {
+        vkCmdDrawIndexedIndirectCount(command_buffer, draw_buffer, draw_offset,
+                                      draw_count_buffer, draw_count_offset,
+                                      meshlet_count, stride);
+    } else if (is_multi_draw_supported) {
+        vkCmdDrawIndexedIndirect(command_buffer, draw_buffer, draw_offset, meshlet_count, stride);
     } else {
-        vkCmdDraw(command_buffer, vertex_count_, 1, 0, 0);
+        for (uint32_t i = 0; i < meshlet_count; ++i) {
+            vkCmdDrawIndexedIndirect(command_buffer, draw_buffer, draw_offset + i * stride, 1, stride);
+        }
     }
 }
 
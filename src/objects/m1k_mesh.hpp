@@ -7,11 +7,15 @@
 #include "m1k_buffer.hpp"
 #include "m1k_texture.hpp"
 #include "m1k_utils.hpp"
+#include "m1k_bounds.hpp"
 #include "m1k_data_struct.hpp"
 #include "m1k_descriptor.hpp"
+#include "m1k_config.hpp"
+#include "ui/m1k_camera.hpp"
 
 
 // std
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
@@ -35,6 +39,37 @@ struct M1kVertex {
     }
 };
 
+// GPU layout with kUsePackedVertices, decoded in bindless_pbr_shader.vert
+struct M1kPackedVertex {
+    uint16_t position[4];   // unorm inside the mesh bounds, w: tangent handedness
+    int16_t normal[2];      // octahedral, snorm
+    int16_t tangent[2];     // octahedral, snorm
+    uint16_t uv[2];         // half float
+};
+static_assert(sizeof(M1kPackedVertex) == 20, "M1kPackedVertex must stay tightly packed");
+
+// MaterialFeatures_PackedVertex in the shaders
+static constexpr uint32_t kMaterialFeaturePackedVertex = 1 << 7;
+
+// one level of detail, a range of the shared index buffer
+struct M1kMeshLod {
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+    float error = 0.0f;     // simplification error relative to the bounding radius
+};
+
+// at most kMeshletMaxVertices vertices and kMeshletMaxTriangles triangles of
+// lod 0, std430 layout of meshlet_cull.comp
+struct M1kMeshlet {
+    glm::vec4 sphere{0.0f};     // xyz: center, w: radius, vertex space
+    glm::vec4 cone{0.0f};       // xyz: average normal, w: sine of the spread, 1: never backfacing
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+    uint32_t vertex_count = 0;
+    uint32_t padding = 0;
+};
+static_assert(sizeof(M1kMeshlet) == 48, "M1kMeshlet must match the std430 layout");
+
 
 // for each mesh
 struct M1kMaterialSet {
@@ -57,6 +92,7 @@ struct M1kMaterialSet {
     float roughness_factor{1.0f};
     float occlusion_factor{1.0f};
     float normal_scale{1.0f};
+    bool is_double_sided{false};    // glTF doubleSided, back faces are visible
 
     glm::mat4 transform{};
     glm::mat4 inv_transform{};
@@ -93,17 +129,69 @@ class M1kMesh {
             M1kDescriptorSetLayout &set_layout,
             M1kDescriptorPool &pool,
             std::vector<M1kVertex>& vertices,
-            std::vector<uint32_t>& indices, M1kMaterialSet material_set, uint32_t flag);
+            std::vector<uint32_t>& indices, M1kMaterialSet material_set, uint32_t flag,
+            std::vector<M1kMeshLod> lods = {},
+            std::vector<M1kMeshlet> meshlets = {});
 
     static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
     static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+    // tightly packed positions only, for depth-only passes
+    static std::vector<VkVertexInputBindingDescription> getPositionBindingDescriptions();
+    static std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions();
+
+    // vertex, position and index buffers in bytes
+    VkDeviceSize getGpuMemorySize() const;
 
     void bind(VkCommandBuffer command_buffer, VkPipelineLayout& pipeline_layout);
-    void draw(VkCommandBuffer command_buffer);
+    void bindPositions(VkCommandBuffer command_buffer, VkPipelineLayout& pipeline_layout);
+    // instances come from the instance stream at binding 1
+    void draw(VkCommandBuffer command_buffer, uint32_t lod = 0, uint32_t instance_count = 1);
+
+    // coarsest level whose error, scaled by the projected bounding sphere,
+    // stays below kLodScreenError * 2^lod_bias of the screen height, the
+    // bounds placed in the world by object_transform
+    uint32_t selectLod(const M1kCamera& camera, float lod_bias,
+                       const glm::mat4& object_transform) const;
+    uint32_t getLodCount() const { return static_cast<uint32_t>(lods_.size()); }
+
+    // lod 0 from the draw commands a cluster culling pass wrote, with
+    // draw_count_buffer the commands are compacted and counted there, without
+    // it all getMeshletCount() commands are issued, culled ones empty
+    void drawIndirect(VkCommandBuffer command_buffer,
+                      VkBuffer draw_buffer, VkDeviceSize draw_offset,
+                      VkBuffer draw_count_buffer, VkDeviceSize draw_count_offset,
+                      bool is_multi_draw_supported);
+
+    uint32_t getMeshletCount() const { return static_cast<uint32_t>(meshlets_.size()); }
+    // material UBO at binding 0, the meshlets at binding 1
+    VkDescriptorSet getDescriptorSet() const { return mesh_descriptor_set_; }
+    // MaterialFeatures bits, picks the pipeline permutation the mesh is shaded with
+    uint32_t getMaterialFlags() const { return flags_; }
+    bool isDoubleSided() const { return material_set_.is_double_sided; }
+    // vertex space to model space, without the packed position dequantization
+    const glm::mat4& getTransform() const { return material_set_.transform; }
+
+    // bounds in model space (node transform already applied)
+    const M1kAabb& getBounds() const { return bounds_; }
+    // ray in model space, t is the closest triangle hit
+    bool raycast(const M1kRay& ray, float& t) const;
 
    private:
+    void computeBounds();
     void createVertexBuffers(const std::vector<M1kVertex> &vertices);
+    void createPositionBuffer(const std::vector<M1kVertex> &vertices);
+    // vertex and position buffers in the packed layout
+    void createPackedVertexBuffers(const std::vector<M1kVertex> &vertices);
     void createIndexBuffers(const std::vector<uint32_t> &indices);
+    // device local buffer filled through a staging buffer, dst_stage and
+    // dst_access are where it is read first
+    std::unique_ptr<M1kBuffer> createDeviceLocalBuffer(const void *data,
+                                                       uint32_t element_size,
+                                                       uint32_t element_count,
+                                                       VkBufferUsageFlags usage,
+                                                       VkPipelineStageFlags dst_stage,
+                                                       VkAccessFlags dst_access,
+                                                       bool share_with_compute = false);
     void createDescriptorSets(M1kDescriptorSetLayout &set_layout, M1kDescriptorPool &pool);
 
     M1kDevice& m1k_device_;
@@ -111,16 +199,23 @@ class M1kMesh {
     std::unique_ptr<M1kBuffer> material_ubo_buffer_;
 
     std::vector<M1kVertex> vertices_{};
-    std::vector<uint32_t> indices_{};
+    std::vector<uint32_t> indices_{};  // every lod, lod 0 first
+    std::vector<M1kMeshLod> lods_{};
+    std::vector<M1kMeshlet> meshlets_{};
     M1kMaterialSet material_set_;
     uint32_t flags_ = 0;
+    M1kAabb bounds_{};
+    M1kAabb local_bounds_{};    // vertex space, the packed positions are relative to it
 
     std::unique_ptr<M1kBuffer> vertex_buffer_;
+    std::unique_ptr<M1kBuffer> position_buffer_;
+    std::unique_ptr<M1kBuffer> meshlet_buffer_;    // null without meshlets
     uint32_t vertex_count_;
 
     bool has_index_buffer_{false};
     std::unique_ptr<M1kBuffer> index_buffer_;
     uint32_t index_count_;
+    VkIndexType index_type_ = VK_INDEX_TYPE_UINT32;
 };
 
 
@@ -0,0 +1,680 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "m1k_mesh_optimizer.hpp"
+#include "m1k_config.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+namespace m1k {
+
+namespace {
+
+constexpr uint32_t kInvalidIndex = ~0u;
+
+struct ClusterSortKey {
+    uint32_t begin = 0;  // in triangles
+    uint32_t end = 0;
+    float sort_key = 0.0f;
+};
+
+// per vertex lists of the triangles using it
+struct TriangleAdjacency {
+    std::vector<uint32_t> counts{};
+    std::vector<uint32_t> offsets{};
+    std::vector<uint32_t> triangles{};
+
+    TriangleAdjacency(const std::vector<uint32_t>& indices, uint32_t vertex_count)
+        : counts(vertex_count, 0), offsets(vertex_count, 0), triangles(indices.size()) {
+        for (uint32_t index : indices) {
+            counts[index]++;
+        }
+        uint32_t offset = 0;
+        for (uint32_t v = 0; v < vertex_count; ++v) {
+            offsets[v] = offset;
+            offset += counts[v];
+        }
+        std::vector<uint32_t> fill(offsets);
+        for (uint32_t i = 0; i < indices.size(); ++i) {
+            triangles[fill[indices[i]]++] = i / 3;
+        }
+    }
+};
+
+// symmetric plane quadric, error(p) = p^T A p + 2 b^T p + c
+struct Quadric {
+    float a00 = 0.0f, a11 = 0.0f, a22 = 0.0f;
+    float a01 = 0.0f, a02 = 0.0f, a12 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+    float c = 0.0f;
+
+    static Quadric fromPlane(const glm::vec3& n, float d, float weight) {
+        Quadric q{};
+        q.a00 = n.x * n.x * weight;
+        q.a11 = n.y * n.y * weight;
+        q.a22 = n.z * n.z * weight;
+        q.a01 = n.x * n.y * weight;
+        q.a02 = n.x * n.z * weight;
+        q.a12 = n.y * n.z * weight;
+        q.b0 = n.x * d * weight;
+        q.b1 = n.y * d * weight;
+        q.b2 = n.z * d * weight;
+        q.c = d * d * weight;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        a00 += other.a00; a11 += other.a11; a22 += other.a22;
+        a01 += other.a01; a02 += other.a02; a12 += other.a12;
+        b0 += other.b0; b1 += other.b1; b2 += other.b2;
+        c += other.c;
+        return *this;
+    }
+
+    float error(const glm::vec3& p) const {
+        float e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z +
+                  2.0f * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+                  2.0f * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+        return std::max(e, 0.0f);  // rounding can dip below
+    }
+};
+
+struct Collapse {
+    uint32_t source = kInvalidIndex;
+    uint32_t target = kInvalidIndex;
+    float cost = 0.0f;
+};
+
+// a vertex on an edge not shared by exactly two triangles is on a border,
+// a non-manifold edge or an attribute seam, collapsing it tears the surface
+std::vector<uint8_t> findLockedVertices(const std::vector<uint32_t>& indices,
+                                        uint32_t vertex_count) {
+    std::vector<uint64_t> edges{};
+    edges.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t a = indices[i + corner];
+            uint32_t b = indices[i + (corner + 1) % 3];
+            edges.push_back(static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<uint8_t> is_locked(vertex_count, 0);
+    for (size_t begin = 0; begin < edges.size();) {
+        size_t end = begin;
+        while (end < edges.size() && edges[end] == edges[begin]) end++;
+        if (end - begin != 2) {
+            is_locked[edges[begin] >> 32] = 1;
+            is_locked[edges[begin] & 0xffffffff] = 1;
+        }
+        begin = end;
+    }
+    return is_locked;
+}
+
+}
+
+M1kWeldStats weldVertices(std::vector<M1kVertex>& vertices,
+                          std::vector<uint32_t>& indices) {
+    M1kWeldStats stats{};
+    auto vertex_count = static_cast<uint32_t>(vertices.size());
+    stats.vertex_count_before = vertex_count;
+    stats.vertex_count_after = vertex_count;
+    if (vertex_count == 0) return stats;
+
+    if (indices.empty()) {
+        indices.resize(vertex_count);
+        std::iota(indices.begin(), indices.end(), 0u);
+        stats.generated_indices = true;
+    }
+
+    // power of two with a load factor of at most 0.5, linear probing
+    uint32_t capacity = 1;
+    while (capacity < vertex_count * 2) capacity <<= 1;
+    std::vector<uint32_t> slots(capacity, kInvalidIndex);
+    std::hash<M1kVertex> hasher{};
+
+    std::vector<uint32_t> remap(vertex_count, kInvalidIndex);
+    std::vector<M1kVertex> output{};
+    output.reserve(vertex_count);
+
+    for (uint32_t v = 0; v < vertex_count; ++v) {
+        const M1kVertex& vertex = vertices[v];
+        auto slot = static_cast<uint32_t>(hasher(vertex)) & (capacity - 1);
+        while (slots[slot] != kInvalidIndex && !(output[slots[slot]] == vertex)) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (slots[slot] == kInvalidIndex) {
+            slots[slot] = static_cast<uint32_t>(output.size());
+            output.push_back(vertex);
+        }
+        remap[v] = slots[slot];
+    }
+
+    for (uint32_t& index : indices) {
+        index = remap[index];
+    }
+
+    stats.vertex_count_after = static_cast<uint32_t>(output.size());
+    vertices.swap(output);
+    return stats;
+}
+
+M1kVertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices,
+                                       uint32_t vertex_count,
+                                       uint32_t cache_size) {
+    M1kVertexCacheStats stats{};
+    if (indices.size() < 3) return stats;
+
+    // a FIFO holds v while fewer than cache_size vertices entered after it
+    std::vector<uint32_t> entry_time(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+    uint32_t miss_count = 0;
+    uint32_t unique_count = 0;
+
+    for (uint32_t index : indices) {
+        if (entry_time[index] == 0) unique_count++;
+        if (time - entry_time[index] > cache_size) {
+            entry_time[index] = time++;
+            miss_count++;
+        }
+    }
+
+    stats.acmr = static_cast<float>(miss_count) / static_cast<float>(indices.size() / 3);
+    stats.atvr = static_cast<float>(miss_count) / static_cast<float>(unique_count);
+    return stats;
+}
+
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices,
+                                          uint32_t vertex_count,
+                                          uint32_t cache_size) {
+    std::vector<uint32_t> clusters{};
+    auto triangle_count = static_cast<uint32_t>(indices.size() / 3);
+    if (triangle_count == 0) return clusters;
+
+    TriangleAdjacency adjacency{indices, vertex_count};
+    std::vector<uint32_t> live_counts(adjacency.counts);
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    std::vector<bool> is_emitted(triangle_count, false);
+    std::vector<uint32_t> dead_ends{};
+    std::vector<uint32_t> candidates{};
+    candidates.reserve(64);
+
+    std::vector<uint32_t> output{};
+    output.reserve(indices.size());
+
+    uint32_t time = cache_size + 1;
+    uint32_t cursor = 0;
+
+    // a referenced vertex from the dead end stack, else the next one in input order
+    auto skip_dead_end = [&]() {
+        while (!dead_ends.empty()) {
+            uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if (live_counts[v] > 0) return v;
+        }
+        while (cursor < vertex_count) {
+            if (live_counts[cursor] > 0) return cursor;
+            cursor++;
+        }
+        return kInvalidIndex;
+    };
+
+    uint32_t fanning_vertex = skip_dead_end();
+    while (fanning_vertex != kInvalidIndex) {
+        candidates.clear();
+
+        uint32_t begin = adjacency.offsets[fanning_vertex];
+        uint32_t end = begin + adjacency.counts[fanning_vertex];
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t triangle = adjacency.triangles[i];
+            if (is_emitted[triangle]) continue;
+
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                uint32_t v = indices[triangle * 3 + corner];
+                output.push_back(v);
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                live_counts[v]--;
+                if (time - cache_time[v] > cache_size) {
+                    cache_time[v] = time++;
+                }
+            }
+            is_emitted[triangle] = true;
+        }
+
+        // the candidate that stays in the cache while its remaining
+        // triangles are emitted, the oldest one of those first
+        uint32_t next_vertex = kInvalidIndex;
+        int best_priority = -1;
+        for (uint32_t v : candidates) {
+            if (live_counts[v] == 0) continue;
+
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live_counts[v] <= cache_size) {
+                priority = static_cast<int>(time - cache_time[v]);
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                next_vertex = v;
+            }
+        }
+
+        if (next_vertex == kInvalidIndex) {
+            next_vertex = skip_dead_end();
+            // the cache is as good as flushed, a hard cluster boundary
+            clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+        }
+        fanning_vertex = next_vertex;
+    }
+
+    assert(output.size() == indices.size());
+    indices.swap(output);
+
+    // boundaries are pushed after each fan, turn them into cluster starts
+    clusters.pop_back();
+    clusters.insert(clusters.begin(), 0);
+    return clusters;
+}
+
+uint32_t optimizeOverdraw(std::vector<uint32_t>& indices,
+                          const std::vector<M1kVertex>& vertices,
+                          const std::vector<uint32_t>& clusters,
+                          uint32_t cache_size,
+                          float threshold) {
+    auto triangle_count = static_cast<uint32_t>(indices.size() / 3);
+    if (triangle_count == 0 || clusters.empty()) return 0;
+
+    auto vertex_count = static_cast<uint32_t>(vertices.size());
+    float target_acmr = analyzeVertexCache(indices, vertex_count, cache_size).acmr * threshold;
+
+    // soft boundaries: cut a hard cluster as soon as the part since the
+    // last cut is as cache friendly as the target
+    std::vector<ClusterSortKey> sorted_clusters{};
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    uint32_t time = cache_size + 1;
+
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        uint32_t cluster_end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        uint32_t begin = clusters[c];
+        uint32_t start_time = time;
+        uint32_t miss_count = 0;
+
+        for (uint32_t triangle = clusters[c]; triangle < cluster_end; ++triangle) {
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                uint32_t v = indices[triangle * 3 + corner];
+                // cached only if it entered after this cluster started
+                if (cache_time[v] < start_time || time - cache_time[v] > cache_size) {
+                    cache_time[v] = time++;
+                    miss_count++;
+                }
+            }
+
+            uint32_t cluster_triangles = triangle + 1 - begin;
+            float acmr = static_cast<float>(miss_count) / static_cast<float>(cluster_triangles);
+            if (acmr <= target_acmr && triangle + 1 < cluster_end) {
+                sorted_clusters.push_back({begin, triangle + 1});
+                begin = triangle + 1;
+                start_time = time;
+                miss_count = 0;
+            }
+        }
+        sorted_clusters.push_back({begin, cluster_end});
+    }
+
+    // area weighted centroid of the mesh
+    glm::vec3 mesh_centroid{0.0f};
+    float mesh_area = 0.0f;
+    for (uint32_t triangle = 0; triangle < triangle_count; ++triangle) {
+        const glm::vec3& p0 = vertices[indices[triangle * 3 + 0]].position;
+        const glm::vec3& p1 = vertices[indices[triangle * 3 + 1]].position;
+        const glm::vec3& p2 = vertices[indices[triangle * 3 + 2]].position;
+        float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+        mesh_centroid += (p0 + p1 + p2) * (area / 3.0f);
+        mesh_area += area;
+    }
+    mesh_centroid /= std::max(mesh_area, 1e-12f);
+
+    // clusters facing away from the mesh center are likely occluders
+    for (auto& cluster : sorted_clusters) {
+        glm::vec3 centroid{0.0f};
+        glm::vec3 normal{0.0f};
+        float area = 0.0f;
+        for (uint32_t triangle = cluster.begin; triangle < cluster.end; ++triangle) {
+            const glm::vec3& p0 = vertices[indices[triangle * 3 + 0]].position;
+            const glm::vec3& p1 = vertices[indices[triangle * 3 + 1]].position;
+            const glm::vec3& p2 = vertices[indices[triangle * 3 + 2]].position;
+            glm::vec3 area_normal = glm::cross(p1 - p0, p2 - p0);
+            float triangle_area = glm::length(area_normal);
+            centroid += (p0 + p1 + p2) * (triangle_area / 3.0f);
+            normal += area_normal;
+            area += triangle_area;
+        }
+        centroid /= std::max(area, 1e-12f);
+        float normal_length = glm::length(normal);
+        if (normal_length > 0.0f) normal /= normal_length;
+
+        cluster.sort_key = glm::dot(centroid - mesh_centroid, normal);
+    }
+
+    std::stable_sort(sorted_clusters.begin(), sorted_clusters.end(),
+                     [](const ClusterSortKey& a, const ClusterSortKey& b) {
+                         return a.sort_key > b.sort_key;
+                     });
+
+    std::vector<uint32_t> output{};
+    output.reserve(indices.size());
+    for (const auto& cluster : sorted_clusters) {
+        output.insert(output.end(),
+                      indices.begin() + cluster.begin * 3,
+                      indices.begin() + cluster.end * 3);
+    }
+    indices.swap(output);
+
+    return static_cast<uint32_t>(sorted_clusters.size());
+}
+
+uint32_t optimizeVertexFetch(std::vector<M1kVertex>& vertices,
+                             std::vector<uint32_t>& indices) {
+    std::vector<uint32_t> remap(vertices.size(), kInvalidIndex);
+    std::vector<M1kVertex> output{};
+    output.reserve(vertices.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == kInvalidIndex) {
+            remap[index] = static_cast<uint32_t>(output.size());
+            output.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    auto removed_count = static_cast<uint32_t>(vertices.size() - output.size());
+    vertices.swap(output);
+    return removed_count;
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<M1kVertex>& vertices,
+                                   const std::vector<uint32_t>& indices,
+                                   uint32_t target_index_count,
+                                   float target_error,
+                                   float& result_error) {
+    result_error = 0.0f;
+    std::vector<uint32_t> result(indices);
+    auto vertex_count = static_cast<uint32_t>(vertices.size());
+    if (result.size() <= target_index_count || vertex_count == 0) return result;
+
+    M1kAabb bounds{};
+    for (const auto& vertex : vertices) bounds.expand(vertex.position);
+    float radius = std::max(0.5f * glm::length(bounds.extent()), 1e-12f);
+    float max_cost = (target_error * radius) * (target_error * radius);
+
+    // area weighted planes of the input triangles
+    std::vector<Quadric> quadrics(vertex_count);
+    for (size_t i = 0; i + 2 < result.size(); i += 3) {
+        const glm::vec3& p0 = vertices[result[i + 0]].position;
+        const glm::vec3& p1 = vertices[result[i + 1]].position;
+        const glm::vec3& p2 = vertices[result[i + 2]].position;
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area == 0.0f) continue;
+        normal /= area;
+
+        Quadric q = Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            quadrics[result[i + corner]] += q;
+        }
+    }
+
+    std::vector<uint8_t> is_locked = findLockedVertices(result, vertex_count);
+    std::vector<uint32_t> remap(vertex_count);
+    std::vector<uint8_t> is_touched(vertex_count);
+    std::vector<Collapse> collapses{};
+    float worst_cost = 0.0f;
+
+    // batches of independent collapses, cheapest first, until the target
+    // count is reached or every remaining collapse is too expensive
+    while (result.size() > target_index_count) {
+        TriangleAdjacency adjacency{result, vertex_count};
+
+        // the cheapest edge leaving every unlocked vertex
+        collapses.assign(vertex_count, Collapse{});
+        for (size_t i = 0; i + 2 < result.size(); i += 3) {
+            for (uint32_t corner = 0; corner < 3; ++corner) {
+                uint32_t a = result[i + corner];
+                uint32_t b = result[i + (corner + 1) % 3];
+                for (int direction = 0; direction < 2; ++direction) {
+                    uint32_t source = direction == 0 ? a : b;
+                    uint32_t target = direction == 0 ? b : a;
+                    if (is_locked[source]) continue;
+
+                    Quadric q = quadrics[source];
+                    q += quadrics[target];
+                    float cost = q.error(vertices[target].position);
+                    auto& collapse = collapses[source];
+                    if (collapse.source == kInvalidIndex || cost < collapse.cost) {
+                        collapse = {source, target, cost};
+                    }
+                }
+            }
+        }
+        collapses.erase(std::remove_if(collapses.begin(), collapses.end(),
+                                       [&](const Collapse& collapse) {
+                                           return collapse.source == kInvalidIndex ||
+                                                  collapse.cost > max_cost;
+                                       }),
+                        collapses.end());
+        if (collapses.empty()) break;
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        // an interior collapse removes two triangles
+        size_t collapse_budget = (result.size() - target_index_count) / 6 + 1;
+        size_t collapse_count = 0;
+        std::iota(remap.begin(), remap.end(), 0u);
+        std::fill(is_touched.begin(), is_touched.end(), 0);
+
+        for (const auto& collapse : collapses) {
+            if (collapse_count >= collapse_budget) break;
+            uint32_t source = collapse.source;
+            uint32_t target = collapse.target;
+            if (is_touched[source] || is_touched[target]) continue;
+
+            // moving source onto target must not flip a surviving triangle
+            bool is_flipping = false;
+            uint32_t begin = adjacency.offsets[source];
+            uint32_t end = begin + adjacency.counts[source];
+            for (uint32_t t = begin; t < end && !is_flipping; ++t) {
+                const uint32_t* triangle = &result[adjacency.triangles[t] * 3];
+                if (triangle[0] == target || triangle[1] == target || triangle[2] == target) continue;
+
+                glm::vec3 p[3];
+                glm::vec3 q[3];
+                for (uint32_t corner = 0; corner < 3; ++corner) {
+                    p[corner] = vertices[triangle[corner]].position;
+                    q[corner] = triangle[corner] == source ? vertices[target].position : p[corner];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                is_flipping = glm::dot(before, after) <= 0.0f;
+            }
+            if (is_flipping) continue;
+
+            // the neighbourhood changes shape, later collapses of this batch
+            // would have to check against it
+            for (uint32_t t = begin; t < end; ++t) {
+                const uint32_t* triangle = &result[adjacency.triangles[t] * 3];
+                is_touched[triangle[0]] = is_touched[triangle[1]] = is_touched[triangle[2]] = 1;
+            }
+
+            remap[source] = target;
+            quadrics[target] += quadrics[source];
+            worst_cost = std::max(worst_cost, collapse.cost);
+            collapse_count++;
+        }
+        if (collapse_count == 0) break;
+
+        // rewrite and drop the triangles that degenerated
+        size_t write = 0;
+        for (size_t i = 0; i + 2 < result.size(); i += 3) {
+            uint32_t a = remap[result[i + 0]];
+            uint32_t b = remap[result[i + 1]];
+            uint32_t c = remap[result[i + 2]];
+            if (a == b || b == c || c == a) continue;
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    result_error = std::sqrt(worst_cost) / radius;
+    return result;
+}
+
+std::vector<M1kMeshLod> generateMeshLods(const std::vector<M1kVertex>& vertices,
+                                         std::vector<uint32_t>& indices) {
+    std::vector<M1kMeshLod> lods{{0, static_cast<uint32_t>(indices.size()), 0.0f}};
+    auto vertex_count = static_cast<uint32_t>(vertices.size());
+
+    std::vector<uint32_t> previous(indices);
+    for (uint32_t level = 1; level < kMeshLodCount; ++level) {
+        auto target_index_count =
+            static_cast<uint32_t>(previous.size() / 3 * kMeshLodReduction) * 3;
+        if (target_index_count < 3) break;
+
+        float error = 0.0f;
+        std::vector<uint32_t> lod = simplifyMesh(vertices, previous, target_index_count,
+                                                 kMeshLodMaxError, error);
+        // stuck on locked vertices or the error bound, not worth a level
+        if (lod.size() < 3 || lod.size() > previous.size() * 9 / 10) break;
+
+        optimizeVertexCache(lod, vertex_count, kVertexCacheSize);
+
+        // errors measured against the previous level add up
+        lods.push_back({static_cast<uint32_t>(indices.size()),
+                        static_cast<uint32_t>(lod.size()),
+                        lods.back().error + error});
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        previous.swap(lod);
+    }
+    return lods;
+}
+
+std::vector<M1kMeshlet> buildMeshlets(const std::vector<M1kVertex>& vertices,
+                                      const std::vector<uint32_t>& indices,
+                                      uint32_t index_count) {
+    std::vector<M1kMeshlet> meshlets{};
+    // id of the meshlet that last took each vertex
+    std::vector<uint32_t> vertex_meshlet(vertices.size(), kInvalidIndex);
+    std::vector<uint32_t> meshlet_vertices{};
+    meshlet_vertices.reserve(kMeshletMaxVertices);
+
+    auto finish_meshlet = [&](uint32_t first_index, uint32_t end_index) {
+        M1kMeshlet meshlet{};
+        meshlet.first_index = first_index;
+        meshlet.index_count = end_index - first_index;
+        meshlet.vertex_count = static_cast<uint32_t>(meshlet_vertices.size());
+
+        M1kAabb bounds{};
+        for (uint32_t v : meshlet_vertices) bounds.expand(vertices[v].position);
+        glm::vec3 center = bounds.center();
+        float radius = 0.0f;
+        for (uint32_t v : meshlet_vertices) {
+            radius = std::max(radius, glm::length(vertices[v].position - center));
+        }
+        meshlet.sphere = glm::vec4(center, radius);
+
+        // the cone holds every face normal, backfacing as a whole when the
+        // view direction is within 90 degrees minus its spread of the axis
+        std::vector<glm::vec3> normals{};
+        normals.reserve(meshlet.index_count / 3);
+        glm::vec3 axis{0.0f};
+        for (uint32_t i = first_index; i < end_index; i += 3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length == 0.0f) continue;
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+
+        float axis_length = glm::length(axis);
+        meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        if (axis_length > 0.0f) {
+            axis /= axis_length;
+            float min_dot = 1.0f;
+            for (const auto& normal : normals) min_dot = std::min(min_dot, glm::dot(normal, axis));
+            if (min_dot > 0.0f) {
+                meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - min_dot * min_dot));
+            }
+        }
+        meshlets.push_back(meshlet);
+    };
+
+    uint32_t first_index = 0;
+    for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+        auto meshlet_id = static_cast<uint32_t>(meshlets.size());
+        uint32_t new_vertex_count = 0;
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t v = indices[i + corner];
+            if (vertex_meshlet[v] != meshlet_id &&
+                (corner < 1 || v != indices[i]) && (corner < 2 || v != indices[i + 1])) {
+                new_vertex_count++;
+            }
+        }
+
+        uint32_t triangle_count = (i - first_index) / 3;
+        if (meshlet_vertices.size() + new_vertex_count > kMeshletMaxVertices ||
+            triangle_count + 1 > kMeshletMaxTriangles) {
+            finish_meshlet(first_index, i);
+            meshlet_vertices.clear();
+            first_index = i;
+            meshlet_id++;
+        }
+
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t v = indices[i + corner];
+            if (vertex_meshlet[v] != meshlet_id) {
+                vertex_meshlet[v] = meshlet_id;
+                meshlet_vertices.push_back(v);
+            }
+        }
+    }
+    if (first_index < index_count) {
+        finish_meshlet(first_index, index_count - index_count % 3);
+    }
+    return meshlets;
+}
+
+M1kMeshOptimizeStats optimizeMesh(std::vector<M1kVertex>& vertices,
+                                  std::vector<uint32_t>& indices) {
+    M1kMeshOptimizeStats stats{};
+    auto vertex_count = static_cast<uint32_t>(vertices.size());
+    stats.before = analyzeVertexCache(indices, vertex_count, kVertexCacheSize);
+
+    std::vector<uint32_t> clusters = optimizeVertexCache(indices, vertex_count, kVertexCacheSize);
+    stats.cluster_count = static_cast<uint32_t>(clusters.size());
+    if (kOverdrawThreshold > 0.0f) {
+        stats.cluster_count = optimizeOverdraw(indices, vertices, clusters,
+                                               kVertexCacheSize, kOverdrawThreshold);
+    }
+    stats.removed_vertex_count = optimizeVertexFetch(vertices, indices);
+
+    stats.after = analyzeVertexCache(indices, static_cast<uint32_t>(vertices.size()),
+                                     kVertexCacheSize);
+    return stats;
+}
+
+}
@@ -0,0 +1,106 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "m1k_mesh.hpp"
+
+// libs
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
+
+// std
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace std {
+template<>
+struct hash<m1k::M1kVertex> {
+    size_t operator()(m1k::M1kVertex const &vertex) const {
+        size_t seed = 0;
+        m1k::hashCombine(seed, vertex.position,  vertex.normal, vertex.uv);
+        return seed;
+    }
+};
+}
+
+namespace m1k {
+
+// post-transform vertex cache behaviour of an index buffer, simulated as a
+// FIFO of kVertexCacheSize entries
+struct M1kVertexCacheStats {
+    float acmr = 0.0f;  // cache misses per triangle, 0.5 is the ideal
+    float atvr = 0.0f;  // cache misses per referenced vertex, 1.0 is the ideal
+};
+
+struct M1kMeshOptimizeStats {
+    M1kVertexCacheStats before{};
+    M1kVertexCacheStats after{};
+    uint32_t cluster_count = 0;
+    uint32_t removed_vertex_count = 0;  // never referenced by an index
+};
+
+struct M1kWeldStats {
+    uint32_t vertex_count_before = 0;
+    uint32_t vertex_count_after = 0;
+    bool generated_indices = false;  // the primitive had no index buffer
+};
+
+// merges bitwise identical vertices through an open addressing table keyed
+// by std::hash<M1kVertex>, an empty index list is generated first so
+// non-indexed primitives come out indexed
+M1kWeldStats weldVertices(std::vector<M1kVertex>& vertices,
+                          std::vector<uint32_t>& indices);
+
+M1kVertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices,
+                                       uint32_t vertex_count,
+                                       uint32_t cache_size);
+
+// Tipsify (Sander et al. 2007), returns the triangle offset of every cluster,
+// a cluster starts wherever the fan ran into a dead end
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t>& indices,
+                                          uint32_t vertex_count,
+                                          uint32_t cache_size);
+
+// splits the clusters further while their ACMR stays within threshold times
+// the mesh ACMR, then draws outward facing clusters first
+uint32_t optimizeOverdraw(std::vector<uint32_t>& indices,
+                          const std::vector<M1kVertex>& vertices,
+                          const std::vector<uint32_t>& clusters,
+                          uint32_t cache_size,
+                          float threshold);
+
+// vertices in first use order, unreferenced ones dropped, returns how many
+// were dropped
+uint32_t optimizeVertexFetch(std::vector<M1kVertex>& vertices,
+                             std::vector<uint32_t>& indices);
+
+// quadric error metric edge collapse (Garland and Heckbert 1997) onto existing
+// vertices, so the result indexes the same vertex buffer. Border and
+// attribute seam vertices stay where they are. target_error is relative to
+// the mesh bounding radius, the error reached is written to result_error
+std::vector<uint32_t> simplifyMesh(const std::vector<M1kVertex>& vertices,
+                                   const std::vector<uint32_t>& indices,
+                                   uint32_t target_index_count,
+                                   float target_error,
+                                   float& result_error);
+
+// simplifies lod 0 (all of indices) kMeshLodCount - 1 times, each coarser
+// level is appended to indices, returns the ranges of every level
+std::vector<M1kMeshLod> generateMeshLods(const std::vector<M1kVertex>& vertices,
+                                         std::vector<uint32_t>& indices);
+
+// splits the first index_count indices into meshlets of consecutive
+// triangles, bounded by kMeshletMaxVertices and kMeshletMaxTriangles, with
+// bounding spheres and normal cones for cluster culling
+std::vector<M1kMeshlet> buildMeshlets(const std::vector<M1kVertex>& vertices,
+                                      const std::vector<uint32_t>& indices,
+                                      uint32_t index_count);
+
+// all of the above on an indexed triangle list
+M1kMeshOptimizeStats optimizeMesh(std::vector<M1kVertex>& vertices,
+                                  std::vector<uint32_t>& indices);
+
+}
@@ -3,38 +3,45 @@
 //
 
 #include "m1k_model.hpp"
+#include "m1k_asset_manager.hpp"
+#include "m1k_mesh_optimizer.hpp"
+#include "m1k_config.hpp"
 
 // Define these only in *one* .cc file.
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "tiny_gltf.h"
 
+// std
+#include <chrono>
 
-namespace std {
-template<>
-struct hash<m1k::M1kVertex> {
-    size_t operator()(m1k::M1kVertex const &vertex) const {
-        size_t seed = 0;
-        m1k::hashCombine(seed, vertex.position,  vertex.normal, vertex.uv);
-        return seed;
-    }
+namespace m1k {
+
+namespace {
+
+// CPU side of one glTF primitive, before it is uploaded as a M1kMesh
+struct M1kPrimitiveData {
+    std::string name{};
+    std::vector<M1kVertex> vertices{};
+    std::vector<uint32_t> indices{};
+    std::vector<M1kMeshLod> lods{};
+    std::vector<M1kMeshlet> meshlets{};
+    M1kMaterialSet material_set{};
+    uint32_t flags = 0;
+    bool is_triangle_list = true;
 };
-}
 
-namespace m1k {
+}
 
 M1kModel::M1kModel(M1kDevice& device,
                    M1kDescriptorSetLayout &set_layout,
                    M1kDescriptorPool &pool,
+                   M1kThreadPool &thread_pool,
+                   M1kAssetManager &asset_manager,
                    const std::string& filepath)
     : m1K_device_(device), descriptor_set_layout_(set_layout), descriptor_pool_(pool)
 {
-    std::string default_texture_path = "../assets/textures/dummy_texture.png";
-    dummy_texture_ = std::make_shared<M1kTexture>(m1K_device_,
-                                                default_texture_path);
-    to_update_textures_["dummy_texture"] = dummy_texture_;
-
-    loadModelFromGLTF(filepath);
+    loadModelFromGLTF(filepath, thread_pool, asset_manager);
 }
 
 M1kModel::~M1kModel() = default;
@@ -57,9 +64,42 @@ void M1kModel::draw(VkCommandBuffer command_buffer,
     }
 }
 
+void M1kModel::drawMesh(VkCommandBuffer command_buffer,
+                        uint32_t mesh_index,
+                        VkPipelineLayout& pipeline_layout,
+                        uint32_t lod,
+                        uint32_t instance_count) {
+    assert(mesh_index < meshes_.size() && "Mesh index out of range");
+
+    auto& mesh = meshes_[mesh_index];
+    mesh->bind(command_buffer, pipeline_layout);
+    mesh->draw(command_buffer, lod, instance_count);
+}
 
+void M1kModel::drawMeshPositions(VkCommandBuffer command_buffer,
+                                 uint32_t mesh_index,
+                                 VkPipelineLayout& pipeline_layout,
+                                 uint32_t lod,
+                                 uint32_t instance_count) {
+    assert(mesh_index < meshes_.size() && "Mesh index out of range");
 
-void M1kModel::loadModelFromGLTF(const std::string& filepath) {
+    auto& mesh = meshes_[mesh_index];
+    mesh->bindPositions(command_buffer, pipeline_layout);
+    mesh->draw(command_buffer, lod, instance_count);
+}
+
+uint32_t M1kModel::selectMeshLod(uint32_t mesh_index,
+                                 const M1kCamera& camera,
+                                 float lod_bias,
+                                 const glm::mat4& object_transform) const {
+    assert(mesh_index < meshes_.size() && "Mesh index out of range");
+    return meshes_[mesh_index]->selectLod(camera, lod_bias, object_transform);
+}
+
+
+
+void M1kModel::loadModelFromGLTF(const std::string& filepath, M1kThreadPool& thread_pool,
+                                 M1kAssetManager& asset_manager) {
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
     std::string err;
@@ -80,16 +120,16 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
     std::cout << "M1k::INFO~~~~~~~~Loaded glTF model: " << filepath << std::endl;
     model_directory_path_ = filepath.substr(0, filepath.find_last_of("/\\"));
 
-    // First load all textures and record new to be updated texture
+    // First load all textures, the asset manager records the new ones
     for(const auto& img : model.images) {
         if(textures_.find(img.uri) == textures_.end()) {
             textures_[img.uri] =
-                std::make_shared<M1kTexture>(m1K_device_,
-                                             model_directory_path_ + "/" + img.uri);
-            to_update_textures_[img.uri] = textures_[img.uri];  // for update
+                asset_manager.loadTexture(model_directory_path_ + "/" + img.uri);
         }
     }
 
+    std::vector<M1kPrimitiveData> primitives{};
+
     for (const auto& node : model.nodes) {
         if(node.mesh < 0 || node.mesh >= model.meshes.size()) continue;
 
@@ -117,6 +157,11 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
         for(const auto& primitive : mesh.primitives) {
             const auto& attributes = primitive.attributes;
 
+            M1kPrimitiveData primitive_data{};
+            primitive_data.name = mesh.name + "[" + std::to_string(&primitive - mesh.primitives.data()) + "]";
+            primitive_data.is_triangle_list =
+                primitive.mode == TINYGLTF_MODE_TRIANGLES || primitive.mode == -1;
+
             std::vector<M1kVertex> vertices{};
             std::vector<uint32_t> indices{};
             M1kMaterialSet material_set;
@@ -129,6 +174,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
             if (primitive.material >= 0) {
                 const auto& material = model.materials[primitive.material];
                 std::cout << "M1k::INFO~~~~~~~~Uses material: " << material.name << std::endl;
+                material_set.is_double_sided = material.doubleSided;
 
                 if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
                     int textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
@@ -139,8 +185,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
 
                     if(textures_.find(image.uri) == textures_.end()) {
                         textures_[image.uri] =
-                            std::make_shared<M1kTexture>(m1K_device_,
-                                                         model_directory_path_ + "/" + image.uri);
+                            asset_manager.loadTexture(model_directory_path_ + "/" + image.uri);
                     }
                     material_set.base_color_texture_handle  = textures_[image.uri]->getIndex();
 
@@ -154,7 +199,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                         factor[2] << "," << factor[3] << "," <<
                         ")" << std::endl;
                 } else {
-                    material_set.base_color_texture_handle = dummy_texture_->getIndex();
+                    material_set.base_color_texture_handle = asset_manager.getDummyTexture()->getIndex();
                 }
 
                 if (material.normalTexture.index >= 0) {
@@ -166,8 +211,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
 
                     if(textures_.find(image.uri) == textures_.end()) {
                         textures_[image.uri] =
-                            std::make_shared<M1kTexture>(m1K_device_,
-                                                         model_directory_path_ + "/" + image.uri);
+                            asset_manager.loadTexture(model_directory_path_ + "/" + image.uri);
                     }
                     material_set.normal_texture_handle  = textures_[image.uri]->getIndex();
 
@@ -179,7 +223,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                     std::cout << "M1k::INFO~~~~~~~~Normal texture path: " << image.uri << std::endl;
                     std::cout << "M1k::INFO~~~~~~~~Normal scale: " << normal_scale << std::endl;
                 } else {
-                    material_set.normal_texture_handle = dummy_texture_->getIndex();
+                    material_set.normal_texture_handle = asset_manager.getDummyTexture()->getIndex();
                 }
 
                 if (material.pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
@@ -191,8 +235,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
 
                     if(textures_.find(image.uri) == textures_.end()) {
                         textures_[image.uri] =
-                            std::make_shared<M1kTexture>(m1K_device_,
-                                                         model_directory_path_ + "/" + image.uri);
+                            asset_manager.loadTexture(model_directory_path_ + "/" + image.uri);
                     }
                     material_set.roughness_metalness_texture_handle  = textures_[image.uri]->getIndex();
 
@@ -206,7 +249,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                     std::cout << "M1k::INFO~~~~~~~~Metallic factor: " << metallic_factor << std::endl;
                     std::cout << "M1k::INFO~~~~~~~~Roughness factor: " << roughness_factor << std::endl;
                 } else {
-                    material_set.roughness_metalness_texture_handle = dummy_texture_->getIndex();
+                    material_set.roughness_metalness_texture_handle = asset_manager.getDummyTexture()->getIndex();
                 }
 
                 if (material.occlusionTexture.index >= 0) {
@@ -218,8 +261,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
 
                     if(textures_.find(image.uri) == textures_.end()) {
                         textures_[image.uri] =
-                            std::make_shared<M1kTexture>(m1K_device_,
-                                                         model_directory_path_ + "/" + image.uri);
+                            asset_manager.loadTexture(model_directory_path_ + "/" + image.uri);
                     }
                     material_set.occlusion_texture_handle  = textures_[image.uri]->getIndex();
 
@@ -230,7 +272,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                     std::cout << "M1k::INFO~~~~~~~~Occlusion texture path: " << image.uri << std::endl;
                     std::cout << "M1k::INFO~~~~~~~~Occlusion strength: " << occlusion_factor << std::endl;
                 } else {
-                    material_set.occlusion_texture_handle  = dummy_texture_->getIndex();
+                    material_set.occlusion_texture_handle  = asset_manager.getDummyTexture()->getIndex();
                 }
 
                 if (material.emissiveTexture.index >= 0) {
@@ -242,8 +284,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
 
                     if(textures_.find(image.uri) == textures_.end()) {
                         textures_[image.uri] =
-                            std::make_shared<M1kTexture>(m1K_device_,
-                                                         model_directory_path_ + "/" + image.uri);
+                            asset_manager.loadTexture(model_directory_path_ + "/" + image.uri);
                     }
                     material_set.emissive_texture_handle  = textures_[image.uri]->getIndex();
 
@@ -257,7 +298,7 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                         factor[2] << "," <<
                         ")" << std::endl;
                 } else {
-                    material_set.emissive_texture_handle  = dummy_texture_->getIndex();
+                    material_set.emissive_texture_handle  = asset_manager.getDummyTexture()->getIndex();
                 }
 
                 auto it = material.extensions.find("KHR_materials_clearcoat");
@@ -344,14 +385,147 @@ void M1kModel::loadModelFromGLTF(const std::string& filepath) {
                 }
             }
 
-            meshes_.push_back(std::make_unique<M1kMesh>(m1K_device_,
-                                                        descriptor_set_layout_,
-                                                        descriptor_pool_,
-                                                        vertices, indices,
-                                                        material_set, flags));
+            primitive_data.vertices = std::move(vertices);
+            primitive_data.indices = std::move(indices);
+            primitive_data.material_set = material_set;
+            primitive_data.flags = flags;
+            primitives.push_back(std::move(primitive_data));
         }
     }
 
+    // merge duplicated vertices, non-indexed primitives get their index
+    // buffer here, one job per primitive
+    if (kWeldVerticesOnImport) {
+        std::vector<M1kWeldStats> stats(primitives.size());
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        thread_pool.parallelFor(
+            static_cast<uint32_t>(primitives.size()),
+            [&](uint32_t job_index, uint32_t) {
+                auto& primitive_data = primitives[job_index];
+                stats[job_index] = weldVertices(primitive_data.vertices, primitive_data.indices);
+            });
+
+        auto elapsed = std::chrono::duration<float, std::milli>(
+            std::chrono::high_resolution_clock::now() - start_time).count();
+
+        size_t total_before = 0;
+        size_t total_after = 0;
+        for (size_t i = 0; i < primitives.size(); ++i) {
+            total_before += stats[i].vertex_count_before;
+            total_after += stats[i].vertex_count_after;
+            if (stats[i].vertex_count_after == stats[i].vertex_count_before &&
+                !stats[i].generated_indices) continue;
+            std::cout << "M1k::INFO~~~~~~~~Welded " << primitives[i].name
+                      << ": " << stats[i].vertex_count_before << " -> "
+                      << stats[i].vertex_count_after << " vertices"
+                      << (stats[i].generated_indices ? ", index buffer generated" : "")
+                      << std::endl;
+        }
+        std::cout << "M1k::INFO~~~~~~~~Vertex welding: " << total_before << " -> " << total_after
+                  << " vertices in " << elapsed << " ms" << std::endl;
+    }
+
+    // reorder for the post-transform cache, overdraw and vertex fetch, one
+    // job per primitive
+    if (kOptimizeMeshesOnImport) {
+        std::vector<M1kMeshOptimizeStats> stats(primitives.size());
+        // not vector<bool>, the jobs write it concurrently
+        std::vector<uint8_t> is_optimized(primitives.size(), 0);
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        thread_pool.parallelFor(
+            static_cast<uint32_t>(primitives.size()),
+            [&](uint32_t job_index, uint32_t) {
+                auto& primitive_data = primitives[job_index];
+                if (!primitive_data.is_triangle_list || primitive_data.indices.size() < 3) return;
+
+                stats[job_index] = optimizeMesh(primitive_data.vertices, primitive_data.indices);
+                is_optimized[job_index] = 1;
+            });
+
+        auto elapsed = std::chrono::duration<float, std::milli>(
+            std::chrono::high_resolution_clock::now() - start_time).count();
+
+        for (size_t i = 0; i < primitives.size(); ++i) {
+            if (!is_optimized[i]) continue;
+            std::cout << "M1k::INFO~~~~~~~~Optimized " << primitives[i].name
+                      << ": ACMR " << stats[i].before.acmr << " -> " << stats[i].after.acmr
+                      << ", ATVR " << stats[i].before.atvr << " -> " << stats[i].after.atvr
+                      << ", " << stats[i].cluster_count << " overdraw clusters, "
+                      << stats[i].removed_vertex_count << " unused vertices removed" << std::endl;
+        }
+        std::cout << "M1k::INFO~~~~~~~~Mesh optimization took " << elapsed << " ms" << std::endl;
+    }
+
+    // coarser index buffers behind lod 0, after the reordering so every level
+    // shares the optimized vertex order
+    if (kGenerateMeshLods) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        thread_pool.parallelFor(
+            static_cast<uint32_t>(primitives.size()),
+            [&](uint32_t job_index, uint32_t) {
+                auto& primitive_data = primitives[job_index];
+                if (!primitive_data.is_triangle_list || primitive_data.indices.size() < 3) return;
+
+                primitive_data.lods = generateMeshLods(primitive_data.vertices, primitive_data.indices);
+            });
+
+        auto elapsed = std::chrono::duration<float, std::milli>(
+            std::chrono::high_resolution_clock::now() - start_time).count();
+
+        for (const auto& primitive_data : primitives) {
+            if (primitive_data.lods.size() <= 1) continue;
+            std::cout << "M1k::INFO~~~~~~~~LODs of " << primitive_data.name << ": "
+                      << primitive_data.lods.front().index_count / 3;
+            for (size_t i = 1; i < primitive_data.lods.size(); ++i) {
+                std::cout << " -> " << primitive_data.lods[i].index_count / 3;
+            }
+            std::cout << " triangles, error " << primitive_data.lods.back().error << std::endl;
+        }
+        std::cout << "M1k::INFO~~~~~~~~LOD generation took " << elapsed << " ms" << std::endl;
+    }
+
+    // full detail only, the coarser levels are already cheap to draw whole
+    if (kBuildMeshlets) {
+        thread_pool.parallelFor(
+            static_cast<uint32_t>(primitives.size()),
+            [&](uint32_t job_index, uint32_t) {
+                auto& primitive_data = primitives[job_index];
+                if (!primitive_data.is_triangle_list || primitive_data.indices.size() < 3) return;
+
+                auto lod0_index_count = primitive_data.lods.empty()
+                    ? static_cast<uint32_t>(primitive_data.indices.size())
+                    : primitive_data.lods.front().index_count;
+                primitive_data.meshlets = buildMeshlets(primitive_data.vertices,
+                                                        primitive_data.indices, lod0_index_count);
+                if (primitive_data.meshlets.size() < kMinMeshletsForClusterCulling) {
+                    primitive_data.meshlets.clear();
+                }
+            });
+
+        size_t meshlet_count = 0;
+        for (const auto& primitive_data : primitives) meshlet_count += primitive_data.meshlets.size();
+        std::cout << "M1k::INFO~~~~~~~~Built " << meshlet_count << " meshlets" << std::endl;
+    }
+
+    for (auto& primitive_data : primitives) {
+        meshes_.push_back(std::make_unique<M1kMesh>(m1K_device_,
+                                                    descriptor_set_layout_,
+                                                    descriptor_pool_,
+                                                    primitive_data.vertices, primitive_data.indices,
+                                                    primitive_data.material_set, primitive_data.flags,
+                                                    std::move(primitive_data.lods),
+                                                    std::move(primitive_data.meshlets)));
+    }
+
+    VkDeviceSize geometry_size = 0;
+    for (const auto& mesh : meshes_) {
+        geometry_size += mesh->getGpuMemorySize();
+    }
+    std::cout << "M1k::INFO~~~~~~~~Geometry memory: " << geometry_size / 1024 << " KiB"
+              << (kUsePackedVertices ? " (packed vertices)" : "") << std::endl;
 }
 
 
@@ -8,6 +8,7 @@
 #include "m1k_buffer.hpp"
 #include "m1k_device.hpp"
 #include "m1k_data_struct.hpp"
+#include "m1k_thread_pool.hpp"
 
 // libs
 #define GLM_ENABLE_EXPERIMENTAL
@@ -24,11 +25,16 @@
 
 namespace m1k {
 
+class M1kAssetManager;
+
 class M1kModel {
    public:
+    // textures come from asset_manager, shared with every other model
     M1kModel(M1kDevice& device,
              M1kDescriptorSetLayout &set_layout,
              M1kDescriptorPool &pool,
+             M1kThreadPool &thread_pool,
+             M1kAssetManager &asset_manager,
              const std::string& filepath);
     ~M1kModel();
 
@@ -38,12 +44,28 @@ class M1kModel {
     void draw(VkCommandBuffer command_buffer,
               VkDescriptorSet bindless_set,
               VkPipelineLayout& pipeline_layout);
-
-    std::unordered_map<std::string, std::shared_ptr<M1kTexture>> to_update_textures_{};
-    std::shared_ptr<M1kTexture> dummy_texture_;
+    void drawMesh(VkCommandBuffer command_buffer,
+                  uint32_t mesh_index,
+                  VkPipelineLayout& pipeline_layout,
+                  uint32_t lod = 0,
+                  uint32_t instance_count = 1);
+    // position stream only, for depth-only pipelines
+    void drawMeshPositions(VkCommandBuffer command_buffer,
+                           uint32_t mesh_index,
+                           VkPipelineLayout& pipeline_layout,
+                           uint32_t lod = 0,
+                           uint32_t instance_count = 1);
+    // see M1kMesh::selectLod, passes drawing the same mesh must agree on it
+    uint32_t selectMeshLod(uint32_t mesh_index, const M1kCamera& camera, float lod_bias,
+                           const glm::mat4& object_transform) const;
+
+    size_t getMeshCount() const { return meshes_.size(); }
+    const M1kMesh& getMesh(uint32_t index) const { return *meshes_[index]; }
+    M1kMesh& getMesh(uint32_t index) { return *meshes_[index]; }
 
    private:
-    void loadModelFromGLTF(const std::string& filepath);
+    void loadModelFromGLTF(const std::string& filepath, M1kThreadPool& thread_pool,
+                           M1kAssetManager& asset_manager);
 
     M1kDevice& m1K_device_;
     M1kDescriptorSetLayout &descriptor_set_layout_;
@@ -54,6 +76,7 @@ class M1kModel {
     std::vector<std::unique_ptr<M1kMesh>> meshes_{};
 
     std::string model_directory_path_{};
+    // by uri, holds the shared textures as long as the model lives
     std::unordered_map<std::string, std::shared_ptr<M1kTexture>> textures_{};
 };
 
@@ -0,0 +1,445 @@
+//
+// Created by fangl on 2024/3/24.
+//
+
+#include "m1k_scene_bvh.hpp"
+
+// std
+#include <algorithm>
+#include <cassert>
+
+namespace m1k {
+
+M1kSceneBvh::PrimitiveId M1kSceneBvh::insert(const M1kBvhPrimitive& primitive,
+                                             const M1kAabb& bounds) {
+    PrimitiveId id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+        primitives_[id] = primitive;
+        primitive_bounds_[id] = bounds;
+        primitive_centroids_[id] = bounds.center();
+        primitive_leaves_[id] = kInvalidIndex;
+        primitive_alive_[id] = true;
+    } else {
+        id = static_cast<PrimitiveId>(primitives_.size());
+        primitives_.push_back(primitive);
+        primitive_bounds_.push_back(bounds);
+        primitive_centroids_.push_back(bounds.center());
+        primitive_leaves_.push_back(kInvalidIndex);
+        primitive_alive_.push_back(true);
+    }
+    primitives_[id].is_dynamic = false;
+
+    ++live_count_;
+    ++version_;
+    ++static_version_;
+    is_dirty_ = true;
+    return id;
+}
+
+void M1kSceneBvh::remove(PrimitiveId id) {
+    assert(id < primitives_.size() && primitive_alive_[id] && "Removing unknown BVH primitive");
+
+    primitive_alive_[id] = false;
+    primitive_leaves_[id] = kInvalidIndex;
+    free_ids_.push_back(id);
+    --live_count_;
+    ++version_;
+    if (primitives_[id].is_dynamic) {
+        --dynamic_count_;
+    } else {
+        ++static_version_;
+    }
+    is_dirty_ = true;
+}
+
+void M1kSceneBvh::update(PrimitiveId id, const M1kAabb& bounds) {
+    assert(id < primitives_.size() && primitive_alive_[id] && "Updating unknown BVH primitive");
+
+    primitive_bounds_[id] = bounds;
+    primitive_centroids_[id] = bounds.center();
+    ++version_;
+    if (!primitives_[id].is_dynamic) {
+        primitives_[id].is_dynamic = true;
+        ++dynamic_count_;
+        ++static_version_;
+    }
+
+    // not in the tree yet, the next build picks it up
+    if (is_dirty_ || primitive_leaves_[id] == kInvalidIndex) return;
+
+    refitLeaf(primitive_leaves_[id]);
+    ++refits_since_build_;
+}
+
+void M1kSceneBvh::commit() {
+    // refitting keeps the topology from the last build, after enough
+    // movement the SAH split planes no longer match and queries slow down
+    if (refits_since_build_ > live_count_ * kRebuildRefitRatio + kMaxLeafSize) {
+        is_dirty_ = true;
+    }
+
+    if (is_dirty_) {
+        build();
+    }
+}
+
+void M1kSceneBvh::clear() {
+    nodes_.clear();
+    node_parents_.clear();
+    primitive_indices_.clear();
+    primitives_.clear();
+    primitive_bounds_.clear();
+    primitive_centroids_.clear();
+    primitive_leaves_.clear();
+    primitive_alive_.clear();
+    free_ids_.clear();
+    object_primitives_.clear();
+    live_count_ = 0;
+    dynamic_count_ = 0;
+    refits_since_build_ = 0;
+    ++version_;
+    ++static_version_;
+    is_dirty_ = false;
+}
+
+void M1kSceneBvh::build() {
+    nodes_.clear();
+    node_parents_.clear();
+    primitive_indices_.clear();
+    is_dirty_ = false;
+    refits_since_build_ = 0;
+
+    for (PrimitiveId id = 0; id < primitives_.size(); ++id) {
+        if (primitive_alive_[id]) {
+            primitive_indices_.push_back(id);
+        }
+    }
+    if (primitive_indices_.empty()) return;
+
+    nodes_.reserve(primitive_indices_.size() * 2);
+    node_parents_.reserve(primitive_indices_.size() * 2);
+
+    Node root{};
+    root.left_first = 0;
+    root.count = static_cast<uint32_t>(primitive_indices_.size());
+    nodes_.push_back(root);
+    node_parents_.push_back(kInvalidIndex);
+
+    updateNodeBounds(0);
+    subdivide(0);
+}
+
+void M1kSceneBvh::updateNodeBounds(uint32_t node_index) {
+    Node& node = nodes_[node_index];
+    M1kAabb box{};
+    for (uint32_t i = 0; i < node.count; ++i) {
+        box.expand(primitive_bounds_[primitive_indices_[node.left_first + i]]);
+    }
+    node.bounds_min = box.min;
+    node.bounds_max = box.max;
+}
+
+void M1kSceneBvh::subdivide(uint32_t root_index) {
+    struct Bin {
+        M1kAabb bounds{};
+        uint32_t count = 0;
+    };
+
+    std::vector<uint32_t> stack{root_index};
+    while (!stack.empty()) {
+        uint32_t node_index = stack.back();
+        stack.pop_back();
+
+        uint32_t first = nodes_[node_index].left_first;
+        uint32_t count = nodes_[node_index].count;
+
+        if (count <= kMaxLeafSize) {
+            for (uint32_t i = 0; i < count; ++i) {
+                primitive_leaves_[primitive_indices_[first + i]] = node_index;
+            }
+            continue;
+        }
+
+        M1kAabb centroid_bounds{};
+        for (uint32_t i = 0; i < count; ++i) {
+            centroid_bounds.expand(primitive_centroids_[primitive_indices_[first + i]]);
+        }
+
+        // binned SAH over the three axes
+        int best_axis = -1;
+        uint32_t best_split = 0;
+        float best_cost = std::numeric_limits<float>::max();
+
+        for (int axis = 0; axis < 3; ++axis) {
+            float axis_min = centroid_bounds.min[axis];
+            float axis_max = centroid_bounds.max[axis];
+            if (axis_max - axis_min <= 1e-6f) continue;
+
+            Bin bins[kSahBins];
+            float scale = static_cast<float>(kSahBins) / (axis_max - axis_min);
+            for (uint32_t i = 0; i < count; ++i) {
+                PrimitiveId id = primitive_indices_[first + i];
+                uint32_t bin = std::min(
+                    kSahBins - 1,
+                    static_cast<uint32_t>((primitive_centroids_[id][axis] - axis_min) * scale));
+                bins[bin].count++;
+                bins[bin].bounds.expand(primitive_bounds_[id]);
+            }
+
+            float left_area[kSahBins - 1];
+            uint32_t left_count[kSahBins - 1];
+            M1kAabb left_box{};
+            uint32_t left_sum = 0;
+            for (uint32_t i = 0; i < kSahBins - 1; ++i) {
+                left_sum += bins[i].count;
+                left_box.expand(bins[i].bounds);
+                left_count[i] = left_sum;
+                left_area[i] = left_box.surfaceArea();
+            }
+
+            M1kAabb right_box{};
+            uint32_t right_sum = 0;
+            for (uint32_t i = kSahBins - 1; i > 0; --i) {
+                right_sum += bins[i].count;
+                right_box.expand(bins[i].bounds);
+                float cost = left_count[i - 1] * left_area[i - 1] +
+                             right_sum * right_box.surfaceArea();
+                if (left_count[i - 1] > 0 && right_sum > 0 && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+
+        auto begin = primitive_indices_.begin() + first;
+        auto end = begin + count;
+        decltype(begin) middle;
+
+        if (best_axis >= 0) {
+            float axis_min = centroid_bounds.min[best_axis];
+            float scale = static_cast<float>(kSahBins) /
+                          (centroid_bounds.max[best_axis] - axis_min);
+            middle = std::partition(begin, end, [&](PrimitiveId id) {
+                uint32_t bin = std::min(
+                    kSahBins - 1,
+                    static_cast<uint32_t>((primitive_centroids_[id][best_axis] - axis_min) * scale));
+                return bin < best_split;
+            });
+        } else {
+            // all centroids coincide, split by count so leaves stay small
+            middle = begin + count / 2;
+        }
+
+        uint32_t left_count = static_cast<uint32_t>(middle - begin);
+
+        uint32_t left_index = static_cast<uint32_t>(nodes_.size());
+        Node left{};
+        left.left_first = first;
+        left.count = left_count;
+        Node right{};
+        right.left_first = first + left_count;
+        right.count = count - left_count;
+        nodes_.push_back(left);
+        nodes_.push_back(right);
+        node_parents_.push_back(node_index);
+        node_parents_.push_back(node_index);
+
+        nodes_[node_index].left_first = left_index;
+        nodes_[node_index].count = 0;
+
+        updateNodeBounds(left_index);
+        updateNodeBounds(left_index + 1);
+
+        stack.push_back(left_index + 1);
+        stack.push_back(left_index);
+    }
+}
+
+void M1kSceneBvh::refitLeaf(uint32_t leaf_index) {
+    updateNodeBounds(leaf_index);
+
+    uint32_t node_index = node_parents_[leaf_index];
+    while (node_index != kInvalidIndex) {
+        Node& node = nodes_[node_index];
+        const Node& left = nodes_[node.left_first];
+        const Node& right = nodes_[node.left_first + 1];
+
+        glm::vec3 new_min = glm::min(left.bounds_min, right.bounds_min);
+        glm::vec3 new_max = glm::max(left.bounds_max, right.bounds_max);
+        if (new_min == node.bounds_min && new_max == node.bounds_max) {
+            break;  // ancestors are unaffected
+        }
+        node.bounds_min = new_min;
+        node.bounds_max = new_max;
+
+        node_index = node_parents_[node_index];
+    }
+}
+
+void M1kSceneBvh::syncGameObjects(M1kGameObject::Map& game_objects) {
+    for (auto it = object_primitives_.begin(); it != object_primitives_.end();) {
+        if (game_objects.find(it->first) == game_objects.end()) {
+            for (auto id : it->second) {
+                remove(id);
+            }
+            it = object_primitives_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto& kv : game_objects) {
+        auto& obj = kv.second;
+        if (obj.getType() != GameObjectType::PbrObject || obj.model == nullptr) continue;
+
+        auto& ids = object_primitives_[obj.getId()];
+        uint32_t mesh_count = static_cast<uint32_t>(obj.model->getMeshCount());
+        glm::mat4 transform = obj.transform.worldMat4();
+
+        if (ids.empty()) {
+            for (uint32_t i = 0; i < mesh_count; ++i) {
+                ids.push_back(insert({obj.getId(), i},
+                                     obj.model->getMesh(i).getBounds().transformed(transform)));
+            }
+            continue;
+        }
+
+        for (uint32_t i = 0; i < mesh_count; ++i) {
+            M1kAabb bounds = obj.model->getMesh(i).getBounds().transformed(transform);
+            if (bounds != primitive_bounds_[ids[i]]) {
+                update(ids[i], bounds);
+            }
+        }
+    }
+
+    commit();
+}
+
+void M1kSceneBvh::queryFrustum(const M1kFrustum& frustum,
+                               std::vector<M1kBvhPrimitive>& out) const {
+    assert(!is_dirty_ && "BVH must be committed before querying");
+    if (nodes_.empty()) return;
+
+    struct Entry {
+        uint32_t node;
+        bool inside;
+    };
+    std::vector<Entry> stack;
+    stack.reserve(64);
+    stack.push_back({0, false});
+
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes_[entry.node];
+
+        bool inside = entry.inside;
+        if (!inside) {
+            auto containment = frustum.classify(nodeBounds(node));
+            if (containment == M1kFrustum::Outside) continue;
+            // whole subtree is visible, skip the remaining plane tests
+            inside = containment == M1kFrustum::Inside;
+        }
+
+        if (node.isLeaf()) {
+            for (uint32_t i = 0; i < node.count; ++i) {
+                PrimitiveId id = primitive_indices_[node.left_first + i];
+                if (inside || frustum.intersects(primitive_bounds_[id])) {
+                    out.push_back(primitives_[id]);
+                }
+            }
+        } else {
+            stack.push_back({node.left_first + 1, inside});
+            stack.push_back({node.left_first, inside});
+        }
+    }
+}
+
+void M1kSceneBvh::querySphere(const glm::vec3& center, float radius,
+                              std::vector<M1kBvhPrimitive>& out) const {
+    assert(!is_dirty_ && "BVH must be committed before querying");
+    if (nodes_.empty()) return;
+
+    std::vector<uint32_t> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        stack.pop_back();
+
+        if (!intersectSphereAabb(center, radius, nodeBounds(node))) continue;
+
+        if (node.isLeaf()) {
+            for (uint32_t i = 0; i < node.count; ++i) {
+                PrimitiveId id = primitive_indices_[node.left_first + i];
+                if (intersectSphereAabb(center, radius, primitive_bounds_[id])) {
+                    out.push_back(primitives_[id]);
+                }
+            }
+        } else {
+            stack.push_back(node.left_first + 1);
+            stack.push_back(node.left_first);
+        }
+    }
+}
+
+bool M1kSceneBvh::raycast(const M1kRay& ray, M1kBvhHit& hit,
+                          const RayFilter& filter) const {
+    assert(!is_dirty_ && "BVH must be committed before querying");
+    if (nodes_.empty()) return false;
+
+    glm::vec3 inv_direction = 1.0f / ray.direction;
+    M1kRay current_ray = ray;
+    bool found = false;
+
+    std::vector<uint32_t> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        const Node& node = nodes_[stack.back()];
+        stack.pop_back();
+
+        float t_node;
+        if (!intersectRayAabb(current_ray, inv_direction, nodeBounds(node), t_node)) continue;
+
+        if (node.isLeaf()) {
+            for (uint32_t i = 0; i < node.count; ++i) {
+                PrimitiveId id = primitive_indices_[node.left_first + i];
+                float t_hit;
+                if (!intersectRayAabb(current_ray, inv_direction, primitive_bounds_[id], t_hit)) continue;
+                if (filter && !filter(primitives_[id], t_hit)) continue;
+
+                if (t_hit < current_ray.t_max) {
+                    current_ray.t_max = t_hit;
+                    hit.primitive = primitives_[id];
+                    hit.t = t_hit;
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // visit the nearer child first so t_max shrinks early
+        uint32_t near_child = node.left_first;
+        uint32_t far_child = node.left_first + 1;
+        float t_left, t_right;
+        bool hit_left = intersectRayAabb(current_ray, inv_direction, nodeBounds(nodes_[near_child]), t_left);
+        bool hit_right = intersectRayAabb(current_ray, inv_direction, nodeBounds(nodes_[far_child]), t_right);
+        if (hit_left && hit_right && t_right < t_left) {
+            std::swap(near_child, far_child);
+        }
+        if (hit_left || hit_right) {
+            stack.push_back(far_child);
+            stack.push_back(near_child);
+        }
+    }
+
+    return found;
+}
+
+}
@@ -0,0 +1,128 @@
+//
+// Created by fangl on 2024/3/24.
+//
+
+#pragma once
+
+#include "m1k_game_object.hpp"
+#include "m1k_bounds.hpp"
+
+// std
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace m1k {
+
+// one mesh of one game object
+struct M1kBvhPrimitive {
+    M1kGameObject::id_t object_id;
+    uint32_t mesh_index;
+    bool is_dynamic = false;    // moved since it was inserted, set by the BVH
+};
+
+struct M1kBvhHit {
+    M1kBvhPrimitive primitive{};
+    float t = std::numeric_limits<float>::max();
+};
+
+/*
+ * CPU BVH over all mesh instances of the scene.
+ *
+ * Built with binned SAH into a flat node array (32 bytes per node, siblings
+ * adjacent), so traversal walks contiguous memory. Bounds changes are
+ * refitted in place along the leaf-to-root path; insertions and removals
+ * mark the tree dirty and it is rebuilt on the next commit().
+ */
+class M1kSceneBvh {
+   public:
+    using PrimitiveId = uint32_t;
+    // narrow phase for ray queries, returns true and the hit distance on hit
+    using RayFilter = std::function<bool(const M1kBvhPrimitive&, float&)>;
+
+    M1kSceneBvh() = default;
+
+    M1kSceneBvh(const M1kSceneBvh&) = delete;
+    M1kSceneBvh& operator=(const M1kSceneBvh&) = delete;
+
+    PrimitiveId insert(const M1kBvhPrimitive& primitive, const M1kAabb& bounds);
+    void remove(PrimitiveId id);
+    void update(PrimitiveId id, const M1kAabb& bounds);
+
+    // rebuild if the topology changed or refits degraded the tree too much
+    void commit();
+    void build();
+    void clear();
+
+    // keep the tree in sync with the game objects (one primitive per mesh,
+    // world bounds through TransformComponent::worldMat4)
+    void syncGameObjects(M1kGameObject::Map& game_objects);
+
+    void queryFrustum(const M1kFrustum& frustum,
+                      std::vector<M1kBvhPrimitive>& out) const;
+    void querySphere(const glm::vec3& center, float radius,
+                     std::vector<M1kBvhPrimitive>& out) const;
+    bool raycast(const M1kRay& ray, M1kBvhHit& hit,
+                 const RayFilter& filter = nullptr) const;
+
+    size_t primitiveCount() const { return live_count_; }
+    size_t nodeCount() const { return nodes_.size(); }
+    // bumped whenever a primitive is inserted, removed or moved, lets
+    // caches built from the scene (e.g. shadow maps) detect changes
+    uint64_t version() const { return version_; }
+    // as version() but only for the static primitives: a primitive counts as
+    // dynamic from its first move on, and that move is its last static change
+    uint64_t staticVersion() const { return static_version_; }
+    size_t dynamicCount() const { return dynamic_count_; }
+
+   private:
+    struct Node {
+        glm::vec3 bounds_min;
+        uint32_t left_first;  // left child for interior, first index for leaf
+        glm::vec3 bounds_max;
+        uint32_t count;       // 0 for interior nodes
+
+        bool isLeaf() const { return count > 0; }
+    };
+    static_assert(sizeof(Node) == 32, "BVH node should stay 32 bytes");
+
+    static constexpr uint32_t kInvalidIndex = ~0u;
+    static constexpr uint32_t kMaxLeafSize = 4;
+    static constexpr uint32_t kSahBins = 12;
+    static constexpr float kRebuildRefitRatio = 0.5f;
+
+    void updateNodeBounds(uint32_t node_index);
+    void subdivide(uint32_t node_index);
+    void refitLeaf(uint32_t leaf_index);
+
+    M1kAabb nodeBounds(const Node& node) const {
+        M1kAabb box;
+        box.min = node.bounds_min;
+        box.max = node.bounds_max;
+        return box;
+    }
+
+    std::vector<Node> nodes_{};
+    std::vector<uint32_t> node_parents_{};
+    // leaf-ordered primitive ids, each node covers a contiguous range
+    std::vector<PrimitiveId> primitive_indices_{};
+
+    // indexed by PrimitiveId
+    std::vector<M1kBvhPrimitive> primitives_{};
+    std::vector<M1kAabb> primitive_bounds_{};
+    std::vector<glm::vec3> primitive_centroids_{};
+    std::vector<uint32_t> primitive_leaves_{};
+    std::vector<bool> primitive_alive_{};
+    std::vector<PrimitiveId> free_ids_{};
+    size_t live_count_ = 0;
+
+    bool is_dirty_ = false;
+    size_t refits_since_build_ = 0;
+    uint64_t version_ = 0;
+    uint64_t static_version_ = 0;
+    size_t dynamic_count_ = 0;
+
+    std::unordered_map<M1kGameObject::id_t, std::vector<PrimitiveId>> object_primitives_{};
+};
+
+}
@@ -4,6 +4,7 @@
 
 #include <stdexcept>
 #include "m1k_texture.hpp"
+#include "m1k_config.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -15,11 +16,16 @@
 namespace m1k {
 
 uint32_t M1kTexture::next_texture_index = 0;
+std::vector<uint32_t> M1kTexture::free_texture_indices{};
 
 M1kTexture::M1kTexture(M1kDevice& device, const std::string& path)
-    : m1k_device_(device), file_path(path), index_(next_texture_index++)
+    : M1kTexture(device, path, nullptr, 0) {}
+
+M1kTexture::M1kTexture(M1kDevice& device, const std::string& path,
+                       const void* file_data, size_t file_size)
+    : m1k_device_(device), file_path(path), index_(acquireIndex())
 {
-    createTextureImage(path);
+    createTextureImage(path, file_data, file_size);
     createTextureImageView();
     createTextureSampler(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_BORDER_COLOR_INT_OPAQUE_BLACK);
     createDescriptorImageInfo();
@@ -31,6 +37,20 @@ M1kTexture::~M1kTexture() {
 
     vkDestroySampler(m1k_device_.device(), m1k_texture_sampler_, nullptr);
     vkDestroyImageView(m1k_device_.device(), m1k_texture_image_view_, nullptr);
+
+    free_texture_indices.push_back(index_);
+}
+
+uint32_t M1kTexture::acquireIndex() {
+    if (!free_texture_indices.empty()) {
+        uint32_t index = free_texture_indices.back();
+        free_texture_indices.pop_back();
+        return index;
+    }
+    if (next_texture_index >= static_cast<uint32_t>(kMaxBindlessResources)) {
+        throw std::runtime_error("M1k::ERR++++++++out of bindless texture slots!");
+    }
+    return next_texture_index++;
 }
 
 VkDescriptorImageInfo& M1kTexture::getDescriptorImageInfo() {
@@ -41,13 +61,23 @@ const std::string& M1kTexture::getTextureFilePath() {
     return file_path;
 }
 
-void M1kTexture::createTextureImage(const std::string& path) {
+void M1kTexture::createTextureImage(const std::string& path, const void* file_data, size_t file_size) {
     int tex_width, tex_height, tex_channels;
-    stbi_uc* pixels = stbi_load(path.c_str(),
-                                &tex_width,
-                                &tex_height,
-                                &tex_channels,
-                                STBI_rgb_alpha);
+    stbi_uc* pixels = nullptr;
+    if (file_data != nullptr) {
+        pixels = stbi_load_from_memory(static_cast<const stbi_uc*>(file_data),
+                                       static_cast<int>(file_size),
+                                       &tex_width,
+                                       &tex_height,
+                                       &tex_channels,
+                                       STBI_rgb_alpha);
+    } else {
+        pixels = stbi_load(path.c_str(),
+                           &tex_width,
+                           &tex_height,
+                           &tex_channels,
+                           STBI_rgb_alpha);
+    }
 
     mip_levels_ = static_cast<uint32_t>(std::floor(std::log2(std::max(tex_width, tex_height)))) + 1;
     VkDeviceSize image_size = tex_width * tex_height * 4;
@@ -75,23 +105,24 @@ void M1kTexture::createTextureImage(const std::string& path) {
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                 m1k_texture_image_, m1k_texture_image_memory_);
 
-    m1k_device_.transitionImageLayout(m1k_texture_image_, VK_FORMAT_R8G8B8A8_UNORM,
-                                      VK_IMAGE_LAYOUT_UNDEFINED,
-                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                      mip_levels_);
-
+    // runs on the transfer queue when there is one, also moves every mip
+    // level to TRANSFER_DST_OPTIMAL for the blits below
     m1k_device_.copyBufferToImage(staging_buffer, m1k_texture_image_,
                                   static_cast<uint32_t>(tex_width),
                                   static_cast<uint32_t>(tex_height),
-                                  1);
+                                  1, mip_levels_);
     // If we generate mipmap, we DO NOT need this!
 //    m1k_device_.transitionImageLayout(m1k_texture_image_, VK_FORMAT_R8G8B8A8_UNORM,
 //                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 //                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 //                                      mip_levels_);
 
-    vkDestroyBuffer(m1k_device_.device(), staging_buffer, nullptr);
-    vkFreeMemory(m1k_device_.device(), staging_buffer_memory, nullptr);
+    // the copy is only queued, the staging memory lives until the frame after it
+    VkDevice device = m1k_device_.device();
+    m1k_device_.graphicsTimeline().deferDestroy([device, staging_buffer, staging_buffer_memory]() {
+        vkDestroyBuffer(device, staging_buffer, nullptr);
+        vkFreeMemory(device, staging_buffer_memory, nullptr);
+    });
 
     generateMipmaps(m1k_texture_image_, VK_FORMAT_R8G8B8A8_UNORM,
                     tex_width, tex_height, mip_levels_);
@@ -108,7 +139,8 @@ void M1kTexture::generateMipmaps(VkImage image, VkFormat image_format,
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer commandBuffer = m1k_device_.beginSingleTimeCommands();
+    // part of the upload batch, after the ownership acquire of the copy
+    VkCommandBuffer commandBuffer = m1k_device_.uploadGraphicsCommands();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -188,8 +220,6 @@ void M1kTexture::generateMipmaps(VkImage image, VkFormat image_format,
                          0,0, nullptr,
                          0, nullptr,
                          1, &barrier);
-
-    m1k_device_.endSingleTimeCommands(commandBuffer);
 }
 
 void M1kTexture::createImage(uint32_t width, uint32_t height, uint32_t mip_levels,
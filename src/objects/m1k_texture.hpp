@@ -6,11 +6,18 @@
 
 #include "../core/m1k_device.hpp"
 
+// std
+#include <string>
+#include <vector>
+
 namespace m1k {
 
 class M1kTexture {
    public:
     M1kTexture(M1kDevice& device, const std::string& path);
+    // decodes file_data, the contents of path already read by the caller
+    M1kTexture(M1kDevice& device, const std::string& path,
+               const void* file_data, size_t file_size);
     ~M1kTexture();
 
     M1kTexture(const M1kTexture&) = delete;
@@ -23,7 +30,12 @@ class M1kTexture {
     static uint32_t next_texture_index;
 
 private:
-    void createTextureImage(const std::string& path);
+    // bindless slots of destroyed textures are handed out again, a texture
+    // is only destroyed once no frame in flight samples it
+    static uint32_t acquireIndex();
+    static std::vector<uint32_t> free_texture_indices;
+
+    void createTextureImage(const std::string& path, const void* file_data, size_t file_size);
     void createImage(uint32_t width, uint32_t height, uint32_t mip_levels,
                      VkFormat format,
                      VkImageTiling tiling, VkImageUsageFlags usage,
@@ -3,6 +3,7 @@
 //
 
 #include "bindless_pbr_render_system.hpp"
+#include "cluster_cull_system.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -13,113 +14,248 @@
 #include <stdexcept>
 #include <array>
 #include <iostream>
+#include <algorithm>
 
 
 namespace m1k {
 
-BindlessPbrRenderSystem::BindlessPbrRenderSystem(M1kDevice &device, VkRenderPass render_pass,
+BindlessPbrRenderSystem::BindlessPbrRenderSystem(M1kDevice &device, const RenderTargetInfo &render_target,
+                                 uint32_t frames_in_flight,
                                  VkDescriptorSetLayout global_set_layout,
                                  VkDescriptorSetLayout pbr_set_layout,
-                                 VkDescriptorSetLayout bindless_set_layout)
+                                 VkDescriptorSetLayout bindless_set_layout,
+                                 M1kPipelineBuildQueue &build_queue)
     : m1k_device_(device), global_set_layout_(global_set_layout),
-      pbr_set_layout_(pbr_set_layout), bindless_set_layout_(bindless_set_layout)
+      pbr_set_layout_(pbr_set_layout), bindless_set_layout_(bindless_set_layout),
+      instance_batcher_(device, frames_in_flight)
 {
     createPipelineLayout();
-    createPipeline(render_pass);
+    createPipeline(render_target, build_queue);
 }
 
-BindlessPbrRenderSystem::~BindlessPbrRenderSystem() {
-    vkDestroyPipelineLayout(m1k_device_.device(), pipeline_layout_, nullptr);
-}
+BindlessPbrRenderSystem::~BindlessPbrRenderSystem() {}
 
 void BindlessPbrRenderSystem::createPipelineLayout() {
-    std::vector<VkDescriptorSetLayout> descriptor_set_layouts{
-        global_set_layout_, bindless_set_layout_, pbr_set_layout_};
-
-    VkPipelineLayoutCreateInfo pipeline_layout_info{};
-    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(descriptor_set_layouts.size());
-    pipeline_layout_info.pSetLayouts = descriptor_set_layouts.data();
-
-    if(vkCreatePipelineLayout(m1k_device_.device(),
-                               &pipeline_layout_info,
-                               nullptr,
-                               &pipeline_layout_) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout");
-    }
+    // the same layout as the deferred G-buffer pass, one object for both
+    pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        {global_set_layout_, bindless_set_layout_, pbr_set_layout_});
 }
 
-void BindlessPbrRenderSystem::createPipeline(VkRenderPass render_pass) {
+void BindlessPbrRenderSystem::createPipeline(const RenderTargetInfo &render_target,
+                                             M1kPipelineBuildQueue &build_queue) {
     assert(pipeline_layout_ != nullptr && "Cannot create pipeline before pipeline layout");
 
-    PipelineConfigInfo pipeline_config{};
-    M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
-    pipeline_config.render_pass = render_pass;
-    pipeline_config.pipeline_layout = pipeline_layout_;
-    m1k_pipeline_ = std::make_unique<M1kPipeline>(
+    // the shading pipelines are compiled per material on first use
+    VkPipelineLayout pipeline_layout = pipeline_layout_;
+    shading_permutations_ = std::make_unique<M1kPipelinePermutations>(
+        m1k_device_,
+        [render_target, pipeline_layout](PipelineConfigInfo &pipeline_config) {
+            M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
+            render_target.applyTo(pipeline_config);
+            pipeline_config.pipeline_layout = pipeline_layout;
+            M1kInstanceBatcher::addVertexInput(pipeline_config, false);
+        },
+        "./shaders/binaries/bindless_pbr_shader.vert.spv",
+        "./shaders/binaries/bindless_pbr_shader.frag.spv");
+
+    // both vertex shaders use invariant gl_Position, so EQUAL matches exactly
+    depth_equal_permutations_ = std::make_unique<M1kPipelinePermutations>(
         m1k_device_,
-        pipeline_config,
+        [render_target, pipeline_layout](PipelineConfigInfo &equal_config) {
+            M1kPipeline::defaultPipelineConfigInfo(equal_config);
+            render_target.applyTo(equal_config);
+            equal_config.pipeline_layout = pipeline_layout;
+            equal_config.depth_stencil_info.depthCompareOp = VK_COMPARE_OP_EQUAL;
+            equal_config.depth_stencil_info.depthWriteEnable = VK_FALSE;
+            M1kInstanceBatcher::addVertexInput(equal_config, false);
+        },
         "./shaders/binaries/bindless_pbr_shader.vert.spv",
         "./shaders/binaries/bindless_pbr_shader.frag.spv");
+    build_queue.addPermutations(*shading_permutations_);
+    build_queue.addPermutations(*depth_equal_permutations_);
+
+    build_queue.addGraphics(
+        depth_prepass_pipeline_,
+        [render_target, pipeline_layout](PipelineConfigInfo &depth_config) {
+            M1kPipeline::defaultPipelineConfigInfo(depth_config);
+            render_target.applyTo(depth_config);
+            depth_config.pipeline_layout = pipeline_layout;
+            depth_config.binding_descriptions = M1kMesh::getPositionBindingDescriptions();
+            depth_config.attribute_descriptions = M1kMesh::getPositionAttributeDescriptions();
+            M1kInstanceBatcher::addVertexInput(depth_config, true);
+            depth_config.color_blend_attachment.colorWriteMask = 0;
+        },
+        "./shaders/binaries/depth_prepass.vert.spv",
+        "");
 }
 
 void BindlessPbrRenderSystem::render(FrameInfo &frame_info) {
-    m1k_pipeline_->bind(frame_info.command_buffer);
+    // hierarchical frustum culling against the scene BVH
+    visible_primitives_.clear();
+    M1kFrustum frustum = M1kFrustum::fromMatrix(
+        frame_info.camera.getProjection() * frame_info.camera.getView());
+    frame_info.scene_bvh.queryFrustum(frustum, visible_primitives_);
+
+    // objects sharing a model become one instanced draw per mesh and level
+    draws_.clear();
+    instance_batcher_.begin(frame_info.frame_index);
+    instance_batcher_.batch(frame_info, visible_primitives_, draws_);
+
+    if (draws_.empty()) return;
+    sortDrawsByPipeline();
+
+    // split the draw list into contiguous ranges, one secondary buffer each
+    uint32_t draw_count = static_cast<uint32_t>(draws_.size());
+    uint32_t max_job_count = frame_info.renderer.getMainThreadIndex();  // == worker count
+    uint32_t job_count = std::min(
+        max_job_count, (draw_count + kMinDrawsPerRecordJob - 1) / kMinDrawsPerRecordJob);
+    job_count = std::max(job_count, 1u);
+    uint32_t draws_per_job = (draw_count + job_count - 1) / job_count;
+
+    // with the pre-pass the first job_count buffers lay down depth for the
+    // whole list, they execute before any shading job since jobs run in order
+    uint32_t pass_count = is_depth_prepass_enabled_ ? 2 : 1;
+    uint32_t depth_job_count = is_depth_prepass_enabled_ ? job_count : 0;
+
+    frame_info.renderer.recordSecondaryParallel(
+        frame_info.command_buffer, job_count * pass_count,
+        [&](VkCommandBuffer command_buffer, uint32_t job_index) {
+            bool is_depth_job = job_index < depth_job_count;
+            uint32_t range_index = is_depth_job ? job_index : job_index - depth_job_count;
+            uint32_t first = range_index * draws_per_job;
+            uint32_t last = std::min(first + draws_per_job, draw_count);
+            if (is_depth_job) {
+                recordDepthDraws(frame_info, command_buffer, first, last);
+            } else {
+                recordDraws(frame_info, command_buffer, first, last);
+            }
+        });
+}
+
+void BindlessPbrRenderSystem::sortDrawsByPipeline() {
+    auto &permutations =
+        is_depth_prepass_enabled_ ? *depth_equal_permutations_ : *shading_permutations_;
+    for (auto &draw : draws_) {
+        uint32_t flags = draw.model->getMesh(draw.primitive.mesh_index).getMaterialFlags();
+        draw.pipeline = &permutations.get(flags);
+    }
+
+    // stable, the batcher's model and mesh order keeps the draws of one
+    // material together inside a pipeline
+    std::stable_sort(draws_.begin(), draws_.end(),
+                     [](const M1kInstancedDraw &a, const M1kInstancedDraw &b) {
+                         return a.pipeline < b.pipeline;
+                     });
+}
+
+void BindlessPbrRenderSystem::recordDraws(const FrameInfo& frame_info,
+                                          VkCommandBuffer command_buffer,
+                                          uint32_t first, uint32_t last) {
+    // state doesn't carry over between secondary buffers, bind per job;
+    // the sets stay bound across pipelines sharing pipeline_layout_
 
     // bind global descriptor set
     vkCmdBindDescriptorSets(
-        frame_info.command_buffer,
+        command_buffer,
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         pipeline_layout_,
         0, 1,
         &frame_info.global_descriptor_set,
         0, nullptr);
 
-    for(auto& kv : frame_info.game_objects) {
-        auto &obj = kv.second;
+    // bind bindless descriptor set, shared by all models
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipeline_layout_,
+        1, 1,
+        &frame_info.bindless_descriptor_set,
+        0, nullptr);
 
-        // filter
-        if(obj.getType() != GameObjectType::PbrObject) continue;
+    // the same draws as recordDepthDraws, the EQUAL depth test needs the same triangles
+    M1kPipeline *bound_pipeline = nullptr;
+    for(uint32_t i = first; i < last; ++i) {
+        const auto& draw = draws_[i];
+        if (draw.pipeline != bound_pipeline) {
+            draw.pipeline->bind(command_buffer);
+            bound_pipeline = draw.pipeline;
+        }
+        instance_batcher_.bind(command_buffer, draw);
 
-        obj.model->draw(frame_info.command_buffer,
-                        frame_info.bindless_descriptor_set,
-                        pipeline_layout_);
+        // the cluster culling pass only takes meshes drawn once
+        if (draw.lod == 0 && draw.instance_count == 1 &&
+            frame_info.cluster_cull_system != nullptr &&
+            frame_info.cluster_cull_system->drawMesh(command_buffer, frame_info, draw.primitive,
+                                                     draw.model->getMesh(draw.primitive.mesh_index),
+                                                     pipeline_layout_, false)) {
+            continue;
+        }
+        draw.model->drawMesh(command_buffer,
+                             draw.primitive.mesh_index,
+                             pipeline_layout_,
+                             draw.lod,
+                             draw.instance_count);
     }
 }
 
-void BindlessPbrRenderSystem::updateBindlessTextures(m1k::FrameInfo& frame_info) {
-    VkWriteDescriptorSet bindless_descriptor_writes[kMaxBindlessResources];
-    VkDescriptorImageInfo bindless_image_info[kMaxBindlessResources];
-    uint32_t current_write_index = 0;
+void BindlessPbrRenderSystem::recordDepthDraws(const FrameInfo& frame_info,
+                                               VkCommandBuffer command_buffer,
+                                               uint32_t first, uint32_t last) {
+    depth_prepass_pipeline_->bind(command_buffer);
+
+    // only camera matrices, no textures
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipeline_layout_,
+        0, 1,
+        &frame_info.global_descriptor_set,
+        0, nullptr);
 
-    for(auto& pair : frame_info.game_objects) {
-        if(pair.second.getType() != GameObjectType::PbrObject) continue;
+    for(uint32_t i = first; i < last; ++i) {
+        const auto& draw = draws_[i];
+        instance_batcher_.bind(command_buffer, draw);
 
-        auto& model = pair.second.model;
-        auto& to_be_updated_textures = model->to_update_textures_;
+        if (draw.lod == 0 && draw.instance_count == 1 &&
+            frame_info.cluster_cull_system != nullptr &&
+            frame_info.cluster_cull_system->drawMesh(command_buffer, frame_info, draw.primitive,
+                                                     draw.model->getMesh(draw.primitive.mesh_index),
+                                                     pipeline_layout_, true)) {
+            continue;
+        }
+        draw.model->drawMeshPositions(command_buffer,
+                                      draw.primitive.mesh_index,
+                                      pipeline_layout_,
+                                      draw.lod,
+                                      draw.instance_count);
+    }
+}
 
-        for(auto& p : to_be_updated_textures) {
-            auto& texture = p.second;
-            VkWriteDescriptorSet& descriptor_write = bindless_descriptor_writes[current_write_index];
-            descriptor_write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-            descriptor_write.descriptorCount = 1;
-            descriptor_write.dstArrayElement = texture->getIndex();
-            descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptor_write.dstSet = frame_info.bindless_descriptor_set;
-            descriptor_write.dstBinding = kBindlessTextureBinding;
+void BindlessPbrRenderSystem::updateBindlessTextures(m1k::FrameInfo& frame_info,
+                                                     M1kAssetManager& asset_manager) {
+    VkWriteDescriptorSet bindless_descriptor_writes[kMaxBindlessResources];
+    VkDescriptorImageInfo bindless_image_info[kMaxBindlessResources];
+    uint32_t current_write_index = 0;
 
-            auto sampler = texture->getDescriptorImageInfo().sampler;
-            VkDescriptorImageInfo& descriptor_image_info = bindless_image_info[current_write_index];
-            descriptor_image_info.sampler = sampler;
-            descriptor_image_info.imageView = texture->getDescriptorImageInfo().imageView;
-            descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    // shared between models, each texture is written once
+    for(auto& texture : asset_manager.takeNewTextures()) {
+        VkWriteDescriptorSet& descriptor_write = bindless_descriptor_writes[current_write_index];
+        descriptor_write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+        descriptor_write.descriptorCount = 1;
+        descriptor_write.dstArrayElement = texture->getIndex();
+        descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptor_write.dstSet = frame_info.bindless_descriptor_set;
+        descriptor_write.dstBinding = kBindlessTextureBinding;
 
-            descriptor_write.pImageInfo = &descriptor_image_info;
+        auto sampler = texture->getDescriptorImageInfo().sampler;
+        VkDescriptorImageInfo& descriptor_image_info = bindless_image_info[current_write_index];
+        descriptor_image_info.sampler = sampler;
+        descriptor_image_info.imageView = texture->getDescriptorImageInfo().imageView;
+        descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-            ++current_write_index;
-        }
+        descriptor_write.pImageInfo = &descriptor_image_info;
 
-        to_be_updated_textures.clear();
+        ++current_write_index;
     }
 
     if (current_write_index) {
@@ -6,8 +6,12 @@
 
 #include "core/m1k_device.hpp"
 #include "core/m1k_pipeline.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
+#include "core/m1k_pipeline_permutations.hpp"
 #include "m1k_frame_info.hpp"
+#include "objects/m1k_asset_manager.hpp"
 #include "objects/m1k_game_object.hpp"
+#include "objects/m1k_instance_batcher.hpp"
 #include "ui/m1k_camera.hpp"
 #include "m1k_config.hpp"
 
@@ -19,10 +23,12 @@ namespace m1k {
 class BindlessPbrRenderSystem {
    public:
     BindlessPbrRenderSystem(M1kDevice &device,
-                    VkRenderPass render_pass,
+                    const RenderTargetInfo &render_target,
+                    uint32_t frames_in_flight,
                     VkDescriptorSetLayout global_set_layout,
                     VkDescriptorSetLayout pbr_set_layout,
-                    VkDescriptorSetLayout bindless_set_layout);
+                    VkDescriptorSetLayout bindless_set_layout,
+                    M1kPipelineBuildQueue &build_queue);
     ~BindlessPbrRenderSystem();
 
     // copy version delete
@@ -30,18 +36,45 @@ class BindlessPbrRenderSystem {
     BindlessPbrRenderSystem &operator=(const BindlessPbrRenderSystem&) = delete;
 
     void render(FrameInfo &frame_info);
-    void updateBindlessTextures(FrameInfo &frame_info);
+    // writes the slots of the textures asset_manager created since the last call
+    void updateBindlessTextures(FrameInfo &frame_info, M1kAssetManager &asset_manager);
+
+    size_t getVisibleMeshCount() const { return visible_primitives_.size(); }
+    // instanced draws the visible meshes were batched into
+    size_t getDrawCount() const { return draws_.size(); }
+
+    // depth-only pass with the position stream first, then shading with
+    // EQUAL depth test and no depth writes
+    void setDepthPrepassEnabled(bool enabled) { is_depth_prepass_enabled_ = enabled; }
+    bool isDepthPrepassEnabled() const { return is_depth_prepass_enabled_; }
 
    private:
     void createPipelineLayout();
-    void createPipeline(VkRenderPass render_pass);
+    void createPipeline(const RenderTargetInfo &render_target, M1kPipelineBuildQueue &build_queue);
+    // the permutation of every draw, then draws_ grouped by it
+    void sortDrawsByPipeline();
+    // records draws_[first, last) into one secondary buffer
+    void recordDraws(const FrameInfo& frame_info, VkCommandBuffer command_buffer,
+                     uint32_t first, uint32_t last);
+    void recordDepthDraws(const FrameInfo& frame_info, VkCommandBuffer command_buffer,
+                          uint32_t first, uint32_t last);
 
     M1kDevice &m1k_device_;
     VkDescriptorSetLayout global_set_layout_;
     VkDescriptorSetLayout pbr_set_layout_;
     VkDescriptorSetLayout bindless_set_layout_;
-    std::unique_ptr<M1kPipeline> m1k_pipeline_;
+    // one pipeline per material flags
+    std::unique_ptr<M1kPipelinePermutations> shading_permutations_;
+    std::unique_ptr<M1kPipeline> depth_prepass_pipeline_;
+    // same shaders as shading_permutations_, EQUAL test against the pre-pass depth
+    std::unique_ptr<M1kPipelinePermutations> depth_equal_permutations_;
     VkPipelineLayout pipeline_layout_;
+
+    bool is_depth_prepass_enabled_ = kDefaultDepthPrepass;
+
+    std::vector<M1kBvhPrimitive> visible_primitives_{};
+    M1kInstanceBatcher instance_batcher_;
+    std::vector<M1kInstancedDraw> draws_{};
 };
 
 }
@@ -0,0 +1,513 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "cascaded_shadow_system.hpp"
+#include "core/m1k_shader_reflection.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace m1k {
+
+static_assert(kShadowCascadeCount == 4, "shaders declare shadow_matrices[4]");
+
+CascadedShadowSystem::CascadedShadowSystem(M1kDevice &device,
+                                           uint32_t frames_in_flight,
+                                           VkDescriptorSetLayout global_set_layout,
+                                           VkDescriptorSetLayout pbr_set_layout,
+                                           VkDescriptorSetLayout bindless_set_layout,
+                                           M1kPipelineBuildQueue &build_queue)
+    : m1k_device_(device), instance_batcher_(device, frames_in_flight) {
+    shadow_format_ = m1k_device_.findSupportedFormat(
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+
+    createShadowMap();
+    createStaticShadowMap();
+    createSampler();
+    createPipelineLayout(global_set_layout, pbr_set_layout, bindless_set_layout);
+
+    if (m1k_device_.isDynamicRenderingSupported()) {
+        createPipeline(build_queue);
+    } else {
+        std::cout << "M1K::WARN========Shadow maps need dynamic rendering, "
+                     "shadows are disabled." << std::endl;
+    }
+}
+
+CascadedShadowSystem::~CascadedShadowSystem() {
+    VkDevice device = m1k_device_.device();
+    vkDestroySampler(device, shadow_sampler_, nullptr);
+    for (auto view : cascade_views_) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    vkDestroyImageView(device, shadow_array_view_, nullptr);
+    vkDestroyImage(device, shadow_image_, nullptr);
+    vkFreeMemory(device, shadow_image_memory_, nullptr);
+    for (auto view : static_cascade_views_) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    vkDestroyImage(device, static_image_, nullptr);
+    vkFreeMemory(device, static_image_memory_, nullptr);
+}
+
+void CascadedShadowSystem::createShadowMap() {
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.extent = {kShadowMapResolution, kShadowMapResolution, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = kShadowCascadeCount;
+    image_info.format = shadow_format_;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    m1k_device_.createImageWithInfo(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                    shadow_image_, shadow_image_memory_);
+
+    shadow_array_view_ = m1k_device_.createImageView(
+        shadow_image_, shadow_format_, 1, VK_IMAGE_ASPECT_DEPTH_BIT,
+        VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, kShadowCascadeCount);
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        cascade_views_[i] = m1k_device_.createImageView(
+            shadow_image_, shadow_format_, 1, VK_IMAGE_ASPECT_DEPTH_BIT,
+            VK_IMAGE_VIEW_TYPE_2D, i, 1);
+    }
+
+    // far plane everywhere until a cascade is drawn, i.e. fully lit
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, kShadowCascadeCount};
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = shadow_image_;
+    barrier.subresourceRange = range;
+
+    VkCommandBuffer command_buffer = m1k_device_.beginSingleTimeCommands();
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkClearDepthStencilValue clear_value{1.0f, 0};
+    vkCmdClearDepthStencilImage(command_buffer, shadow_image_,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_value, 1, &range);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1,
+                         &barrier);
+
+    m1k_device_.endSingleTimeCommands(command_buffer);
+}
+
+void CascadedShadowSystem::createStaticShadowMap() {
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.extent = {kShadowMapResolution, kShadowMapResolution, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = kShadowCascadeCount;
+    image_info.format = shadow_format_;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    m1k_device_.createImageWithInfo(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                    static_image_, static_image_memory_);
+
+    // every layer is drawn before it is first copied, a new fit always renders
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        static_cascade_views_[i] = m1k_device_.createImageView(
+            static_image_, shadow_format_, 1, VK_IMAGE_ASPECT_DEPTH_BIT,
+            VK_IMAGE_VIEW_TYPE_2D, i, 1);
+    }
+}
+
+void CascadedShadowSystem::createSampler() {
+    // hardware 2x2 PCF, outside the map counts as lit
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    sampler_info.compareEnable = VK_TRUE;
+    sampler_info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    sampler_info.maxLod = 0.0f;
+
+    if (vkCreateSampler(m1k_device_.device(), &sampler_info, nullptr, &shadow_sampler_) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow sampler");
+    }
+}
+
+void CascadedShadowSystem::createPipelineLayout(VkDescriptorSetLayout global_set_layout,
+                                                VkDescriptorSetLayout pbr_set_layout,
+                                                VkDescriptorSetLayout bindless_set_layout) {
+    // the cascade view projection
+    auto push_constant_ranges = M1kShaderReflection::fromFile(
+        "./shaders/binaries/shadow_depth.vert.spv").getPushConstantRanges();
+    assert(!push_constant_ranges.empty() && push_constant_ranges[0].size >= sizeof(glm::mat4) &&
+           "Shadow shader doesn't push a matrix");
+
+    // material ubo stays in set 2, M1kModel binds it there
+    pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        {global_set_layout, bindless_set_layout, pbr_set_layout}, push_constant_ranges);
+}
+
+void CascadedShadowSystem::createPipeline(M1kPipelineBuildQueue &build_queue) {
+    assert(pipeline_layout_ != nullptr && "Cannot create pipeline before pipeline layout");
+
+    RenderTargetInfo shadow_target{};
+    shadow_target.depth_format = shadow_format_;
+    shadow_target.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineLayout pipeline_layout = pipeline_layout_;
+    build_queue.addGraphics(
+        shadow_pipeline_,
+        [shadow_target, pipeline_layout](PipelineConfigInfo &pipeline_config) {
+            M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
+            shadow_target.applyTo(pipeline_config);
+            pipeline_config.pipeline_layout = pipeline_layout;
+            pipeline_config.binding_descriptions = M1kMesh::getPositionBindingDescriptions();
+            pipeline_config.attribute_descriptions = M1kMesh::getPositionAttributeDescriptions();
+            M1kInstanceBatcher::addVertexInput(pipeline_config, true);
+            pipeline_config.color_blend_info.attachmentCount = 0;
+            pipeline_config.rasterization_info.depthBiasEnable = VK_TRUE;
+            pipeline_config.rasterization_info.depthBiasConstantFactor = 1.25f;
+            pipeline_config.rasterization_info.depthBiasSlopeFactor = 1.75f;
+        },
+        "./shaders/binaries/shadow_depth.vert.spv",
+        "");
+}
+
+VkDescriptorImageInfo CascadedShadowSystem::getShadowMapImageInfo() const {
+    VkDescriptorImageInfo image_info{};
+    image_info.sampler = shadow_sampler_;
+    image_info.imageView = shadow_array_view_;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return image_info;
+}
+
+void CascadedShadowSystem::fitCascade(Cascade &cascade, const glm::vec3 &center, float radius,
+                                      const glm::vec3 &light_direction) {
+    glm::vec3 up = std::abs(light_direction.y) > 0.99f ? glm::vec3{0.0f, 0.0f, 1.0f}
+                                                       : glm::vec3{0.0f, -1.0f, 0.0f};
+
+    cascade.radius = radius * kShadowCacheMargin;
+    cascade.texel_size = 2.0f * cascade.radius / static_cast<float>(kShadowMapResolution);
+
+    // snap the center to whole texels in light space, a refit then moves the
+    // map by whole texels and the shadow edges don't crawl
+    M1kCamera light_camera{};
+    light_camera.setViewDirection(glm::vec3{0.0f}, -light_direction, up);
+    glm::vec4 center_light = light_camera.getView() * glm::vec4(center, 1.0f);
+    center_light.x = std::floor(center_light.x / cascade.texel_size) * cascade.texel_size;
+    center_light.y = std::floor(center_light.y / cascade.texel_size) * cascade.texel_size;
+    cascade.center = glm::vec3(light_camera.getViewInverse() * center_light);
+
+    float distance = cascade.radius + kShadowCasterExtension;
+    light_camera.setViewDirection(cascade.center + light_direction * distance,
+                                  -light_direction, up);
+    light_camera.setOrthographicProjection(-cascade.radius, cascade.radius,
+                                           -cascade.radius, cascade.radius,
+                                           0.0f, distance + cascade.radius);
+    cascade.view_projection = light_camera.getProjection() * light_camera.getView();
+    cascade.is_valid = true;
+}
+
+void CascadedShadowSystem::update(FrameInfo &frame_info, GlobalUbo &ubo) {
+    if (shadow_pipeline_ == nullptr) return;  // splits stay 0, all lit
+
+    glm::vec3 light_direction = glm::normalize(glm::vec3(ubo.direct_light));
+    // moving objects are drawn over the cached layers every frame instead
+    uint64_t static_version = frame_info.scene_bvh.staticVersion();
+    bool is_light_changed = glm::dot(light_direction, cached_light_direction_) < 0.99999f;
+
+    if (is_light_changed || static_version != cached_static_version_) {
+        for (auto &cascade : cascades_) {
+            cascade.is_stale = true;
+        }
+        cached_static_version_ = static_version;
+    }
+    if (is_light_changed) {
+        cached_light_direction_ = light_direction;
+        for (auto &cascade : cascades_) {
+            cascade.is_valid = false;
+        }
+    }
+
+    // slice bounding spheres from the projection, x = ndc.x * z / P[0][0]
+    const glm::mat4 &projection = frame_info.camera.getProjection();
+    float k = 1.0f / (projection[0][0] * projection[0][0]) +
+              1.0f / (projection[1][1] * projection[1][1]);
+    const glm::mat4 &inverse_view = frame_info.camera.getViewInverse();
+
+    float slice_near = kCameraNear;
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        float p = static_cast<float>(i + 1) / static_cast<float>(kShadowCascadeCount);
+        float log_split = kCameraNear * std::pow(kShadowDistance / kCameraNear, p);
+        float uniform_split = kCameraNear + (kShadowDistance - kCameraNear) * p;
+        float slice_far = kShadowSplitLambda * log_split + (1.0f - kShadowSplitLambda) * uniform_split;
+
+        // center on the view axis, equally far from the near and far corners
+        float center_z = std::min((1.0f + k) * (slice_near + slice_far) * 0.5f, slice_far);
+        float radius = std::sqrt(k * slice_far * slice_far +
+                                 (slice_far - center_z) * (slice_far - center_z));
+        glm::vec3 center = glm::vec3(inverse_view * glm::vec4(0.0f, 0.0f, center_z, 1.0f));
+
+        auto &cascade = cascades_[i];
+        bool is_covered = cascade.is_valid &&
+                          glm::length(center - cascade.center) + radius <= cascade.radius;
+        if (!is_covered) {
+            fitCascade(cascade, center, radius, light_direction);
+            cascade.needs_render = true;
+        } else if (cascade.is_stale && (frame_counter_ + i) % (1ull << i) == 0) {
+            cascade.needs_render = true;
+        }
+        if (cascade.needs_render) {
+            cascade.is_stale = false;
+        }
+
+        ubo.shadow_matrices[i] = cascade.view_projection;
+        ubo.shadow_cascade_splits[i] = slice_far;
+        ubo.shadow_texel_sizes[i] = cascade.texel_size;
+        slice_near = slice_far;
+    }
+
+    ++frame_counter_;
+}
+
+void CascadedShadowSystem::drawCasters(FrameInfo &frame_info, VkImageView view,
+                                       VkAttachmentLoadOp load_op,
+                                       const glm::mat4 &view_projection,
+                                       const std::vector<M1kBvhPrimitive> &casters) {
+    VkCommandBuffer command_buffer = frame_info.command_buffer;
+
+    VkViewport viewport{0.0f, 0.0f, static_cast<float>(kShadowMapResolution),
+                        static_cast<float>(kShadowMapResolution), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, {kShadowMapResolution, kShadowMapResolution}};
+
+    VkRenderingAttachmentInfo depth_attachment{};
+    depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depth_attachment.imageView = view;
+    depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depth_attachment.loadOp = load_op;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.clearValue.depthStencil = {1.0f, 0};
+
+    VkRenderingInfo rendering_info{};
+    rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    rendering_info.renderArea = scissor;
+    rendering_info.layerCount = 1;
+    rendering_info.pDepthAttachment = &depth_attachment;
+
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    shadow_pipeline_->bind(command_buffer);
+    vkCmdPushConstants(command_buffer, pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(glm::mat4), &view_projection);
+
+    // levels picked for the camera, casters match the receivers they shadow
+    draws_.clear();
+    instance_batcher_.batch(frame_info, casters, draws_);
+    for (const auto &draw : draws_) {
+        instance_batcher_.bind(command_buffer, draw);
+        draw.model->drawMeshPositions(command_buffer, draw.primitive.mesh_index,
+                                      pipeline_layout_, draw.lod, draw.instance_count);
+    }
+
+    vkCmdEndRendering(command_buffer);
+}
+
+void CascadedShadowSystem::render(FrameInfo &frame_info) {
+    rendered_cascade_count_ = 0;
+    dynamic_cascade_count_ = 0;
+    if (shadow_pipeline_ == nullptr) return;
+
+    VkCommandBuffer command_buffer = frame_info.command_buffer;
+    bool has_dynamic_objects = frame_info.scene_bvh.dynamicCount() > 0;
+
+    // casters inside the light box of each cascade, split by mobility; the
+    // sampled map is recomposed when either part changed
+    std::array<bool, kShadowCascadeCount> is_composed{};
+    bool has_work = false;
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        auto &cascade = cascades_[i];
+        static_casters_[i].clear();
+        dynamic_casters_[i].clear();
+        if (!cascade.needs_render && !has_dynamic_objects && !cascade.has_dynamic_casters) {
+            continue;
+        }
+
+        visible_primitives_.clear();
+        frame_info.scene_bvh.queryFrustum(M1kFrustum::fromMatrix(cascade.view_projection),
+                                          visible_primitives_);
+        for (const auto &primitive : visible_primitives_) {
+            if (primitive.is_dynamic) {
+                dynamic_casters_[i].push_back(primitive);
+            } else if (cascade.needs_render) {
+                static_casters_[i].push_back(primitive);
+            }
+        }
+
+        is_composed[i] = cascade.needs_render || cascade.has_dynamic_casters ||
+                         !dynamic_casters_[i].empty();
+        has_work = has_work || is_composed[i];
+    }
+    if (!has_work) return;
+
+    instance_batcher_.begin(frame_info.frame_index);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    // static layers: the cached content is thrown away, only wait for the
+    // copies that read it
+    std::vector<VkImageMemoryBarrier> static_barriers;
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        if (!cascades_[i].needs_render) continue;
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        barrier.image = static_image_;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1};
+        static_barriers.push_back(barrier);
+    }
+
+    if (!static_barriers.empty()) {
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                             0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(static_barriers.size()),
+                             static_barriers.data());
+
+        for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+            auto &cascade = cascades_[i];
+            if (!cascade.needs_render) continue;
+
+            drawCasters(frame_info, static_cascade_views_[i], VK_ATTACHMENT_LOAD_OP_CLEAR,
+                        cascade.view_projection, static_casters_[i]);
+            cascade.needs_render = false;
+            ++rendered_cascade_count_;
+        }
+
+        for (auto &static_barrier : static_barriers) {
+            static_barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+            static_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            static_barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            static_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        }
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(static_barriers.size()),
+                             static_barriers.data());
+    }
+
+    // sampled layers: the static layer, then the dynamic casters on top.
+    // Earlier frames only sampled them
+    std::vector<VkImageMemoryBarrier> barriers;
+    std::vector<VkImageCopy> copies;
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        if (!is_composed[i]) continue;
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.image = shadow_image_;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1};
+        barriers.push_back(barrier);
+
+        VkImageCopy copy{};
+        copy.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, i, 1};
+        copy.dstSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, i, 1};
+        copy.extent = {kShadowMapResolution, kShadowMapResolution, 1};
+        copies.push_back(copy);
+    }
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()), barriers.data());
+    vkCmdCopyImage(command_buffer,
+                   static_image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   shadow_image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(copies.size()), copies.data());
+
+    for (auto &compose_barrier : barriers) {
+        compose_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        compose_barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        compose_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        compose_barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    }
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                             VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 0, nullptr, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    for (uint32_t i = 0; i < kShadowCascadeCount; ++i) {
+        if (!is_composed[i]) continue;
+
+        auto &cascade = cascades_[i];
+        cascade.has_dynamic_casters = !dynamic_casters_[i].empty();
+        if (!cascade.has_dynamic_casters) continue;
+
+        drawCasters(frame_info, cascade_views_[i], VK_ATTACHMENT_LOAD_OP_LOAD,
+                    cascade.view_projection, dynamic_casters_[i]);
+        ++dynamic_cascade_count_;
+    }
+
+    // the copy-only layers reached the attachment stages through the barrier above
+    for (auto &compose_barrier : barriers) {
+        compose_barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        compose_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        compose_barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        compose_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, nullptr, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()), barriers.data());
+}
+
+}
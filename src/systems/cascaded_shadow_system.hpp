@@ -0,0 +1,127 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "core/m1k_device.hpp"
+#include "core/m1k_pipeline.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
+#include "m1k_config.hpp"
+#include "m1k_data_struct.hpp"
+#include "m1k_frame_info.hpp"
+#include "objects/m1k_game_object.hpp"
+#include "objects/m1k_instance_batcher.hpp"
+
+// std
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Cascaded shadow maps for GlobalUbo::direct_light.
+ *
+ * All cascades live in one depth array image (global set, binding 5). Each
+ * cascade is fitted to the bounding sphere of its view slice, enlarged by
+ * kShadowCacheMargin and snapped to shadow texels.
+ *
+ * Static casters are cached in a second array image. A cascade's static
+ * layer is only drawn again when
+ *   - the slice left the cached region (camera moved or turned), or
+ *   - the light direction or the static scene changed; then cascade i
+ *     refreshes once every 2^i frames, so far cascades spread their cost.
+ * Objects count as dynamic once they moved (M1kSceneBvh::staticVersion).
+ * A cascade with dynamic casters, now or last frame, copies its static layer
+ * into the sampled map and draws only the dynamic casters on top, every
+ * frame. With a static camera and scene no shadow pass is recorded at all.
+ *
+ * The passes use dynamic rendering; without it the map stays cleared to the
+ * far plane and everything is lit.
+ */
+class CascadedShadowSystem {
+   public:
+    CascadedShadowSystem(M1kDevice &device,
+                         uint32_t frames_in_flight,
+                         VkDescriptorSetLayout global_set_layout,
+                         VkDescriptorSetLayout pbr_set_layout,
+                         VkDescriptorSetLayout bindless_set_layout,
+                         M1kPipelineBuildQueue &build_queue);
+    ~CascadedShadowSystem();
+
+    CascadedShadowSystem(const CascadedShadowSystem&) = delete;
+    CascadedShadowSystem &operator=(const CascadedShadowSystem&) = delete;
+
+    // for the global descriptor sets
+    VkDescriptorImageInfo getShadowMapImageInfo() const;
+
+    // fits the cascades, picks the ones drawn this frame and fills the ubo,
+    // after the scene BVH was synced with the game objects
+    void update(FrameInfo &frame_info, GlobalUbo &ubo);
+    // records the picked cascades, outside of any render pass, needs the
+    // scene BVH committed
+    void render(FrameInfo &frame_info);
+
+    // static layers redrawn, cascades with dynamic casters drawn this frame
+    uint32_t getRenderedCascadeCount() const { return rendered_cascade_count_; }
+    uint32_t getDynamicCascadeCount() const { return dynamic_cascade_count_; }
+
+   private:
+    struct Cascade {
+        glm::mat4 view_projection{1.0f};
+        glm::vec3 center{0.0f};
+        float radius = 0.0f;  // of the rendered region, margin included
+        float texel_size = 0.0f;
+        bool is_valid = false;
+        // light or static scene changed since it was drawn
+        bool is_stale = true;
+        bool needs_render = false;      // the static layer
+        bool has_dynamic_casters = false;   // in the sampled map, from last frame
+    };
+
+    void createShadowMap();
+    void createStaticShadowMap();
+    void createSampler();
+    void createPipelineLayout(VkDescriptorSetLayout global_set_layout,
+                              VkDescriptorSetLayout pbr_set_layout,
+                              VkDescriptorSetLayout bindless_set_layout);
+    void createPipeline(M1kPipelineBuildQueue &build_queue);
+    void fitCascade(Cascade &cascade, const glm::vec3 &center, float radius,
+                    const glm::vec3 &light_direction);
+    void drawCasters(FrameInfo &frame_info, VkImageView view, VkAttachmentLoadOp load_op,
+                     const glm::mat4 &view_projection,
+                     const std::vector<M1kBvhPrimitive> &casters);
+
+    M1kDevice &m1k_device_;
+
+    VkFormat shadow_format_ = VK_FORMAT_UNDEFINED;
+    VkImage shadow_image_ = VK_NULL_HANDLE;
+    VkDeviceMemory shadow_image_memory_ = VK_NULL_HANDLE;
+    VkImageView shadow_array_view_ = VK_NULL_HANDLE;  // sampled
+    std::array<VkImageView, kShadowCascadeCount> cascade_views_{};  // rendered
+    // static casters only, copied into shadow_image_
+    VkImage static_image_ = VK_NULL_HANDLE;
+    VkDeviceMemory static_image_memory_ = VK_NULL_HANDLE;
+    std::array<VkImageView, kShadowCascadeCount> static_cascade_views_{};
+    VkSampler shadow_sampler_ = VK_NULL_HANDLE;
+
+    std::unique_ptr<M1kPipeline> shadow_pipeline_;
+    VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+
+    std::array<Cascade, kShadowCascadeCount> cascades_{};
+    glm::vec3 cached_light_direction_{0.0f};
+    uint64_t cached_static_version_ = ~0ull;
+    uint64_t frame_counter_ = 0;
+    uint32_t rendered_cascade_count_ = 0;
+    uint32_t dynamic_cascade_count_ = 0;
+
+    std::vector<M1kBvhPrimitive> visible_primitives_{};
+    std::array<std::vector<M1kBvhPrimitive>, kShadowCascadeCount> static_casters_{};
+    std::array<std::vector<M1kBvhPrimitive>, kShadowCascadeCount> dynamic_casters_{};
+    // one buffer for all cascades of a frame
+    M1kInstanceBatcher instance_batcher_;
+    std::vector<M1kInstancedDraw> draws_{};
+};
+
+}
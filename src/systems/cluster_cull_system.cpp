@@ -0,0 +1,276 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "cluster_cull_system.hpp"
+#include "core/m1k_shader_reflection.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+namespace m1k {
+
+namespace {
+
+// local_size_x of meshlet_cull.comp
+constexpr uint32_t kMeshletCullLocalSize = 64;
+
+struct ClusterCullPushConstants {
+    glm::mat4 transform{1.0f};  // meshlet bounds to world space
+    uint32_t meshlet_count = 0;
+    uint32_t first_command = 0;
+    uint32_t count_index = 0;
+    uint32_t is_compacted = 0;
+    uint32_t is_backface_culled = 0;
+};
+
+}
+
+ClusterCullSystem::ClusterCullSystem(M1kDevice &device, uint32_t frames_in_flight,
+                                     VkDescriptorSetLayout global_set_layout,
+                                     VkDescriptorSetLayout pbr_set_layout,
+                                     M1kPipelineBuildQueue &build_queue)
+    : m1k_device_(device), is_compacted_(device.isDrawIndirectCountSupported()) {
+    // the render systems drawing the commands all start from the default config
+    PipelineConfigInfo pipeline_config{};
+    M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
+    is_backface_culled_ =
+        (pipeline_config.rasterization_info.cullMode & VK_CULL_MODE_BACK_BIT) != 0;
+
+    createBuffers(frames_in_flight);
+    createDescriptorSets(frames_in_flight);
+    createPipelineLayout(global_set_layout, pbr_set_layout);
+    build_queue.addCompute(cull_pipeline_, pipeline_layout_,
+                           "./shaders/binaries/meshlet_cull.comp.spv");
+
+    if (!is_compacted_) {
+        std::cout << "M1K::INFO~~~~~~~~No draw indirect count, culled meshlets "
+                     "are drawn as empty commands." << std::endl;
+    }
+}
+
+ClusterCullSystem::~ClusterCullSystem() {}
+
+void ClusterCullSystem::createBuffers(uint32_t frames_in_flight) {
+    draw_buffers_.resize(frames_in_flight);
+    draw_count_buffers_.resize(frames_in_flight);
+
+    for (uint32_t i = 0; i < frames_in_flight; ++i) {
+        // written by the culling pass, consumed by the indirect draws
+        draw_buffers_[i] = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(VkDrawIndexedIndirectCommand), kMaxClusterDrawCommands,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, true);
+        draw_count_buffers_[i] = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(uint32_t), kMaxClusterCulledMeshes,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, true);
+    }
+}
+
+void ClusterCullSystem::createDescriptorSets(uint32_t frames_in_flight) {
+    // set 1 of the culling shader: draw commands, draw counts
+    output_set_layout_ =
+        M1kDescriptorSetLayout::Builder(m1k_device_)
+            .addBindings(
+                M1kShaderReflection::fromFile("./shaders/binaries/meshlet_cull.comp.spv"), 1)
+            .build();
+
+    output_pool_ =
+        M1kDescriptorPool::Builder(m1k_device_)
+            .setMaxSets(frames_in_flight)
+            .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * frames_in_flight)
+            .build();
+
+    output_descriptor_sets_.resize(frames_in_flight);
+    for (uint32_t i = 0; i < frames_in_flight; ++i) {
+        auto draw_buffer_info = draw_buffers_[i]->descriptorInfo();
+        auto draw_count_buffer_info = draw_count_buffers_[i]->descriptorInfo();
+        if (!M1kDescriptorWriter(*output_set_layout_, *output_pool_)
+                 .writeBuffer(0, &draw_buffer_info)
+                 .writeBuffer(1, &draw_count_buffer_info)
+                 .build(output_descriptor_sets_[i])) {
+            throw std::runtime_error("failed to allocate cluster culling descriptor set");
+        }
+    }
+}
+
+void ClusterCullSystem::createPipelineLayout(VkDescriptorSetLayout global_set_layout,
+                                             VkDescriptorSetLayout pbr_set_layout) {
+    // the mesh set keeps number 2 as in the render systems
+    std::vector<VkDescriptorSetLayout> descriptor_set_layouts{
+        global_set_layout, output_set_layout_->getDescriptorSetLayout(), pbr_set_layout};
+
+    auto push_constant_ranges = M1kShaderReflection::fromFile(
+        "./shaders/binaries/meshlet_cull.comp.spv").getPushConstantRanges();
+    assert(!push_constant_ranges.empty() &&
+           push_constant_ranges[0].size >= sizeof(ClusterCullPushConstants) &&
+           "Meshlet culling shader doesn't match ClusterCullPushConstants");
+
+    pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        descriptor_set_layouts, push_constant_ranges);
+}
+
+void ClusterCullSystem::cull(FrameInfo &frame_info, VkCommandBuffer compute_command_buffer) {
+    dispatches_.clear();
+    draws_.clear();
+    command_count_ = 0;
+
+    // the same meshes and levels the render systems will draw
+    visible_primitives_.clear();
+    M1kFrustum frustum = M1kFrustum::fromMatrix(
+        frame_info.camera.getProjection() * frame_info.camera.getView());
+    frame_info.scene_bvh.queryFrustum(frustum, visible_primitives_);
+
+    candidates_.clear();
+    for (const auto &primitive : visible_primitives_) {
+        auto it = frame_info.game_objects.find(primitive.object_id);
+        if (it == frame_info.game_objects.end()) continue;
+
+        auto &obj = it->second;
+        if (obj.getType() != GameObjectType::PbrObject) continue;
+
+        M1kMesh &mesh = obj.model->getMesh(primitive.mesh_index);
+        if (mesh.getMeshletCount() == 0) continue;
+
+        glm::mat4 transform = obj.transform.worldMat4();
+        if (mesh.selectLod(frame_info.camera, frame_info.lod_bias, transform) != 0) continue;
+        candidates_.push_back({obj.model.get(), primitive, transform});
+    }
+
+    // a mesh several objects draw at lod 0 is one instanced draw, drawn whole
+    std::sort(candidates_.begin(), candidates_.end(),
+              [](const Candidate &a, const Candidate &b) {
+                  return a.model != b.model ? a.model < b.model
+                                            : a.primitive.mesh_index < b.primitive.mesh_index;
+              });
+    auto is_same_mesh = [this](size_t a, size_t b) {
+        return candidates_[a].model == candidates_[b].model &&
+               candidates_[a].primitive.mesh_index == candidates_[b].primitive.mesh_index;
+    };
+
+    for (size_t i = 0; i < candidates_.size(); ++i) {
+        if ((i > 0 && is_same_mesh(i - 1, i)) ||
+            (i + 1 < candidates_.size() && is_same_mesh(i, i + 1))) {
+            continue;
+        }
+
+        const Candidate &candidate = candidates_[i];
+        M1kMesh &mesh = candidate.model->getMesh(candidate.primitive.mesh_index);
+        uint32_t meshlet_count = mesh.getMeshletCount();
+
+        if (dispatches_.size() >= kMaxClusterCulledMeshes ||
+            command_count_ + meshlet_count > kMaxClusterDrawCommands) {
+            if (!has_warned_overflow_) {
+                std::cout << "M1K::WARN========Cluster culling capacity exceeded, "
+                             "the remaining meshes are drawn whole." << std::endl;
+                has_warned_overflow_ = true;
+            }
+            break;
+        }
+
+        ClusterDraw draw{command_count_, static_cast<uint32_t>(dispatches_.size())};
+        dispatches_.push_back({&mesh, candidate.transform, draw});
+        draws_[drawKey(candidate.primitive)] = draw;
+        command_count_ += meshlet_count;
+    }
+
+    if (dispatches_.empty()) return;
+
+    // this slot's buffers were last read by the graphics submission the
+    // renderer waited for in beginFrame
+    int frame_index = frame_info.frame_index;
+
+    if (is_compacted_) {
+        VkBuffer draw_count_buffer = draw_count_buffers_[frame_index]->getBuffer();
+        auto count_size = static_cast<VkDeviceSize>(sizeof(uint32_t) * dispatches_.size());
+        vkCmdFillBuffer(compute_command_buffer, draw_count_buffer, 0, count_size, 0);
+
+        // the shader increments the cleared counts
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = draw_count_buffer;
+        barrier.offset = 0;
+        barrier.size = count_size;
+        vkCmdPipelineBarrier(compute_command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    cull_pipeline_->bind(compute_command_buffer);
+    VkDescriptorSet descriptor_sets[] = {frame_info.global_descriptor_set,
+                                         output_descriptor_sets_[frame_index]};
+    vkCmdBindDescriptorSets(compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, 0, 2, descriptor_sets, 0, nullptr);
+
+    for (const auto &dispatch : dispatches_) {
+        VkDescriptorSet mesh_descriptor_set = dispatch.mesh->getDescriptorSet();
+        vkCmdBindDescriptorSets(compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                pipeline_layout_, 2, 1, &mesh_descriptor_set,
+                                0, nullptr);
+
+        ClusterCullPushConstants push{};
+        push.transform = dispatch.transform * dispatch.mesh->getTransform();
+        push.meshlet_count = dispatch.mesh->getMeshletCount();
+        push.first_command = dispatch.draw.first_command;
+        push.count_index = dispatch.draw.count_index;
+        push.is_compacted = is_compacted_ ? 1 : 0;
+        // a double-sided material shows the faces the cone test would drop
+        push.is_backface_culled =
+            is_backface_culled_ && !dispatch.mesh->isDoubleSided() ? 1 : 0;
+        vkCmdPushConstants(compute_command_buffer, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(ClusterCullPushConstants), &push);
+
+        vkCmdDispatch(compute_command_buffer,
+                      M1kComputePipeline::groupCount(push.meshlet_count,
+                                                     kMeshletCullLocalSize),
+                      1, 1);
+    }
+}
+
+bool ClusterCullSystem::drawMesh(VkCommandBuffer command_buffer,
+                                 const FrameInfo &frame_info,
+                                 const M1kBvhPrimitive &primitive,
+                                 M1kMesh &mesh,
+                                 VkPipelineLayout &pipeline_layout,
+                                 bool is_positions_only) const {
+    auto it = draws_.find(drawKey(primitive));
+    if (it == draws_.end()) return false;
+
+    if (is_positions_only) {
+        mesh.bindPositions(command_buffer, pipeline_layout);
+    } else {
+        mesh.bind(command_buffer, pipeline_layout);
+    }
+
+    const ClusterDraw &draw = it->second;
+    int frame_index = frame_info.frame_index;
+    VkDeviceSize draw_offset = sizeof(VkDrawIndexedIndirectCommand) * draw.first_command;
+    if (is_compacted_) {
+        mesh.drawIndirect(command_buffer,
+                          draw_buffers_[frame_index]->getBuffer(), draw_offset,
+                          draw_count_buffers_[frame_index]->getBuffer(),
+                          sizeof(uint32_t) * draw.count_index,
+                          m1k_device_.isMultiDrawIndirectSupported());
+    } else {
+        mesh.drawIndirect(command_buffer,
+                          draw_buffers_[frame_index]->getBuffer(), draw_offset,
+                          VK_NULL_HANDLE, 0,
+                          m1k_device_.isMultiDrawIndirectSupported());
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,119 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "core/m1k_buffer.hpp"
+#include "core/m1k_compute_pipeline.hpp"
+#include "core/m1k_descriptor.hpp"
+#include "core/m1k_device.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
+#include "m1k_config.hpp"
+#include "m1k_frame_info.hpp"
+#include "objects/m1k_game_object.hpp"
+
+// std
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * GPU culling of the meshlets of dense meshes.
+ *
+ * Every frame the visible meshes drawn at lod 0 that carry meshlets get a
+ * range of a per-frame draw command buffer, unless several objects share the
+ * mesh and it is drawn instanced. A compute pass on the async compute
+ * queue tests each meshlet's bounding sphere against the camera frustum and
+ * writes one VkDrawIndexedIndirectCommand per surviving meshlet. The frame's
+ * graphics submission waits for it before the indirect draws read the commands.
+ *
+ * The normal cone is tested against the camera position as well only when
+ * the pipelines cull back faces and the mesh's material is single-sided;
+ * otherwise a meshlet facing away is still drawn and only the frustum test
+ * applies, so the picture never changes.
+ *
+ * With VK_KHR_draw_indirect_count the commands are compacted and counted per
+ * mesh; otherwise every meshlet keeps its slot and culled ones are written
+ * with instanceCount 0, which works on any device.
+ */
+class ClusterCullSystem {
+   public:
+    ClusterCullSystem(M1kDevice &device, uint32_t frames_in_flight,
+                      VkDescriptorSetLayout global_set_layout,
+                      VkDescriptorSetLayout pbr_set_layout,
+                      M1kPipelineBuildQueue &build_queue);
+    ~ClusterCullSystem();
+
+    ClusterCullSystem(const ClusterCullSystem&) = delete;
+    ClusterCullSystem &operator=(const ClusterCullSystem&) = delete;
+
+    // picks the meshes and records the culling pass into the frame's compute
+    // command buffer, needs the scene BVH committed
+    void cull(FrameInfo &frame_info, VkCommandBuffer compute_command_buffer);
+
+    // binds the mesh and draws the commands of this frame, false if the mesh
+    // wasn't culled here and has to be drawn whole; safe from several workers
+    bool drawMesh(VkCommandBuffer command_buffer,
+                  const FrameInfo &frame_info,
+                  const M1kBvhPrimitive &primitive,
+                  M1kMesh &mesh,
+                  VkPipelineLayout &pipeline_layout,
+                  bool is_positions_only) const;
+
+    uint32_t getCulledMeshCount() const { return static_cast<uint32_t>(dispatches_.size()); }
+    uint32_t getTestedMeshletCount() const { return command_count_; }
+
+   private:
+    struct ClusterDraw {
+        uint32_t first_command = 0;
+        uint32_t count_index = 0;
+    };
+
+    struct Candidate {
+        M1kModel *model = nullptr;
+        M1kBvhPrimitive primitive{};
+        glm::mat4 transform{1.0f};  // object placement
+    };
+
+    struct Dispatch {
+        M1kMesh *mesh = nullptr;
+        glm::mat4 transform{1.0f};
+        ClusterDraw draw{};
+    };
+
+    static uint64_t drawKey(const M1kBvhPrimitive &primitive) {
+        return static_cast<uint64_t>(primitive.object_id) << 32 | primitive.mesh_index;
+    }
+
+    void createBuffers(uint32_t frames_in_flight);
+    void createDescriptorSets(uint32_t frames_in_flight);
+    void createPipelineLayout(VkDescriptorSetLayout global_set_layout,
+                              VkDescriptorSetLayout pbr_set_layout);
+
+    M1kDevice &m1k_device_;
+    bool is_compacted_ = false;
+    bool is_backface_culled_ = false;   // the drawing pipelines cull back faces
+
+    std::vector<std::unique_ptr<M1kBuffer>> draw_buffers_{};
+    std::vector<std::unique_ptr<M1kBuffer>> draw_count_buffers_{};
+
+    std::unique_ptr<M1kDescriptorSetLayout> output_set_layout_;
+    std::unique_ptr<M1kDescriptorPool> output_pool_;
+    std::vector<VkDescriptorSet> output_descriptor_sets_{};
+
+    std::unique_ptr<M1kComputePipeline> cull_pipeline_;
+    VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+
+    // this frame's meshes, read only while the draws are recorded
+    std::vector<M1kBvhPrimitive> visible_primitives_{};
+    std::vector<Candidate> candidates_{};
+    std::vector<Dispatch> dispatches_{};
+    std::unordered_map<uint64_t, ClusterDraw> draws_{};
+    uint32_t command_count_ = 0;
+    bool has_warned_overflow_ = false;
+};
+
+}
@@ -0,0 +1,288 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "deferred_pbr_render_system.hpp"
+#include "cluster_cull_system.hpp"
+#include "core/m1k_shader_reflection.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace m1k {
+
+namespace {
+
+constexpr std::array<VkFormat, DeferredPbrRenderSystem::kGBufferColorCount> kGBufferFormats{
+    VK_FORMAT_R8G8B8A8_SRGB,            // base colour, ao
+    VK_FORMAT_R16G16_SNORM,             // octahedral normal
+    VK_FORMAT_R8G8B8A8_UNORM,           // roughness, metalness, occlusion strength
+    VK_FORMAT_B10G11R11_UFLOAT_PACK32,  // emissive
+};
+
+constexpr const char* kGBufferNames[DeferredPbrRenderSystem::kGBufferColorCount]{
+    "gbuffer_albedo", "gbuffer_normal", "gbuffer_material", "gbuffer_emissive"};
+
+}
+
+DeferredPbrRenderSystem::DeferredPbrRenderSystem(M1kDevice &device,
+                                                 const RenderTargetInfo &render_target,
+                                                 uint32_t frames_in_flight,
+                                                 VkDescriptorSetLayout global_set_layout,
+                                                 VkDescriptorSetLayout pbr_set_layout,
+                                                 VkDescriptorSetLayout bindless_set_layout,
+                                                 M1kPipelineBuildQueue &build_queue)
+    : m1k_device_(device), instance_batcher_(device, frames_in_flight) {
+    gbuffer_depth_format_ = m1k_device_.findSupportedFormat(
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+
+    createSampler();
+    createDescriptorSets(frames_in_flight);
+    createPipelineLayouts(global_set_layout, pbr_set_layout, bindless_set_layout);
+    createPipelines(render_target, build_queue);
+}
+
+DeferredPbrRenderSystem::~DeferredPbrRenderSystem() {
+    vkDestroySampler(m1k_device_.device(), gbuffer_sampler_, nullptr);
+}
+
+void DeferredPbrRenderSystem::createSampler() {
+    // only read with texelFetch
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_NEAREST;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = 0.0f;
+
+    if (vkCreateSampler(m1k_device_.device(), &sampler_info, nullptr, &gbuffer_sampler_) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create G-buffer sampler");
+    }
+}
+
+void DeferredPbrRenderSystem::createDescriptorSets(uint32_t frames_in_flight) {
+    // set 1 of the lighting shader: the G-buffer colors, then depth
+    gbuffer_set_layout_ =
+        M1kDescriptorSetLayout::Builder(m1k_device_)
+            .addBindings(
+                M1kShaderReflection::fromFile("./shaders/binaries/deferred_lighting.frag.spv"), 1)
+            .build();
+
+    gbuffer_pool_ =
+        M1kDescriptorPool::Builder(m1k_device_)
+            .setMaxSets(frames_in_flight)
+            .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                         (kGBufferColorCount + 1) * frames_in_flight)
+            .build();
+
+    gbuffer_descriptor_sets_.resize(frames_in_flight);
+    for (auto &set : gbuffer_descriptor_sets_) {
+        if (!gbuffer_pool_->allocateDescriptor(gbuffer_set_layout_->getDescriptorSetLayout(), set)) {
+            throw std::runtime_error("failed to allocate G-buffer descriptor set");
+        }
+    }
+}
+
+void DeferredPbrRenderSystem::createPipelineLayouts(VkDescriptorSetLayout global_set_layout,
+                                                    VkDescriptorSetLayout pbr_set_layout,
+                                                    VkDescriptorSetLayout bindless_set_layout) {
+    // same set numbers as BindlessPbrRenderSystem, shares the vertex shader
+    // and with it the pipeline layout
+    gbuffer_pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        {global_set_layout, bindless_set_layout, pbr_set_layout});
+
+    lighting_pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        {global_set_layout, gbuffer_set_layout_->getDescriptorSetLayout()});
+}
+
+void DeferredPbrRenderSystem::createPipelines(const RenderTargetInfo &render_target,
+                                              M1kPipelineBuildQueue &build_queue) {
+    assert(gbuffer_pipeline_layout_ != nullptr && "Cannot create pipeline before pipeline layout");
+
+    RenderTargetInfo gbuffer_target{};
+    gbuffer_target.color_formats.assign(kGBufferFormats.begin(), kGBufferFormats.end());
+    gbuffer_target.depth_format = gbuffer_depth_format_;
+    gbuffer_target.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    // compiled per material on first use
+    VkPipelineLayout gbuffer_pipeline_layout = gbuffer_pipeline_layout_;
+    gbuffer_permutations_ = std::make_unique<M1kPipelinePermutations>(
+        m1k_device_,
+        [gbuffer_target, gbuffer_pipeline_layout](PipelineConfigInfo &gbuffer_config) {
+            M1kPipeline::defaultPipelineConfigInfo(gbuffer_config);
+            gbuffer_target.applyTo(gbuffer_config);
+            gbuffer_config.pipeline_layout = gbuffer_pipeline_layout;
+            M1kInstanceBatcher::addVertexInput(gbuffer_config, false);
+            gbuffer_config.color_blend_attachments.assign(
+                kGBufferColorCount, gbuffer_config.color_blend_attachment);
+        },
+        "./shaders/binaries/bindless_pbr_shader.vert.spv",
+        "./shaders/binaries/deferred_gbuffer.frag.spv");
+    build_queue.addPermutations(*gbuffer_permutations_);
+
+    VkPipelineLayout lighting_pipeline_layout = lighting_pipeline_layout_;
+    build_queue.addGraphics(
+        lighting_pipeline_,
+        [render_target, lighting_pipeline_layout](PipelineConfigInfo &lighting_config) {
+            M1kPipeline::defaultPipelineConfigInfo(lighting_config);
+            render_target.applyTo(lighting_config);
+            lighting_config.pipeline_layout = lighting_pipeline_layout;
+            lighting_config.binding_descriptions.clear();
+            lighting_config.attribute_descriptions.clear();
+        },
+        "./shaders/binaries/fullscreen.vert.spv",
+        "./shaders/binaries/deferred_lighting.frag.spv");
+}
+
+void DeferredPbrRenderSystem::addGeometryPass(FrameInfo &frame_info) {
+    // hierarchical frustum culling against the scene BVH
+    visible_primitives_.clear();
+    M1kFrustum frustum = M1kFrustum::fromMatrix(
+        frame_info.camera.getProjection() * frame_info.camera.getView());
+    frame_info.scene_bvh.queryFrustum(frustum, visible_primitives_);
+
+    // objects sharing a model become one instanced draw per mesh and level
+    draws_.clear();
+    instance_batcher_.begin(frame_info.frame_index);
+    instance_batcher_.batch(frame_info, visible_primitives_, draws_);
+
+    // grouped by material permutation, the model and mesh order of the
+    // batcher keeps each material together inside one
+    for (auto &draw : draws_) {
+        uint32_t flags = draw.model->getMesh(draw.primitive.mesh_index).getMaterialFlags();
+        draw.pipeline = &gbuffer_permutations_->get(flags);
+    }
+    std::stable_sort(draws_.begin(), draws_.end(),
+                     [](const M1kInstancedDraw &a, const M1kInstancedDraw &b) {
+                         return a.pipeline < b.pipeline;
+                     });
+
+    auto &graph = frame_info.renderer.getRenderGraph();
+    VkExtent2D extent = frame_info.renderer.getSwapChainExtent();
+
+    for (uint32_t i = 0; i < kGBufferColorCount; ++i) {
+        M1kRenderGraphImageDesc desc{};
+        desc.extent = extent;
+        desc.format = kGBufferFormats[i];
+        desc.extra_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+        gbuffer_colors_[i] = graph.createImage(kGBufferNames[i], desc);
+    }
+    M1kRenderGraphImageDesc depth_desc{};
+    depth_desc.extent = extent;
+    depth_desc.format = gbuffer_depth_format_;
+    depth_desc.extra_usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+    gbuffer_depth_ = graph.createImage("gbuffer_depth", depth_desc);
+
+    VkClearValue depth_clear{};
+    depth_clear.depthStencil = {1.0f, 0};
+
+    graph.addPass(
+        "gbuffer",
+        [&](M1kRenderGraph::PassBuilder &builder) {
+            for (auto color : gbuffer_colors_) {
+                builder.writeColor(color);
+            }
+            builder.writeDepth(gbuffer_depth_, VK_ATTACHMENT_LOAD_OP_CLEAR, depth_clear);
+        },
+        [this, &frame_info](VkCommandBuffer command_buffer, const M1kRenderGraph &) {
+            recordGeometry(frame_info, command_buffer);
+        });
+
+    // sampled by the lighting pass after the graph
+    for (auto color : gbuffer_colors_) {
+        graph.markOutput(color, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    graph.markOutput(gbuffer_depth_, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+void DeferredPbrRenderSystem::recordGeometry(const FrameInfo &frame_info,
+                                             VkCommandBuffer command_buffer) {
+    if (draws_.empty()) return;
+
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        gbuffer_pipeline_layout_,
+        0, 1,
+        &frame_info.global_descriptor_set,
+        0, nullptr);
+
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        gbuffer_pipeline_layout_,
+        1, 1,
+        &frame_info.bindless_descriptor_set,
+        0, nullptr);
+
+    M1kPipeline *bound_pipeline = nullptr;
+    for (const auto &draw : draws_) {
+        if (draw.pipeline != bound_pipeline) {
+            draw.pipeline->bind(command_buffer);
+            bound_pipeline = draw.pipeline;
+        }
+        instance_batcher_.bind(command_buffer, draw);
+
+        // the cluster culling pass only takes meshes drawn once
+        if (draw.lod == 0 && draw.instance_count == 1 &&
+            frame_info.cluster_cull_system != nullptr &&
+            frame_info.cluster_cull_system->drawMesh(command_buffer, frame_info, draw.primitive,
+                                                     draw.model->getMesh(draw.primitive.mesh_index),
+                                                     gbuffer_pipeline_layout_, false)) {
+            continue;
+        }
+        draw.model->drawMesh(command_buffer, draw.primitive.mesh_index, gbuffer_pipeline_layout_,
+                             draw.lod, draw.instance_count);
+    }
+}
+
+void DeferredPbrRenderSystem::render(FrameInfo &frame_info) {
+    auto &graph = frame_info.renderer.getRenderGraph();
+    VkDescriptorSet gbuffer_set = gbuffer_descriptor_sets_[frame_info.frame_index];
+
+    // the frame that used this set last has finished, safe to rewrite
+    std::array<VkDescriptorImageInfo, kGBufferColorCount + 1> image_infos{};
+    for (uint32_t i = 0; i <= kGBufferColorCount; ++i) {
+        M1kRenderGraph::Handle image = i < kGBufferColorCount ? gbuffer_colors_[i] : gbuffer_depth_;
+        image_infos[i].sampler = gbuffer_sampler_;
+        image_infos[i].imageView = graph.getImageView(image);
+        image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    M1kDescriptorWriter writer(*gbuffer_set_layout_, *gbuffer_pool_);
+    for (uint32_t i = 0; i <= kGBufferColorCount; ++i) {
+        writer.writeImage(i, &image_infos[i]);
+    }
+    writer.overwrite(gbuffer_set);
+
+    auto &renderer = frame_info.renderer;
+    VkCommandBuffer command_buffer =
+        renderer.beginSecondaryCommandBuffer(renderer.getMainThreadIndex());
+
+    lighting_pipeline_->bind(command_buffer);
+    std::array<VkDescriptorSet, 2> descriptor_sets{frame_info.global_descriptor_set, gbuffer_set};
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        lighting_pipeline_layout_,
+        0, static_cast<uint32_t>(descriptor_sets.size()),
+        descriptor_sets.data(),
+        0, nullptr);
+    vkCmdDraw(command_buffer, 3, 1, 0, 0);
+
+    renderer.endSecondaryCommandBuffer(command_buffer);
+    renderer.executeSecondaryCommandBuffers(frame_info.command_buffer, {command_buffer});
+}
+
+}
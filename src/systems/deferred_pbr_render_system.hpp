@@ -0,0 +1,97 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "core/m1k_descriptor.hpp"
+#include "core/m1k_device.hpp"
+#include "core/m1k_pipeline.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
+#include "core/m1k_pipeline_permutations.hpp"
+#include "m1k_frame_info.hpp"
+#include "objects/m1k_game_object.hpp"
+#include "objects/m1k_instance_batcher.hpp"
+#include "m1k_config.hpp"
+
+// std
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Deferred alternative to BindlessPbrRenderSystem, same materials and
+ * bindless textures.
+ *
+ * addGeometryPass() declares a single sampled G-buffer pass on the frame's
+ * render graph:
+ *   0  R8G8B8A8_SRGB      base colour, ao
+ *   1  R16G16_SNORM       octahedral world normal
+ *   2  R8G8B8A8_UNORM     roughness, metalness, occlusion strength
+ *   3  B10G11R11_UFLOAT   emissive
+ *   +  depth
+ * render() then shades it with one full-screen triangle inside the scene
+ * pass, walking the clustered light lists, and writes the G-buffer depth so
+ * forward passes after it still depth test.
+ */
+class DeferredPbrRenderSystem {
+   public:
+    static constexpr uint32_t kGBufferColorCount = 4;
+
+    DeferredPbrRenderSystem(M1kDevice &device,
+                            const RenderTargetInfo &render_target,
+                            uint32_t frames_in_flight,
+                            VkDescriptorSetLayout global_set_layout,
+                            VkDescriptorSetLayout pbr_set_layout,
+                            VkDescriptorSetLayout bindless_set_layout,
+                            M1kPipelineBuildQueue &build_queue);
+    ~DeferredPbrRenderSystem();
+
+    DeferredPbrRenderSystem(const DeferredPbrRenderSystem&) = delete;
+    DeferredPbrRenderSystem &operator=(const DeferredPbrRenderSystem&) = delete;
+
+    // before the render graph is executed
+    void addGeometryPass(FrameInfo &frame_info);
+    // inside the scene pass, after the render graph was executed
+    void render(FrameInfo &frame_info);
+
+    size_t getVisibleMeshCount() const { return visible_primitives_.size(); }
+    size_t getDrawCount() const { return draws_.size(); }
+
+   private:
+    void createSampler();
+    void createDescriptorSets(uint32_t frames_in_flight);
+    void createPipelineLayouts(VkDescriptorSetLayout global_set_layout,
+                               VkDescriptorSetLayout pbr_set_layout,
+                               VkDescriptorSetLayout bindless_set_layout);
+    void createPipelines(const RenderTargetInfo &render_target, M1kPipelineBuildQueue &build_queue);
+    void recordGeometry(const FrameInfo &frame_info, VkCommandBuffer command_buffer);
+
+    M1kDevice &m1k_device_;
+
+    // one pipeline per material flags
+    std::unique_ptr<M1kPipelinePermutations> gbuffer_permutations_;
+    std::unique_ptr<M1kPipeline> lighting_pipeline_;
+    VkPipelineLayout gbuffer_pipeline_layout_ = VK_NULL_HANDLE;
+    VkPipelineLayout lighting_pipeline_layout_ = VK_NULL_HANDLE;
+
+    // G-buffer views change whenever the graph rebuilds its images, so every
+    // frame in flight rewrites its own set
+    std::unique_ptr<M1kDescriptorSetLayout> gbuffer_set_layout_;
+    std::unique_ptr<M1kDescriptorPool> gbuffer_pool_;
+    std::vector<VkDescriptorSet> gbuffer_descriptor_sets_{};
+    VkSampler gbuffer_sampler_ = VK_NULL_HANDLE;
+    VkFormat gbuffer_depth_format_ = VK_FORMAT_UNDEFINED;
+
+    // render graph handles of the current frame
+    std::array<M1kRenderGraph::Handle, kGBufferColorCount> gbuffer_colors_{};
+    M1kRenderGraph::Handle gbuffer_depth_ = M1kRenderGraph::kInvalidHandle;
+
+    std::vector<M1kBvhPrimitive> visible_primitives_{};
+    M1kInstanceBatcher instance_batcher_;
+    std::vector<M1kInstancedDraw> draws_{};
+};
+
+}
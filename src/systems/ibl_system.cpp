@@ -0,0 +1,647 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "ibl_system.hpp"
+#include "utils/m1k_utils.hpp"
+
+#include "stb_image.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace m1k {
+
+namespace {
+
+constexpr uint32_t kIblCacheMagic = 0x494b314d;  // "M1KI"
+// bump when the bake shaders change
+constexpr uint32_t kIblCacheVersion = 1;
+// local_size_x/y of the ibl_*.comp shaders
+constexpr uint32_t kIblLocalSize = 8;
+
+struct IblCacheHeader {
+    uint32_t magic = kIblCacheMagic;
+    uint32_t version = kIblCacheVersion;
+    uint64_t key = 0;
+    uint64_t payload_size = 0;
+};
+
+// everything besides the source file that changes the baked data
+struct IblBakeSettings {
+    uint32_t version = kIblCacheVersion;
+    uint32_t irradiance_size = kIrradianceMapSize;
+    uint32_t prefiltered_size = kPrefilteredMapSize;
+    uint32_t prefiltered_mips = kPrefilteredMipLevels;
+    uint32_t brdf_lut_size = kBrdfLutSize;
+    uint32_t sample_count = kIblSampleCount;
+};
+
+struct IblPushConstant {
+    float roughness = 0.0f;
+    uint32_t sample_count = 0;
+};
+
+// whole image, all mips and layers
+void transitionImage(VkCommandBuffer command_buffer, VkImage image,
+                     VkImageLayout old_layout, VkImageLayout new_layout,
+                     VkAccessFlags src_access, VkAccessFlags dst_access,
+                     VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS,
+                                0, VK_REMAINING_ARRAY_LAYERS};
+
+    vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+}
+
+VkDeviceSize IblSystem::IblImage::byteSize() const {
+    VkDeviceSize byte_size = 0;
+    for (uint32_t mip = 0; mip < mip_levels; ++mip) {
+        VkDeviceSize mip_size = std::max(size >> mip, 1u);
+        byte_size += mip_size * mip_size * layer_count * texel_size;
+    }
+    return byte_size;
+}
+
+IblSystem::IblSystem(M1kDevice &device, const std::string &environment_path)
+    : m1k_device_(device) {
+    createSampler();
+
+    char *source_data = nullptr;
+    size_t source_size = 0;
+    if (!readFileBinary(environment_path, &source_data, &source_size)) {
+        std::cout << "M1K::WARN========No environment map at " << environment_path
+                  << ", using flat ambient lighting. Put an equirectangular .hdr there,"
+                     " e.g. one from https://polyhaven.com/hdris" << std::endl;
+        createImages(1, 1, 1, 1);
+        clearImages();
+        return;
+    }
+    std::unique_ptr<char[]> source{source_data};
+
+    IblBakeSettings settings{};
+    uint64_t key = fnv1a(source.get(), source_size);
+    key = fnv1a(&settings, sizeof(settings), key);
+
+    std::stringstream cache_name;
+    cache_name << std::hex << std::setw(16) << std::setfill('0') << key << ".ibl";
+    createDirectoryIfNotExists(kIblCacheDirectory);
+    std::string cache_path = kIblCacheDirectory + "/" + cache_name.str();
+
+    createImages(kIrradianceMapSize, kPrefilteredMapSize, kPrefilteredMipLevels, kBrdfLutSize);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (loadCache(cache_path, key)) {
+        is_enabled_ = true;
+    } else {
+        // stb decodes from memory, the file was already read for the hash
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        float *pixels = stbi_loadf_from_memory(
+            reinterpret_cast<const stbi_uc *>(source.get()), static_cast<int>(source_size),
+            &width, &height, &channels, STBI_rgb_alpha);
+        if (pixels == nullptr) {
+            std::cout << "M1K::WARN========Failed to decode environment map "
+                      << environment_path << ", using flat ambient lighting." << std::endl;
+            destroyImage(irradiance_);
+            destroyImage(prefiltered_);
+            destroyImage(brdf_lut_);
+            createImages(1, 1, 1, 1);
+            clearImages();
+            return;
+        }
+
+        bake(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), cache_path, key);
+        stbi_image_free(pixels);
+        is_enabled_ = true;
+    }
+
+    auto elapsed = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - start_time).count();
+    std::cout << "M1K::INFO~~~~~~~~IBL " << (is_baked_ ? "baked" : "loaded from cache")
+              << " in " << elapsed << " ms: " << cache_path << std::endl;
+}
+
+IblSystem::~IblSystem() {
+    destroyImage(irradiance_);
+    destroyImage(prefiltered_);
+    destroyImage(brdf_lut_);
+    vkDestroySampler(m1k_device_.device(), sampler_, nullptr);
+}
+
+void IblSystem::createImages(uint32_t irradiance_size, uint32_t prefiltered_size,
+                             uint32_t prefiltered_mips, uint32_t brdf_lut_size) {
+    // no mips smaller than one texel
+    uint32_t max_mips = static_cast<uint32_t>(std::floor(std::log2(prefiltered_size))) + 1;
+
+    // rgba16f everywhere, rg16f storage images are optional
+    createImage(irradiance_, VK_FORMAT_R16G16B16A16_SFLOAT, 8, irradiance_size, 1, 6);
+    createImage(prefiltered_, VK_FORMAT_R16G16B16A16_SFLOAT, 8, prefiltered_size,
+                std::min(prefiltered_mips, max_mips), 6);
+    createImage(brdf_lut_, VK_FORMAT_R16G16B16A16_SFLOAT, 8, brdf_lut_size, 1, 1);
+}
+
+void IblSystem::createImage(IblImage &ibl_image, VkFormat format, uint32_t texel_size,
+                            uint32_t size, uint32_t mip_levels, uint32_t layer_count) {
+    ibl_image.format = format;
+    ibl_image.texel_size = texel_size;
+    ibl_image.size = size;
+    ibl_image.mip_levels = mip_levels;
+    ibl_image.layer_count = layer_count;
+
+    bool is_cube = layer_count == 6;
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.flags = is_cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.extent = {size, size, 1};
+    image_info.mipLevels = mip_levels;
+    image_info.arrayLayers = layer_count;
+    image_info.format = format;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    m1k_device_.createImageWithInfo(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                    ibl_image.image, ibl_image.memory);
+
+    ibl_image.view = m1k_device_.createImageView(
+        ibl_image.image, format, mip_levels, VK_IMAGE_ASPECT_COLOR_BIT,
+        is_cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D, 0, layer_count);
+}
+
+void IblSystem::destroyImage(IblImage &ibl_image) {
+    VkDevice device = m1k_device_.device();
+    vkDestroyImageView(device, ibl_image.view, nullptr);
+    vkDestroyImage(device, ibl_image.image, nullptr);
+    vkFreeMemory(device, ibl_image.memory, nullptr);
+    ibl_image = IblImage{};
+}
+
+void IblSystem::createSampler() {
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.minLod = 0.0f;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+    if (vkCreateSampler(m1k_device_.device(), &sampler_info, nullptr, &sampler_) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create IBL sampler");
+    }
+}
+
+VkDescriptorImageInfo IblSystem::getIrradianceImageInfo() const {
+    return {sampler_, irradiance_.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+VkDescriptorImageInfo IblSystem::getPrefilteredImageInfo() const {
+    return {sampler_, prefiltered_.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+VkDescriptorImageInfo IblSystem::getBrdfLutImageInfo() const {
+    return {sampler_, brdf_lut_.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+}
+
+void IblSystem::update(GlobalUbo &ubo) const {
+    ubo.ibl_prefiltered_mips = is_enabled_ ? prefiltered_.mip_levels : 0;
+}
+
+void IblSystem::appendCopyRegions(const IblImage &ibl_image, VkDeviceSize &offset,
+                                  std::vector<VkBufferImageCopy> &regions) const {
+    for (uint32_t mip = 0; mip < ibl_image.mip_levels; ++mip) {
+        uint32_t mip_size = std::max(ibl_image.size >> mip, 1u);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, ibl_image.layer_count};
+        region.imageExtent = {mip_size, mip_size, 1};
+        regions.push_back(region);
+
+        offset += static_cast<VkDeviceSize>(mip_size) * mip_size * ibl_image.layer_count *
+                  ibl_image.texel_size;
+    }
+}
+
+VkDeviceSize IblSystem::getPayloadSize() const {
+    return irradiance_.byteSize() + prefiltered_.byteSize() + brdf_lut_.byteSize();
+}
+
+void IblSystem::clearImages() {
+    VkCommandBuffer command_buffer = m1k_device_.beginSingleTimeCommands();
+
+    VkClearColorValue black{};
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS,
+                                  0, VK_REMAINING_ARRAY_LAYERS};
+    for (IblImage *ibl_image : {&irradiance_, &prefiltered_, &brdf_lut_}) {
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        vkCmdClearColorImage(command_buffer, ibl_image->image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &range);
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    m1k_device_.endSingleTimeCommands(command_buffer);
+}
+
+bool IblSystem::loadCache(const std::string &cache_path, uint64_t key) {
+    char *file_data = nullptr;
+    size_t file_size = 0;
+    if (!readFileBinary(cache_path, &file_data, &file_size)) {
+        return false;
+    }
+    std::unique_ptr<char[]> data{file_data};
+
+    VkDeviceSize payload_size = getPayloadSize();
+    IblCacheHeader header{};
+    if (file_size >= sizeof(header)) {
+        std::memcpy(&header, data.get(), sizeof(header));
+    }
+    if (file_size != sizeof(header) + payload_size || header.magic != kIblCacheMagic ||
+        header.version != kIblCacheVersion || header.key != key ||
+        header.payload_size != payload_size) {
+        std::cout << "M1K::WARN========IBL cache " << cache_path
+                  << " is invalid, baking again." << std::endl;
+        return false;
+    }
+
+    M1kBuffer staging_buffer{
+        m1k_device_,
+        1,
+        static_cast<uint32_t>(payload_size),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    staging_buffer.map();
+    staging_buffer.writeToBuffer(data.get() + sizeof(header));
+
+    VkCommandBuffer command_buffer = m1k_device_.beginSingleTimeCommands();
+
+    VkDeviceSize offset = 0;
+    for (IblImage *ibl_image : {&irradiance_, &prefiltered_, &brdf_lut_}) {
+        std::vector<VkBufferImageCopy> regions;
+        appendCopyRegions(*ibl_image, offset, regions);
+
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        vkCmdCopyBufferToImage(command_buffer, staging_buffer.getBuffer(), ibl_image->image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(regions.size()), regions.data());
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    m1k_device_.endSingleTimeCommands(command_buffer);
+    return true;
+}
+
+void IblSystem::bake(const float *pixels, uint32_t width, uint32_t height,
+                     const std::string &cache_path, uint64_t key) {
+    VkDevice device = m1k_device_.device();
+    is_baked_ = true;
+
+    // environment as a mipmapped rgba16f image, the bake shaders pick a mip per
+    // sample so a few hundred samples don't alias on small bright spots
+    uint32_t environment_mips =
+        static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+    M1kBuffer environment_staging{
+        m1k_device_,
+        sizeof(uint64_t),
+        width * height,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    environment_staging.map();
+    auto halves = static_cast<uint64_t *>(environment_staging.getMappedMemory());
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i) {
+        halves[i] = glm::packHalf4x16(
+            glm::vec4(pixels[i * 4], pixels[i * 4 + 1], pixels[i * 4 + 2], 1.0f));
+    }
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.extent = {width, height, 1};
+    image_info.mipLevels = environment_mips;
+    image_info.arrayLayers = 1;
+    image_info.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkImage environment_image = VK_NULL_HANDLE;
+    VkDeviceMemory environment_memory = VK_NULL_HANDLE;
+    m1k_device_.createImageWithInfo(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                    environment_image, environment_memory);
+    VkImageView environment_view = m1k_device_.createImageView(
+        environment_image, VK_FORMAT_R16G16B16A16_SFLOAT, environment_mips);
+
+    // wraps around horizontally, clamps at the poles
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSampler environment_sampler = VK_NULL_HANDLE;
+    if (vkCreateSampler(device, &sampler_info, nullptr, &environment_sampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create environment sampler");
+    }
+
+    // storage views, cube mips are written as 2D arrays
+    auto create_storage_view = [&](const IblImage &ibl_image, uint32_t mip) {
+        VkImageViewCreateInfo view_info{};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = ibl_image.image;
+        view_info.viewType = ibl_image.layer_count > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                                       : VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = ibl_image.format;
+        view_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 1,
+                                      0, ibl_image.layer_count};
+
+        VkImageView view;
+        if (vkCreateImageView(device, &view_info, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create IBL storage view");
+        }
+        return view;
+    };
+
+    std::vector<VkImageView> storage_views;
+    storage_views.push_back(create_storage_view(irradiance_, 0));
+    for (uint32_t mip = 0; mip < prefiltered_.mip_levels; ++mip) {
+        storage_views.push_back(create_storage_view(prefiltered_, mip));
+    }
+    storage_views.push_back(create_storage_view(brdf_lut_, 0));
+
+    // one set per dispatch, they only differ in the output view
+    auto set_count = static_cast<uint32_t>(storage_views.size());
+    auto bake_set_layout =
+        M1kDescriptorSetLayout::Builder(m1k_device_)
+            .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+            .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+            .build();
+    auto bake_pool =
+        M1kDescriptorPool::Builder(m1k_device_)
+            .setMaxSets(set_count)
+            .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set_count)
+            .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, set_count)
+            .build();
+
+    VkDescriptorImageInfo environment_info{
+        environment_sampler, environment_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    std::vector<VkDescriptorSet> bake_sets(set_count);
+    for (uint32_t i = 0; i < set_count; ++i) {
+        VkDescriptorImageInfo output_info{VK_NULL_HANDLE, storage_views[i], VK_IMAGE_LAYOUT_GENERAL};
+        M1kDescriptorWriter(*bake_set_layout, *bake_pool)
+            .writeImage(0, &environment_info)
+            .writeImage(1, &output_info)
+            .build(bake_sets[i]);
+    }
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(IblPushConstant);
+
+    VkDescriptorSetLayout descriptor_set_layout = bake_set_layout->getDescriptorSetLayout();
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+    VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipeline_layout) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create IBL bake pipeline layout");
+    }
+
+    M1kComputePipeline irradiance_pipeline{
+        m1k_device_, pipeline_layout, "./shaders/binaries/ibl_irradiance.comp.spv"};
+    M1kComputePipeline prefilter_pipeline{
+        m1k_device_, pipeline_layout, "./shaders/binaries/ibl_prefilter.comp.spv"};
+    M1kComputePipeline brdf_lut_pipeline{
+        m1k_device_, pipeline_layout, "./shaders/binaries/ibl_brdf_lut.comp.spv"};
+
+    M1kBuffer readback_buffer{
+        m1k_device_,
+        1,
+        static_cast<uint32_t>(getPayloadSize()),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+
+    VkCommandBuffer command_buffer = m1k_device_.beginSingleTimeCommands();
+
+    // upload mip 0 and blit the chain down
+    transitionImage(command_buffer, environment_image,
+                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkBufferImageCopy upload_region{};
+    upload_region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    upload_region.imageExtent = {width, height, 1};
+    vkCmdCopyBufferToImage(command_buffer, environment_staging.getBuffer(), environment_image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload_region);
+
+    VkImageMemoryBarrier mip_barrier{};
+    mip_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    mip_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mip_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    mip_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    mip_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    mip_barrier.image = environment_image;
+
+    auto mip_width = static_cast<int32_t>(width);
+    auto mip_height = static_cast<int32_t>(height);
+    for (uint32_t mip = 1; mip < environment_mips; ++mip) {
+        mip_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 1, 0, 1};
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &mip_barrier);
+
+        VkImageBlit blit{};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 0, 1};
+        blit.srcOffsets[1] = {mip_width, mip_height, 1};
+        mip_width = std::max(mip_width / 2, 1);
+        mip_height = std::max(mip_height / 2, 1);
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1};
+        blit.dstOffsets[1] = {mip_width, mip_height, 1};
+        vkCmdBlitImage(command_buffer,
+                       environment_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       environment_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1, &blit, VK_FILTER_LINEAR);
+    }
+
+    // every mip but the last is in TRANSFER_SRC now
+    mip_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, environment_mips - 1, 0, 1};
+    mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    mip_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    mip_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    if (environment_mips > 1) {
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &mip_barrier);
+    }
+    mip_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, environment_mips - 1, 1, 0, 1};
+    mip_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    mip_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &mip_barrier);
+
+    for (IblImage *ibl_image : {&irradiance_, &prefiltered_, &brdf_lut_}) {
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                        0, VK_ACCESS_SHADER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+
+    auto dispatch = [&](M1kComputePipeline &pipeline, VkDescriptorSet set, float roughness,
+                        uint32_t size, uint32_t layer_count) {
+        IblPushConstant push{roughness, kIblSampleCount};
+        pipeline.bind(command_buffer);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+                                0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(IblPushConstant), &push);
+        uint32_t group_count = M1kComputePipeline::groupCount(size, kIblLocalSize);
+        vkCmdDispatch(command_buffer, group_count, group_count, layer_count);
+    };
+
+    uint32_t set_index = 0;
+    dispatch(irradiance_pipeline, bake_sets[set_index++], 0.0f, irradiance_.size, 6);
+    for (uint32_t mip = 0; mip < prefiltered_.mip_levels; ++mip) {
+        float roughness = prefiltered_.mip_levels > 1
+                              ? static_cast<float>(mip) / static_cast<float>(prefiltered_.mip_levels - 1)
+                              : 0.0f;
+        dispatch(prefilter_pipeline, bake_sets[set_index++], roughness,
+                 std::max(prefiltered_.size >> mip, 1u), 6);
+    }
+    dispatch(brdf_lut_pipeline, bake_sets[set_index++], 0.0f, brdf_lut_.size, 1);
+
+    // read the results back for the cache, then hand them to the fragment shaders
+    VkDeviceSize offset = 0;
+    for (IblImage *ibl_image : {&irradiance_, &prefiltered_, &brdf_lut_}) {
+        std::vector<VkBufferImageCopy> regions;
+        appendCopyRegions(*ibl_image, offset, regions);
+
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        vkCmdCopyImageToBuffer(command_buffer, ibl_image->image,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               readback_buffer.getBuffer(),
+                               static_cast<uint32_t>(regions.size()), regions.data());
+        transitionImage(command_buffer, ibl_image->image,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    VkBufferMemoryBarrier host_barrier{};
+    host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    host_barrier.buffer = readback_buffer.getBuffer();
+    host_barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &host_barrier, 0, nullptr);
+
+    m1k_device_.endSingleTimeCommands(command_buffer);
+
+    // written next to the final name and renamed, a crash never leaves a
+    // truncated cache behind
+    IblCacheHeader header{};
+    header.key = key;
+    header.payload_size = getPayloadSize();
+
+    std::vector<char> file_data(sizeof(header) + header.payload_size);
+    std::memcpy(file_data.data(), &header, sizeof(header));
+    readback_buffer.map();
+    std::memcpy(file_data.data() + sizeof(header), readback_buffer.getMappedMemory(),
+                header.payload_size);
+
+    std::string temp_path = cache_path + ".tmp";
+    writeFileBinary(temp_path, file_data.data(), file_data.size());
+    std::error_code error;
+    std::filesystem::rename(temp_path, cache_path, error);
+    if (error) {
+        std::cout << "M1K::WARN========Failed to write IBL cache " << cache_path
+                  << ": " << error.message() << std::endl;
+    }
+
+    vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+    for (auto view : storage_views) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    vkDestroySampler(device, environment_sampler, nullptr);
+    vkDestroyImageView(device, environment_view, nullptr);
+    vkDestroyImage(device, environment_image, nullptr);
+    vkFreeMemory(device, environment_memory, nullptr);
+}
+
+}
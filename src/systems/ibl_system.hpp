@@ -0,0 +1,96 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "core/m1k_buffer.hpp"
+#include "core/m1k_compute_pipeline.hpp"
+#include "core/m1k_descriptor.hpp"
+#include "core/m1k_device.hpp"
+#include "m1k_config.hpp"
+#include "m1k_data_struct.hpp"
+
+// std
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Image based lighting from an equirectangular HDR environment.
+ *
+ * Once at startup three compute passes bake
+ *   - a cosine convolved irradiance cube,
+ *   - a GGX prefiltered cube, roughness 0 to 1 across its mips,
+ *   - the split sum BRDF LUT,
+ * which the PBR shaders read from global set bindings 6, 7 and 8.
+ *
+ * The results are written to kIblCacheDirectory under the FNV-1a hash of the
+ * environment file and the bake settings, later launches upload them and
+ * skip the compute entirely. Without the environment file the images are 1x1
+ * black and GlobalUbo::ibl_prefiltered_mips stays 0, the shaders then fall
+ * back to the flat ambient term.
+ */
+class IblSystem {
+   public:
+    IblSystem(M1kDevice &device, const std::string &environment_path);
+    ~IblSystem();
+
+    IblSystem(const IblSystem&) = delete;
+    IblSystem &operator=(const IblSystem&) = delete;
+
+    // for the global descriptor sets
+    VkDescriptorImageInfo getIrradianceImageInfo() const;
+    VkDescriptorImageInfo getPrefilteredImageInfo() const;
+    VkDescriptorImageInfo getBrdfLutImageInfo() const;
+
+    void update(GlobalUbo &ubo) const;
+
+    bool isEnabled() const { return is_enabled_; }
+
+   private:
+    struct IblImage {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;  // cube or 2D, sampled
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        uint32_t size = 1;
+        uint32_t mip_levels = 1;
+        uint32_t layer_count = 1;
+        uint32_t texel_size = 0;  // bytes
+
+        VkDeviceSize byteSize() const;
+    };
+
+    void createImages(uint32_t irradiance_size, uint32_t prefiltered_size,
+                      uint32_t prefiltered_mips, uint32_t brdf_lut_size);
+    void createImage(IblImage &ibl_image, VkFormat format, uint32_t texel_size,
+                     uint32_t size, uint32_t mip_levels, uint32_t layer_count);
+    void destroyImage(IblImage &ibl_image);
+    void createSampler();
+
+    void clearImages();
+    bool loadCache(const std::string &cache_path, uint64_t key);
+    // pixels are rgba32f as decoded by stb
+    void bake(const float *pixels, uint32_t width, uint32_t height,
+              const std::string &cache_path, uint64_t key);
+
+    // buffer layout of the cache payload, every mip and face in order
+    void appendCopyRegions(const IblImage &ibl_image, VkDeviceSize &offset,
+                           std::vector<VkBufferImageCopy> &regions) const;
+    VkDeviceSize getPayloadSize() const;
+
+    M1kDevice &m1k_device_;
+
+    IblImage irradiance_{};
+    IblImage prefiltered_{};
+    IblImage brdf_lut_{};
+    VkSampler sampler_ = VK_NULL_HANDLE;
+
+    bool is_enabled_ = false;
+    bool is_baked_ = false;  // this launch, not from the cache
+};
+
+}
@@ -0,0 +1,125 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#include "light_cluster_system.hpp"
+#include "m1k_config.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace m1k {
+
+namespace {
+
+constexpr uint32_t kClusterCount = kClusterGridX * kClusterGridY * kClusterGridZ;
+// local_size_x of cluster_light_cull.comp
+constexpr uint32_t kClusterCullLocalSize = 64;
+
+}
+
+LightClusterSystem::LightClusterSystem(M1kDevice &device, uint32_t frames_in_flight,
+                                       VkDescriptorSetLayout global_set_layout,
+                                       M1kPipelineBuildQueue &build_queue)
+    : m1k_device_(device) {
+    createBuffers(frames_in_flight);
+    createPipelineLayout(global_set_layout);
+    build_queue.addCompute(cull_pipeline_, pipeline_layout_,
+                           "./shaders/binaries/cluster_light_cull.comp.spv");
+}
+
+LightClusterSystem::~LightClusterSystem() {}
+
+void LightClusterSystem::createBuffers(uint32_t frames_in_flight) {
+    light_buffers_.resize(frames_in_flight);
+    cluster_count_buffers_.resize(frames_in_flight);
+    cluster_index_buffers_.resize(frames_in_flight);
+
+    for (uint32_t i = 0; i < frames_in_flight; ++i) {
+        // written by the host every frame, read by both queues
+        light_buffers_[i] = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(PointLight), kMaxPointLights,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 1, true);
+        light_buffers_[i]->map();
+
+        // written by the culling pass, read by the fragment shader
+        cluster_count_buffers_[i] = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(uint32_t), kClusterCount,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, true);
+        cluster_index_buffers_[i] = std::make_unique<M1kBuffer>(
+            m1k_device_, sizeof(uint32_t), kClusterCount * kMaxLightsPerCluster,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, true);
+    }
+}
+
+void LightClusterSystem::createPipelineLayout(VkDescriptorSetLayout global_set_layout) {
+    pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout({global_set_layout});
+}
+
+VkDescriptorBufferInfo LightClusterSystem::getLightBufferInfo(int frame_index) {
+    return light_buffers_[frame_index]->descriptorInfo();
+}
+
+VkDescriptorBufferInfo LightClusterSystem::getClusterCountBufferInfo(int frame_index) {
+    return cluster_count_buffers_[frame_index]->descriptorInfo();
+}
+
+VkDescriptorBufferInfo LightClusterSystem::getClusterIndexBufferInfo(int frame_index) {
+    return cluster_index_buffers_[frame_index]->descriptorInfo();
+}
+
+void LightClusterSystem::update(FrameInfo &frame_info,
+                                const std::vector<PointLight> &point_lights,
+                                GlobalUbo &ubo) {
+    light_count_ = static_cast<uint32_t>(
+        std::min<size_t>(point_lights.size(), kMaxPointLights));
+    if (light_count_ < point_lights.size() && !has_warned_light_overflow_) {
+        std::cout << "M1K::WARN========Point lights exceed " << kMaxPointLights
+                  << ", the rest are ignored." << std::endl;
+        has_warned_light_overflow_ = true;
+    }
+
+    auto &light_buffer = light_buffers_[frame_info.frame_index];
+    if (light_count_ > 0) {
+        VkDeviceSize size = sizeof(PointLight) * light_count_;
+        light_buffer->writeToBuffer(const_cast<PointLight *>(point_lights.data()), size);
+        light_buffer->flush();
+    }
+
+    // slice = log(z) * scale + bias, slices are uniform in log space
+    float log_depth_ratio = std::log(kCameraFar / kCameraNear);
+    float slice_scale = static_cast<float>(kClusterGridZ) / log_depth_ratio;
+    float slice_bias = -static_cast<float>(kClusterGridZ) * std::log(kCameraNear) / log_depth_ratio;
+
+    VkExtent2D extent = frame_info.renderer.getSwapChainExtent();
+    ubo.cluster_grid = glm::uvec4(kClusterGridX, kClusterGridY, kClusterGridZ, 0);
+    ubo.cluster_depth = glm::vec4(kCameraNear, kCameraFar, slice_scale, slice_bias);
+    ubo.viewport_extent = glm::vec4(extent.width, extent.height,
+                                    1.0f / static_cast<float>(extent.width),
+                                    1.0f / static_cast<float>(extent.height));
+    ubo.num_lights = light_count_;
+}
+
+void LightClusterSystem::cull(FrameInfo &frame_info, VkCommandBuffer compute_command_buffer) {
+    // this slot's buffers were last read by the graphics submission the
+    // renderer waited for in beginFrame, nothing to order against here
+    cull_pipeline_->bind(compute_command_buffer);
+    vkCmdBindDescriptorSets(compute_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, 0, 1, &frame_info.global_descriptor_set,
+                            0, nullptr);
+    vkCmdDispatch(compute_command_buffer,
+                  M1kComputePipeline::groupCount(kClusterCount, kClusterCullLocalSize),
+                  1, 1);
+}
+
+}
@@ -0,0 +1,71 @@
+//
+// Created by fangl on 2024/3/28.
+//
+
+#pragma once
+
+#include "core/m1k_buffer.hpp"
+#include "core/m1k_compute_pipeline.hpp"
+#include "core/m1k_device.hpp"
+#include "core/m1k_pipeline_build_queue.hpp"
+#include "m1k_data_struct.hpp"
+#include "m1k_frame_info.hpp"
+
+// std
+#include <memory>
+#include <vector>
+
+namespace m1k {
+
+/*
+ * Clustered forward lighting.
+ *
+ * The point lights live in a per-frame storage buffer (global set, binding 2)
+ * instead of the GlobalUbo. Every frame a compute pass on the async compute
+ * queue bins them into kClusterGridX * kClusterGridY * kClusterGridZ view
+ * space clusters (bindings 3 and 4), the PBR fragment shader then only walks
+ * the lights of its own cluster. The buffers are shared with the compute
+ * queue, the frame's graphics submission waits for the pass.
+ */
+class LightClusterSystem {
+   public:
+    LightClusterSystem(M1kDevice &device, uint32_t frames_in_flight,
+                       VkDescriptorSetLayout global_set_layout,
+                       M1kPipelineBuildQueue &build_queue);
+    ~LightClusterSystem();
+
+    LightClusterSystem(const LightClusterSystem&) = delete;
+    LightClusterSystem &operator=(const LightClusterSystem&) = delete;
+
+    // for the global descriptor set of frame_index
+    VkDescriptorBufferInfo getLightBufferInfo(int frame_index);
+    VkDescriptorBufferInfo getClusterCountBufferInfo(int frame_index);
+    VkDescriptorBufferInfo getClusterIndexBufferInfo(int frame_index);
+
+    // uploads the lights, fills the cluster parameters and light count of the ubo
+    void update(FrameInfo &frame_info, const std::vector<PointLight> &point_lights,
+                GlobalUbo &ubo);
+    // records the culling pass into the frame's compute command buffer,
+    // after update() wrote the lights and the ubo
+    void cull(FrameInfo &frame_info, VkCommandBuffer compute_command_buffer);
+
+    uint32_t getLightCount() const { return light_count_; }
+
+   private:
+    void createBuffers(uint32_t frames_in_flight);
+    void createPipelineLayout(VkDescriptorSetLayout global_set_layout);
+
+    M1kDevice &m1k_device_;
+
+    std::vector<std::unique_ptr<M1kBuffer>> light_buffers_{};
+    std::vector<std::unique_ptr<M1kBuffer>> cluster_count_buffers_{};
+    std::vector<std::unique_ptr<M1kBuffer>> cluster_index_buffers_{};
+
+    std::unique_ptr<M1kComputePipeline> cull_pipeline_;
+    VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+
+    uint32_t light_count_ = 0;
+    bool has_warned_light_overflow_ = false;
+};
+
+}
@@ -17,13 +17,13 @@
 
 namespace m1k {
 
-PbrRenderSystem::PbrRenderSystem(M1kDevice &device, VkRenderPass render_pass,
+PbrRenderSystem::PbrRenderSystem(M1kDevice &device, const RenderTargetInfo &render_target,
                                  VkDescriptorSetLayout global_set_layout,
                                  VkDescriptorSetLayout pbr_set_layout)
     : m1k_device_(device)
 {
     createPipelineLayout(global_set_layout, pbr_set_layout);
-    createPipeline(render_pass);
+    createPipeline(render_target);
 }
 
 PbrRenderSystem::~PbrRenderSystem() {
@@ -47,12 +47,12 @@ void PbrRenderSystem::createPipelineLayout(VkDescriptorSetLayout global_set_layo
     }
 }
 
-void PbrRenderSystem::createPipeline(VkRenderPass render_pass) {
+void PbrRenderSystem::createPipeline(const RenderTargetInfo &render_target) {
     assert(pipeline_layout_ != nullptr && "Cannot create pipeline before pipeline layout");
 
     PipelineConfigInfo pipeline_config{};
     M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
-    pipeline_config.render_pass = render_pass;
+    render_target.applyTo(pipeline_config);
     pipeline_config.pipeline_layout = pipeline_layout_;
     m1k_pipeline_ = std::make_unique<M1kPipeline>(
         m1k_device_,
@@ -18,7 +18,7 @@ namespace m1k {
 class PbrRenderSystem {
    public:
     PbrRenderSystem(M1kDevice &device,
-                    VkRenderPass render_pass,
+                    const RenderTargetInfo &render_target,
                     VkDescriptorSetLayout global_set_layout,
                     VkDescriptorSetLayout pbr_set_layout);
     ~PbrRenderSystem();
@@ -32,7 +32,7 @@ class PbrRenderSystem {
    private:
     void createPipelineLayout(VkDescriptorSetLayout global_set_layout,
                               VkDescriptorSetLayout pbr_set_layout);
-    void createPipeline(VkRenderPass render_pass);
+    void createPipeline(const RenderTargetInfo &render_target);
 
     M1kDevice &m1k_device_;
     std::unique_ptr<M1kPipeline> m1k_pipeline_;
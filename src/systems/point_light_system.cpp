@@ -3,6 +3,8 @@
 //
 
 #include "point_light_system.hpp"
+#include "core/m1k_shader_reflection.hpp"
+#include "../m1k_config.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -10,6 +12,7 @@
 #include <glm/gtc/constants.hpp>
 
 // std
+#include <cassert>
 #include <stdexcept>
 #include <array>
 #include <iostream>
@@ -24,86 +27,73 @@ struct PointLightPushConstants {
     float radius;
 };
 
-PointLightSystem::PointLightSystem(M1kDevice &device, VkRenderPass render_pass, VkDescriptorSetLayout global_set_layout)
+PointLightSystem::PointLightSystem(M1kDevice &device, const RenderTargetInfo &render_target, VkDescriptorSetLayout global_set_layout,
+                                   M1kPipelineBuildQueue &build_queue)
     : m1k_device_(device) {
     createPipelineLayout(global_set_layout);
-    createPipeline(render_pass);
+    createPipeline(render_target, build_queue);
 }
 
-PointLightSystem::~PointLightSystem() {
-    vkDestroyPipelineLayout(m1k_device_.device(), pipeline_layout_, nullptr);
-}
+PointLightSystem::~PointLightSystem() {}
 
 void PointLightSystem::createPipelineLayout(VkDescriptorSetLayout global_set_layout) {
+    // the push block as both shaders declare it
+    auto push_constant_ranges = M1kShaderReflection::fromFiles({
+        "./shaders/binaries/point_light.vert.spv",
+        "./shaders/binaries/point_light.frag.spv"}).getPushConstantRanges();
+    assert(!push_constant_ranges.empty() &&
+           push_constant_ranges[0].size >= sizeof(PointLightPushConstants) &&
+           "Point light shaders don't match PointLightPushConstants");
 
-    VkPushConstantRange push_constant_range{};
-    push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-    push_constant_range.offset = 0;
-    push_constant_range.size = sizeof(PointLightPushConstants);
-
-    std::vector<VkDescriptorSetLayout> descriptor_set_layouts{global_set_layout};
-
-    VkPipelineLayoutCreateInfo pipeline_layout_info{};
-    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = static_cast<uint32_t>(descriptor_set_layouts.size());
-    pipeline_layout_info.pSetLayouts = descriptor_set_layouts.data();
-    pipeline_layout_info.pushConstantRangeCount = 1;
-    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
-
-    if(vkCreatePipelineLayout(m1k_device_.device(),
-                              &pipeline_layout_info,
-                              nullptr,
-                              &pipeline_layout_) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout");
-    }
+    pipeline_layout_ = m1k_device_.layoutCache().getPipelineLayout(
+        {global_set_layout}, push_constant_ranges);
 }
 
-void PointLightSystem::createPipeline(VkRenderPass render_pass) {
+void PointLightSystem::createPipeline(const RenderTargetInfo &render_target,
+                                      M1kPipelineBuildQueue &build_queue) {
     assert(pipeline_layout_ != nullptr && "Cannot create pipeline before pipeline layout");
 
-    PipelineConfigInfo pipeline_config{};
-    M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
-    M1kPipeline::enableAlphaBlending(pipeline_config);  // blending
+    VkPipelineLayout pipeline_layout = pipeline_layout_;
+    build_queue.addGraphics(
+        m1k_pipeline_,
+        [render_target, pipeline_layout](PipelineConfigInfo &pipeline_config) {
+            M1kPipeline::defaultPipelineConfigInfo(pipeline_config);
+            M1kPipeline::enableAlphaBlending(pipeline_config);  // blending
 
-    pipeline_config.binding_descriptions.clear();
-    pipeline_config.attribute_descriptions.clear();
+            pipeline_config.binding_descriptions.clear();
+            pipeline_config.attribute_descriptions.clear();
 
-    pipeline_config.render_pass = render_pass;
-    pipeline_config.pipeline_layout = pipeline_layout_;
-    m1k_pipeline_ = std::make_unique<M1kPipeline>(
-        m1k_device_,
-        pipeline_config,
+            render_target.applyTo(pipeline_config);
+            pipeline_config.pipeline_layout = pipeline_layout;
+        },
         "./shaders/binaries/point_light.vert.spv",
         "./shaders/binaries/point_light.frag.spv");
 }
 
-void PointLightSystem::update(FrameInfo &frame_info, GlobalUbo &ubo) {
+void PointLightSystem::update(FrameInfo &frame_info, std::vector<PointLight> &point_lights) {
     auto rotate_light = glm::rotate(
         glm::mat4(1.0f),
         frame_info.frame_time,
         {0.f, -1.f, 0.f});
 
-    int light_index = 0;
-    if(frame_info.game_objects.size() != 0) {
-        for(auto &kv : frame_info.game_objects) {
-            auto &obj = kv.second;
-            // filter
-            if(obj.point_light == nullptr)  continue;
-
-            assert(light_index < MAX_LIGHTS && "Point lights exceed maximum specified.");
+    point_lights.clear();
+    for(auto &kv : frame_info.game_objects) {
+        auto &obj = kv.second;
+        // filter
+        if(obj.point_light == nullptr)  continue;
 
-            // update light position
-            obj.transform.translation = glm::vec3(rotate_light * glm::vec4(obj.transform.translation, 1.f));
+        // update light position
+        obj.transform.translation = glm::vec3(rotate_light * glm::vec4(obj.transform.translation, 1.f));
 
-            // copy light to ubo
-            ubo.point_lights[light_index].position = glm::vec4(obj.transform.translation, 1.0f);
-            ubo.point_lights[light_index].color = glm::vec4(obj.color, obj.point_light->light_intensity);
+        // range where intensity / d^2 falls to the cutoff, used for the cluster binning
+        float intensity = obj.point_light->light_intensity;
+        float range = glm::sqrt(glm::max(intensity, 0.0f) / kPointLightCutoff);
 
-            light_index++;
-        }
+        PointLight point_light{};
+        point_light.position = glm::vec4(obj.transform.translation, range);
+        point_light.color = glm::vec4(obj.color, intensity);
+        point_lights.push_back(point_light);
     }
-
-    ubo.num_lights = light_index;
 }
 
 void PointLightSystem::render(FrameInfo &frame_info) {
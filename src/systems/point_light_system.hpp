@@ -6,25 +6,30 @@
 
 #include "../core/m1k_device.hpp"
 #include "../core/m1k_pipeline.hpp"
+#include "../core/m1k_pipeline_build_queue.hpp"
 #include "../m1k_frame_info.hpp"
 #include "../objects/m1k_game_object.hpp"
 #include "../ui/m1k_camera.hpp"
 
 // std
 #include <memory>
+#include <vector>
 
 namespace m1k {
 
 class PointLightSystem {
 public:
-    PointLightSystem(M1kDevice &device, VkRenderPass render_pass, VkDescriptorSetLayout global_set_layout);
+    // the pipeline is compiled when build_queue is built
+    PointLightSystem(M1kDevice &device, const RenderTargetInfo &render_target, VkDescriptorSetLayout global_set_layout,
+                     M1kPipelineBuildQueue &build_queue);
     ~PointLightSystem();
 
     // copy version delete
     PointLightSystem(const PointLightSystem&) = delete;
     PointLightSystem &operator=(const PointLightSystem&) = delete;
 
-    void update(FrameInfo &frame_info, GlobalUbo &ubo);
+    // animates the lights and collects them for LightClusterSystem
+    void update(FrameInfo &frame_info, std::vector<PointLight> &point_lights);
     void render(FrameInfo &frame_info);
 
     void setAllPointLightsIntensity(float intensity, FrameInfo &frame_info);
@@ -33,7 +38,7 @@ public:
 
 private:
     void createPipelineLayout(VkDescriptorSetLayout global_set_layout);
-    void createPipeline(VkRenderPass render_pass);
+    void createPipeline(const RenderTargetInfo &render_target, M1kPipelineBuildQueue &build_queue);
 
     M1kDevice &m1k_device_;
 
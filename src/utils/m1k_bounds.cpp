@@ -0,0 +1,131 @@
+//
+// Created by fangl on 2024/3/24.
+//
+
+#include "m1k_bounds.hpp"
+
+// std
+#include <algorithm>
+#include <cmath>
+
+namespace m1k {
+
+M1kAabb M1kAabb::transformed(const glm::mat4& matrix) const {
+    if (!isValid()) return *this;
+
+    M1kAabb result;
+    result.min = glm::vec3(matrix[3]);
+    result.max = glm::vec3(matrix[3]);
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            float a = matrix[j][i] * min[j];
+            float b = matrix[j][i] * max[j];
+            result.min[i] += std::min(a, b);
+            result.max[i] += std::max(a, b);
+        }
+    }
+
+    return result;
+}
+
+M1kFrustum M1kFrustum::fromMatrix(const glm::mat4& m) {
+    // Gribb-Hartmann, clip z in [0, 1] (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+    glm::vec4 row0{m[0][0], m[1][0], m[2][0], m[3][0]};
+    glm::vec4 row1{m[0][1], m[1][1], m[2][1], m[3][1]};
+    glm::vec4 row2{m[0][2], m[1][2], m[2][2], m[3][2]};
+    glm::vec4 row3{m[0][3], m[1][3], m[2][3], m[3][3]};
+
+    M1kFrustum frustum{};
+    frustum.planes[0] = row3 + row0;  // left
+    frustum.planes[1] = row3 - row0;  // right
+    frustum.planes[2] = row3 + row1;  // bottom
+    frustum.planes[3] = row3 - row1;  // top
+    frustum.planes[4] = row2;         // near
+    frustum.planes[5] = row3 - row2;  // far
+
+    for (auto& plane : frustum.planes) {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+
+    return frustum;
+}
+
+M1kFrustum::Containment M1kFrustum::classify(const M1kAabb& box) const {
+    glm::vec3 center = box.center();
+    glm::vec3 half_extent = box.extent() * 0.5f;
+
+    Containment result = Inside;
+    for (const auto& plane : planes) {
+        glm::vec3 normal{plane};
+        float distance = glm::dot(normal, center) + plane.w;
+        float radius = glm::dot(half_extent, glm::abs(normal));
+
+        if (distance < -radius) {
+            return Outside;
+        }
+        if (distance < radius) {
+            result = Intersect;
+        }
+    }
+
+    return result;
+}
+
+bool M1kFrustum::intersectsSphere(const glm::vec3& center, float radius) const {
+    for (const auto& plane : planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool intersectRayAabb(const M1kRay& ray, const glm::vec3& inv_direction,
+                      const M1kAabb& box, float& t_near) {
+    glm::vec3 t0 = (box.min - ray.origin) * inv_direction;
+    glm::vec3 t1 = (box.max - ray.origin) * inv_direction;
+    glm::vec3 t_min = glm::min(t0, t1);
+    glm::vec3 t_max = glm::max(t0, t1);
+
+    float enter = std::max(std::max(t_min.x, t_min.y), std::max(t_min.z, 0.0f));
+    float exit = std::min(std::min(t_max.x, t_max.y), std::min(t_max.z, ray.t_max));
+
+    t_near = enter;
+    return enter <= exit;
+}
+
+bool intersectSphereAabb(const glm::vec3& center, float radius,
+                         const M1kAabb& box) {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 offset = closest - center;
+    return glm::dot(offset, offset) <= radius * radius;
+}
+
+bool intersectRayTriangle(const M1kRay& ray, const glm::vec3& v0,
+                          const glm::vec3& v1, const glm::vec3& v2, float& t) {
+    constexpr float kEpsilon = 1e-7f;
+
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    glm::vec3 p = glm::cross(ray.direction, edge2);
+    float det = glm::dot(edge1, p);
+    if (std::fabs(det) < kEpsilon) return false;
+
+    float inv_det = 1.0f / det;
+    glm::vec3 s = ray.origin - v0;
+    float u = glm::dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(ray.direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = glm::dot(edge2, q) * inv_det;
+    return t > kEpsilon && t < ray.t_max;
+}
+
+}
@@ -0,0 +1,84 @@
+//
+// Created by fangl on 2024/3/24.
+//
+
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+// std
+#include <limits>
+
+namespace m1k {
+
+struct M1kAabb {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+
+    bool isValid() const {
+        return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+    }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const M1kAabb& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return max - min; }
+
+    float surfaceArea() const {
+        if (!isValid()) return 0.0f;
+        glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    bool operator==(const M1kAabb& other) const {
+        return min == other.min && max == other.max;
+    }
+    bool operator!=(const M1kAabb& other) const { return !(*this == other); }
+
+    // transform the 8 corners (Arvo's method) and rebuild the box
+    M1kAabb transformed(const glm::mat4& matrix) const;
+};
+
+struct M1kRay {
+    glm::vec3 origin{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, 1.0f};
+    float t_max = std::numeric_limits<float>::max();
+};
+
+// planes are stored as (normal, distance), normal points inside
+struct M1kFrustum {
+    enum Containment { Outside = 0, Intersect, Inside };
+
+    glm::vec4 planes[6];
+
+    static M1kFrustum fromMatrix(const glm::mat4& view_projection);
+
+    Containment classify(const M1kAabb& box) const;
+    bool intersects(const M1kAabb& box) const {
+        return classify(box) != Outside;
+    }
+    bool intersectsSphere(const glm::vec3& center, float radius) const;
+};
+
+// slab test, returns entry distance in t_near
+bool intersectRayAabb(const M1kRay& ray, const glm::vec3& inv_direction,
+                      const M1kAabb& box, float& t_near);
+
+bool intersectSphereAabb(const glm::vec3& center, float radius,
+                         const M1kAabb& box);
+
+// Moller-Trumbore
+bool intersectRayTriangle(const M1kRay& ray, const glm::vec3& v0,
+                          const glm::vec3& v1, const glm::vec3& v2, float& t);
+
+}
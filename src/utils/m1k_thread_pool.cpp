@@ -0,0 +1,97 @@
+//
+// Created by fangl on 2024/3/25.
+//
+
+#include "m1k_thread_pool.hpp"
+
+// std
+#include <algorithm>
+#include <exception>
+
+namespace m1k {
+
+M1kThreadPool::M1kThreadPool(uint32_t thread_count) {
+    if (thread_count == 0) {
+        uint32_t hardware_threads = std::thread::hardware_concurrency();
+        thread_count = std::max(1u, hardware_threads > 1 ? hardware_threads - 1 : 1u);
+    }
+
+    workers_.reserve(thread_count);
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back(&M1kThreadPool::workerLoop, this, i);
+    }
+}
+
+M1kThreadPool::~M1kThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_stopping_ = true;
+    }
+    condition_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void M1kThreadPool::enqueue(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+void M1kThreadPool::workerLoop(uint32_t thread_index) {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] { return is_stopping_ || !tasks_.empty(); });
+            if (is_stopping_ && tasks_.empty()) return;
+
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task(thread_index);
+    }
+}
+
+void M1kThreadPool::parallelFor(uint32_t job_count,
+                                const std::function<void(uint32_t, uint32_t)>& job) {
+    if (job_count == 0) return;
+
+    // the counter lives on this stack frame, so it is only touched under
+    // the lock to make sure no worker still uses it once we return
+    uint32_t remaining = job_count;
+    std::exception_ptr first_error;
+    std::mutex done_mutex;
+    std::condition_variable done_condition;
+
+    for (uint32_t i = 0; i < job_count; ++i) {
+        enqueue([&, i](uint32_t thread_index) {
+            // an exception escaping the worker would terminate the process,
+            // and the job still has to count as done
+            std::exception_ptr error;
+            try {
+                job(i, thread_index);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (error && !first_error) first_error = error;
+            if (--remaining == 0) {
+                done_condition.notify_one();
+            }
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_condition.wait(lock, [&] { return remaining == 0; });
+    }
+    if (first_error) std::rethrow_exception(first_error);
+}
+
+}
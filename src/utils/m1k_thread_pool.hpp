@@ -0,0 +1,47 @@
+//
+// Created by fangl on 2024/3/25.
+//
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace m1k {
+
+class M1kThreadPool {
+   public:
+    // 0 -> one worker per hardware thread, minus the main thread
+    explicit M1kThreadPool(uint32_t thread_count = 0);
+    ~M1kThreadPool();
+
+    M1kThreadPool(const M1kThreadPool&) = delete;
+    M1kThreadPool& operator=(const M1kThreadPool&) = delete;
+
+    uint32_t threadCount() const { return static_cast<uint32_t>(workers_.size()); }
+
+    // runs job(job_index, thread_index) for every job and blocks until all
+    // of them finished, thread_index is stable per worker in [0, threadCount).
+    // If jobs throw, the first exception is rethrown here once all are done
+    void parallelFor(uint32_t job_count,
+                     const std::function<void(uint32_t, uint32_t)>& job);
+
+   private:
+    using Task = std::function<void(uint32_t)>;
+
+    void enqueue(Task task);
+    void workerLoop(uint32_t thread_index);
+
+    std::vector<std::thread> workers_{};
+    std::queue<Task> tasks_{};
+    std::mutex mutex_{};
+    std::condition_variable condition_{};
+    bool is_stopping_ = false;
+};
+
+}
@@ -42,6 +42,16 @@ std::string getFilePathNameWithoutSuffix(const std::string& path) {
     return path.substr(last_slash_pos, last_dot_pos - last_slash_pos);
 }
 
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+    constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
 bool readFileBinary(const std::string& filepath, char** data, size_t* size) {
     std::ifstream file(filepath, std::ios::binary);
     if (!file) {
@@ -65,11 +75,14 @@ bool readFileBinary(const std::string& filepath, char** data, size_t* size) {
     }
 }
 
-void writeFileBinary(const std::string& file_path, const void* data, size_t size) {
+bool writeFileBinary(const std::string& file_path, const void* data, size_t size) {
     std::ofstream file(file_path, std::ios::binary);
-    if (file) {
-        file.write(reinterpret_cast<const char*>(data), size);
+    if (!file) {
+        return false;
     }
+    file.write(reinterpret_cast<const char*>(data), size);
+    file.close();
+    return !file.fail();
 }
 
 bool createDirectoryIfNotExists(const std::string& path) {
@@ -146,6 +159,35 @@ glm::mat4 TransformComponent::mat4() {
         {translation.x, translation.y, translation.z, 1.0f}};
 }
 
+glm::mat4 TransformComponent::worldMat4() const {
+    const float c3 = glm::cos(rotation.z);
+    const float s3 = glm::sin(rotation.z);
+    const float c2 = glm::cos(rotation.x);
+    const float s2 = glm::sin(rotation.x);
+    const float c1 = glm::cos(rotation.y);
+    const float s1 = glm::sin(rotation.y);
+    return glm::mat4{
+        {
+            scale.x * (c1 * c3 + s1 * s2 * s3),
+            scale.x * (c2 * s3),
+            scale.x * (c1 * s2 * s3 - c3 * s1),
+            0.0f,
+        },
+        {
+            scale.y * (c3 * s1 * s2 - c1 * s3),
+            scale.y * (c2 * c3),
+            scale.y * (c1 * c3 * s2 + s1 * s3),
+            0.0f,
+        },
+        {
+            scale.z * (c2 * s1),
+            scale.z * (-s2),
+            scale.z * (c1 * c2),
+            0.0f,
+        },
+        {translation.x, translation.y, translation.z, 1.0f}};
+}
+
 glm::mat3 TransformComponent::normalMatrix() {
     const float c3 = glm::cos(rotation.z);
     const float s3 = glm::sin(rotation.z);
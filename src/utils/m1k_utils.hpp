@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <fstream>
 #include <cstddef>
+#include <cstdint>
 #include <algorithm>
 #include <filesystem>
 #include <iostream>
@@ -39,18 +40,25 @@ struct TransformComponent {
 
     // faster mat4 transform
     glm::mat4 mat4();
+    // object placement in the world, same rotation order as mat4() without
+    // the flip glTF node transforms get
+    glm::mat4 worldMat4() const;
 
     glm::mat3 normalMatrix();
 };
 
 
+// FNV-1a, chain calls through hash to cover several ranges
+static constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = kFnvOffsetBasis);
+
 std::string getFileExtension(const std::string& filePath);
 
 bool identifyFileSuffix(const std::string& suffix, const std::string& filePath);
 std::string getFilePathNameWithoutSuffix(const std::string& path);
 
 bool readFileBinary(const std::string& filepath, char** data, size_t* size);
-void writeFileBinary(const std::string& file_path, const void* data, size_t size);
+bool writeFileBinary(const std::string& file_path, const void* data, size_t size);
 bool createDirectoryIfNotExists(const std::string& path);
 
 void* allocateAligned(size_t size, size_t alignment);